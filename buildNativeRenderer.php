@@ -0,0 +1,57 @@
+<?php
+
+/*
+ * Prebuilds the ISA variants of the native renderer's library into .tmp (see NativeRendererLibrary), one of them then
+ * being picked at load time according to the CPU, so that the game starts without compiling anything.
+ *
+ * Usage: php buildNativeRenderer.php [--pgo]
+ *     --pgo: the variants get profile-guided and link-time optimizations, the profile being collected by running the
+ *            headless benchmark scenarios (fixed time step and random seed) with an instrumented library
+ */
+
+use NoiseByNorthwest\TermAsteroids\Engine\NativeRendererLibrary;
+use NoiseByNorthwest\TermAsteroids\Game\TermAsteroids;
+
+require 'vendor/autoload.php';
+
+// both the single-threaded and the banded rendering paths are trained
+const TRAINING_THREAD_COUNTS = [1, 4];
+
+$train = function (string $instrumentedFileName): void {
+    foreach (TermAsteroids::BENCHMARK_SCENARIOS as $scenario) {
+        foreach (TRAINING_THREAD_COUNTS as $threadCount) {
+            echo sprintf("Training with the %s benchmark scenario (%d threads)...\n", $scenario, $threadCount);
+
+            $command = sprintf(
+                'TERM_ASTEROIDS_NATIVE_RENDERER_LIBRARY=%s TERM_ASTEROIDS_RENDERER_THREAD_COUNT=%d '
+                    . 'php -dzend.assertions=-1 index.php --benchmark-mode --headless --use-native-renderer '
+                    . '--benchmark-scenario=%s',
+                escapeshellarg($instrumentedFileName),
+                $threadCount,
+                $scenario
+            );
+
+            // the frames are discarded, the messages kept
+            exec($command . ' 2>&1 >/dev/null', $output, $resultCode);
+
+            if ($resultCode !== 0) {
+                throw new \RuntimeException(sprintf("Training failed:\n%s", implode("\n", $output)));
+            }
+
+            // the training runs must not be mistaken for benchmark results
+            foreach ($output as $line) {
+                if (preg_match('/^Benchmark results written to (.+)$/', $line, $matches)) {
+                    unlink($matches[1]);
+                }
+            }
+
+            $output = [];
+        }
+    }
+};
+
+$fileNames = NativeRendererLibrary::buildIsaVariants(in_array('--pgo', $argv, true) ? $train : null);
+
+foreach ($fileNames as $variant => $fileName) {
+    echo sprintf("%s: %s\n", $variant, $fileName);
+}
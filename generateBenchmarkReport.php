@@ -14,7 +14,7 @@
  *
  */
 
-function generatePhpVersionReport(string $phpVersion)
+function generatePhpVersionReport(string $resultFilePrefix, string $phpVersion)
 {
     $results = [];
     foreach ([
@@ -25,7 +25,7 @@ function generatePhpVersionReport(string $phpVersion)
     ] as $settings) {
         $bestIterationFileName = null;
         $bestAvgFrameTime = PHP_FLOAT_MAX;
-        foreach (glob(".tmp/benchmark-*:$phpVersion:$settings.*.json") as $iterationFileName) {
+        foreach (glob(".tmp/$resultFilePrefix-*:$phpVersion:$settings.*.json") as $iterationFileName) {
             $iterationData = json_decode(file_get_contents($iterationFileName), associative: true);
             $avgFrameTime = $iterationData['stats']['totalTime'] / $iterationData['stats']['renderedFrameCount'];
             if ($bestAvgFrameTime > $avgFrameTime) {
@@ -88,6 +88,21 @@ function generatePhpVersionReport(string $phpVersion)
         )
     ];
 
+    foreach ([50, 90, 99] as $percentile) {
+        $rows[] = [
+            sprintf('P%d frame time', $percentile),
+            ...array_map(
+                function (array $result) use ($percentile) {
+                    // not available in the results of older versions
+                    $frameTimeMs = $result['stats'][sprintf('p%dFrameTimeMs', $percentile)] ?? null;
+
+                    return $frameTimeMs === null ? 'N/A' : sprintf('%5.1fms', $frameTimeMs);
+                },
+                $results
+            )
+        ];
+    }
+
     $rows[] = [
         'Average framerate',
         ...array_map(
@@ -168,7 +183,10 @@ function generatePhpVersionReport(string $phpVersion)
     }
 }
 
-foreach (explode("\n", trim(shell_exec('ls .tmp/benchmark-* | cut -d : -f2 | sort -u'))) as $phpVersion) {
-    generatePhpVersionReport($phpVersion);
+// e.g. "benchmark_headless" to report the headless benchmark results
+$resultFilePrefix = $argv[1] ?? 'benchmark';
+
+foreach (explode("\n", trim(shell_exec("ls .tmp/$resultFilePrefix-* | cut -d : -f2 | sort -u"))) as $phpVersion) {
+    generatePhpVersionReport($resultFilePrefix, $phpVersion);
     echo "\n\n\n";
 }
@@ -2,12 +2,40 @@
 
 require 'vendor/autoload.php';
 
-// just to avoid having the xterm window not maximized yet at screen creation time
-usleep(200 * 1000);
+if (! in_array('--headless', $argv, true)) {
+    // just to avoid having the xterm window not maximized yet at screen creation time
+    usleep(200 * 1000);
+}
+
+$resolveOptionValue = function (string $name) use ($argv): ?string {
+    foreach ($argv as $arg) {
+        if (str_starts_with($arg, '--' . $name . '=')) {
+            return substr($arg, strlen('--' . $name . '='));
+        }
+    }
+
+    return null;
+};
+
+$benchmarkFrameCount = $resolveOptionValue('benchmark-frame-count');
+
+if (isset($_ENV['TERM_ASTEROIDS_NATIVE_RENDERER_LIBRARY'])) {
+    \NoiseByNorthwest\TermAsteroids\Engine\NativeRendererLibrary::setFileName($_ENV['TERM_ASTEROIDS_NATIVE_RENDERER_LIBRARY']);
+}
 
 (new \NoiseByNorthwest\TermAsteroids\Game\TermAsteroids(
     devMode: in_array('--dev-mode', $argv, true),
     benchmarkMode: in_array('--benchmark-mode', $argv, true),
     useNativeRenderer: in_array('--use-native-renderer', $argv, true),
     kittyKeyboardProtocolSupported: ($_ENV['TERM_ASTEROIDS_KITTY_KBP'] ?? '0') === '1',
+    nativeRendererThreadCount: (int) ($_ENV['TERM_ASTEROIDS_RENDERER_THREAD_COUNT'] ?? '1'),
+    presentationBufferCount: (int) ($_ENV['TERM_ASTEROIDS_PRESENTATION_BUFFER_COUNT'] ?? '0'),
+    repeatSequencesEnabled: ($_ENV['TERM_ASTEROIDS_REPEAT_SEQUENCES'] ?? '0') === '1',
+    lineShiftsEnabled: ($_ENV['TERM_ASTEROIDS_LINE_SHIFTS'] ?? '0') === '1',
+    graphicsOutput: $_ENV['TERM_ASTEROIDS_GRAPHICS_OUTPUT'] ?? null,
+    drawStreamCaptureFileName: $_ENV['TERM_ASTEROIDS_DRAW_STREAM_CAPTURE_FILE'] ?? null,
+    benchmarkScenario: $resolveOptionValue('benchmark-scenario')
+        ?? \NoiseByNorthwest\TermAsteroids\Game\TermAsteroids::BENCHMARK_SCENARIO_DEFAULT,
+    headless: in_array('--headless', $argv, true),
+    benchmarkFrameCount: $benchmarkFrameCount !== null ? (int) $benchmarkFrameCount : null,
 ))->run();
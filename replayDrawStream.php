@@ -0,0 +1,261 @@
+<?php
+
+/*
+ * Replays a draw stream captured by NativeRenderer::startCapture() (see TERM_ASTEROIDS_DRAW_STREAM_CAPTURE_FILE)
+ * through both the PHP renderer and the native one, and reports the frames whose presented pixels differ.
+ *
+ * Usage: php replayDrawStream.php <capture file> [--tolerance=<max channel difference>]
+ *
+ * The text layer, the change threshold and the output byte budget are native only and thus not replayed, so that the
+ * same pixels are expected from both renderers.
+ */
+
+use NoiseByNorthwest\TermAsteroids\Engine\AABox;
+use NoiseByNorthwest\TermAsteroids\Engine\Bitmap;
+use NoiseByNorthwest\TermAsteroids\Engine\NativeRenderer;
+use NoiseByNorthwest\TermAsteroids\Engine\PhpRenderer;
+use NoiseByNorthwest\TermAsteroids\Engine\RendererInterface;
+use NoiseByNorthwest\TermAsteroids\Engine\Vec2;
+
+require 'vendor/autoload.php';
+
+// must match the NATIVE_RENDERER_CAPTURE_* constants
+const CAPTURE_MAGIC = "TADRAWS\0";
+const CAPTURE_VERSION = 1;
+const CAPTURE_BITMAP = 1;
+const CAPTURE_RESET = 2;
+const CAPTURE_CLEAR = 3;
+const CAPTURE_DRAW = 4;
+const CAPTURE_RECT = 5;
+const CAPTURE_UPDATE = 8;
+const CAPTURED_VERTICAL_BLENDING_COLORS = 1;
+const CAPTURED_HORIZONTAL_DISTORTION_OFFSETS = 2;
+const CAPTURED_HORIZONTAL_BACKGROUND_DISTORTION_OFFSETS = 4;
+
+function readBytes($file, int $size): string
+{
+    $data = $size > 0 ? fread($file, $size) : '';
+    if ($data === false || strlen($data) !== $size) {
+        throw new \RuntimeException('Truncated draw stream capture');
+    }
+
+    return $data;
+}
+
+/**
+ * @return array<int>
+ */
+function unpackInt64s(string $data, int $offset, int $count): array
+{
+    return array_values(unpack(sprintf('q%d', $count), $data, $offset));
+}
+
+function countDifferingPixels(array $pixels, array $referencePixels, int $tolerance, int &$maxDifference): int
+{
+    $count = 0;
+    foreach ($pixels as $i => $color) {
+        $referenceColor = $referencePixels[$i];
+        $difference = max(
+            abs((($color >> 16) & 0xff) - (($referenceColor >> 16) & 0xff)),
+            abs((($color >> 8) & 0xff) - (($referenceColor >> 8) & 0xff)),
+            abs(($color & 0xff) - ($referenceColor & 0xff)),
+        );
+
+        if ($difference > $tolerance) {
+            $count++;
+            $maxDifference = max($maxDifference, $difference);
+        }
+    }
+
+    return $count;
+}
+
+$fileName = $argv[1] ?? null;
+$tolerance = 0;
+foreach (array_slice($argv, 2) as $arg) {
+    if (! str_starts_with($arg, '--tolerance=')) {
+        throw new \RuntimeException(sprintf('Unknown argument: %s', $arg));
+    }
+
+    $tolerance = (int) substr($arg, strlen('--tolerance='));
+}
+
+if ($fileName === null) {
+    echo "Usage: php replayDrawStream.php <capture file> [--tolerance=<max channel difference>]\n";
+    exit(1);
+}
+
+$file = fopen($fileName, 'rb');
+if ($file === false) {
+    throw new \RuntimeException(sprintf('Cannot open %s', $fileName));
+}
+
+$header = unpack('a8magic/Vversion/Vwidth/Vheight', readBytes($file, 24));
+if ($header['magic'] !== CAPTURE_MAGIC || $header['version'] !== CAPTURE_VERSION) {
+    throw new \RuntimeException(sprintf('%s is not a draw stream capture of the current version', $fileName));
+}
+
+/** @var array<RendererInterface> $renderers */
+$renderers = [
+    'PHP' => new PhpRenderer($header['width'], $header['height']),
+    'Native' => new NativeRenderer($header['width'], $header['height']),
+];
+
+/** @var array<Bitmap> $bitmaps */
+$bitmaps = [];
+$frameCount = 0;
+$differingFrames = [];
+
+// both renderers write their frames to the standard output, which is discarded
+ob_start(fn (string $buffer) => '');
+
+while (! feof($file) && ($recordHeader = fread($file, 8)) !== '') {
+    $record = unpack('Vtype/Vsize', $recordHeader . readBytes($file, 8 - strlen($recordHeader)));
+    $payload = readBytes($file, $record['size']);
+
+    switch ($record['type']) {
+        case CAPTURE_BITMAP:
+            $bitmap = unpack('Vindex/Vwidth/Vheight', $payload);
+            $pixelCount = $bitmap['width'] * $bitmap['height'];
+            $bitmaps[$bitmap['index']] = new Bitmap(
+                $bitmap['width'],
+                $bitmap['height'],
+                array_values(unpack(sprintf('V%d', $pixelCount), $payload, 16))
+            );
+            break;
+
+        case CAPTURE_RESET:
+            foreach ($renderers as $renderer) {
+                $renderer->reset();
+            }
+            break;
+
+        case CAPTURE_CLEAR:
+            $color = unpack('Vcolor', $payload)['color'];
+            foreach ($renderers as $renderer) {
+                $renderer->clear($color);
+            }
+            break;
+
+        case CAPTURE_DRAW:
+            $draw = unpack(
+                'VbitmapIndex/VarrayFlags/qx/qy/qglobalAlpha/qglobalBlendingColor/qpersisted/qglobalPersistedColor/'
+                    . 'qbilinearFilteringEnabled/erotationAngle/gbrightness/gditheringAlphaRatioThreshold',
+                $payload
+            );
+            $bitmap = $bitmaps[$draw['bitmapIndex']];
+            $arrayOffset = 80;
+
+            $verticalBlendingColors = [];
+            if ($draw['arrayFlags'] & CAPTURED_VERTICAL_BLENDING_COLORS) {
+                // -1 stands for no blending color on the native side
+                $verticalBlendingColors = array_filter(
+                    unpackInt64s($payload, $arrayOffset, $bitmap->getWidth()),
+                    fn (int $color) => $color !== -1
+                );
+                $arrayOffset += 8 * $bitmap->getWidth();
+            }
+
+            $horizontalDistortionOffsets = [];
+            if ($draw['arrayFlags'] & CAPTURED_HORIZONTAL_DISTORTION_OFFSETS) {
+                $horizontalDistortionOffsets = unpackInt64s($payload, $arrayOffset, $bitmap->getHeight());
+                $arrayOffset += 8 * $bitmap->getHeight();
+            }
+
+            $horizontalBackgroundDistortionOffsets = [];
+            if ($draw['arrayFlags'] & CAPTURED_HORIZONTAL_BACKGROUND_DISTORTION_OFFSETS) {
+                $horizontalBackgroundDistortionOffsets = unpackInt64s($payload, $arrayOffset, $bitmap->getHeight());
+            }
+
+            foreach ($renderers as $renderer) {
+                $renderer->drawBitmap(
+                    $bitmap,
+                    $draw['x'],
+                    $draw['y'],
+                    $draw['globalAlpha'],
+                    $draw['brightness'],
+                    $draw['globalBlendingColor'] !== -1 ? $draw['globalBlendingColor'] : null,
+                    $verticalBlendingColors,
+                    (bool) $draw['persisted'],
+                    $draw['globalPersistedColor'] !== -1 ? $draw['globalPersistedColor'] : null,
+                    $horizontalDistortionOffsets,
+                    $horizontalBackgroundDistortionOffsets,
+                    $draw['ditheringAlphaRatioThreshold'],
+                    $draw['rotationAngle'],
+                    (bool) $draw['bilinearFilteringEnabled'],
+                );
+            }
+            break;
+
+        case CAPTURE_RECT:
+            $rect = unpack('Vwidth/Vheight/qx/qy/Vcolor', $payload);
+            foreach ($renderers as $renderer) {
+                $renderer->drawRect(
+                    new AABox(new Vec2($rect['x'], $rect['y']), new Vec2($rect['width'], $rect['height'])),
+                    $rect['color']
+                );
+            }
+            break;
+
+        case CAPTURE_UPDATE:
+            $update = unpack(
+                'qtrueColorModeEnabled/qpersistenceEffectsEnabled/qpersistenceAlphaDecrease/qremovedColorDepthBits/'
+                    . 'qlowResolutionMode/qorderedDitheringEnabled',
+                $payload
+            );
+
+            $presentedPixels = [];
+            foreach ($renderers as $name => $renderer) {
+                $renderer->update(
+                    (bool) $update['trueColorModeEnabled'],
+                    (bool) $update['persistenceEffectsEnabled'],
+                    $update['persistenceAlphaDecrease'],
+                    $update['removedColorDepthBits'],
+                    $update['lowResolutionMode'],
+                    (bool) $update['orderedDitheringEnabled'],
+                );
+
+                $presentedPixels[$name] = $renderer->getPresentedPixels();
+            }
+
+            $maxDifference = 0;
+            $differingPixelCount = countDifferingPixels(
+                $presentedPixels['Native'],
+                $presentedPixels['PHP'],
+                $tolerance,
+                $maxDifference
+            );
+
+            if ($differingPixelCount > 0) {
+                $differingFrames[$frameCount] = [$differingPixelCount, $maxDifference];
+            }
+
+            $frameCount++;
+            break;
+
+        default:
+            // the text layer is native only
+            break;
+    }
+}
+
+ob_end_clean();
+fclose($file);
+
+foreach ($differingFrames as $frameIndex => [$differingPixelCount, $maxDifference]) {
+    echo sprintf(
+        "Frame %d: %d differing pixels (max channel difference: %d)\n",
+        $frameIndex,
+        $differingPixelCount,
+        $maxDifference
+    );
+}
+
+echo sprintf(
+    "%d / %d frames differ between the PHP and the native renderers (tolerance: %d)\n",
+    count($differingFrames),
+    $frameCount,
+    $tolerance
+);
+
+exit(count($differingFrames) > 0 ? 1 : 0);
@@ -9,11 +9,16 @@ class Bitmap
     private int $height;
 
     /**
-     * @var int[]
+     * @var int[]|null null until needed when the bitmap is unserialized, its pixels are then rebuilt from the native ones
      */
-    private array $pixels;
+    private ?array $pixels;
 
-    private \FFI\CData $nativePixels;
+    /**
+     * null when the bitmap is unserialized, its native pixels being then mapped from the bitmap atlas
+     */
+    private ?\FFI\CData $nativePixels = null;
+
+    private \FFI\CData $nativePixelsPointer;
 
     public static function generateVerticalGradient(int $width, int $height, array $colorGradient, bool $loopBack = false): self
     {
@@ -50,19 +55,18 @@ class Bitmap
     {
         assert($frameCount > 0);
 
-        $bitmaps[] = $bitmap;
-
         $angleStep = (2 * M_PI) / $frameCount;
+        $angles = [];
         $i = 1;
         $angle = 0;
         while ($i < $frameCount) {
             $i++;
             $angle += $angleStep;
 
-            $bitmaps[] = $bitmap->withCenteredRotation($angle);
+            $angles[] = $angle;
         }
 
-        return $bitmaps;
+        return [$bitmap, ...$bitmap->withCenteredRotations($angles)];
     }
 
     /**
@@ -84,20 +88,37 @@ class Bitmap
 
     private function buildNativePixels(): void
     {
-        $this->nativePixels = NativeRenderer::getFfi()->new(sprintf('int64_t[%d]', count($this->pixels)));
-        for ($i = 0; $i < count($this->pixels); $i++){
-            $this->nativePixels[$i] = $this->pixels[$i];
+        // native pixels are 32-bit ARGB, the transparent pixels (-1) become fully transparent black
+        $pixelCount = count($this->pixels);
+        $nativePixelValues = [];
+        for ($i = 0; $i < $pixelCount; $i++) {
+            $nativePixelValues[] = $this->pixels[$i] < 0 ? 0 : $this->pixels[$i];
         }
+
+        $this->nativePixels = NativeRenderer::getFfi()->new(sprintf('uint32_t[%d]', $pixelCount));
+        \FFI::memcpy($this->nativePixels, pack('V*', ...$nativePixelValues), $pixelCount * 4);
+
+        $this->nativePixelsPointer = NativeRenderer::getFfi()->cast('uint32_t *', $this->nativePixels);
     }
 
-    public function __sleep(): array
+    /**
+     * The pixels are stored in the bitmap atlas being built (see BitmapAtlas::build())
+     */
+    public function __serialize(): array
     {
-        return ['width', 'height', 'pixels'];
+        return [
+            'width' => $this->width,
+            'height' => $this->height,
+            'atlasOffset' => BitmapAtlas::addPixels($this->nativePixelsPointer, $this->width * $this->height),
+        ];
     }
 
-    public function __wakeup(): void
+    public function __unserialize(array $data): void
     {
-        $this->buildNativePixels();
+        $this->width = $data['width'];
+        $this->height = $data['height'];
+        $this->pixels = null;
+        $this->nativePixelsPointer = BitmapAtlas::getPixels($data['atlasOffset'], $this->width * $this->height);
     }
 
     /**
@@ -121,53 +142,77 @@ class Bitmap
      */
     public function getPixels(): array
     {
-        return $this->pixels;
+        // the transparent pixels rebuilt from the native ones are 0 instead of -1, which is equivalent
+        return $this->pixels ??= array_values(unpack(
+            'V*',
+            \FFI::string($this->nativePixelsPointer, 4 * $this->width * $this->height)
+        ));
     }
 
-    public function getNativePixels(): \FFI\CData
+    public function getNativePixelsPointer(): \FFI\CData
     {
-        return $this->nativePixels;
+        return $this->nativePixelsPointer;
     }
 
     public function withCenteredRotation(float $angle): self
     {
-        $newPixels = array_fill(0, $this->width * $this->height, 0);
+        return $this->withCenteredRotations([$angle])[0];
+    }
 
-        $projectionMatrix = Mat3::identity()
-            ->translate($this->width / 2, $this->height / 2)
-            ->rotate($angle)
-            ->translate(-($this->width / 2), -($this->height / 2))
-        ;
+    /**
+     * The rotations are computed natively and in parallel
+     *
+     * @param array<float> $angles
+     * @return array<self>
+     */
+    public function withCenteredRotations(array $angles): array
+    {
+        if (count($angles) === 0) {
+            return [];
+        }
 
-        for ($y = 0; $y < $this->height; $y++) {
-            for ($x = 0; $x < $this->width; $x++) {
-                $point = new Vec2($x, $y);
-                $projectedPoint = $projectionMatrix->transform($point);
+        $ffi = NativeRenderer::getFfi();
+        $pixelCount = $this->width * $this->height;
+        $frameCount = count($angles);
 
-                $pX = Math::roundToInt($projectedPoint->getX());
+        $matrixCoefficients = [];
+        foreach ($angles as $angle) {
+            $rows = Mat3::identity()
+                ->translate($this->width / 2, $this->height / 2)
+                ->rotate($angle)
+                ->translate(-($this->width / 2), -($this->height / 2))
+                ->getRows()
+            ;
 
-                if ($pX < 0 || $this->width <= $pX) {
-                    continue;
-                }
+            array_push($matrixCoefficients, ...$rows[0], ...$rows[1]);
+        }
 
-                $pY = Math::roundToInt($projectedPoint->getY());
+        $nativeMatrices = $ffi->new(sprintf('double[%d]', 6 * $frameCount));
+        \FFI::memcpy($nativeMatrices, pack('d*', ...$matrixCoefficients), 6 * $frameCount * 8);
 
-                if ($pY < 0 || $this->height <= $pY) {
-                    continue;
-                }
+        $nativePixels = $ffi->new(sprintf('int64_t[%d]', $pixelCount));
+        \FFI::memcpy($nativePixels, pack('q*', ...$this->getPixels()), $pixelCount * 8);
 
-                $newPixels[
-                    $x + $y * $this->width
-                ] = $this->pixels[
-                    $pX + $pY * $this->width
-                ];
-            }
-        }
+        $nativeRotatedPixels = $ffi->new(sprintf('int64_t[%d]', $frameCount * $pixelCount));
 
-        return new self(
+        $ffi->NativeRenderer_rotateBitmap(
+            $nativePixels,
             $this->width,
             $this->height,
-            $newPixels,
+            $nativeMatrices,
+            $frameCount,
+            $nativeRotatedPixels
         );
+
+        $bitmaps = [];
+        for ($i = 0; $i < $frameCount; $i++) {
+            $bitmaps[] = new self(
+                $this->width,
+                $this->height,
+                array_values(unpack('q*', \FFI::string(\FFI::addr($nativeRotatedPixels[$i * $pixelCount]), $pixelCount * 8))),
+            );
+        }
+
+        return $bitmaps;
     }
 }
@@ -0,0 +1,131 @@
+<?php
+
+namespace NoiseByNorthwest\TermAsteroids\Engine;
+
+/**
+ * Versioned binary file which packs the pixels of the serialized bitmaps (see Bitmap::__serialize()) one after
+ * another.
+ *
+ * Once loaded, the file is memory-mapped by the native side so that the unserialized bitmaps reference their pixels in
+ * place, without any copy, and so that the game processes of a host share the same pages.
+ *
+ * Each build gets a random generation, stored in the header, which the serialized bitmaps must be stored along with
+ * (see CacheUtils::saveToFile()), since their pixel offsets are only valid for the atlas they were built with.
+ */
+class BitmapAtlas
+{
+    const VERSION = 2;
+
+    // must match NATIVE_RENDERER_BITMAP_ATLAS_MAGIC
+    private const MAGIC = "TAATLAS\0";
+
+    // the pixels start on a cache line boundary
+    private const HEADER_SIZE = 64;
+
+    private static ?\FFI\CData $mappedPixels = null;
+
+    private static int $mappedPixelCount = 0;
+
+    private static ?int $mappedGeneration = null;
+
+    /**
+     * @var array<string>|null the packed pixels of the atlas being built
+     */
+    private static ?array $builtPixelChunks = null;
+
+    private static int $builtPixelCount = 0;
+
+    public static function load(string $fileName): bool
+    {
+        $pixelCount = NativeRenderer::getFfi()->new('size_t');
+        $generation = NativeRenderer::getFfi()->new('uint64_t');
+        $pixels = NativeRenderer::getFfi()->NativeRenderer_mapBitmapAtlas(
+            $fileName,
+            self::VERSION,
+            \FFI::addr($pixelCount),
+            \FFI::addr($generation)
+        );
+
+        if ($pixels === null) {
+            return false;
+        }
+
+        self::$mappedPixels = $pixels;
+        self::$mappedPixelCount = $pixelCount->cdata;
+        self::$mappedGeneration = $generation->cdata;
+
+        return true;
+    }
+
+    /**
+     * @return int|null the generation of the loaded atlas
+     */
+    public static function getGeneration(): ?int
+    {
+        return self::$mappedGeneration;
+    }
+
+    /**
+     * Runs $func, which is expected to serialize bitmaps, and writes their pixels to the given atlas file.
+     * $func is given the generation of the atlas being built.
+     */
+    public static function build(string $fileName, callable $func): mixed
+    {
+        assert(self::$builtPixelChunks === null);
+
+        self::$builtPixelChunks = [];
+        self::$builtPixelCount = 0;
+
+        try {
+            $generation = random_int(1, PHP_INT_MAX);
+            $result = $func($generation);
+
+            $header = str_pad(
+                self::MAGIC . pack('VVPP', self::VERSION, 0, self::$builtPixelCount, $generation),
+                self::HEADER_SIZE,
+                "\0"
+            );
+
+            // the current file may be mapped by other processes, so it is replaced rather than overwritten
+            $tmpFileName = $fileName . '.' . getmypid();
+            file_put_contents($tmpFileName, [$header, ...self::$builtPixelChunks]);
+            rename($tmpFileName, $fileName);
+
+            return $result;
+        } finally {
+            self::$builtPixelChunks = null;
+        }
+    }
+
+    /**
+     * @return int the offset of the added pixels
+     */
+    public static function addPixels(\FFI\CData $pixels, int $pixelCount): int
+    {
+        if (self::$builtPixelChunks === null) {
+            throw new \RuntimeException('Bitmaps can only be serialized while a bitmap atlas is built');
+        }
+
+        $offset = self::$builtPixelCount;
+        self::$builtPixelChunks[] = \FFI::string($pixels, 4 * $pixelCount);
+        self::$builtPixelCount += $pixelCount;
+
+        return $offset;
+    }
+
+    /**
+     * @return \FFI\CData a uint32_t pointer to the mapped pixels
+     */
+    public static function getPixels(int $offset, int $pixelCount): \FFI\CData
+    {
+        if (self::$mappedPixels === null) {
+            throw new \RuntimeException('No bitmap atlas is loaded');
+        }
+
+        if ($offset < 0 || $offset + $pixelCount > self::$mappedPixelCount) {
+            throw new \RuntimeException(sprintf('Pixels %d to %d are out of the bitmap atlas', $offset, $offset + $pixelCount));
+        }
+
+        return self::$mappedPixels + $offset;
+    }
+}
@@ -113,108 +113,79 @@ class BitmapNoiseGenerator
         ]);
 
         if (!isset($cache[$cacheKey])) {
-            $maxScale = $scales[array_key_last($scales)];
-
-            $pixels = array_fill(0, $width * $height, 0);
-
-            for ($y = 0; $y < $height; $y++) {
-                $distY = Math::dist($y, $height / 2) / ($height / 2);
-
-                for ($x = 0; $x < $width; $x++) {
-                    $distX = Math::dist($x, $width / 2) / ($width / 2);
-
-                    if ((new Vec2($distX, $distY))->computeLength() > $radius) {
-                        $z = 0;
-                    } else {
-                        $z = 1;
-                        foreach ($scales as $k => $r) {
-                            $pX = $x / $r + $shift;
-                            $pY = $y / $r + $shift;
-
-                            $z *= Math::lerp(
-                                Math::lerp(0.8, 0, $r / $maxScale),
-                                1,
-                                self::perlin(
-                                    $pX,
-                                    $pY,
-                                    count($scales) > 1 && $k !== count($scales) - 1 ? 1 : $seed
-                                ) * 0.5 + 0.5
-                            );
-                        }
-                    }
-
-                    assert($z >= 0);
-
-                    if ($z > 0) {
-                        $z *= cos((1.1 / $radius) * M_PI_2 * $distY);
-                        $z *= cos((1.1 / $radius) * M_PI_2 * $distX);
+            $ffi = NativeRenderer::getFfi();
+            $scaleCount = count($scales);
+
+            // the gradients of each scale's grid, which covers the points of the perlin noise sampled by the bitmap
+            $scaleSeeds = [];
+            $gradientGridBounds = [];
+            $gradients = [];
+            foreach ($scales as $k => $r) {
+                $scaleSeed = $scaleCount > 1 && $k !== $scaleCount - 1 ? 1 : $seed;
+                $firstX = (int) floor($shift);
+                $firstY = (int) floor($shift);
+                $lastX = (int) floor(($width - 1) / $r + $shift) + 1;
+                $lastY = (int) floor(($height - 1) / $r + $shift) + 1;
+
+                for ($iy = $firstY; $iy <= $lastY; $iy++) {
+                    for ($ix = $firstX; $ix <= $lastX; $ix++) {
+                        array_push($gradients, ...self::getGradient($ix, $iy, $scaleSeed));
                     }
-
-                    $pixels[$y * $width + $x] = $z;
                 }
-            }
-
-            $cache[$cacheKey] = $pixels;
-        }
-
-        return $cache[$cacheKey];
-    }
 
-    /**
-     * @see https://en.wikipedia.org/wiki/Perlin_noise
-     * @param float $x
-     * @param float $y
-     * @param int   $seed
-     * @return float
-     */
-    private static function perlin(float $x, float $y, int $seed): float
-    {
-        static $cache = [];
+                $scaleSeeds[] = $scaleSeed;
+                array_push($gradientGridBounds, $firstX, $firstY, $lastX, $lastY);
+            }
 
-        $cacheKey = round($x, 2) . '/' . round($y, 2) . '/' . $seed;
-        if (isset($cache[$cacheKey])) {
-            return $cache[$cacheKey];
-        }
+            // FFI arrays cannot be empty, the arrays are not read anyway without any scale
+            $nativeScales = $ffi->new(sprintf('double[%d]', max($scaleCount, 1)));
+            \FFI::memcpy($nativeScales, pack('d*', ...$scales), $scaleCount * 8);
 
-        $x0 = (int) floor($x);
-        $x1 = $x0 + 1;
-        $y0 = (int) floor($y);
-        $y1 = $y0 + 1;
+            $nativeScaleSeeds = $ffi->new(sprintf('int64_t[%d]', max($scaleCount, 1)));
+            \FFI::memcpy($nativeScaleSeeds, pack('q*', ...$scaleSeeds), $scaleCount * 8);
 
-        $sx = $x - $x0;
-        $sy = $y - $y0;
+            $nativeGradientGridBounds = $ffi->new(sprintf('int64_t[%d]', max(count($gradientGridBounds), 1)));
+            \FFI::memcpy($nativeGradientGridBounds, pack('q*', ...$gradientGridBounds), count($gradientGridBounds) * 8);
 
-        $n0 = self::dotGridGradient($x0, $y0, $x, $y, $seed);
-        $n1 = self::dotGridGradient($x1, $y0, $x, $y, $seed);
-        $ix0 = Math::lerp($n0, $n1, $sx);
+            $nativeGradients = $ffi->new(sprintf('double[%d]', max(count($gradients), 1)));
+            \FFI::memcpy($nativeGradients, pack('d*', ...$gradients), count($gradients) * 8);
 
-        $n0 = self::dotGridGradient($x0, $y1, $x, $y, $seed);
-        $n1 = self::dotGridGradient($x1, $y1, $x, $y, $seed);
-        $ix1 = Math::lerp($n0, $n1, $sx);
+            $nativeNoiseMap = $ffi->new(sprintf('double[%d]', $width * $height));
 
-        $value = Math::lerp($ix0, $ix1, $sy);
+            if (! $ffi->NativeRenderer_generateNoiseMap(
+                $nativeNoiseMap,
+                $width,
+                $height,
+                $shift,
+                $radius,
+                $nativeScales,
+                $nativeScaleSeeds,
+                $scaleCount,
+                $nativeGradients,
+                $nativeGradientGridBounds,
+            )) {
+                throw new \RuntimeException('Cannot allocate the perlin noise cache');
+            }
 
-        $cache[$cacheKey] = $value;
+            $cache[$cacheKey] = array_values(unpack('d*', \FFI::string($nativeNoiseMap, $width * $height * 8)));
+        }
 
-        return $value;
+        return $cache[$cacheKey];
     }
 
-    private static function dotGridGradient(int $ix, int $iy, float $x, float $y, int $seed): float
+    /**
+     * @return array<float> the (x, y) gradient of the perlin noise grid's given point
+     */
+    private static function getGradient(int $ix, int $iy, int $seed): array
     {
         static $gradientCache = [];
 
         $gradientCacheKey = $ix . ' ' . $iy . ' ' . $seed;
-        if (isset($gradientCache[$gradientCacheKey])) {
-            $gradient = $gradientCache[$gradientCacheKey];
-        } else {
-            $gradient = self::randomGradient($ix, $iy, $seed);
-            $gradientCache[$gradientCacheKey] = $gradient;
+        if (! isset($gradientCache[$gradientCacheKey])) {
+            $gradientCache[$gradientCacheKey] = self::randomGradient($ix, $iy, $seed);
         }
 
-        $dx = $x - $ix;
-        $dy = $y - $iy;
-
-        return $dx * $gradient[0] + $dy * $gradient[1];
+        return $gradientCache[$gradientCacheKey];
     }
 
     private static function randomGradient(int $ix, int $iy, int $seed): array
@@ -18,19 +18,53 @@ class CacheUtils
         return self::$cache[$key];
     }
 
-    public static function saveToFile(string $fileName): void
+    /**
+     * The cached bitmaps' pixels are saved to the given bitmap atlas file, whose generation is saved along with the
+     * cache, as both files are replaced one after the other
+     */
+    public static function saveToFile(string $fileName, string $bitmapAtlasFileName): void
     {
-        file_put_contents($fileName, igbinary_serialize(self::$cache));
+        $data = BitmapAtlas::build(
+            $bitmapAtlasFileName,
+            fn (int $bitmapAtlasGeneration) => igbinary_serialize([
+                'bitmapAtlasGeneration' => $bitmapAtlasGeneration,
+                'cache' => igbinary_serialize(self::$cache),
+            ])
+        );
+
+        $tmpFileName = $fileName . '.' . getmypid();
+        file_put_contents($tmpFileName, $data);
+        rename($tmpFileName, $fileName);
     }
 
-    public static function loadFromFile(string $fileName): bool
+    public static function loadFromFile(string $fileName, string $bitmapAtlasFileName): bool
     {
+        if (! BitmapAtlas::load($bitmapAtlasFileName)) {
+            return false;
+        }
+
         $data = igbinary_unserialize(file_get_contents($fileName));
-        if (!is_array($data)) {
+
+        // the bitmaps' pixel offsets are only valid for the atlas they were saved with
+        if (
+            !is_array($data)
+            || ($data['bitmapAtlasGeneration'] ?? null) !== BitmapAtlas::getGeneration()
+            || !is_string($data['cache'] ?? null)
+        ) {
+            return false;
+        }
+
+        try {
+            $cache = igbinary_unserialize($data['cache']);
+        } catch (\RuntimeException) {
+            return false;
+        }
+
+        if (!is_array($cache)) {
             return false;
         }
 
-        self::$cache = $data;
+        self::$cache = $cache;
 
         return true;
     }
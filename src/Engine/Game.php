@@ -10,6 +10,8 @@ abstract class Game
 
     private bool $kittyKeyboardProtocolSupported;
 
+    private bool $headless;
+
     private bool $finished = false;
 
     /**
@@ -17,16 +19,30 @@ abstract class Game
      */
     private array $gameObjects = [];
 
+    /**
+     * The z indexes of the game objects added so far, in ascending order, so that the game objects are rendered without
+     * being sorted
+     *
+     * @var array<int, true>
+     */
+    private array $zIndexes = [];
+
     private GameObjectPool $gameObjectPool;
 
+    private SpatialHash $spatialHash;
+
+    private ParticleSystem $particleSystem;
+
     private bool $profilerEnabled;
 
     private bool $profilingEnabled = false;
 
-    function __construct(bool $kittyKeyboardProtocolSupported)
+    function __construct(bool $kittyKeyboardProtocolSupported, bool $headless = false)
     {
         $this->kittyKeyboardProtocolSupported = $kittyKeyboardProtocolSupported;
+        $this->headless = $headless;
         $this->gameObjectPool = new GameObjectPool($this);
+        $this->spatialHash = new SpatialHash();
         $this->profilerEnabled = getenv('SPX_ENABLED') === '1' && getenv('SPX_AUTO_START') === '0';
     }
 
@@ -35,6 +51,16 @@ abstract class Game
         return $this->gameObjectPool;
     }
 
+    public function getSpatialHash(): SpatialHash
+    {
+        return $this->spatialHash;
+    }
+
+    public function getParticleSystem(): ParticleSystem
+    {
+        return $this->particleSystem;
+    }
+
     public function run(): void
     {
         gc_disable();
@@ -42,11 +68,14 @@ abstract class Game
         Timer::init();
 
         $this->adaptivePerformanceManager = new AdaptivePerformanceManager(45);
-        $this->screen = new Screen(300, 144, $this->adaptivePerformanceManager);
+        $this->screen = new Screen(300, 144, $this->adaptivePerformanceManager, headless: $this->headless);
+        $this->particleSystem = new ParticleSystem();
         $this->onInit();
         $this->screen->init();
-        // must be called after screen init to not disable kitty's keyboard protocol
-        Input::init(kittyKeyboardProtocolSupported: $this->kittyKeyboardProtocolSupported);
+        if (! $this->headless) {
+            // must be called after screen init to not disable kitty's keyboard protocol
+            Input::init(kittyKeyboardProtocolSupported: $this->kittyKeyboardProtocolSupported);
+        }
         $this->reset();
 
         while (!$this->finished) {
@@ -62,13 +91,15 @@ abstract class Game
 
             // we save the current list so that new objects will be updated & rendered in the next frame
             $gameObjects = $this->gameObjects;
-            $renderedGameObjects = [];
-            $renderedGameObjectStats = [];
-            foreach ($gameObjects as $gameObject) {
+            // the objects which survived their update, per z index, they are rendered even if terminated afterwards
+            $renderQueue = [];
+            foreach ($gameObjects as $id => $gameObject) {
                 if (
                     // it could have been terminated by another object within this loop
                     $gameObject->isTerminated() ||
-                        ! $gameObject->isActive()
+                        ! $gameObject->isActive() ||
+                        // or even terminated then acquired again, as a new object
+                        $gameObject->getId() !== $id
                 ) {
                     continue;
                 }
@@ -83,38 +114,62 @@ abstract class Game
                     continue;
                 }
 
-                $renderedGameObjects[] = $gameObject;
+                $renderQueue[$gameObject->getZIndex()][] = $gameObject;
+            }
+
+            $this->particleSystem->update($this->screen);
 
-                $className = get_class($gameObject);
-                if (!isset($renderedGameObjectStats[$className])) {
-                    $renderedGameObjectStats[$className] = 0;
+            $this->screen->clear(ColorUtils::createColor('#000000'));
+
+            $debugInfoDisplayEnabled = $this->screen->isDebugInfoDisplayEnabled();
+            $renderedGameObjectCount = 0;
+            $renderedGameObjectStats = [];
+
+            // each particle layer is drawn right after the game objects of lower or equal z index
+            $particleLayers = $this->particleSystem->getLayers();
+            foreach (array_keys($this->zIndexes) as $zIndex) {
+                if (! isset($renderQueue[$zIndex])) {
+                    continue;
+                }
+
+                while (count($particleLayers) > 0 && $particleLayers[0] < $zIndex) {
+                    $this->screen->drawParticles($this->particleSystem, array_shift($particleLayers));
                 }
 
-                $renderedGameObjectStats[$className]++;
+                foreach ($renderQueue[$zIndex] as $gameObject) {
+                    $gameObject->render();
+                    $renderedGameObjectCount++;
+
+                    if ($debugInfoDisplayEnabled) {
+                        $className = $gameObject::class;
+                        $renderedGameObjectStats[$className] = ($renderedGameObjectStats[$className] ?? 0) + 1;
+                    }
+                }
             }
 
-            usort($renderedGameObjects, fn (GameObject $a, GameObject $b) => $a->getZIndex() <=> $b->getZIndex());
-
-            arsort($renderedGameObjectStats);
-            $debugLine = sprintf(
-                'Game objects: total: %4d - rendered: %4d - acquired: %4d - released: %4d - rendered by type: (%s)',
-                $this->gameObjectPool->getGameObjectCount(),
-                count($renderedGameObjects),
-                $this->gameObjectPool->getAcquiredGameObjectCount(),
-                $this->gameObjectPool->getReleasedGameObjectCount(),
-                implode(' - ', array_map(
-                    fn ($k) => sprintf(
-                        '%s: %5d',
-                        array_slice(explode('\\', $k), -1, 1)[0],
-                        $renderedGameObjectStats[$k]
-                    ),
-                    array_keys(array_slice($renderedGameObjectStats, 0, 7))
-                ))
-            );
+            foreach ($particleLayers as $particleLayer) {
+                $this->screen->drawParticles($this->particleSystem, $particleLayer);
+            }
 
-            $this->screen->clear(ColorUtils::createColor('#000000'));
-            foreach ($renderedGameObjects as $gameObject) {
-                $gameObject->render();
+            $debugLine = null;
+            if ($debugInfoDisplayEnabled) {
+                arsort($renderedGameObjectStats);
+                $debugLine = sprintf(
+                    'Game objects: total: %4d - rendered: %4d - acquired: %4d - released: %4d - particles: %5d - rendered by type: (%s)',
+                    $this->gameObjectPool->getGameObjectCount(),
+                    $renderedGameObjectCount,
+                    $this->gameObjectPool->getAcquiredGameObjectCount(),
+                    $this->gameObjectPool->getReleasedGameObjectCount(),
+                    $this->particleSystem->getParticleCount(),
+                    implode(' - ', array_map(
+                        fn ($k) => sprintf(
+                            '%s: %5d',
+                            array_slice(explode('\\', $k), -1, 1)[0],
+                            $renderedGameObjectStats[$k]
+                        ),
+                        array_keys(array_slice($renderedGameObjectStats, 0, 7))
+                    ))
+                );
             }
 
             $this->screen->update($debugLine);
@@ -173,6 +228,17 @@ abstract class Game
         assert(! isset($this->gameObjects[$gameObject->getId()]));
 
         $this->gameObjects[$gameObject->getId()] = $gameObject;
+
+        $zIndex = $gameObject->getZIndex();
+        if (! isset($this->zIndexes[$zIndex])) {
+            // new z indexes are rare, they are kept once seen
+            $this->zIndexes[$zIndex] = true;
+            ksort($this->zIndexes);
+        }
+
+        if ($gameObject->isCollidable()) {
+            $this->spatialHash->update($gameObject);
+        }
     }
 
     public function removeGameObject(GameObject $gameObject): void
@@ -182,6 +248,7 @@ abstract class Game
         assert(isset($this->gameObjects[$gameObject->getId()]));
 
         unset($this->gameObjects[$gameObject->getId()]);
+        $this->spatialHash->remove($gameObject);
     }
 
     abstract protected function onInit(): void;
@@ -207,6 +274,9 @@ abstract class Game
         $this->screen->reset();
 
         $this->gameObjects = [];
+        $this->zIndexes = [];
+        $this->spatialHash->clear();
+        $this->particleSystem->clear();
         $this->gameObjectPool->reset();
 
         $this->onReset();
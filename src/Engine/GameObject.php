@@ -177,6 +177,14 @@ abstract class GameObject
         return $this->hitBoxes;
     }
 
+    /**
+     * Collidable game objects are indexed by the game's spatial hash, see Game::getSpatialHash().
+     */
+    public function isCollidable(): bool
+    {
+        return false;
+    }
+
     public function collidesWith(GameObject $other): bool
     {
         return $this->resolveFirstCollidingHitBox($other) !== null;
@@ -287,6 +295,10 @@ abstract class GameObject
         $this->sprite->updateBoundingBox();
         $this->updateHitBoxes();
 
+        if ($this->isCollidable()) {
+            $this->getGame()->getSpatialHash()->update($this);
+        }
+
         if (
             ! $this->enteredScreen &&
             ! $this->isOffScreen()
@@ -12,10 +12,16 @@ class GameObjectPool
     private array $acquiredGameObjects = [];
 
     /**
+     * Per-class LIFO free-lists, keyed by the ids the objects had when they were released
+     *
      * @var array<string, array<GameObject>>
      */
     private array $releasedGameObjects = [];
 
+    private int $acquiredGameObjectCount = 0;
+
+    private int $releasedGameObjectCount = 0;
+
     /**
      * @var array<string, int>
      */
@@ -36,6 +42,8 @@ class GameObjectPool
         $this->acquiredGameObjects = [];
         $this->releasedGameObjects = [];
         $this->excludedGameObjectCounts = [];
+        $this->acquiredGameObjectCount = 0;
+        $this->releasedGameObjectCount = 0;
     }
 
     /**
@@ -96,7 +104,9 @@ class GameObjectPool
                 + count($this->acquiredGameObjects[$className])
             ) >= $className::getMinPoolSize()
         ) {
-            $gameObject = array_shift($this->releasedGameObjects[$className]);
+            // the most recently released object is the most likely to be still cached
+            $gameObject = array_pop($this->releasedGameObjects[$className]);
+            $this->releasedGameObjectCount--;
             assert($gameObject instanceof GameObject);
             assert($gameObject->isTerminated());
             assert(!$this->isAcquired($gameObject));
@@ -107,6 +117,7 @@ class GameObjectPool
 
         $gameObject->reset($pos, $initializer);
         $this->acquiredGameObjects[$className][$gameObject->getId()] = $gameObject;
+        $this->acquiredGameObjectCount++;
 
         return $gameObject;
     }
@@ -124,6 +135,8 @@ class GameObjectPool
 
         unset($this->acquiredGameObjects[$className][$gameObject->getId()]);
         $this->releasedGameObjects[$className][$gameObject->getId()] = $gameObject;
+        $this->acquiredGameObjectCount--;
+        $this->releasedGameObjectCount++;
     }
 
     public function isAcquired(GameObject $gameObject): bool
@@ -143,22 +156,12 @@ class GameObjectPool
 
     public function getAcquiredGameObjectCount(): int
     {
-        $sum = 0;
-        foreach ($this->acquiredGameObjects as $acquiredGameObjects) {
-            $sum += count($acquiredGameObjects);
-        }
-
-        return $sum;
+        return $this->acquiredGameObjectCount;
     }
 
     public function getReleasedGameObjectCount(): int
     {
-        $sum = 0;
-        foreach ($this->releasedGameObjects as $releasedGameObjects) {
-            $sum += count($releasedGameObjects);
-        }
-
-        return $sum;
+        return $this->releasedGameObjectCount;
     }
 
     public function getStats(): array
@@ -4,33 +4,20 @@ namespace NoiseByNorthwest\TermAsteroids\Engine;
 
 class Input
 {
-    // FIXME support all functional keys
-    private static array $functionalKeyMap = [
-        57399 => '0',
-        57400 => '1',
-        57401 => '2',
-        57402 => '3',
-        57403 => '4',
-        57404 => '5',
-        57405 => '6',
-        57406 => '7',
-        57407 => '8',
-        57408 => '9',
-        57409 => '.',
-        57410 => '/',
-        57411 => '*',
-        57412 => '-',
-        57413 => '+',
-        57415 => '=',
-        57416 => ','
-    ];
+    /**
+     * The maximum number of key events decoded per call to the native side, the other ones being decoded by the next
+     * call
+     */
+    private const EVENT_BUFFER_SIZE = 64;
 
     private static bool $kittyKeyboardProtocolSupported;
 
     /**
-     * @var resource|null
+     * @var \FFI\CData|null see NativeRenderer_createInput()
      */
-    private static $stdin = null;
+    private static ?\FFI\CData $nativeInput = null;
+
+    private static \FFI\CData $nativeEvents;
 
     private static array $lastHitTime = [];
 
@@ -39,10 +26,17 @@ class Input
     public static function init(bool $kittyKeyboardProtocolSupported): void
     {
         self::$kittyKeyboardProtocolSupported = $kittyKeyboardProtocolSupported;
-        self::$stdin = fopen('php://stdin', 'r');
-        assert(self::$stdin !== false);
 
-        stream_set_blocking(self::$stdin, 0);
+        $nativeInput = NativeRenderer::getFfi()->NativeRenderer_createInput(0);
+        if ($nativeInput === null) {
+            throw new \RuntimeException('Cannot read the terminal input');
+        }
+
+        self::$nativeInput = $nativeInput;
+        self::$nativeEvents = NativeRenderer::getFfi()->new(sprintf(
+            'NativeRendererInputEvent[%d]',
+            self::EVENT_BUFFER_SIZE
+        ));
 
         if (self::$kittyKeyboardProtocolSupported) {
             // More details here: https://sw.kovidgoyal.net/kitty/keyboard-protocol/#progressive-enhancement
@@ -52,66 +46,50 @@ class Input
         system('stty cbreak -echo');
     }
 
+    /**
+     * Sleeps for the given duration (in seconds), the input which arrives meanwhile being read so that it is decoded
+     * by the next getEvents() call. Without input (i.e. in headless mode), it is a mere sleep.
+     */
+    public static function wait(float $duration): void
+    {
+        if (
+            self::$nativeInput === null ||
+                ! NativeRenderer::getFfi()->NativeRenderer_waitForInput(self::$nativeInput, $duration)
+        ) {
+            usleep(max(0, (int) ($duration * 1000 * 1000)));
+        }
+    }
+
     /**
      * @return array<InputEvent>
      */
     public static function getEvents(): array
     {
-        assert(self::$stdin !== null);
+        assert(self::$nativeInput !== null);
 
         $currentTime = microtime(true);
 
-        $inputText = fgets(self::$stdin);
-        if ($inputText === false) {
+        $nativeEventCount = NativeRenderer::getFfi()->NativeRenderer_readInputEvents(
+            self::$nativeInput,
+            self::$nativeEvents,
+            self::EVENT_BUFFER_SIZE
+        );
+
+        if ($nativeEventCount === 0) {
             return self::resolveEmulatedReleaseEvents($currentTime);
         }
 
         $events = [];
-        $len = strlen($inputText);
-
-        for ($i = 0; $i < $len; $i++) {
-            if ($inputText[$i] === "\033") {
-                $s = $inputText[$i];
-
-                $i++;
-                assert($inputText[$i] === '[');
-
-                $s .= $inputText[$i];
-                $i++;
-                while ($i < $len) {
-                    $end = false;
-                    if (
-                        $inputText[$i] === '~' || (
-                            $inputText[$i] === 'u' && ctype_digit($inputText[$i - 1])
-                        )
-                    ) {
-                        $end = true;
-                    } elseif ($inputText[$i] === "\033" || ctype_lower($inputText[$i])) {
-                        $i--;
-
-                        break;
-                    }
-
-                    $s .= $inputText[$i];
-                    $i++;
-
-                    if ($end) {
-                        $i--;
-
-                        break;
-                    }
-                }
 
-                $pressedKey = $s;
-            } else {
-                $pressedKey = $inputText[$i];
-            }
+        for ($i = 0; $i < $nativeEventCount; $i++) {
+            $nativeEvent = self::$nativeEvents[$i];
+            $pressedKey = \FFI::string($nativeEvent->key);
 
-            if (preg_match('~\\[(\d+);129:3~', $pressedKey, $m) === 1) {
-                $releasedKeyCode = (int) $m[1];
-                $releasedKey = self::$functionalKeyMap[$releasedKeyCode] ?? chr($releasedKeyCode);
+            if ($nativeEvent->release) {
+                $releasedKey = $pressedKey;
 
-                if (! isset(self::$pressedKeys[$releasedKey])) {
+                // the release of the keys whose release is emulated is ignored
+                if (! isset(self::$pressedKeys[$releasedKey]) || ! self::isReleaseEventSupported($releasedKey)) {
                     continue;
                 }
 
@@ -121,9 +99,6 @@ class Input
                 continue;
             }
 
-            $pressedKey = preg_replace('~\\[1;129:2~', '[', $pressedKey);
-            $pressedKey = preg_replace('~\\[1;129~', '[', $pressedKey);
-
             if (isset(self::$pressedKeys[$pressedKey])) {
                 if (self::isReleaseEventSupported($pressedKey)) {
                     continue;
@@ -30,6 +30,14 @@ class Mat3
         $this->rows = $rows;
     }
 
+    /**
+     * @return array<array<float>>
+     */
+    public function getRows(): array
+    {
+        return $this->rows;
+    }
+
     public function translate(float $x, float $y): self
     {
         $translationMatrix = self::identity();
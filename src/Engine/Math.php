@@ -64,4 +64,19 @@ abstract class Math
     {
         return (int) round($v);
     }
+
+    /**
+     * @param array<int|float> $values
+     * @param float $percentile within [0, 100]
+     * @return float the nearest-rank percentile of the values
+     */
+    public static function percentile(array $values, float $percentile): float
+    {
+        assert(count($values) > 0);
+        assert(0 <= $percentile && $percentile <= 100);
+
+        sort($values);
+
+        return $values[max(0, (int) ceil($percentile / 100 * count($values)) - 1)];
+    }
 }
\ No newline at end of file
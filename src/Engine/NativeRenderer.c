@@ -1,613 +1,5510 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <poll.h>
 #include <main/php.h>
 #include <main/php_output.h>
+#include <ext/standard/php_math.h>
 #include "NativeRenderer.h"
 
+#define NATIVE_RENDERER_INITIAL_OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// upper bound of the bytes emitted for one character cell (cursor move + SGR sequence + glyph)
+#define NATIVE_RENDERER_MAX_CELL_OUTPUT_SIZE 64
+
+#define NATIVE_RENDERER_DECIMAL_TABLE_SIZE 1000
+
+// a run of identical characters is repeated (REP) when it saves more glyph bytes than this,
+// and erased (ECH) when it is made of at least this number of spaces
+#define NATIVE_RENDERER_MIN_REPEATED_RUN_SIZE 8
+#define NATIVE_RENDERER_MIN_ERASED_RUN_LENGTH 12
+
+// until the first frame has been encoded, the bytes per character are assumed to be this
+#define NATIVE_RENDERER_DEFAULT_CHARACTER_OUTPUT_SIZE 24
+
+// the row pairs are shifted left (DCH) by up to this number of columns when it spares redrawing enough characters
+#define NATIVE_RENDERER_MAX_LINE_SHIFT 8
+#define NATIVE_RENDERER_MIN_LINE_SHIFT_GAIN 16
+
+#define NATIVE_RENDERER_MAX_PRESENTATION_BUFFER_COUNT 8
+
+// the text layer extends past the frame by this number of lines, which only hold text (e.g. status lines)
+#define NATIVE_RENDERER_TEXT_STATUS_LINE_COUNT 8
+
+// the graphics output compares the frames by tiles, the changed tiles of a tile row being uploaded by runs
+#define NATIVE_RENDERER_GRAPHICS_TILE_WIDTH 32
+#define NATIVE_RENDERER_GRAPHICS_TILE_HEIGHT 16
+
+// the id of the single image, as it appears in the graphics commands
+#define NATIVE_RENDERER_GRAPHICS_IMAGE_ID "5441"
+#define NATIVE_RENDERER_GRAPHICS_DELETION_COMMAND "\033_Ga=d,d=I,i=" NATIVE_RENDERER_GRAPHICS_IMAGE_ID ",q=2\033\\"
+
+// the terminal unlinks the objects it has read, the other ones are unlinked once this number of newer ones exist
+#define NATIVE_RENDERER_GRAPHICS_MAX_OBJECT_COUNT 1024
+#define NATIVE_RENDERER_GRAPHICS_OBJECT_PATH_SIZE 96
+
+// the base64 bytes per chunk of the direct transmission medium
+#define NATIVE_RENDERER_GRAPHICS_CHUNK_SIZE 4096
+
+// see NativeRenderer_startCapture()
+#define NATIVE_RENDERER_CAPTURE_MAGIC "TADRAWS"
+#define NATIVE_RENDERER_CAPTURE_VERSION 1
+#define NATIVE_RENDERER_CAPTURE_FILE_BUFFER_SIZE (1024 * 1024)
+
+// must match BitmapAtlas::MAGIC and BitmapAtlas::HEADER_SIZE
+#define NATIVE_RENDERER_BITMAP_ATLAS_MAGIC "TAATLAS"
+#define NATIVE_RENDERER_BITMAP_ATLAS_HEADER_SIZE 64
+
+// profiled stages, in the order of NativeRendererProfile's per-stage arrays
+enum {
+    NATIVE_RENDERER_STAGE_CLEAR,
+    NATIVE_RENDERER_STAGE_DRAW,
+    NATIVE_RENDERER_STAGE_PERSISTENCE,
+    NATIVE_RENDERER_STAGE_COLOR_REDUCTION,
+    NATIVE_RENDERER_STAGE_ENCODING,
+    NATIVE_RENDERER_STAGE_OUTPUT,
+    NATIVE_RENDERER_STAGE_COUNT
+};
+
+_Static_assert(
+    sizeof ((NativeRendererProfile *) 0)->lastStageTimes / sizeof (double) == NATIVE_RENDERER_STAGE_COUNT,
+    "NativeRendererProfile must have one slot per stage"
+);
+
+typedef struct {
+    char digits[3];
+    uint8_t length;
+} NativeRendererDecimal;
+
+// decimal representations of 0-999, which covers color channels as well as row / column numbers
+static NativeRendererDecimal NativeRenderer_decimalTable[NATIVE_RENDERER_DECIMAL_TABLE_SIZE];
+
+static void NativeRenderer_initDecimalTable(void)
+{
+    for (size_t i = 0; i < NATIVE_RENDERER_DECIMAL_TABLE_SIZE; i++) {
+        NativeRendererDecimal * decimal = &NativeRenderer_decimalTable[i];
+
+        decimal->length = i >= 100 ? 3 : (i >= 10 ? 2 : 1);
+        for (size_t j = 0, value = i; j < decimal->length; j++, value /= 10) {
+            decimal->digits[decimal->length - 1 - j] = '0' + value % 10;
+        }
+    }
+}
+
+/*
+ * A horizontal band of the screen, made of complete character rows (i.e. of an even number of pixel rows).
+ * With several threads, each band is drawn and updated by its own thread into its own output buffer.
+ */
+typedef struct NativeRendererBand {
+    size_t firstRow;
+    size_t lastRow;
+    size_t drawnBitmapPixelCount;
+    size_t ditheredAwayPixelCount;
+    size_t updatedCharacterCount;
+    size_t deferredCharacterCount;
+    size_t savedByteCount;
+    // the bytes per character of the last encoded frame, used to share the byte budget out
+    double characterOutputSize;
+    // the row where the next frame starts to encode, so that the deferred characters are redrawn in turn
+    size_t roundRobinRow;
+    double stageTimes[NATIVE_RENDERER_STAGE_COUNT];
+    char * outputBuffer;
+    size_t outputBufferSize;
+    size_t outputLength;
+    int outputTruncated;
+    // the first SGR sequence of the output, which is re-encoded when the bands are joined, its foreground color
+    // being -1 when it does not matter (a space)
+    size_t firstSgrOffset;
+    size_t firstSgrLength;
+    int64_t firstSgrUpperColor;
+    int64_t firstSgrLowerColor;
+    // whether the background color has been reset before the first SGR sequence
+    int firstSgrAfterBackgroundReset;
+    // the SGR sequence setting the foreground color first, when the first one did not, also re-encoded
+    size_t foregroundSgrOffset;
+    size_t foregroundSgrLength;
+    int64_t foregroundSgrUpperColor;
+    int64_t foregroundSgrLowerColor;
+    int64_t foregroundSgrLastLowerColor;
+    int64_t lastSgrUpperColor;
+    int64_t lastSgrLowerColor;
+} NativeRendererBand;
+
+typedef struct NativeRendererJob {
+    void (* run)(NativeRenderer * nativeRenderer, NativeRendererBand * band, const struct NativeRendererJob * job);
+    const NativeRendererDrawCommand * commands;
+    size_t commandCount;
+    int64_t trueColorModeEnabled;
+    int64_t persistenceEffectsEnabled;
+    int64_t persistenceAlphaDecrease;
+    int64_t removedColorDepthBits;
+    int64_t lowResolutionMode;
+    int64_t changeThreshold;
+    int64_t outputByteBudget;
+} NativeRendererJob;
+
+typedef struct {
+    NativeRenderer * nativeRenderer;
+    size_t bandIndex;
+    pthread_t thread;
+} NativeRendererWorker;
+
+/*
+ * Persistent worker threads, one per band except the first one which is processed by the calling thread.
+ */
+typedef struct NativeRendererThreadPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t jobStartedCond;
+    pthread_cond_t jobDoneCond;
+    NativeRendererWorker * workers;
+    size_t workerCount;
+    uint64_t jobId;
+    size_t pendingWorkerCount;
+    int stopping;
+    NativeRendererJob job;
+} NativeRendererThreadPool;
+
+static void * NativeRenderer_runWorker(void * arg)
+{
+    const NativeRendererWorker * worker = arg;
+    NativeRendererThreadPool * threadPool = worker->nativeRenderer->threadPool;
+    uint64_t lastJobId = 0;
+
+    pthread_mutex_lock(&threadPool->mutex);
+
+    while (1) {
+        while (! threadPool->stopping && threadPool->jobId == lastJobId) {
+            pthread_cond_wait(&threadPool->jobStartedCond, &threadPool->mutex);
+        }
+
+        if (threadPool->stopping) {
+            break;
+        }
+
+        lastJobId = threadPool->jobId;
+        const NativeRendererJob job = threadPool->job;
+
+        pthread_mutex_unlock(&threadPool->mutex);
+
+        job.run(worker->nativeRenderer, &worker->nativeRenderer->bands[worker->bandIndex], &job);
+
+        pthread_mutex_lock(&threadPool->mutex);
+
+        threadPool->pendingWorkerCount--;
+        if (threadPool->pendingWorkerCount == 0) {
+            pthread_cond_signal(&threadPool->jobDoneCond);
+        }
+    }
+
+    pthread_mutex_unlock(&threadPool->mutex);
+
+    return NULL;
+}
+
+static void NativeRenderer_runJob(NativeRenderer * nativeRenderer, const NativeRendererJob * job)
+{
+    NativeRendererThreadPool * threadPool = nativeRenderer->threadPool;
+
+    if (! threadPool) {
+        job->run(nativeRenderer, &nativeRenderer->bands[0], job);
+
+        return;
+    }
+
+    pthread_mutex_lock(&threadPool->mutex);
+    threadPool->job = *job;
+    threadPool->jobId++;
+    threadPool->pendingWorkerCount = threadPool->workerCount;
+    pthread_cond_broadcast(&threadPool->jobStartedCond);
+    pthread_mutex_unlock(&threadPool->mutex);
+
+    job->run(nativeRenderer, &nativeRenderer->bands[0], job);
+
+    pthread_mutex_lock(&threadPool->mutex);
+    while (threadPool->pendingWorkerCount > 0) {
+        pthread_cond_wait(&threadPool->jobDoneCond, &threadPool->mutex);
+    }
+
+    pthread_mutex_unlock(&threadPool->mutex);
+}
+
+static void NativeRenderer_destroyThreadPool(NativeRenderer * nativeRenderer)
+{
+    NativeRendererThreadPool * threadPool = nativeRenderer->threadPool;
+
+    if (threadPool) {
+        pthread_mutex_lock(&threadPool->mutex);
+        threadPool->stopping = 1;
+        pthread_cond_broadcast(&threadPool->jobStartedCond);
+        pthread_mutex_unlock(&threadPool->mutex);
+
+        for (size_t i = 0; i < threadPool->workerCount; i++) {
+            pthread_join(threadPool->workers[i].thread, NULL);
+        }
+
+        pthread_cond_destroy(&threadPool->jobDoneCond);
+        pthread_cond_destroy(&threadPool->jobStartedCond);
+        pthread_mutex_destroy(&threadPool->mutex);
+        free(threadPool->workers);
+    }
+
+    free(threadPool);
+    nativeRenderer->threadPool = NULL;
+
+    if (nativeRenderer->bands) {
+        for (size_t i = 0; i < nativeRenderer->bandCount; i++) {
+            free(nativeRenderer->bands[i].outputBuffer);
+        }
+    }
+
+    free(nativeRenderer->bands);
+    nativeRenderer->bands = NULL;
+    nativeRenderer->bandCount = 0;
+}
+
+static int NativeRenderer_createThreadPool(NativeRenderer * nativeRenderer, size_t threadCount)
+{
+    const size_t characterRowCount = nativeRenderer->height / 2;
+
+    nativeRenderer->bandCount = threadCount < characterRowCount ? threadCount : characterRowCount;
+    if (nativeRenderer->bandCount == 0) {
+        nativeRenderer->bandCount = 1;
+    }
+
+    nativeRenderer->bands = calloc(nativeRenderer->bandCount, sizeof *nativeRenderer->bands);
+    if (! nativeRenderer->bands) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < nativeRenderer->bandCount; i++) {
+        NativeRendererBand * band = &nativeRenderer->bands[i];
+
+        band->firstRow = 2 * (characterRowCount * i / nativeRenderer->bandCount);
+        band->lastRow = 2 * (characterRowCount * (i + 1) / nativeRenderer->bandCount);
+        band->outputBufferSize = NATIVE_RENDERER_INITIAL_OUTPUT_BUFFER_SIZE / nativeRenderer->bandCount;
+        band->outputBuffer = malloc(band->outputBufferSize);
+        if (! band->outputBuffer) {
+            return 0;
+        }
+    }
+
+    if (nativeRenderer->bandCount == 1) {
+        return 1;
+    }
+
+    NativeRendererThreadPool * threadPool = calloc(1, sizeof *threadPool);
+    if (! threadPool) {
+        return 0;
+    }
+
+    threadPool->workers = calloc(nativeRenderer->bandCount - 1, sizeof *threadPool->workers);
+    if (! threadPool->workers) {
+        free(threadPool);
+
+        return 0;
+    }
+
+    pthread_mutex_init(&threadPool->mutex, NULL);
+    pthread_cond_init(&threadPool->jobStartedCond, NULL);
+    pthread_cond_init(&threadPool->jobDoneCond, NULL);
+
+    nativeRenderer->threadPool = threadPool;
+
+    for (size_t i = 0; i < nativeRenderer->bandCount - 1; i++) {
+        NativeRendererWorker * worker = &threadPool->workers[i];
+
+        worker->nativeRenderer = nativeRenderer;
+        worker->bandIndex = i + 1;
+
+        if (pthread_create(&worker->thread, NULL, NativeRenderer_runWorker, worker) != 0) {
+            return 0;
+        }
+
+        threadPool->workerCount++;
+    }
+
+    return 1;
+}
+
+typedef struct {
+    char * output;
+    size_t outputBufferSize;
+    size_t outputLength;
+    double submissionTime;
+} NativeRendererPresentationBuffer;
+
+/*
+ * Writes the submitted frames to the terminal from a dedicated thread, through a ring of output buffers.
+ * The submitting thread blocks when every buffer is waiting to be written.
+ */
+typedef struct NativeRendererPresenter {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t frameSubmittedCond;
+    pthread_cond_t frameWrittenCond;
+    NativeRendererPresentationBuffer buffers[NATIVE_RENDERER_MAX_PRESENTATION_BUFFER_COUNT];
+    size_t bufferCount;
+    size_t firstQueuedBufferIndex;
+    // the buffer being written is still counted as queued
+    size_t queuedBufferCount;
+    int stopping;
+    size_t queueDepth;
+    double writeLatency;
+} NativeRendererPresenter;
+
+static double NativeRenderer_getTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void NativeRenderer_writeAll(const char * output, size_t outputLength)
+{
+    while (outputLength > 0) {
+        const ssize_t writtenByteCount = write(STDOUT_FILENO, output, outputLength);
+        if (writtenByteCount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // a non-blocking output is full, the terminal has to drain it first
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pollFd = {.fd = STDOUT_FILENO, .events = POLLOUT};
+                if (poll(&pollFd, 1, -1) >= 0 || errno == EINTR) {
+                    continue;
+                }
+            }
+
+            // the terminal is gone, there is nobody left to show the frame to
+            return;
+        }
+
+        output += writtenByteCount;
+        outputLength -= writtenByteCount;
+    }
+}
+
+static void * NativeRenderer_runPresenter(void * arg)
+{
+    NativeRendererPresenter * presenter = arg;
+
+    pthread_mutex_lock(&presenter->mutex);
+
+    while (1) {
+        while (! presenter->stopping && presenter->queuedBufferCount == 0) {
+            pthread_cond_wait(&presenter->frameSubmittedCond, &presenter->mutex);
+        }
+
+        // the queued frames are still written when stopping
+        if (presenter->queuedBufferCount == 0) {
+            break;
+        }
+
+        const NativeRendererPresentationBuffer * buffer = &presenter->buffers[presenter->firstQueuedBufferIndex];
+
+        pthread_mutex_unlock(&presenter->mutex);
+
+        NativeRenderer_writeAll(buffer->output, buffer->outputLength);
+        const double writeLatency = NativeRenderer_getTime() - buffer->submissionTime;
+
+        pthread_mutex_lock(&presenter->mutex);
+
+        presenter->writeLatency = writeLatency;
+        presenter->firstQueuedBufferIndex = (presenter->firstQueuedBufferIndex + 1) % presenter->bufferCount;
+        presenter->queuedBufferCount--;
+        pthread_cond_broadcast(&presenter->frameWrittenCond);
+    }
+
+    pthread_mutex_unlock(&presenter->mutex);
+
+    return NULL;
+}
+
+static void NativeRenderer_destroyPresenter(NativeRenderer * nativeRenderer)
+{
+    NativeRendererPresenter * presenter = nativeRenderer->presenter;
+
+    if (! presenter) {
+        return;
+    }
+
+    pthread_mutex_lock(&presenter->mutex);
+    presenter->stopping = 1;
+    pthread_cond_signal(&presenter->frameSubmittedCond);
+    pthread_mutex_unlock(&presenter->mutex);
+
+    pthread_join(presenter->thread, NULL);
+
+    pthread_cond_destroy(&presenter->frameWrittenCond);
+    pthread_cond_destroy(&presenter->frameSubmittedCond);
+    pthread_mutex_destroy(&presenter->mutex);
+
+    for (size_t i = 0; i < presenter->bufferCount; i++) {
+        free(presenter->buffers[i].output);
+    }
+
+    free(presenter);
+    nativeRenderer->presenter = NULL;
+}
+
+// log-linear buckets of nanoseconds (as HDR histograms do), 8 per power of 2, i.e. a 12.5% precision
+#define NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_BITS 3
+#define NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_COUNT (1 << NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_BITS)
+// values are capped to 2^40ns (~18mn)
+#define NATIVE_RENDERER_HISTOGRAM_MAX_EXPONENT 40
+#define NATIVE_RENDERER_HISTOGRAM_BUCKET_COUNT ( \
+    (NATIVE_RENDERER_HISTOGRAM_MAX_EXPONENT - NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_BITS + 1) \
+        * NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_COUNT \
+)
+
+/*
+ * Frame time histogram of every stage, and the counters reported by NativeRenderer_getProfile().
+ * It is only touched by the calling thread, the bands' stage times being merged when they are joined.
+ */
+typedef struct NativeRendererProfiler {
+    // the stage times of the frame being rendered, recorded by NativeRenderer_update()
+    double frameStageTimes[NATIVE_RENDERER_STAGE_COUNT];
+    double lastStageTimes[NATIVE_RENDERER_STAGE_COUNT];
+    double maxStageTimes[NATIVE_RENDERER_STAGE_COUNT];
+    uint32_t histograms[NATIVE_RENDERER_STAGE_COUNT][NATIVE_RENDERER_HISTOGRAM_BUCKET_COUNT];
+    uint64_t frameCount;
+    uint64_t blendedPixelCount;
+    uint64_t ditheredAwayPixelCount;
+    uint64_t changedCharacterCount;
+    uint64_t emittedByteCount;
+    uint64_t savedByteCount;
+    uint64_t deferredCharacterCount;
+    uint64_t flushCount;
+} NativeRendererProfiler;
+
+static inline void NativeRenderer_addStageTime(NativeRenderer * nativeRenderer, int stage, double startTime)
+{
+    nativeRenderer->profiler->frameStageTimes[stage] += NativeRenderer_getTime() - startTime;
+}
+
+static size_t NativeRenderer_getHistogramBucketIndex(uint64_t value)
+{
+    if (value < NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_COUNT) {
+        return value;
+    }
+
+    const uint64_t maxValue = ((uint64_t) 1 << NATIVE_RENDERER_HISTOGRAM_MAX_EXPONENT) - 1;
+    if (value > maxValue) {
+        value = maxValue;
+    }
+
+    const int exponent = 63 - __builtin_clzll(value);
+    const int shift = exponent - NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_BITS;
+
+    return (shift + 1) * NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_COUNT
+        + ((value >> shift) & (NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_COUNT - 1));
+}
+
+// the middle of the bucket's range, in nanoseconds
+static double NativeRenderer_getHistogramBucketValue(size_t bucketIndex)
+{
+    if (bucketIndex < NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_COUNT) {
+        return bucketIndex;
+    }
+
+    const int shift = bucketIndex / NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_COUNT - 1;
+    const uint64_t subBucket = bucketIndex % NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_COUNT;
+    const uint64_t lowerBound = (NATIVE_RENDERER_HISTOGRAM_SUB_BUCKET_COUNT + subBucket) << shift;
+
+    return lowerBound + ((uint64_t) 1 << shift) / 2.0;
+}
+
+static double NativeRenderer_getHistogramPercentile(const uint32_t * histogram, uint64_t valueCount, double percentile)
+{
+    if (valueCount == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) ceil(percentile / 100 * valueCount);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t cumulatedValueCount = 0;
+    for (size_t i = 0; i < NATIVE_RENDERER_HISTOGRAM_BUCKET_COUNT; i++) {
+        cumulatedValueCount += histogram[i];
+        if (cumulatedValueCount >= rank) {
+            return NativeRenderer_getHistogramBucketValue(i) / 1e9;
+        }
+    }
+
+    return NativeRenderer_getHistogramBucketValue(NATIVE_RENDERER_HISTOGRAM_BUCKET_COUNT - 1) / 1e9;
+}
+
+static void NativeRenderer_recordProfiledFrame(NativeRenderer * nativeRenderer)
+{
+    NativeRendererProfiler * profiler = nativeRenderer->profiler;
+
+    for (size_t i = 0; i < NATIVE_RENDERER_STAGE_COUNT; i++) {
+        const double stageTime = profiler->frameStageTimes[i];
+
+        profiler->histograms[i][NativeRenderer_getHistogramBucketIndex((uint64_t) (stageTime * 1e9))]++;
+        profiler->lastStageTimes[i] = stageTime;
+        if (stageTime > profiler->maxStageTimes[i]) {
+            profiler->maxStageTimes[i] = stageTime;
+        }
+
+        profiler->frameStageTimes[i] = 0;
+    }
+
+    profiler->frameCount++;
+}
+
+/*
+ * Damaged areas, tracked per row as masks of column chunks (1 bit per 64th of the width), out of which the frame
+ * buffers hold the clear color and the persistence buffer is transparent. Each row is only touched by the band
+ * which owns it.
+ */
+typedef struct NativeRendererDamage {
+    size_t chunkWidth;
+    uint32_t clearColor;
+    // where the current frame buffer may differ from the clear color
+    uint64_t * currentRowMasks;
+    // where the previous frame buffer may differ from the clear color
+    uint64_t * previousRowMasks;
+    // where the persistence buffer may not be transparent
+    uint64_t * persistenceRowMasks;
+} NativeRendererDamage;
+
+static NativeRendererDamage * NativeRenderer_createDamage(size_t width, size_t height)
+{
+    NativeRendererDamage * damage = calloc(1, sizeof *damage);
+    if (! damage) {
+        return NULL;
+    }
+
+    damage->chunkWidth = (width + 63) / 64;
+    damage->currentRowMasks = calloc(height, sizeof(uint64_t));
+    damage->previousRowMasks = calloc(height, sizeof(uint64_t));
+    damage->persistenceRowMasks = calloc(height, sizeof(uint64_t));
+
+    if (! damage->currentRowMasks || ! damage->previousRowMasks || ! damage->persistenceRowMasks) {
+        free(damage->currentRowMasks);
+        free(damage->previousRowMasks);
+        free(damage->persistenceRowMasks);
+        free(damage);
+
+        return NULL;
+    }
+
+    return damage;
+}
+
+static void NativeRenderer_destroyDamage(NativeRenderer * nativeRenderer)
+{
+    NativeRendererDamage * damage = nativeRenderer->damage;
+    if (! damage) {
+        return;
+    }
+
+    free(damage->currentRowMasks);
+    free(damage->previousRowMasks);
+    free(damage->persistenceRowMasks);
+    free(damage);
+    nativeRenderer->damage = NULL;
+}
+
+// the chunks overlapped by [firstColumn, lastColumn), which must be within the screen
+static inline uint64_t NativeRenderer_getDamageMask(const NativeRendererDamage * damage, size_t firstColumn, size_t lastColumn)
+{
+    if (firstColumn >= lastColumn) {
+        return 0;
+    }
+
+    const size_t firstChunk = firstColumn / damage->chunkWidth;
+    const size_t lastChunk = (lastColumn - 1) / damage->chunkWidth;
+
+    return (lastChunk == 63 ? ~(uint64_t) 0 : ((uint64_t) 1 << (lastChunk + 1)) - 1) & ~(((uint64_t) 1 << firstChunk) - 1);
+}
+
+/*
+ * Pops the first run of consecutive chunks from the mask and gives its columns,
+ * returns 0 once the mask is empty.
+ */
+static inline int NativeRenderer_popDamagedColumns(
+    NativeRenderer * nativeRenderer,
+    uint64_t * mask,
+    size_t * firstColumn,
+    size_t * lastColumn
+) {
+    if (*mask == 0) {
+        return 0;
+    }
+
+    const size_t chunkWidth = nativeRenderer->damage->chunkWidth;
+    const int firstChunk = __builtin_ctzll(*mask);
+    const uint64_t undamagedChunks = ~(*mask >> firstChunk);
+    const int chunkCount = undamagedChunks ? __builtin_ctzll(undamagedChunks) : 64 - firstChunk;
+
+    *mask &= chunkCount == 64 ? 0 : ~((((uint64_t) 1 << chunkCount) - 1) << firstChunk);
+    *firstColumn = firstChunk * chunkWidth;
+    *lastColumn = (firstChunk + chunkCount) * chunkWidth;
+    if (*lastColumn > nativeRenderer->width) {
+        *lastColumn = nativeRenderer->width;
+    }
+
+    return 1;
+}
+
+/*
+ * Color quantization lookup tables, so that mapping a color to the 256-color palette or reducing its depth only
+ * costs a few loads per pixel.
+ */
+typedef struct NativeRendererQuantizer {
+    // the color cube level (0 to 5) of each channel value
+    uint8_t cubeLevels[256];
+    // the palette index of each gray, out of the color cube's grays and the gray ramp's ones
+    uint8_t grayColorTableIndexes[256];
+    // the settings the reduction tables have been built for
+    int64_t removedColorDepthBits;
+    int64_t orderedDitheringEnabled;
+    // the reduced value of each channel value, per cell of the 4x4 ordered dithering matrix
+    uint8_t reducedChannels[16][256];
+} NativeRendererQuantizer;
+
+static const uint8_t NATIVE_RENDERER_ORDERED_DITHERING_MATRIX[16] = {
+    0, 8, 2, 10,
+    12, 4, 14, 6,
+    3, 11, 1, 9,
+    15, 7, 13, 5,
+};
+
+static NativeRendererQuantizer * NativeRenderer_createQuantizer(void)
+{
+    NativeRendererQuantizer * quantizer = calloc(1, sizeof *quantizer);
+    if (! quantizer) {
+        return NULL;
+    }
+
+    const double fullBrightnessReciprocal = 1 / 255.0;
+    const double brightnessBoost = 0.3;
+
+    for (int i = 0; i < 256; i++) {
+        quantizer->cubeLevels[i] = (uint8_t) round(brightnessBoost + 5 * i * fullBrightnessReciprocal);
+    }
+
+    // the brightness boost of the cube levels, in channel values (a level spanning 255 / 5 of them), so that the
+    // ramp's grays are as bright as the cube's ones
+    const int grayBrightnessBoost = (int) round(brightnessBoost * 255 / 5);
+
+    for (int i = 0; i < 256; i++) {
+        // the gray ramp goes from 8 to 238 by steps of 10, the cube's grays are 0 then 95 to 255 by steps of 40
+        const int target = i + grayBrightnessBoost < 255 ? i + grayBrightnessBoost : 255;
+        const int level = quantizer->cubeLevels[i];
+        const int cubeGray = level ? 55 + 40 * level : 0;
+        const int rampStep = (target - 3) / 10 < 23 ? (target - 3) / 10 : 23;
+        const int rampGray = 8 + 10 * rampStep;
+
+        // black stays black
+        quantizer->grayColorTableIndexes[i] = i > 0 && abs(rampGray - target) < abs(cubeGray - target)
+            ? 232 + rampStep
+            : 16 + 43 * level;
+    }
+
+    quantizer->removedColorDepthBits = -1;
+
+    return quantizer;
+}
+
+static void NativeRenderer_destroyQuantizer(NativeRenderer * nativeRenderer)
+{
+    free(nativeRenderer->quantizer);
+    nativeRenderer->quantizer = NULL;
+}
+
+static void NativeRenderer_prepareQuantizer(
+    NativeRendererQuantizer * quantizer,
+    int64_t removedColorDepthBits,
+    int64_t orderedDitheringEnabled
+) {
+    if (
+        quantizer->removedColorDepthBits == removedColorDepthBits &&
+        quantizer->orderedDitheringEnabled == orderedDitheringEnabled
+    ) {
+        return;
+    }
+
+    quantizer->removedColorDepthBits = removedColorDepthBits;
+    quantizer->orderedDitheringEnabled = orderedDitheringEnabled;
+
+    if (removedColorDepthBits == 0) {
+        return;
+    }
+
+    const int colorReductionCorrectionMask = 1 << (removedColorDepthBits - 1);
+
+    for (int cell = 0; cell < 16; cell++) {
+        // the offset spreads the values over the reduced levels, within one level step
+        const int offset = orderedDitheringEnabled
+            ? (NATIVE_RENDERER_ORDERED_DITHERING_MATRIX[cell] << removedColorDepthBits) >> 4
+            : 0;
+
+        for (int i = 0; i < 256; i++) {
+            const int value = i + offset < 255 ? i + offset : 255;
+
+            quantizer->reducedChannels[cell][i] =
+                ((value >> removedColorDepthBits) << removedColorDepthBits) | colorReductionCorrectionMask;
+        }
+    }
+}
+
+/*
+ * Text layer: character cells drawn over the frame, each one being an ASCII glyph and its colors, and diffed against
+ * what the terminal shows as the pixels are. Its lines are the terminal ones, the first line past the frame being
+ * height / 2, and its columns are the pixel ones. The cells of a line are only touched by the band which owns it.
+ */
+typedef struct NativeRendererText {
+    size_t lineCount;
+    // the cells drawn for the frame being rendered and the ones shown by the terminal, as encoded by
+    // NativeRenderer_getTextCell(), 0 meaning no text
+    uint64_t * currentCells;
+    uint64_t * previousCells;
+    // whether a line may hold text, so that the lines without any are skipped
+    uint8_t * currentLineFlags;
+    uint8_t * previousLineFlags;
+    char * lineOutput;
+} NativeRendererText;
+
+static NativeRendererText * NativeRenderer_createText(size_t width, size_t height)
+{
+    NativeRendererText * text = calloc(1, sizeof *text);
+    if (! text) {
+        return NULL;
+    }
+
+    text->lineCount = height / 2 + NATIVE_RENDERER_TEXT_STATUS_LINE_COUNT;
+    text->currentCells = calloc(text->lineCount * width, sizeof(uint64_t));
+    text->previousCells = calloc(text->lineCount * width, sizeof(uint64_t));
+    text->currentLineFlags = calloc(text->lineCount, 1);
+    text->previousLineFlags = calloc(text->lineCount, 1);
+    text->lineOutput = malloc(width * NATIVE_RENDERER_MAX_CELL_OUTPUT_SIZE);
+
+    if (
+        ! text->currentCells ||
+        ! text->previousCells ||
+        ! text->currentLineFlags ||
+        ! text->previousLineFlags ||
+        ! text->lineOutput
+    ) {
+        free(text->currentCells);
+        free(text->previousCells);
+        free(text->currentLineFlags);
+        free(text->previousLineFlags);
+        free(text->lineOutput);
+        free(text);
+
+        return NULL;
+    }
+
+    return text;
+}
+
+static void NativeRenderer_destroyText(NativeRenderer * nativeRenderer)
+{
+    NativeRendererText * text = nativeRenderer->text;
+    if (! text) {
+        return;
+    }
+
+    free(text->currentCells);
+    free(text->previousCells);
+    free(text->currentLineFlags);
+    free(text->previousLineFlags);
+    free(text->lineOutput);
+    free(text);
+    nativeRenderer->text = NULL;
+}
+
+static inline uint64_t NativeRenderer_getTextCell(char glyph, uint32_t color, uint32_t backgroundColor)
+{
+    // the control characters and the non-ASCII bytes would not take exactly one cell
+    const uint8_t printableGlyph = glyph >= 0x20 && glyph < 0x7f ? glyph : '?';
+
+    return ((uint64_t) printableGlyph << 48) | ((uint64_t) (color & 0xffffff) << 24) | (backgroundColor & 0xffffff);
+}
+
+/*
+ * Kitty graphics protocol output, which replaces the character cells with an image of the frame buffer.
+ * Except with the direct medium, the pixels are written straight into a shared memory object or a temporary file,
+ * whose name is the only payload of the graphics command.
+ */
+enum {
+    NATIVE_RENDERER_GRAPHICS_MEDIUM_NONE,
+    NATIVE_RENDERER_GRAPHICS_MEDIUM_SHARED_MEMORY,
+    NATIVE_RENDERER_GRAPHICS_MEDIUM_TEMPORARY_FILE,
+    NATIVE_RENDERER_GRAPHICS_MEDIUM_DIRECT,
+};
+
+typedef struct NativeRendererGraphics {
+    int64_t medium;
+    // whether the image is displayed, in which case the frames only upload their changed tiles
+    int imageTransmitted;
+    // the changed tiles of the tile row being compared
+    uint8_t * changedTiles;
+    size_t tileColumnCount;
+    // the RGB pixels of the direct medium
+    uint8_t * pixels;
+    size_t pixelsSize;
+    char * output;
+    size_t outputSize;
+    size_t outputLength;
+    size_t uploadedPixelCount;
+    uint64_t objectSerial;
+    // ring of the created objects, the oldest one being unlinked when it is overwritten
+    char (* objectPaths)[NATIVE_RENDERER_GRAPHICS_OBJECT_PATH_SIZE];
+    size_t objectCount;
+} NativeRendererGraphics;
+
+static void NativeRenderer_destroyGraphics(NativeRenderer * nativeRenderer)
+{
+    NativeRendererGraphics * graphics = nativeRenderer->graphics;
+    if (! graphics) {
+        return;
+    }
+
+    if (graphics->objectPaths) {
+        const size_t objectCount = graphics->objectCount < NATIVE_RENDERER_GRAPHICS_MAX_OBJECT_COUNT
+            ? graphics->objectCount
+            : NATIVE_RENDERER_GRAPHICS_MAX_OBJECT_COUNT;
+
+        // the objects which have been read by the terminal are already gone
+        for (size_t i = 0; i < objectCount; i++) {
+            unlink(graphics->objectPaths[i]);
+        }
+    }
+
+    free(graphics->changedTiles);
+    free(graphics->pixels);
+    free(graphics->output);
+    free(graphics->objectPaths);
+    free(graphics);
+    nativeRenderer->graphics = NULL;
+}
+
+/*
+ * Creates an object of the given size in the medium's directory and maps it, its path being stored in path.
+ * The object is tracked (see NativeRendererGraphics::objectPaths) even if it cannot be mapped.
+ */
+static uint8_t * NativeRenderer_createGraphicsObject(NativeRendererGraphics * graphics, size_t size, char * path)
+{
+    // shm_open() is a thin wrapper around /dev/shm, which spares linking librt on older glibc versions
+    snprintf(
+        path,
+        NATIVE_RENDERER_GRAPHICS_OBJECT_PATH_SIZE,
+        // the terminal only deletes the temporary files whose name contains "tty-graphics-protocol"
+        "%s/tty-graphics-protocol-term-asteroids-%d-%llu",
+        graphics->medium == NATIVE_RENDERER_GRAPHICS_MEDIUM_SHARED_MEMORY ? "/dev/shm" : "/tmp",
+        (int) getpid(),
+        (unsigned long long) graphics->objectSerial++
+    );
+
+    // readable by the terminal, which may run as another user (e.g. outside of a container)
+    const int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    char * trackedPath = graphics->objectPaths[graphics->objectCount++ % NATIVE_RENDERER_GRAPHICS_MAX_OBJECT_COUNT];
+    if (graphics->objectCount > NATIVE_RENDERER_GRAPHICS_MAX_OBJECT_COUNT) {
+        unlink(trackedPath);
+    }
+
+    memcpy(trackedPath, path, NATIVE_RENDERER_GRAPHICS_OBJECT_PATH_SIZE);
+
+    void * data = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    close(fd);
+
+    return data != MAP_FAILED ? data : NULL;
+}
+
+static NativeRendererGraphics * NativeRenderer_createGraphics(NativeRenderer * nativeRenderer, int64_t medium)
+{
+    NativeRendererGraphics * graphics = calloc(1, sizeof *graphics);
+    if (! graphics) {
+        return NULL;
+    }
+
+    graphics->medium = medium;
+    graphics->tileColumnCount = (nativeRenderer->width + NATIVE_RENDERER_GRAPHICS_TILE_WIDTH - 1) / NATIVE_RENDERER_GRAPHICS_TILE_WIDTH;
+    graphics->changedTiles = malloc(graphics->tileColumnCount);
+    graphics->outputSize = NATIVE_RENDERER_INITIAL_OUTPUT_BUFFER_SIZE;
+    graphics->output = malloc(graphics->outputSize);
+    graphics->objectPaths = malloc(NATIVE_RENDERER_GRAPHICS_MAX_OBJECT_COUNT * sizeof *graphics->objectPaths);
+
+    if (! graphics->changedTiles || ! graphics->output || ! graphics->objectPaths) {
+        goto error;
+    }
+
+    if (medium != NATIVE_RENDERER_GRAPHICS_MEDIUM_DIRECT) {
+        // the medium is probed with a pixel-sized object
+        char path[NATIVE_RENDERER_GRAPHICS_OBJECT_PATH_SIZE];
+        uint8_t * data = NativeRenderer_createGraphicsObject(graphics, 3, path);
+        if (! data) {
+            goto error;
+        }
+
+        munmap(data, 3);
+        unlink(path);
+    }
+
+    return graphics;
+
+    error:
+        nativeRenderer->graphics = graphics;
+        NativeRenderer_destroyGraphics(nativeRenderer);
+
+        return NULL;
+}
+
+/*
+ * Draw stream capture: the renderer calls of every frame, recorded into a file so that they can be replayed without
+ * the game (see NativeRendererReplay.c). The file starts with a NativeRendererCaptureHeader, followed by records, each
+ * one being a NativeRendererCaptureRecord and its payload, padded to 8 bytes so that a mapped file can be read in
+ * place. The bitmaps are written once, before the first draw which uses them, and then referenced by their index.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t padding;
+} NativeRendererCaptureHeader;
+
+enum {
+    // NativeRendererCapturedBitmap then the pixels
+    NATIVE_RENDERER_CAPTURE_BITMAP = 1,
+    // no payload
+    NATIVE_RENDERER_CAPTURE_RESET,
+    // NativeRendererCapturedClear
+    NATIVE_RENDERER_CAPTURE_CLEAR,
+    // NativeRendererCapturedDraw then the per-column / per-row arrays it has
+    NATIVE_RENDERER_CAPTURE_DRAW,
+    // NativeRendererCapturedRect
+    NATIVE_RENDERER_CAPTURE_RECT,
+    // no payload
+    NATIVE_RENDERER_CAPTURE_CLEAR_TEXT,
+    // NativeRendererCapturedText then the characters
+    NATIVE_RENDERER_CAPTURE_TEXT,
+    // NativeRendererCapturedUpdate, it ends the frame
+    NATIVE_RENDERER_CAPTURE_UPDATE,
+};
+
+typedef struct {
+    uint32_t type;
+    // the size of the padded payload
+    uint32_t size;
+} NativeRendererCaptureRecord;
+
+typedef struct {
+    uint32_t index;
+    uint32_t width;
+    uint32_t height;
+    uint32_t padding;
+} NativeRendererCapturedBitmap;
+
+typedef struct {
+    uint32_t color;
+    uint32_t padding;
+} NativeRendererCapturedClear;
+
+// the arrays follow the draw in this order, when their flag is set
+enum {
+    NATIVE_RENDERER_CAPTURED_VERTICAL_BLENDING_COLORS = 1,
+    NATIVE_RENDERER_CAPTURED_HORIZONTAL_DISTORTION_OFFSETS = 2,
+    NATIVE_RENDERER_CAPTURED_HORIZONTAL_BACKGROUND_DISTORTION_OFFSETS = 4,
+};
+
+typedef struct {
+    uint32_t bitmapIndex;
+    uint32_t arrayFlags;
+    int64_t x;
+    int64_t y;
+    int64_t globalAlpha;
+    int64_t globalBlendingColor;
+    int64_t persisted;
+    int64_t globalPersistedColor;
+    int64_t bilinearFilteringEnabled;
+    double rotationAngle;
+    float brightness;
+    float ditheringAlphaRatioThreshold;
+} NativeRendererCapturedDraw;
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    int64_t x;
+    int64_t y;
+    uint32_t color;
+    uint32_t padding;
+} NativeRendererCapturedRect;
+
+typedef struct {
+    uint32_t line;
+    uint32_t column;
+    uint32_t length;
+    uint32_t color;
+    uint32_t backgroundColor;
+    uint32_t padding;
+} NativeRendererCapturedText;
+
+typedef struct {
+    int64_t trueColorModeEnabled;
+    int64_t persistenceEffectsEnabled;
+    int64_t persistenceAlphaDecrease;
+    int64_t removedColorDepthBits;
+    int64_t lowResolutionMode;
+    int64_t orderedDitheringEnabled;
+    int64_t changeThreshold;
+    int64_t outputByteBudget;
+} NativeRendererCapturedUpdate;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t width;
+    uint32_t height;
+    uint32_t index;
+    uint32_t used;
+} NativeRendererCaptureBitmapEntry;
+
+typedef struct NativeRendererCapture {
+    FILE * file;
+    char * fileBuffer;
+    // the written bitmaps per content hash, with open addressing, so that a bitmap freed then reallocated with other
+    // pixels is not mistaken for the previous one
+    NativeRendererCaptureBitmapEntry * bitmaps;
+    size_t bitmapCapacity;
+    size_t bitmapCount;
+    int failed;
+} NativeRendererCapture;
+
+static void NativeRenderer_writeCapture(NativeRendererCapture * capture, const void * data, size_t size)
+{
+    if (! capture->failed && size > 0 && fwrite(data, size, 1, capture->file) != 1) {
+        capture->failed = 1;
+    }
+}
+
+/*
+ * Writes the header of a record whose payload, of the given size, is written next then ended with
+ * NativeRenderer_endCaptureRecord().
+ */
+static void NativeRenderer_beginCaptureRecord(NativeRendererCapture * capture, uint32_t type, size_t size)
+{
+    const NativeRendererCaptureRecord record = { .type = type, .size = (size + 7) & ~(size_t) 7 };
+
+    NativeRenderer_writeCapture(capture, &record, sizeof record);
+}
+
+static void NativeRenderer_endCaptureRecord(NativeRendererCapture * capture, size_t size)
+{
+    static const char padding[8] = { 0 };
+
+    NativeRenderer_writeCapture(capture, padding, ((size + 7) & ~(size_t) 7) - size);
+}
+
+static void NativeRenderer_writeCaptureRecord(
+    NativeRendererCapture * capture,
+    uint32_t type,
+    const void * payload,
+    size_t payloadSize
+) {
+    NativeRenderer_beginCaptureRecord(capture, type, payloadSize);
+    NativeRenderer_writeCapture(capture, payload, payloadSize);
+    NativeRenderer_endCaptureRecord(capture, payloadSize);
+}
+
+/*
+ * Returns the index of the given bitmap, which is written if it has not been yet, or -1 if the table cannot grow.
+ */
+static int64_t NativeRenderer_captureBitmap(
+    NativeRendererCapture * capture,
+    const uint32_t * pixels,
+    size_t width,
+    size_t height
+) {
+    if (2 * (capture->bitmapCount + 1) > capture->bitmapCapacity) {
+        const size_t capacity = capture->bitmapCapacity ? 2 * capture->bitmapCapacity : 1024;
+        NativeRendererCaptureBitmapEntry * bitmaps = calloc(capacity, sizeof *bitmaps);
+        if (! bitmaps) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < capture->bitmapCapacity; i++) {
+            if (capture->bitmaps[i].used) {
+                size_t j = capture->bitmaps[i].hash & (capacity - 1);
+                while (bitmaps[j].used) {
+                    j = (j + 1) & (capacity - 1);
+                }
+
+                bitmaps[j] = capture->bitmaps[i];
+            }
+        }
+
+        free(capture->bitmaps);
+        capture->bitmaps = bitmaps;
+        capture->bitmapCapacity = capacity;
+    }
+
+    // FNV-1a over the pixels, seeded with the size
+    uint64_t hash = 0xcbf29ce484222325ULL ^ (width << 32 | height);
+    for (size_t i = 0; i < width * height; i++) {
+        hash = (hash ^ pixels[i]) * 0x100000001b3ULL;
+    }
+
+    size_t i = hash & (capture->bitmapCapacity - 1);
+    for (; capture->bitmaps[i].used; i = (i + 1) & (capture->bitmapCapacity - 1)) {
+        const NativeRendererCaptureBitmapEntry * entry = &capture->bitmaps[i];
+        if (entry->hash == hash && entry->width == width && entry->height == height) {
+            return entry->index;
+        }
+    }
+
+    capture->bitmaps[i] = (NativeRendererCaptureBitmapEntry) {
+        .hash = hash,
+        .width = width,
+        .height = height,
+        .index = capture->bitmapCount++,
+        .used = 1,
+    };
+
+    const NativeRendererCapturedBitmap bitmap = {
+        .index = capture->bitmaps[i].index,
+        .width = width,
+        .height = height,
+    };
+
+    const size_t pixelsSize = width * height * sizeof(uint32_t);
+
+    NativeRenderer_beginCaptureRecord(capture, NATIVE_RENDERER_CAPTURE_BITMAP, sizeof bitmap + pixelsSize);
+    NativeRenderer_writeCapture(capture, &bitmap, sizeof bitmap);
+    NativeRenderer_writeCapture(capture, pixels, pixelsSize);
+    NativeRenderer_endCaptureRecord(capture, sizeof bitmap + pixelsSize);
+
+    return bitmap.index;
+}
+
+static void NativeRenderer_captureDraw(NativeRendererCapture * capture, const NativeRendererDrawCommand * command)
+{
+    const int64_t bitmapIndex = NativeRenderer_captureBitmap(
+        capture,
+        command->bitmapPixels,
+        command->bitmapWidth,
+        command->bitmapHeight
+    );
+
+    if (bitmapIndex < 0) {
+        capture->failed = 1;
+
+        return;
+    }
+
+    const NativeRendererCapturedDraw draw = {
+        .bitmapIndex = bitmapIndex,
+        .arrayFlags = (command->verticalBlendingColors ? NATIVE_RENDERER_CAPTURED_VERTICAL_BLENDING_COLORS : 0)
+            | (command->horizontalDistortionOffsets ? NATIVE_RENDERER_CAPTURED_HORIZONTAL_DISTORTION_OFFSETS : 0)
+            | (
+                command->horizontalBackgroundDistortionOffsets
+                    ? NATIVE_RENDERER_CAPTURED_HORIZONTAL_BACKGROUND_DISTORTION_OFFSETS
+                    : 0
+            ),
+        .x = command->x,
+        .y = command->y,
+        .globalAlpha = command->globalAlpha,
+        .globalBlendingColor = command->globalBlendingColor,
+        .persisted = command->persisted,
+        .globalPersistedColor = command->globalPersistedColor,
+        .bilinearFilteringEnabled = command->bilinearFilteringEnabled,
+        .rotationAngle = command->rotationAngle,
+        .brightness = command->brightness,
+        .ditheringAlphaRatioThreshold = command->ditheringAlphaRatioThreshold,
+    };
+
+    const size_t columnArraySize = command->bitmapWidth * sizeof(int64_t);
+    const size_t rowArraySize = command->bitmapHeight * sizeof(int64_t);
+    const size_t arraysSize = (command->verticalBlendingColors ? columnArraySize : 0)
+        + (command->horizontalDistortionOffsets ? rowArraySize : 0)
+        + (command->horizontalBackgroundDistortionOffsets ? rowArraySize : 0);
+
+    NativeRenderer_beginCaptureRecord(capture, NATIVE_RENDERER_CAPTURE_DRAW, sizeof draw + arraysSize);
+    NativeRenderer_writeCapture(capture, &draw, sizeof draw);
+
+    if (command->verticalBlendingColors) {
+        NativeRenderer_writeCapture(capture, command->verticalBlendingColors, columnArraySize);
+    }
+
+    if (command->horizontalDistortionOffsets) {
+        NativeRenderer_writeCapture(capture, command->horizontalDistortionOffsets, rowArraySize);
+    }
+
+    if (command->horizontalBackgroundDistortionOffsets) {
+        NativeRenderer_writeCapture(capture, command->horizontalBackgroundDistortionOffsets, rowArraySize);
+    }
+
+    NativeRenderer_endCaptureRecord(capture, sizeof draw + arraysSize);
+}
+
+int64_t NativeRenderer_startCapture(NativeRenderer * nativeRenderer, const char * fileName)
+{
+    NativeRenderer_stopCapture(nativeRenderer);
+
+    NativeRendererCapture * capture = calloc(1, sizeof *capture);
+    if (! capture) {
+        goto error;
+    }
+
+    capture->file = fopen(fileName, "wb");
+    capture->fileBuffer = malloc(NATIVE_RENDERER_CAPTURE_FILE_BUFFER_SIZE);
+    if (! capture->file || ! capture->fileBuffer) {
+        goto error;
+    }
+
+    setvbuf(capture->file, capture->fileBuffer, _IOFBF, NATIVE_RENDERER_CAPTURE_FILE_BUFFER_SIZE);
+
+    NativeRendererCaptureHeader header = {
+        .version = NATIVE_RENDERER_CAPTURE_VERSION,
+        .width = nativeRenderer->width,
+        .height = nativeRenderer->height,
+    };
+
+    memcpy(header.magic, NATIVE_RENDERER_CAPTURE_MAGIC, sizeof header.magic);
+    NativeRenderer_writeCapture(capture, &header, sizeof header);
+
+    if (capture->failed) {
+        goto error;
+    }
+
+    nativeRenderer->capture = capture;
+
+    return 1;
+
+    error:
+        if (capture && capture->file) {
+            fclose(capture->file);
+        }
+
+        if (capture) {
+            free(capture->fileBuffer);
+        }
+
+        free(capture);
+
+        return 0;
+}
+
+int64_t NativeRenderer_stopCapture(NativeRenderer * nativeRenderer)
+{
+    NativeRendererCapture * capture = nativeRenderer->capture;
+    if (! capture) {
+        return 1;
+    }
+
+    const int64_t succeeded = fclose(capture->file) == 0 && ! capture->failed;
+
+    free(capture->fileBuffer);
+    free(capture->bitmaps);
+    free(capture);
+    nativeRenderer->capture = NULL;
+
+    return succeeded;
+}
+
 NativeRenderer * NativeRenderer_create(size_t width, size_t height)
 {
-    NativeRenderer * nativeRenderer = malloc(sizeof *nativeRenderer);
-    if (! nativeRenderer) {
-        goto error;
+    NativeRenderer * nativeRenderer = calloc(1, sizeof *nativeRenderer);
+    if (! nativeRenderer) {
+        goto error;
+    }
+
+    nativeRenderer->width = width;
+    nativeRenderer->height = height;
+    nativeRenderer->pixelCount = nativeRenderer->width * nativeRenderer->height;
+
+    nativeRenderer->currentFrameBuffer = malloc(nativeRenderer->pixelCount * sizeof(uint32_t));
+    nativeRenderer->previousFrameBuffer = malloc(nativeRenderer->pixelCount * sizeof(uint32_t));
+    nativeRenderer->persistenceBuffer = malloc(nativeRenderer->pixelCount * sizeof(uint32_t));
+
+    nativeRenderer->drawnBitmapPixelCount = 0;
+    nativeRenderer->outputByteCount = 0;
+
+    if (
+        ! nativeRenderer->currentFrameBuffer ||
+        ! nativeRenderer->previousFrameBuffer ||
+        ! nativeRenderer->persistenceBuffer ||
+        ! (nativeRenderer->profiler = calloc(1, sizeof *nativeRenderer->profiler)) ||
+        ! (nativeRenderer->damage = NativeRenderer_createDamage(width, height)) ||
+        ! (nativeRenderer->quantizer = NativeRenderer_createQuantizer()) ||
+        ! (nativeRenderer->text = NativeRenderer_createText(width, height)) ||
+        ! NativeRenderer_createThreadPool(nativeRenderer, 1)
+    ) {
+        goto error;
+    }
+
+    NativeRenderer_initDecimalTable();
+
+    NativeRenderer_reset(nativeRenderer);
+
+    return nativeRenderer;
+
+    error:
+        NativeRenderer_destroy(nativeRenderer);
+
+        return NULL;
+}
+
+void NativeRenderer_destroy(NativeRenderer * nativeRenderer)
+{
+    if (nativeRenderer) {
+        NativeRenderer_destroyPresenter(nativeRenderer);
+        NativeRenderer_destroyThreadPool(nativeRenderer);
+        free(nativeRenderer->currentFrameBuffer);
+        free(nativeRenderer->previousFrameBuffer);
+        free(nativeRenderer->persistenceBuffer);
+        free(nativeRenderer->profiler);
+        NativeRenderer_destroyDamage(nativeRenderer);
+        NativeRenderer_destroyQuantizer(nativeRenderer);
+        NativeRenderer_destroyGraphics(nativeRenderer);
+        NativeRenderer_destroyText(nativeRenderer);
+        NativeRenderer_stopCapture(nativeRenderer);
+    }
+
+    free(nativeRenderer);
+}
+
+int64_t NativeRenderer_setThreadCount(NativeRenderer * nativeRenderer, size_t threadCount)
+{
+    NativeRenderer_destroyThreadPool(nativeRenderer);
+
+    if (! NativeRenderer_createThreadPool(nativeRenderer, threadCount)) {
+        // back to the single-threaded mode, which only fails on memory exhaustion
+        NativeRenderer_destroyThreadPool(nativeRenderer);
+        NativeRenderer_createThreadPool(nativeRenderer, 1);
+
+        return 0;
+    }
+
+    return 1;
+}
+
+int64_t NativeRenderer_setPresentationBufferCount(NativeRenderer * nativeRenderer, size_t bufferCount)
+{
+    // the queued frames are written before switching
+    NativeRenderer_destroyPresenter(nativeRenderer);
+
+    if (bufferCount == 0) {
+        return 1;
+    }
+
+    if (bufferCount > NATIVE_RENDERER_MAX_PRESENTATION_BUFFER_COUNT) {
+        return 0;
+    }
+
+    NativeRendererPresenter * presenter = calloc(1, sizeof *presenter);
+    if (! presenter) {
+        return 0;
+    }
+
+    presenter->bufferCount = bufferCount;
+
+    pthread_mutex_init(&presenter->mutex, NULL);
+    pthread_cond_init(&presenter->frameSubmittedCond, NULL);
+    pthread_cond_init(&presenter->frameWrittenCond, NULL);
+
+    if (pthread_create(&presenter->thread, NULL, NativeRenderer_runPresenter, presenter) != 0) {
+        pthread_cond_destroy(&presenter->frameWrittenCond);
+        pthread_cond_destroy(&presenter->frameSubmittedCond);
+        pthread_mutex_destroy(&presenter->mutex);
+        free(presenter);
+
+        return 0;
+    }
+
+    nativeRenderer->presenter = presenter;
+
+    return 1;
+}
+
+void NativeRenderer_setOutputCompression(
+    NativeRenderer * nativeRenderer,
+    int64_t repeatSequencesEnabled,
+    int64_t lineShiftsEnabled
+) {
+    nativeRenderer->repeatSequencesEnabled = repeatSequencesEnabled;
+    nativeRenderer->lineShiftsEnabled = lineShiftsEnabled;
+}
+
+int64_t NativeRenderer_setGraphicsOutput(NativeRenderer * nativeRenderer, int64_t medium)
+{
+    NativeRenderer_hideGraphics(nativeRenderer);
+    NativeRenderer_destroyGraphics(nativeRenderer);
+
+    // the screen is redrawn from scratch, whatever the output
+    nativeRenderer->previousFrameBufferInvalidated = 1;
+
+    if (medium == NATIVE_RENDERER_GRAPHICS_MEDIUM_NONE) {
+        return 1;
+    }
+
+    if (medium > NATIVE_RENDERER_GRAPHICS_MEDIUM_DIRECT) {
+        return 0;
+    }
+
+    nativeRenderer->graphics = NativeRenderer_createGraphics(nativeRenderer, medium);
+
+    return nativeRenderer->graphics != NULL;
+}
+
+void NativeRenderer_hideGraphics(NativeRenderer * nativeRenderer)
+{
+    NativeRendererGraphics * graphics = nativeRenderer->graphics;
+
+    if (! graphics || ! graphics->imageTransmitted) {
+        return;
+    }
+
+    php_output_write(NATIVE_RENDERER_GRAPHICS_DELETION_COMMAND, sizeof NATIVE_RENDERER_GRAPHICS_DELETION_COMMAND - 1);
+    graphics->imageTransmitted = 0;
+    nativeRenderer->previousFrameBufferInvalidated = 1;
+}
+
+void NativeRenderer_present(NativeRenderer * nativeRenderer, const char * output, size_t outputLength)
+{
+    NativeRendererPresenter * presenter = nativeRenderer->presenter;
+
+    nativeRenderer->profiler->flushCount++;
+
+    if (! presenter) {
+        NativeRenderer_writeAll(output, outputLength);
+
+        return;
+    }
+
+    pthread_mutex_lock(&presenter->mutex);
+
+    presenter->queueDepth = presenter->queuedBufferCount;
+
+    while (presenter->queuedBufferCount == presenter->bufferCount) {
+        pthread_cond_wait(&presenter->frameWrittenCond, &presenter->mutex);
+    }
+
+    // the free buffers are only touched by the submitting thread, so that the copy can be done unlocked
+    NativeRendererPresentationBuffer * buffer = &presenter->buffers[
+        (presenter->firstQueuedBufferIndex + presenter->queuedBufferCount) % presenter->bufferCount
+    ];
+
+    pthread_mutex_unlock(&presenter->mutex);
+
+    if (outputLength > buffer->outputBufferSize) {
+        char * newOutput = realloc(buffer->output, outputLength);
+        if (! newOutput) {
+            // the frame is dropped, which the differential update cannot recover from
+            nativeRenderer->previousFrameBufferInvalidated = 1;
+
+            return;
+        }
+
+        buffer->output = newOutput;
+        buffer->outputBufferSize = outputLength;
+    }
+
+    memcpy(buffer->output, output, outputLength);
+    buffer->outputLength = outputLength;
+    buffer->submissionTime = NativeRenderer_getTime();
+
+    pthread_mutex_lock(&presenter->mutex);
+    presenter->queuedBufferCount++;
+    pthread_cond_signal(&presenter->frameSubmittedCond);
+    pthread_mutex_unlock(&presenter->mutex);
+}
+
+void NativeRenderer_waitForPresentation(NativeRenderer * nativeRenderer)
+{
+    NativeRendererPresenter * presenter = nativeRenderer->presenter;
+
+    if (! presenter) {
+        return;
+    }
+
+    pthread_mutex_lock(&presenter->mutex);
+    while (presenter->queuedBufferCount > 0) {
+        pthread_cond_wait(&presenter->frameWrittenCond, &presenter->mutex);
+    }
+
+    pthread_mutex_unlock(&presenter->mutex);
+}
+
+size_t NativeRenderer_getPresentationQueueDepth(NativeRenderer * nativeRenderer)
+{
+    NativeRendererPresenter * presenter = nativeRenderer->presenter;
+
+    if (! presenter) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&presenter->mutex);
+    const size_t queueDepth = presenter->queueDepth;
+    pthread_mutex_unlock(&presenter->mutex);
+
+    return queueDepth;
+}
+
+double NativeRenderer_getPresentationWriteLatency(NativeRenderer * nativeRenderer)
+{
+    NativeRendererPresenter * presenter = nativeRenderer->presenter;
+
+    if (! presenter) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&presenter->mutex);
+    const double writeLatency = presenter->writeLatency;
+    pthread_mutex_unlock(&presenter->mutex);
+
+    return writeLatency;
+}
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t pixelCount;
+    uint64_t generation;
+} NativeRendererBitmapAtlasHeader;
+
+uint32_t * NativeRenderer_mapBitmapAtlas(const char * fileName, uint32_t version, size_t * pixelCount, uint64_t * generation)
+{
+    void * data = MAP_FAILED;
+    size_t size = 0;
+    struct stat fileStat;
+
+    const int fd = open(fileName, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        goto error;
+    }
+
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size < NATIVE_RENDERER_BITMAP_ATLAS_HEADER_SIZE) {
+        goto error;
+    }
+
+    size = fileStat.st_size;
+
+    // shared, so that the processes which map the same file also share its pages
+    data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        goto error;
+    }
+
+    const NativeRendererBitmapAtlasHeader * header = data;
+    if (
+        memcmp(header->magic, NATIVE_RENDERER_BITMAP_ATLAS_MAGIC, sizeof header->magic) != 0 ||
+        header->version != version ||
+        header->pixelCount > (size - NATIVE_RENDERER_BITMAP_ATLAS_HEADER_SIZE) / sizeof(uint32_t)
+    ) {
+        goto error;
+    }
+
+    close(fd);
+    *pixelCount = header->pixelCount;
+    *generation = header->generation;
+
+    return (uint32_t *) ((char *) data + NATIVE_RENDERER_BITMAP_ATLAS_HEADER_SIZE);
+
+    error:
+        if (data != MAP_FAILED) {
+            munmap(data, size);
+        }
+
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        return NULL;
+}
+
+void NativeRenderer_reset(NativeRenderer * nativeRenderer)
+{
+    if (nativeRenderer->capture) {
+        NativeRenderer_writeCaptureRecord(nativeRenderer->capture, NATIVE_RENDERER_CAPTURE_RESET, NULL, 0);
+    }
+
+    for (size_t i = 0; i < nativeRenderer->pixelCount; i++) {
+        nativeRenderer->currentFrameBuffer[i] = 0;
+        nativeRenderer->previousFrameBuffer[i] = 0;
+        nativeRenderer->persistenceBuffer[i] = 0;
+    }
+
+    // the buffers are now filled with the (transparent black) clear color
+    NativeRendererDamage * damage = nativeRenderer->damage;
+    damage->clearColor = 0;
+    memset(damage->currentRowMasks, 0, nativeRenderer->height * sizeof(uint64_t));
+    memset(damage->previousRowMasks, 0, nativeRenderer->height * sizeof(uint64_t));
+    memset(damage->persistenceRowMasks, 0, nativeRenderer->height * sizeof(uint64_t));
+
+    // every 32-bit value is a valid color, so the next update is forced to redraw everything
+    nativeRenderer->previousFrameBufferInvalidated = 1;
+}
+
+void NativeRenderer_clear(NativeRenderer * nativeRenderer, uint32_t color)
+{
+    const double startTime = NativeRenderer_getTime();
+
+    if (nativeRenderer->capture) {
+        const NativeRendererCapturedClear clear = { .color = color };
+        NativeRenderer_writeCaptureRecord(nativeRenderer->capture, NATIVE_RENDERER_CAPTURE_CLEAR, &clear, sizeof clear);
+    }
+
+    NativeRendererDamage * damage = nativeRenderer->damage;
+
+    if (color != damage->clearColor) {
+        for (size_t i = 0; i < nativeRenderer->pixelCount; i++) {
+            nativeRenderer->currentFrameBuffer[i] = color;
+        }
+
+        // the previous frame now differs from the clear color everywhere
+        const uint64_t fullMask = NativeRenderer_getDamageMask(damage, 0, nativeRenderer->width);
+        for (size_t i = 0; i < nativeRenderer->height; i++) {
+            damage->previousRowMasks[i] = fullMask;
+        }
+
+        damage->clearColor = color;
+    } else {
+        for (size_t i = 0; i < nativeRenderer->height; i++) {
+            uint64_t mask = damage->currentRowMasks[i];
+            size_t firstColumn, lastColumn;
+
+            while (NativeRenderer_popDamagedColumns(nativeRenderer, &mask, &firstColumn, &lastColumn)) {
+                for (size_t j = firstColumn; j < lastColumn; j++) {
+                    nativeRenderer->currentFrameBuffer[i * nativeRenderer->width + j] = color;
+                }
+            }
+        }
+    }
+
+    memset(damage->currentRowMasks, 0, nativeRenderer->height * sizeof(uint64_t));
+
+    nativeRenderer->drawnBitmapPixelCount = 0;
+
+    NativeRenderer_addStageTime(nativeRenderer, NATIVE_RENDERER_STAGE_CLEAR, startTime);
+}
+
+/*
+ * Straightforward per-pixel implementation of the bitmap drawing, which the specialized kernels below are checked
+ * against (see NativeRendererTest.c). It supports neither rotation nor row clipping.
+ */
+void NativeRenderer_drawBitmapReference(
+    NativeRenderer * nativeRenderer,
+    uint32_t * bitmapPixels,
+    size_t bitmapWidth,
+    size_t bitmapHeight,
+    int64_t x,
+    int64_t y,
+    int64_t globalAlpha,
+    float brightness,
+    int64_t globalBlendingColor,
+    int64_t * verticalBlendingColors,
+    int64_t persisted,
+    int64_t globalPersistedColor,
+    int64_t * horizontalDistortionOffsets,
+    int64_t * horizontalBackgroundDistortionOffsets,
+    float ditheringAlphaRatioThreshold
+) {
+    if (globalAlpha == 0) {
+        return;
+    }
+
+    const double fullBrightnessReciprocal = 1 / 255.0;
+
+    for (size_t i = 0; i < bitmapHeight; i++) {
+        const int64_t pxPosY = y + (int64_t) i;
+
+        if (
+            pxPosY < 0 || pxPosY >= (int64_t) nativeRenderer->height
+        ) {
+            continue;
+        }
+
+        const int64_t horizontalDistortionOffset = horizontalDistortionOffsets ? horizontalDistortionOffsets[i] : 0;
+        const int64_t horizontalBackgroundDistortionOffset = horizontalBackgroundDistortionOffsets ? horizontalBackgroundDistortionOffsets[i] : 0;
+
+        for (size_t j = 0; j < bitmapWidth; j++) {
+            const int64_t pxPosX = x + (int64_t) j + horizontalDistortionOffset;
+
+            if (
+                pxPosX < 0 || pxPosX >= (int64_t) nativeRenderer->width
+            ) {
+                continue;
+            }
+
+            int64_t color = bitmapPixels[i * bitmapWidth + j];
+
+            const int64_t alpha = (color >> 24) & 0xff;
+            if (alpha == 0) {
+                continue;
+            }
+
+            int64_t blendingColor = globalBlendingColor;
+            const int64_t verticalBlendingColor = verticalBlendingColors ? verticalBlendingColors[j] : -1;
+            if (blendingColor == -1) {
+                blendingColor = verticalBlendingColor;
+            } else if (verticalBlendingColor != -1) {
+                const int64_t verticalBlendingColorA = (verticalBlendingColor >> 24) & 0xff;
+                if (verticalBlendingColorA != 0) {
+                    int64_t blendingColorA = (blendingColor >> 24) & 0xff;
+                    if (blendingColorA == 0) {
+                        blendingColor = verticalBlendingColor;
+                    } else {
+                        const int64_t verticalBlendingColorR = (verticalBlendingColor >> 16) & 0xff;
+                        const int64_t verticalBlendingColorG = (verticalBlendingColor >> 8) & 0xff;
+                        const int64_t verticalBlendingColorB = (verticalBlendingColor >> 0) & 0xff;
+                        int64_t blendingColorR = (blendingColor >> 16) & 0xff;
+                        int64_t blendingColorG = (blendingColor >> 8) & 0xff;
+                        int64_t blendingColorB = (blendingColor >> 0) & 0xff;
+
+                        const double blendingColorAlphaRatio = blendingColorA / ((double) blendingColorA + verticalBlendingColorA);
+
+                        blendingColorR = (int64_t) (
+                            blendingColorR * blendingColorAlphaRatio
+                                + verticalBlendingColorR * (1 - blendingColorAlphaRatio)
+                        );
+
+                        blendingColorG = (int64_t) (
+                            blendingColorG * blendingColorAlphaRatio
+                                + verticalBlendingColorG * (1 - blendingColorAlphaRatio)
+                        );
+
+                        blendingColorB = (int64_t) (
+                            blendingColorB * blendingColorAlphaRatio
+                                + verticalBlendingColorB * (1 - blendingColorAlphaRatio)
+                        );
+
+                        blendingColorA = (int64_t) (
+                            blendingColorA * blendingColorAlphaRatio
+                                + verticalBlendingColorA * (1 - blendingColorAlphaRatio)
+                        );
+
+                        blendingColor =
+                            blendingColorA << 24
+                            | blendingColorR << 16
+                            | blendingColorG << 8
+                            | blendingColorB
+                        ;
+                    }
+                }
+            }
+
+            int64_t persistedColor = globalPersistedColor >= 0 ? globalPersistedColor : color;
+
+            const size_t pxIndex = pxPosY * nativeRenderer->width + pxPosX;
+
+            if (
+                alpha < 255
+                || globalAlpha < 255
+                || brightness != 1
+                || blendingColor >= 0
+            ) {
+                int64_t colorR = (color >> 16) & 0xff;
+                int64_t colorG = (color >> 8) & 0xff;
+                int64_t colorB = color & 0xff;
+
+                const int64_t blendingColorA = blendingColor >= 0 ? (blendingColor >> 24) & 0xff : 0;
+
+                if (blendingColorA > 0) {
+                    const int64_t blendingColorR = (blendingColor >> 16) & 0xff;
+                    const int64_t blendingColorG = (blendingColor >> 8) & 0xff;
+                    const int64_t blendingColorB = blendingColor & 0xff;
+
+                    const double blendingColorAlphaRatio = blendingColorA * fullBrightnessReciprocal;
+
+                    colorR = (int64_t) (
+                        blendingColorR * blendingColorAlphaRatio
+                        + colorR * (1 - blendingColorAlphaRatio)
+                    );
+
+                    colorG = (int64_t) (
+                        blendingColorG * blendingColorAlphaRatio
+                        + colorG * (1 - blendingColorAlphaRatio)
+                    );
+
+                    colorB = (int64_t) (
+                        blendingColorB * blendingColorAlphaRatio
+                        + colorB * (1 - blendingColorAlphaRatio)
+                    );
+                }
+
+                colorR = (int64_t) (colorR * brightness);
+                colorG = (int64_t) (colorG * brightness);
+                colorB = (int64_t) (colorB * brightness);
+
+                int64_t combinedAlpha = 255;
+                if (globalAlpha < 255 || alpha < 255) {
+                    // exact floor, as the dithering decision depends on it
+                    combinedAlpha = globalAlpha * alpha / 255;
+                }
+
+                if (persisted) {
+                    if (globalPersistedColor < 0) {
+                        persistedColor =
+                            (combinedAlpha << 24) |
+                            ((colorR & 0xff) << 16) |
+                            ((colorG & 0xff) << 8) |
+                            (colorB & 0xff)
+                        ;
+                    }
+
+                    if (brightness != 1) {
+                        persistedColor =
+                            (((persistedColor >> 24) & 0xff) << 24) |
+                            ((((int) (((persistedColor >> 16) & 0xff) * brightness) & 0xff)) << 16) |
+                            ((((int) (((persistedColor >> 8) & 0xff) * brightness) & 0xff)) << 8) |
+                            ((((int) (((persistedColor >> 0) & 0xff) * brightness) & 0xff)) << 0)
+                        ;
+                    }
+                }
+
+                if (combinedAlpha < 255) {
+                    double combinedAlphaRatio = combinedAlpha * fullBrightnessReciprocal;
+
+                    if (ditheringAlphaRatioThreshold > 0 && combinedAlphaRatio <= ditheringAlphaRatioThreshold) {
+                        const uint64_t rn = (214013 * pxIndex + 2531011) & 0xffff;
+                        // exact form of combinedAlphaRatio * 0xffff < rn
+                        combinedAlphaRatio = (uint64_t) combinedAlpha * 257 < rn ? 0.0 : 1.0;
+
+                        if (combinedAlphaRatio == 0.0 && horizontalBackgroundDistortionOffset == 0) {
+                            continue;
+                        }
+                    }
+
+                    if (combinedAlphaRatio < 1) {
+                        const int64_t backgroundColor = pxIndex + horizontalBackgroundDistortionOffset < nativeRenderer->pixelCount
+                            ? nativeRenderer->currentFrameBuffer[pxIndex + horizontalBackgroundDistortionOffset] : 0;
+
+                        const int64_t backgroundColorR = (backgroundColor >> 16) & 0xff;
+                        const int64_t backgroundColorG = (backgroundColor >> 8) & 0xff;
+                        const int64_t backgroundColorB = backgroundColor & 0xff;
+
+                        if (combinedAlphaRatio == 0.0) {
+                            colorR = backgroundColorR;
+                            colorG = backgroundColorG;
+                            colorB = backgroundColorB;
+                        } else {
+                            colorR = (int64_t) (
+                                colorR * combinedAlphaRatio
+                                + backgroundColorR * (1 - combinedAlphaRatio)
+                            );
+
+                            colorG = (int64_t) (
+                                colorG * combinedAlphaRatio
+                                + backgroundColorG * (1 - combinedAlphaRatio)
+                            );
+
+                            colorB = (int64_t) (
+                                colorB * combinedAlphaRatio
+                                + backgroundColorB * (1 - combinedAlphaRatio)
+                            );
+                        }
+                    }
+                }
+
+                color =
+                    (255 << 24) |
+                    ((colorR & 0xff) << 16) |
+                    ((colorG & 0xff) << 8) |
+                    (colorB & 0xff)
+                ;
+            }
+
+            nativeRenderer->currentFrameBuffer[pxIndex] = color;
+            nativeRenderer->drawnBitmapPixelCount++;
+            if (persisted && alpha > 1) {
+                const uint32_t currentPersistedColor = nativeRenderer->persistenceBuffer[pxIndex];
+                const int64_t currentPersistedColorA = (currentPersistedColor >> 24) & 0xff;
+                if (currentPersistedColorA <= 2) {
+                    nativeRenderer->persistenceBuffer[pxIndex] = persistedColor;
+                } else {
+                    int64_t persistedColorA = (persistedColor >> 24) & 0xff;
+                    double blendingRatio = persistedColorA / (double) (persistedColorA + currentPersistedColorA);
+
+                    if (ditheringAlphaRatioThreshold > 0 && blendingRatio <= ditheringAlphaRatioThreshold) {
+                        const uint64_t rn = (214013 * pxIndex + 2531011) & 0xffff;
+                        // exact form of blendingRatio * 0xffff < rn
+                        blendingRatio = (uint64_t) persistedColorA * 0xffff < rn * (persistedColorA + currentPersistedColorA)
+                            ? 0.0 : 1.0;
+                    }
+
+                    if (blendingRatio == 1.0) {
+                        nativeRenderer->persistenceBuffer[pxIndex] = persistedColor;
+                    } else if (blendingRatio > 0) {
+                        const int64_t currentPersistedColorR = (currentPersistedColor >> 16) & 0xff;
+                        const int64_t currentPersistedColorG = (currentPersistedColor >> 8) & 0xff;
+                        const int64_t currentPersistedColorB = currentPersistedColor & 0xff;
+
+                        int64_t persistedColorR = (persistedColor >> 16) & 0xff;
+                        int64_t persistedColorG = (persistedColor >> 8) & 0xff;
+                        int64_t persistedColorB = persistedColor & 0xff;
+
+                        persistedColorA = persistedColorA > currentPersistedColorA ? persistedColorA : currentPersistedColorA;
+
+                        persistedColorR = (int64_t) (
+                            persistedColorR * blendingRatio
+                                + currentPersistedColorR * (1 - blendingRatio)
+                        );
+
+                        persistedColorG = (int64_t) (
+                            persistedColorG * blendingRatio
+                            + currentPersistedColorG * (1 - blendingRatio)
+                        );
+
+                        persistedColorB = (int64_t) (
+                            persistedColorB * blendingRatio
+                            + currentPersistedColorB * (1 - blendingRatio)
+                        );
+
+                        nativeRenderer->persistenceBuffer[pxIndex] =
+                            ((persistedColorA & 0xff) << 24) |
+                            ((persistedColorR & 0xff) << 16) |
+                            ((persistedColorG & 0xff) << 8) |
+                            (persistedColorB & 0xff)
+                        ;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// the kernels' per-column buffers live on the stack, NativeRenderer::drawBitmap() rejects wider bitmaps anyway
+#define NATIVE_RENDERER_KERNEL_MAX_BITMAP_WIDTH 1024
+
+typedef struct {
+    size_t drawnPixelCount;
+    size_t ditheredAwayPixelCount;
+    uint32_t globalAlpha;
+    uint32_t brightness;
+    int shaded;
+    int64_t ditheringAlpha;
+    float ditheringAlphaRatioThreshold;
+    int64_t globalPersistedColor;
+} NativeRendererKernelState;
+
+static inline uint32_t NativeRenderer_div255(uint32_t value)
+{
+    // exact floor(value / 255) for any value up to 255 * 256
+    return (value + 1 + (value >> 8)) >> 8;
+}
+
+static inline uint32_t NativeRenderer_lerpChannel(uint32_t a, uint32_t b, uint32_t alpha)
+{
+    return NativeRenderer_div255(a * alpha + b * (255 - alpha));
+}
+
+static inline int64_t NativeRenderer_mergeBlendingColors(int64_t blendingColor, int64_t verticalBlendingColor)
+{
+    if (blendingColor == -1) {
+        return verticalBlendingColor;
+    }
+
+    if (verticalBlendingColor == -1) {
+        return blendingColor;
+    }
+
+    const int64_t verticalBlendingColorA = (verticalBlendingColor >> 24) & 0xff;
+    if (verticalBlendingColorA == 0) {
+        return blendingColor;
+    }
+
+    int64_t blendingColorA = (blendingColor >> 24) & 0xff;
+    if (blendingColorA == 0) {
+        return verticalBlendingColor;
+    }
+
+    const double blendingColorAlphaRatio = blendingColorA / ((double) blendingColorA + verticalBlendingColorA);
+
+    const int64_t blendingColorR = (int64_t) (
+        ((blendingColor >> 16) & 0xff) * blendingColorAlphaRatio
+            + ((verticalBlendingColor >> 16) & 0xff) * (1 - blendingColorAlphaRatio)
+    );
+
+    const int64_t blendingColorG = (int64_t) (
+        ((blendingColor >> 8) & 0xff) * blendingColorAlphaRatio
+            + ((verticalBlendingColor >> 8) & 0xff) * (1 - blendingColorAlphaRatio)
+    );
+
+    const int64_t blendingColorB = (int64_t) (
+        (blendingColor & 0xff) * blendingColorAlphaRatio
+            + (verticalBlendingColor & 0xff) * (1 - blendingColorAlphaRatio)
+    );
+
+    blendingColorA = (int64_t) (
+        blendingColorA * blendingColorAlphaRatio
+            + verticalBlendingColorA * (1 - blendingColorAlphaRatio)
+    );
+
+    return blendingColorA << 24
+        | blendingColorR << 16
+        | blendingColorG << 8
+        | blendingColorB
+    ;
+}
+
+static inline void NativeRenderer_persistPixel(
+    NativeRenderer * nativeRenderer,
+    size_t pxIndex,
+    int64_t persistedColor,
+    float ditheringAlphaRatioThreshold
+) {
+    const uint32_t currentPersistedColor = nativeRenderer->persistenceBuffer[pxIndex];
+    const uint32_t currentPersistedColorA = (currentPersistedColor >> 24) & 0xff;
+    if (currentPersistedColorA <= 2) {
+        nativeRenderer->persistenceBuffer[pxIndex] = persistedColor;
+
+        return;
+    }
+
+    const uint32_t persistedColorA = (persistedColor >> 24) & 0xff;
+    const uint32_t alphaSum = persistedColorA + currentPersistedColorA;
+
+    if (
+        ditheringAlphaRatioThreshold > 0
+        && persistedColorA / (double) alphaSum <= ditheringAlphaRatioThreshold
+    ) {
+        const uint32_t rn = (214013 * (uint32_t) pxIndex + 2531011) & 0xffff;
+        if (persistedColorA * 0xffff >= rn * alphaSum) {
+            nativeRenderer->persistenceBuffer[pxIndex] = persistedColor;
+        }
+
+        return;
+    }
+
+    if (persistedColorA == 0) {
+        return;
+    }
+
+    const uint32_t persistedColorR = (
+        ((persistedColor >> 16) & 0xff) * persistedColorA
+            + ((currentPersistedColor >> 16) & 0xff) * currentPersistedColorA
+    ) / alphaSum;
+
+    const uint32_t persistedColorG = (
+        ((persistedColor >> 8) & 0xff) * persistedColorA
+            + ((currentPersistedColor >> 8) & 0xff) * currentPersistedColorA
+    ) / alphaSum;
+
+    const uint32_t persistedColorB = (
+        (persistedColor & 0xff) * persistedColorA
+            + (currentPersistedColor & 0xff) * currentPersistedColorA
+    ) / alphaSum;
+
+    nativeRenderer->persistenceBuffer[pxIndex] =
+        (persistedColorA > currentPersistedColorA ? persistedColorA : currentPersistedColorA) << 24 |
+        persistedColorR << 16 |
+        persistedColorG << 8 |
+        persistedColorB
+    ;
+}
+
+/*
+ * Inverse mapping of a draw command's rotation: maps a pixel of the drawn bitmap area to the source bitmap, around
+ * the bitmap center, as Bitmap::withCenteredRotation() does.
+ */
+typedef struct {
+    double xx;
+    double xy;
+    double x0;
+    double yx;
+    double yy;
+    double y0;
+} NativeRendererTransform;
+
+static NativeRendererTransform NativeRenderer_createRotationTransform(const NativeRendererDrawCommand * command)
+{
+    const double cosAngle = cos(command->rotationAngle);
+    const double sinAngle = sin(command->rotationAngle);
+    const double centerX = command->bitmapWidth / 2.0;
+    const double centerY = command->bitmapHeight / 2.0;
+
+    return (NativeRendererTransform) {
+        .xx = cosAngle,
+        .xy = -sinAngle,
+        .x0 = centerX - cosAngle * centerX + sinAngle * centerY,
+        .yx = sinAngle,
+        .yy = cosAngle,
+        .y0 = centerY - sinAngle * centerX - cosAngle * centerY,
+    };
+}
+
+static inline uint32_t NativeRenderer_getBitmapPixel(const NativeRendererDrawCommand * command, int64_t x, int64_t y)
+{
+    if (x < 0 || x >= (int64_t) command->bitmapWidth || y < 0 || y >= (int64_t) command->bitmapHeight) {
+        return 0;
+    }
+
+    return command->bitmapPixels[y * command->bitmapWidth + x];
+}
+
+/*
+ * Samples the [firstColumn, lastColumn) part of the transformed bitmap's row i, the source coordinates being
+ * incremented from one column to the next. The pixels which map outside of the bitmap are transparent.
+ */
+static void NativeRenderer_sampleTransformedBitmapRow(
+    const NativeRendererDrawCommand * command,
+    const NativeRendererTransform * transform,
+    size_t i,
+    size_t firstColumn,
+    size_t lastColumn,
+    uint32_t * sampledRowPixels
+) {
+    double sourceX = transform->xx * firstColumn + transform->xy * i + transform->x0;
+    double sourceY = transform->yx * firstColumn + transform->yy * i + transform->y0;
+
+    if (! command->bilinearFilteringEnabled) {
+        for (size_t j = firstColumn; j < lastColumn; j++) {
+            sampledRowPixels[j] = NativeRenderer_getBitmapPixel(command, lround(sourceX), lround(sourceY));
+
+            sourceX += transform->xx;
+            sourceY += transform->yx;
+        }
+
+        return;
+    }
+
+    for (size_t j = firstColumn; j < lastColumn; j++) {
+        const double floorX = floor(sourceX);
+        const double floorY = floor(sourceY);
+        const int64_t x = floorX;
+        const int64_t y = floorY;
+        const uint32_t weightX = (sourceX - floorX) * 256;
+        const uint32_t weightY = (sourceY - floorY) * 256;
+
+        const uint32_t colors[4] = {
+            NativeRenderer_getBitmapPixel(command, x, y),
+            NativeRenderer_getBitmapPixel(command, x + 1, y),
+            NativeRenderer_getBitmapPixel(command, x, y + 1),
+            NativeRenderer_getBitmapPixel(command, x + 1, y + 1),
+        };
+
+        const uint32_t weights[4] = {
+            (256 - weightX) * (256 - weightY),
+            weightX * (256 - weightY),
+            (256 - weightX) * weightY,
+            weightX * weightY,
+        };
+
+        // the colors are interpolated premultiplied by their alpha, so that transparent pixels do not bleed
+        uint64_t alphaSum = 0, rSum = 0, gSum = 0, bSum = 0;
+        for (int k = 0; k < 4; k++) {
+            const uint64_t weightedAlpha = (uint64_t) weights[k] * (colors[k] >> 24);
+
+            alphaSum += weightedAlpha;
+            rSum += weightedAlpha * ((colors[k] >> 16) & 0xff);
+            gSum += weightedAlpha * ((colors[k] >> 8) & 0xff);
+            bSum += weightedAlpha * (colors[k] & 0xff);
+        }
+
+        sampledRowPixels[j] = alphaSum == 0 ? 0 : (
+            (uint32_t) (alphaSum >> 16) << 24 |
+            (uint32_t) (rSum / alphaSum) << 16 |
+            (uint32_t) (gSum / alphaSum) << 8 |
+            (uint32_t) (bSum / alphaSum)
+        );
+
+        sourceX += transform->xx;
+        sourceY += transform->yx;
+    }
+}
+
+/*
+ * Fixed-point counterpart of NativeRenderer_drawBitmapReference() for one clipped bitmap row.
+ * The flags are compile-time constants at each call site so that every specialized kernel
+ * drops the stages it does not need. Undistorted rows have no dependency between pixels and
+ * are written branch-free, which lets the compiler vectorize them.
+ */
+static inline __attribute__((always_inline)) void NativeRenderer_drawBitmapRow(
+    NativeRenderer * nativeRenderer,
+    NativeRendererKernelState * state,
+    const uint32_t * rowPixels,
+    const int64_t * blendingColors,
+    int64_t * persistedColors,
+    size_t rowPxIndex,
+    size_t firstColumn,
+    size_t lastColumn,
+    int64_t horizontalBackgroundDistortionOffset,
+    const int alphaEnabled,
+    const int brightnessEnabled,
+    const int blendingEnabled,
+    const int persistenceEnabled,
+    const int ditheringEnabled,
+    const int distorted
+) {
+    uint32_t * frameBuffer = nativeRenderer->currentFrameBuffer;
+    const uint32_t globalAlpha = alphaEnabled ? state->globalAlpha : 255;
+    const uint32_t brightness = state->brightness;
+    const int shaded = brightnessEnabled && state->shaded;
+    const uint32_t ditheringAlpha = ditheringEnabled ? state->ditheringAlpha : 0;
+    size_t drawnPixelCount = 0;
+    size_t ditheredAwayPixelCount = 0;
+
+    for (size_t j = firstColumn; j < lastColumn; j++) {
+        const size_t pxIndex = rowPxIndex + j;
+        const uint32_t color = rowPixels[j];
+        const uint32_t alpha = color >> 24;
+
+        int written = alpha != 0;
+
+        uint32_t colorR = (color >> 16) & 0xff;
+        uint32_t colorG = (color >> 8) & 0xff;
+        uint32_t colorB = color & 0xff;
+
+        // fully opaque pixels which no effect applies to are copied untouched, as the reference path does
+        int untouched = (alpha == 255) & (globalAlpha == 255) & ! shaded;
+
+        if (blendingEnabled) {
+            const int64_t blendingColor = blendingColors[j];
+            const uint32_t blendingColorA = blendingColor >= 0 ? (blendingColor >> 24) & 0xff : 0;
+
+            untouched &= blendingColor < 0;
+
+            colorR = NativeRenderer_lerpChannel((blendingColor >> 16) & 0xff, colorR, blendingColorA);
+            colorG = NativeRenderer_lerpChannel((blendingColor >> 8) & 0xff, colorG, blendingColorA);
+            colorB = NativeRenderer_lerpChannel(blendingColor & 0xff, colorB, blendingColorA);
+        }
+
+        if (brightnessEnabled) {
+            colorR = ((colorR * brightness) >> 16) & 0xff;
+            colorG = ((colorG * brightness) >> 16) & 0xff;
+            colorB = ((colorB * brightness) >> 16) & 0xff;
+        }
+
+        const uint32_t combinedAlpha = alphaEnabled ? NativeRenderer_div255(globalAlpha * alpha) : alpha;
+        uint32_t effectiveAlpha = combinedAlpha;
+
+        if (ditheringEnabled) {
+            const uint32_t rn = (214013 * (uint32_t) pxIndex + 2531011) & 0xffff;
+            const int dithered = combinedAlpha <= ditheringAlpha;
+            const int visible = combinedAlpha * 257 >= rn;
+
+            effectiveAlpha = dithered ? (visible ? 255 : 0) : combinedAlpha;
+            ditheredAwayPixelCount += (alpha != 0) & dithered & ! visible;
+            if (! distorted) {
+                written &= (! dithered) | visible;
+            }
+        }
+
+        uint32_t backgroundColor;
+        if (distorted) {
+            if (! written) {
+                if (persistenceEnabled) {
+                    persistedColors[j] = -1;
+                }
+
+                continue;
+            }
+
+            const size_t backgroundPxIndex = pxIndex + horizontalBackgroundDistortionOffset;
+            backgroundColor = backgroundPxIndex < nativeRenderer->pixelCount ? frameBuffer[backgroundPxIndex] : 0;
+        } else {
+            backgroundColor = frameBuffer[pxIndex];
+        }
+
+        const uint32_t blendedColor =
+            0xff000000 |
+            NativeRenderer_lerpChannel(colorR, (backgroundColor >> 16) & 0xff, effectiveAlpha) << 16 |
+            NativeRenderer_lerpChannel(colorG, (backgroundColor >> 8) & 0xff, effectiveAlpha) << 8 |
+            NativeRenderer_lerpChannel(colorB, backgroundColor & 0xff, effectiveAlpha)
+        ;
+
+        frameBuffer[pxIndex] = written ? (untouched ? color : blendedColor) : backgroundColor;
+        drawnPixelCount += written;
+
+        if (persistenceEnabled) {
+            int64_t persistedColor = state->globalPersistedColor >= 0
+                ? state->globalPersistedColor
+                : (int64_t) combinedAlpha << 24 | colorR << 16 | colorG << 8 | colorB;
+
+            if (shaded) {
+                persistedColor =
+                    (persistedColor & 0xff000000) |
+                    (((((persistedColor >> 16) & 0xff) * brightness) >> 16) & 0xff) << 16 |
+                    (((((persistedColor >> 8) & 0xff) * brightness) >> 16) & 0xff) << 8 |
+                    ((((persistedColor & 0xff) * brightness) >> 16) & 0xff)
+                ;
+            }
+
+            persistedColors[j] = written & (alpha > 1) ? persistedColor : -1;
+        }
+    }
+
+    // the persistence buffer is never read while drawing, so it is merged in a second, scalar pass
+    if (persistenceEnabled) {
+        for (size_t j = firstColumn; j < lastColumn; j++) {
+            if (persistedColors[j] >= 0) {
+                NativeRenderer_persistPixel(nativeRenderer, rowPxIndex + j, persistedColors[j], state->ditheringAlphaRatioThreshold);
+            }
+        }
+    }
+
+    state->drawnPixelCount += drawnPixelCount;
+    state->ditheredAwayPixelCount += ditheredAwayPixelCount;
+}
+
+static inline __attribute__((always_inline)) size_t NativeRenderer_drawBitmapKernel(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command,
+    size_t firstRow,
+    size_t lastRow,
+    const int alphaEnabled,
+    const int brightnessEnabled,
+    const int blendingEnabled,
+    const int persistenceEnabled,
+    size_t * ditheredAwayPixelCount
+) {
+    const double fullBrightnessReciprocal = 1 / 255.0;
+
+    NativeRendererKernelState state = {
+        .drawnPixelCount = 0,
+        .ditheredAwayPixelCount = 0,
+        .globalAlpha = command->globalAlpha,
+        .brightness = (uint32_t) (command->brightness * 65536),
+        .shaded = command->brightness != 1,
+        .ditheringAlpha = -1,
+        .ditheringAlphaRatioThreshold = command->ditheringAlphaRatioThreshold,
+        .globalPersistedColor = command->globalPersistedColor,
+    };
+
+    if (command->ditheringAlphaRatioThreshold > 0) {
+        // highest combined alpha (below 255) whose ratio does not exceed the threshold
+        int64_t ditheringAlpha = (int64_t) (command->ditheringAlphaRatioThreshold * 255) + 1;
+        ditheringAlpha = ditheringAlpha > 254 ? 254 : ditheringAlpha;
+        while (ditheringAlpha >= 0 && ditheringAlpha * fullBrightnessReciprocal > command->ditheringAlphaRatioThreshold) {
+            ditheringAlpha--;
+        }
+
+        state.ditheringAlpha = ditheringAlpha;
+    }
+
+    int64_t blendingColors[blendingEnabled ? NATIVE_RENDERER_KERNEL_MAX_BITMAP_WIDTH : 1];
+    if (blendingEnabled) {
+        for (size_t j = 0; j < command->bitmapWidth; j++) {
+            blendingColors[j] = NativeRenderer_mergeBlendingColors(
+                command->globalBlendingColor,
+                command->verticalBlendingColors ? command->verticalBlendingColors[j] : -1
+            );
+        }
+    }
+
+    int64_t persistedColors[persistenceEnabled ? NATIVE_RENDERER_KERNEL_MAX_BITMAP_WIDTH : 1];
+
+    const int rotated = command->rotationAngle != 0;
+    const NativeRendererTransform transform = rotated ? NativeRenderer_createRotationTransform(command) : (NativeRendererTransform) {0};
+    uint32_t sampledRowPixels[rotated ? NATIVE_RENDERER_KERNEL_MAX_BITMAP_WIDTH : 1];
+
+    const int64_t width = nativeRenderer->width;
+
+    for (size_t i = 0; i < command->bitmapHeight; i++) {
+        const int64_t pxPosY = command->y + (int64_t) i;
+
+        if (pxPosY < (int64_t) firstRow || pxPosY >= (int64_t) lastRow) {
+            continue;
+        }
+
+        const int64_t rowOrigin = command->x + (command->horizontalDistortionOffsets ? command->horizontalDistortionOffsets[i] : 0);
+        const int64_t horizontalBackgroundDistortionOffset = command->horizontalBackgroundDistortionOffsets
+            ? command->horizontalBackgroundDistortionOffsets[i] : 0;
+
+        const size_t firstColumn = rowOrigin < 0 ? -rowOrigin : 0;
+        const size_t lastColumn = width - rowOrigin <= 0
+            ? 0
+            : ((size_t) (width - rowOrigin) < command->bitmapWidth ? (size_t) (width - rowOrigin) : command->bitmapWidth);
+
+        const uint32_t * rowPixels = command->bitmapPixels + i * command->bitmapWidth;
+        const size_t rowPxIndex = pxPosY * width + rowOrigin;
+
+        if (rotated) {
+            NativeRenderer_sampleTransformedBitmapRow(command, &transform, i, firstColumn, lastColumn, sampledRowPixels);
+            rowPixels = sampledRowPixels;
+        }
+
+#define NATIVE_RENDERER_DRAW_BITMAP_ROW(ditheringEnabled, distorted) \
+        NativeRenderer_drawBitmapRow( \
+            nativeRenderer, &state, rowPixels, blendingColors, persistedColors, rowPxIndex, firstColumn, lastColumn, \
+            horizontalBackgroundDistortionOffset, alphaEnabled, brightnessEnabled, blendingEnabled, \
+            persistenceEnabled, ditheringEnabled, distorted \
+        )
+
+        if (state.ditheringAlpha < 0) {
+            if (horizontalBackgroundDistortionOffset == 0) {
+                NATIVE_RENDERER_DRAW_BITMAP_ROW(0, 0);
+            } else {
+                NATIVE_RENDERER_DRAW_BITMAP_ROW(0, 1);
+            }
+        } else {
+            if (horizontalBackgroundDistortionOffset == 0) {
+                NATIVE_RENDERER_DRAW_BITMAP_ROW(1, 0);
+            } else {
+                NATIVE_RENDERER_DRAW_BITMAP_ROW(1, 1);
+            }
+        }
+
+#undef NATIVE_RENDERER_DRAW_BITMAP_ROW
+    }
+
+    *ditheredAwayPixelCount += state.ditheredAwayPixelCount;
+
+    return state.drawnPixelCount;
+}
+
+#define NATIVE_RENDERER_KERNEL_TARGETS __attribute__((target_clones("avx2", "sse4.2", "default")))
+
+NATIVE_RENDERER_KERNEL_TARGETS
+static size_t NativeRenderer_drawOpaqueBitmap(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command,
+    size_t firstRow,
+    size_t lastRow,
+    size_t * ditheredAwayPixelCount
+) {
+    return NativeRenderer_drawBitmapKernel(nativeRenderer, command, firstRow, lastRow, 0, 0, 0, 0, ditheredAwayPixelCount);
+}
+
+NATIVE_RENDERER_KERNEL_TARGETS
+static size_t NativeRenderer_drawTranslucentBitmap(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command,
+    size_t firstRow,
+    size_t lastRow,
+    size_t * ditheredAwayPixelCount
+) {
+    return NativeRenderer_drawBitmapKernel(nativeRenderer, command, firstRow, lastRow, 1, 0, 0, 0, ditheredAwayPixelCount);
+}
+
+NATIVE_RENDERER_KERNEL_TARGETS
+static size_t NativeRenderer_drawShadedBitmap(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command,
+    size_t firstRow,
+    size_t lastRow,
+    size_t * ditheredAwayPixelCount
+) {
+    return NativeRenderer_drawBitmapKernel(nativeRenderer, command, firstRow, lastRow, 1, 1, 0, 0, ditheredAwayPixelCount);
+}
+
+NATIVE_RENDERER_KERNEL_TARGETS
+static size_t NativeRenderer_drawBlendedBitmap(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command,
+    size_t firstRow,
+    size_t lastRow,
+    size_t * ditheredAwayPixelCount
+) {
+    return NativeRenderer_drawBitmapKernel(nativeRenderer, command, firstRow, lastRow, 1, 1, 1, 0, ditheredAwayPixelCount);
+}
+
+NATIVE_RENDERER_KERNEL_TARGETS
+static size_t NativeRenderer_drawPersistedBitmap(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command,
+    size_t firstRow,
+    size_t lastRow,
+    size_t * ditheredAwayPixelCount
+) {
+    return NativeRenderer_drawBitmapKernel(nativeRenderer, command, firstRow, lastRow, 1, 1, 1, 1, ditheredAwayPixelCount);
+}
+
+// marks the pixels which the command may write within [firstRow, lastRow)
+static void NativeRenderer_damageCommandRows(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command,
+    size_t firstRow,
+    size_t lastRow
+) {
+    NativeRendererDamage * damage = nativeRenderer->damage;
+    const int64_t width = nativeRenderer->width;
+
+    for (size_t i = 0; i < command->bitmapHeight; i++) {
+        const int64_t pxPosY = command->y + (int64_t) i;
+
+        if (pxPosY < (int64_t) firstRow || pxPosY >= (int64_t) lastRow) {
+            continue;
+        }
+
+        const int64_t rowOrigin = command->x + (command->horizontalDistortionOffsets ? command->horizontalDistortionOffsets[i] : 0);
+        const int64_t firstColumn = rowOrigin < 0 ? 0 : rowOrigin;
+        const int64_t lastColumn = rowOrigin + (int64_t) command->bitmapWidth < width ? rowOrigin + (int64_t) command->bitmapWidth : width;
+
+        if (firstColumn >= lastColumn) {
+            continue;
+        }
+
+        const uint64_t mask = NativeRenderer_getDamageMask(damage, firstColumn, lastColumn);
+
+        damage->currentRowMasks[pxPosY] |= mask;
+        if (command->persisted) {
+            damage->persistenceRowMasks[pxPosY] |= mask;
+        }
+    }
+}
+
+/*
+ * Draws the part of a command which lies within [firstRow, lastRow) and returns the number of drawn pixels.
+ * The number of pixels made transparent by dithering is added to ditheredAwayPixelCount.
+ */
+static size_t NativeRenderer_drawCommandRows(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command,
+    size_t firstRow,
+    size_t lastRow,
+    size_t * ditheredAwayPixelCount
+) {
+    if (command->globalAlpha == 0 || command->bitmapWidth > NATIVE_RENDERER_KERNEL_MAX_BITMAP_WIDTH) {
+        return 0;
+    }
+
+    NativeRenderer_damageCommandRows(nativeRenderer, command, firstRow, lastRow);
+
+    if (command->persisted) {
+        return NativeRenderer_drawPersistedBitmap(nativeRenderer, command, firstRow, lastRow, ditheredAwayPixelCount);
+    }
+
+    if (command->globalBlendingColor != -1 || command->verticalBlendingColors) {
+        return NativeRenderer_drawBlendedBitmap(nativeRenderer, command, firstRow, lastRow, ditheredAwayPixelCount);
+    }
+
+    if (command->brightness != 1) {
+        return NativeRenderer_drawShadedBitmap(nativeRenderer, command, firstRow, lastRow, ditheredAwayPixelCount);
+    }
+
+    if (command->globalAlpha < 255) {
+        return NativeRenderer_drawTranslucentBitmap(nativeRenderer, command, firstRow, lastRow, ditheredAwayPixelCount);
+    }
+
+    return NativeRenderer_drawOpaqueBitmap(nativeRenderer, command, firstRow, lastRow, ditheredAwayPixelCount);
+}
+
+/*
+ * Tells whether a command only reads pixels from the rows it writes, in which case it can be drawn band per band.
+ * Background distortions which wrap around the screen edges read pixels from the neighbouring rows.
+ */
+static int NativeRenderer_isCommandRowLocal(NativeRenderer * nativeRenderer, const NativeRendererDrawCommand * command)
+{
+    if (! command->horizontalBackgroundDistortionOffsets) {
+        return 1;
+    }
+
+    const int64_t width = nativeRenderer->width;
+
+    for (size_t i = 0; i < command->bitmapHeight; i++) {
+        const int64_t horizontalBackgroundDistortionOffset = command->horizontalBackgroundDistortionOffsets[i];
+        if (horizontalBackgroundDistortionOffset == 0) {
+            continue;
+        }
+
+        const int64_t rowOrigin = command->x + (command->horizontalDistortionOffsets ? command->horizontalDistortionOffsets[i] : 0);
+        const int64_t firstColumn = rowOrigin < 0 ? 0 : rowOrigin;
+        const int64_t lastColumn = rowOrigin + (int64_t) command->bitmapWidth < width ? rowOrigin + (int64_t) command->bitmapWidth : width;
+
+        if (firstColumn >= lastColumn) {
+            continue;
+        }
+
+        if (
+            firstColumn + horizontalBackgroundDistortionOffset < 0 ||
+            lastColumn + horizontalBackgroundDistortionOffset > width
+        ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void NativeRenderer_runDrawJob(NativeRenderer * nativeRenderer, NativeRendererBand * band, const NativeRendererJob * job)
+{
+    for (size_t i = 0; i < job->commandCount; i++) {
+        band->drawnBitmapPixelCount += NativeRenderer_drawCommandRows(
+            nativeRenderer,
+            &job->commands[i],
+            band->firstRow,
+            band->lastRow,
+            &band->ditheredAwayPixelCount
+        );
+    }
+}
+
+static void NativeRenderer_drawCommandsInBands(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * commands,
+    size_t commandCount
+) {
+    if (commandCount == 0) {
+        return;
+    }
+
+    const NativeRendererJob job = {
+        .run = NativeRenderer_runDrawJob,
+        .commands = commands,
+        .commandCount = commandCount,
+    };
+
+    NativeRenderer_runJob(nativeRenderer, &job);
+
+    for (size_t i = 0; i < nativeRenderer->bandCount; i++) {
+        nativeRenderer->drawnBitmapPixelCount += nativeRenderer->bands[i].drawnBitmapPixelCount;
+        nativeRenderer->bands[i].drawnBitmapPixelCount = 0;
+        nativeRenderer->profiler->ditheredAwayPixelCount += nativeRenderer->bands[i].ditheredAwayPixelCount;
+        nativeRenderer->bands[i].ditheredAwayPixelCount = 0;
+    }
+}
+
+void NativeRenderer_drawCommand(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command
+) {
+    size_t ditheredAwayPixelCount = 0;
+
+    nativeRenderer->drawnBitmapPixelCount += NativeRenderer_drawCommandRows(
+        nativeRenderer,
+        command,
+        0,
+        nativeRenderer->height,
+        &ditheredAwayPixelCount
+    );
+
+    nativeRenderer->profiler->ditheredAwayPixelCount += ditheredAwayPixelCount;
+}
+
+void NativeRenderer_drawBitmap(
+    NativeRenderer * nativeRenderer,
+    uint32_t * bitmapPixels,
+    size_t bitmapWidth,
+    size_t bitmapHeight,
+    int64_t x,
+    int64_t y,
+    int64_t globalAlpha,
+    float brightness,
+    int64_t globalBlendingColor,
+    int64_t * verticalBlendingColors,
+    int64_t persisted,
+    int64_t globalPersistedColor,
+    int64_t * horizontalDistortionOffsets,
+    int64_t * horizontalBackgroundDistortionOffsets,
+    float ditheringAlphaRatioThreshold
+) {
+    const NativeRendererDrawCommand command = {
+        .bitmapPixels = bitmapPixels,
+        .bitmapWidth = bitmapWidth,
+        .bitmapHeight = bitmapHeight,
+        .x = x,
+        .y = y,
+        .globalAlpha = globalAlpha,
+        .brightness = brightness,
+        .globalBlendingColor = globalBlendingColor,
+        .verticalBlendingColors = verticalBlendingColors,
+        .persisted = persisted,
+        .globalPersistedColor = globalPersistedColor,
+        .horizontalDistortionOffsets = horizontalDistortionOffsets,
+        .horizontalBackgroundDistortionOffsets = horizontalBackgroundDistortionOffsets,
+        .ditheringAlphaRatioThreshold = ditheringAlphaRatioThreshold,
+    };
+
+    if (nativeRenderer->capture) {
+        NativeRenderer_captureDraw(nativeRenderer->capture, &command);
+    }
+
+    NativeRenderer_drawCommand(nativeRenderer, &command);
+}
+
+void NativeRenderer_drawBatch(
+    NativeRenderer * nativeRenderer,
+    NativeRendererDrawCommand * commands,
+    size_t commandCount
+) {
+    const double startTime = NativeRenderer_getTime();
+
+    if (nativeRenderer->capture) {
+        for (size_t i = 0; i < commandCount; i++) {
+            NativeRenderer_captureDraw(nativeRenderer->capture, &commands[i]);
+        }
+    }
+
+    if (nativeRenderer->bandCount == 1) {
+        for (size_t i = 0; i < commandCount; i++) {
+            NativeRenderer_drawCommand(nativeRenderer, &commands[i]);
+        }
+    } else {
+        // the commands which are not row-local are drawn alone, once all the previous ones have been drawn by every band
+        size_t firstCommandIndex = 0;
+        for (size_t i = 0; i < commandCount; i++) {
+            if (NativeRenderer_isCommandRowLocal(nativeRenderer, &commands[i])) {
+                continue;
+            }
+
+            NativeRenderer_drawCommandsInBands(nativeRenderer, commands + firstCommandIndex, i - firstCommandIndex);
+            NativeRenderer_drawCommand(nativeRenderer, &commands[i]);
+            firstCommandIndex = i + 1;
+        }
+
+        NativeRenderer_drawCommandsInBands(nativeRenderer, commands + firstCommandIndex, commandCount - firstCommandIndex);
+    }
+
+    NativeRenderer_addStageTime(nativeRenderer, NATIVE_RENDERER_STAGE_DRAW, startTime);
+}
+
+void NativeRenderer_drawRect(
+    NativeRenderer * nativeRenderer,
+    size_t rectWidth,
+    size_t rectHeight,
+    int64_t x,
+    int64_t y,
+    uint32_t color
+) {
+    const double startTime = NativeRenderer_getTime();
+
+    if (nativeRenderer->capture) {
+        const NativeRendererCapturedRect rect = {
+            .width = rectWidth,
+            .height = rectHeight,
+            .x = x,
+            .y = y,
+            .color = color,
+        };
+
+        NativeRenderer_writeCaptureRecord(nativeRenderer->capture, NATIVE_RENDERER_CAPTURE_RECT, &rect, sizeof rect);
+    }
+
+    const int64_t firstColumn = x < 0 ? 0 : x;
+    const int64_t lastColumn = x + (int64_t) rectWidth < (int64_t) nativeRenderer->width
+        ? x + (int64_t) rectWidth
+        : (int64_t) nativeRenderer->width;
+    const uint64_t damageMask = firstColumn < lastColumn
+        ? NativeRenderer_getDamageMask(nativeRenderer->damage, firstColumn, lastColumn)
+        : 0;
+
+    for (size_t i = 0; i < rectHeight; i++) {
+        const int64_t pxPosY = y + (int64_t) i;
+
+        if (
+            pxPosY < 0 || pxPosY >= (int64_t) nativeRenderer->height
+        ) {
+            continue;
+        }
+
+        nativeRenderer->damage->currentRowMasks[pxPosY] |= damageMask;
+
+        for (size_t j = 0; j < rectWidth; j++) {
+            const int64_t pxPosX = x + (int64_t) j;
+
+            if (
+                pxPosX < 0 || pxPosX >= (int64_t) nativeRenderer->width
+            ) {
+                continue;
+            }
+
+            if (
+                i > 0 && i < rectHeight - 1 &&
+                j > 0 && j < rectWidth - 1
+            ) {
+                continue;
+            }
+
+            const size_t pxIndex = pxPosY * nativeRenderer->width + pxPosX;
+            nativeRenderer->currentFrameBuffer[pxIndex] = color;
+            nativeRenderer->drawnBitmapPixelCount++;
+        }
+    }
+
+    NativeRenderer_addStageTime(nativeRenderer, NATIVE_RENDERER_STAGE_DRAW, startTime);
+}
+
+void NativeRenderer_clearText(NativeRenderer * nativeRenderer)
+{
+    NativeRendererText * text = nativeRenderer->text;
+
+    if (nativeRenderer->capture) {
+        NativeRenderer_writeCaptureRecord(nativeRenderer->capture, NATIVE_RENDERER_CAPTURE_CLEAR_TEXT, NULL, 0);
+    }
+
+    for (size_t line = 0; line < text->lineCount; line++) {
+        if (text->currentLineFlags[line]) {
+            memset(text->currentCells + line * nativeRenderer->width, 0, nativeRenderer->width * sizeof(uint64_t));
+            text->currentLineFlags[line] = 0;
+        }
+    }
+}
+
+void NativeRenderer_drawText(
+    NativeRenderer * nativeRenderer,
+    size_t line,
+    size_t column,
+    const char * string,
+    size_t length,
+    uint32_t color,
+    uint32_t backgroundColor
+) {
+    NativeRendererText * text = nativeRenderer->text;
+
+    if (nativeRenderer->capture) {
+        const NativeRendererCapturedText capturedText = {
+            .line = line,
+            .column = column,
+            .length = length,
+            .color = color,
+            .backgroundColor = backgroundColor,
+        };
+
+        NativeRenderer_beginCaptureRecord(nativeRenderer->capture, NATIVE_RENDERER_CAPTURE_TEXT, sizeof capturedText + length);
+        NativeRenderer_writeCapture(nativeRenderer->capture, &capturedText, sizeof capturedText);
+        NativeRenderer_writeCapture(nativeRenderer->capture, string, length);
+        NativeRenderer_endCaptureRecord(nativeRenderer->capture, sizeof capturedText + length);
+    }
+
+    // the first line and the first column are hidden, as with the pixels
+    if (line == 0 || line >= text->lineCount || column >= nativeRenderer->width) {
+        return;
+    }
+
+    if (column == 0) {
+        if (length == 0) {
+            return;
+        }
+
+        string++;
+        length--;
+        column++;
+    }
+
+    if (length > nativeRenderer->width - column) {
+        length = nativeRenderer->width - column;
+    }
+
+    uint64_t * cells = text->currentCells + line * nativeRenderer->width + column;
+    for (size_t i = 0; i < length; i++) {
+        cells[i] = NativeRenderer_getTextCell(string[i], color, backgroundColor);
+    }
+
+    text->currentLineFlags[line] |= length > 0;
+}
+
+size_t NativeRenderer_getDrawnBitmapPixelCount(
+    NativeRenderer * nativeRenderer
+) {
+    return nativeRenderer->drawnBitmapPixelCount;
+}
+
+size_t NativeRenderer_getOutputByteCount(
+    NativeRenderer * nativeRenderer
+) {
+    return nativeRenderer->outputByteCount;
+}
+
+void NativeRenderer_getProfile(NativeRenderer * nativeRenderer, NativeRendererProfile * profile)
+{
+    const NativeRendererProfiler * profiler = nativeRenderer->profiler;
+
+    profile->frameCount = profiler->frameCount;
+
+    for (size_t i = 0; i < NATIVE_RENDERER_STAGE_COUNT; i++) {
+        profile->lastStageTimes[i] = profiler->lastStageTimes[i];
+        profile->p50StageTimes[i] = NativeRenderer_getHistogramPercentile(profiler->histograms[i], profiler->frameCount, 50);
+        profile->p95StageTimes[i] = NativeRenderer_getHistogramPercentile(profiler->histograms[i], profiler->frameCount, 95);
+        profile->p99StageTimes[i] = NativeRenderer_getHistogramPercentile(profiler->histograms[i], profiler->frameCount, 99);
+        profile->maxStageTimes[i] = profiler->maxStageTimes[i];
+    }
+
+    profile->blendedPixelCount = profiler->blendedPixelCount;
+    profile->ditheredAwayPixelCount = profiler->ditheredAwayPixelCount;
+    profile->changedCharacterCount = profiler->changedCharacterCount;
+    profile->emittedByteCount = profiler->emittedByteCount;
+    profile->savedByteCount = profiler->savedByteCount;
+    profile->deferredCharacterCount = profiler->deferredCharacterCount;
+    profile->flushCount = profiler->flushCount;
+}
+
+void NativeRenderer_resetProfile(NativeRenderer * nativeRenderer)
+{
+    // the stage times of the frame being rendered are kept
+    NativeRendererProfiler * profiler = nativeRenderer->profiler;
+    double frameStageTimes[NATIVE_RENDERER_STAGE_COUNT];
+
+    memcpy(frameStageTimes, profiler->frameStageTimes, sizeof frameStageTimes);
+    memset(profiler, 0, sizeof *profiler);
+    memcpy(profiler->frameStageTimes, frameStageTimes, sizeof frameStageTimes);
+}
+
+/*
+ * Makes room for size more bytes in the band's output buffer and returns the write cursor,
+ * or NULL if the buffer cannot grow.
+ */
+static inline char * NativeRenderer_reserveOutput(NativeRendererBand * band, size_t size)
+{
+    if (band->outputLength + size > band->outputBufferSize) {
+        char * outputBuffer = realloc(band->outputBuffer, 2 * band->outputBufferSize);
+        if (! outputBuffer) {
+            return NULL;
+        }
+
+        band->outputBuffer = outputBuffer;
+        band->outputBufferSize *= 2;
+    }
+
+    return band->outputBuffer + band->outputLength;
+}
+
+static inline char * NativeRenderer_encodeDecimal(char * cursor, size_t value)
+{
+    if (value >= NATIVE_RENDERER_DECIMAL_TABLE_SIZE) {
+        cursor = NativeRenderer_encodeDecimal(cursor, value / NATIVE_RENDERER_DECIMAL_TABLE_SIZE);
+
+        // the remaining digits are zero-padded
+        const NativeRendererDecimal * decimal = &NativeRenderer_decimalTable[value % NATIVE_RENDERER_DECIMAL_TABLE_SIZE];
+        for (size_t i = decimal->length; i < 3; i++) {
+            *cursor++ = '0';
+        }
+
+        memcpy(cursor, decimal->digits, decimal->length);
+
+        return cursor + decimal->length;
+    }
+
+    const NativeRendererDecimal * decimal = &NativeRenderer_decimalTable[value];
+    memcpy(cursor, decimal->digits, 3);
+
+    return cursor + decimal->length;
+}
+
+static inline char * NativeRenderer_encodeString(char * cursor, const char * string, size_t length)
+{
+    memcpy(cursor, string, length);
+
+    return cursor + length;
+}
+
+static inline char * NativeRenderer_encodeTrueColor(char * cursor, uint32_t color)
+{
+    cursor = NativeRenderer_encodeDecimal(cursor, (color >> 16) & 0xff);
+    *cursor++ = ';';
+    cursor = NativeRenderer_encodeDecimal(cursor, (color >> 8) & 0xff);
+    *cursor++ = ';';
+
+    return NativeRenderer_encodeDecimal(cursor, color & 0xff);
+}
+
+static inline int NativeRenderer_getColorTableIndex(const NativeRendererQuantizer * quantizer, uint32_t color)
+{
+    const uint32_t r = (color >> 16) & 0xff;
+    const uint32_t g = (color >> 8) & 0xff;
+    const uint32_t b = color & 0xff;
+
+    if (r == g && g == b) {
+        return quantizer->grayColorTableIndexes[r];
+    }
+
+    return 16 + 36 * quantizer->cubeLevels[r] + 6 * quantizer->cubeLevels[g] + quantizer->cubeLevels[b];
+}
+
+static inline char * NativeRenderer_encodeSgr(
+    char * cursor,
+    int64_t trueColorModeEnabled,
+    int64_t upperColor,
+    int64_t lowerColor,
+    int64_t lastUpperColor,
+    int64_t lastLowerColor
+) {
+    // a -1 foreground color does not matter, e.g. for a space
+    const int upperColorChanged = upperColor != -1 && upperColor != lastUpperColor;
+    const int lowerColorChanged = lowerColor != lastLowerColor;
+
+    if (! upperColorChanged && ! lowerColorChanged) {
+        return cursor;
+    }
+
+    // only the changed side is emitted
+    cursor = NativeRenderer_encodeString(cursor, "\033[", 2);
+
+    if (upperColorChanged) {
+        if (trueColorModeEnabled) {
+            cursor = NativeRenderer_encodeString(cursor, "38;2;", 5);
+            cursor = NativeRenderer_encodeTrueColor(cursor, upperColor);
+        } else {
+            cursor = NativeRenderer_encodeString(cursor, "38;5;", 5);
+            cursor = NativeRenderer_encodeDecimal(cursor, upperColor);
+        }
+    }
+
+    if (lowerColorChanged) {
+        if (upperColorChanged) {
+            *cursor++ = ';';
+        }
+
+        if (trueColorModeEnabled) {
+            cursor = NativeRenderer_encodeString(cursor, "48;2;", 5);
+            cursor = NativeRenderer_encodeTrueColor(cursor, lowerColor);
+        } else {
+            cursor = NativeRenderer_encodeString(cursor, "48;5;", 5);
+            cursor = NativeRenderer_encodeDecimal(cursor, lowerColor);
+        }
+    }
+
+    *cursor++ = 'm';
+
+    return cursor;
+}
+
+/*
+ * Composites the persistence buffer's span onto the current frame buffer's one and fades it. It is branch-free so that
+ * it gets vectorized, the transparent persisted pixels being left unchanged. Returns the max remaining alpha.
+ */
+// without contraction into FMAs, the blending rounds as the PHP renderer's does
+__attribute__((optimize("fp-contract=off")))
+static uint32_t NativeRenderer_decayPersistenceSpan(
+    uint32_t * restrict persistencePixels,
+    uint32_t * restrict framePixels,
+    size_t pixelCount,
+    int32_t persistenceAlphaDecrease
+) {
+    const double fullBrightnessReciprocal = 1 / 255.0;
+    uint32_t maxPersistedColorA = 0;
+
+    for (size_t i = 0; i < pixelCount; i++) {
+        const uint32_t persistedColor = persistencePixels[i];
+        const uint32_t color = framePixels[i];
+
+        const int32_t persistedColorA = (persistedColor >> 24) & 0xff;
+        const double persistedColorAlphaRatio = persistedColorA * fullBrightnessReciprocal;
+
+        const int32_t colorR = (int32_t) (
+            (int32_t) ((color >> 16) & 0xff) * (1 - persistedColorAlphaRatio)
+            + (int32_t) ((persistedColor >> 16) & 0xff) * persistedColorAlphaRatio
+        );
+
+        const int32_t colorG = (int32_t) (
+            (int32_t) ((color >> 8) & 0xff) * (1 - persistedColorAlphaRatio)
+            + (int32_t) ((persistedColor >> 8) & 0xff) * persistedColorAlphaRatio
+        );
+
+        const int32_t colorB = (int32_t) (
+            (int32_t) (color & 0xff) * (1 - persistedColorAlphaRatio)
+            + (int32_t) (persistedColor & 0xff) * persistedColorAlphaRatio
+        );
+
+        int32_t fadedPersistedColorA = persistedColorA - persistenceAlphaDecrease;
+        fadedPersistedColorA = fadedPersistedColorA < 0 ? 0 : fadedPersistedColorA;
+
+        const uint32_t blendedColor = (255u << 24) | (colorR << 16) | (colorG << 8) | colorB;
+        const uint32_t fadedPersistedColor = ((uint32_t) fadedPersistedColorA << 24) | (persistedColor & 0xffffff);
+
+        framePixels[i] = persistedColorA ? blendedColor : color;
+        persistencePixels[i] = persistedColorA ? fadedPersistedColor : persistedColor;
+        maxPersistedColorA = (uint32_t) fadedPersistedColorA > maxPersistedColorA ? (uint32_t) fadedPersistedColorA : maxPersistedColorA;
+    }
+
+    return maxPersistedColorA;
+}
+
+/*
+ * Applies the persistence effects to the band's rows. Only the chunks where the persistence buffer may not be
+ * transparent are visited, so that the cost depends on the live trails rather than on the screen size.
+ */
+static void NativeRenderer_applyPersistence(NativeRenderer * nativeRenderer, NativeRendererBand * band, const NativeRendererJob * job)
+{
+    NativeRendererDamage * damage = nativeRenderer->damage;
+    const size_t chunkWidth = damage->chunkWidth;
+    const int64_t persistenceEffectsEnabled = job->persistenceEffectsEnabled;
+    const int32_t persistenceAlphaDecrease = (int32_t) job->persistenceAlphaDecrease;
+
+    for (size_t i = band->firstRow; i < band->lastRow; i++) {
+        uint64_t mask = damage->persistenceRowMasks[i];
+        uint64_t persistenceMask = 0;
+        size_t firstColumn, lastColumn;
+
+        if (! persistenceEffectsEnabled) {
+            while (NativeRenderer_popDamagedColumns(nativeRenderer, &mask, &firstColumn, &lastColumn)) {
+                memset(
+                    &nativeRenderer->persistenceBuffer[i * nativeRenderer->width + firstColumn],
+                    0,
+                    (lastColumn - firstColumn) * sizeof(uint32_t)
+                );
+            }
+
+            damage->persistenceRowMasks[i] = 0;
+
+            continue;
+        }
+
+        damage->currentRowMasks[i] |= mask;
+
+        while (NativeRenderer_popDamagedColumns(nativeRenderer, &mask, &firstColumn, &lastColumn)) {
+            // chunk by chunk, so that the fully faded ones are no longer visited
+            for (size_t j = firstColumn; j < lastColumn; j += chunkWidth) {
+                const size_t pxIndex = i * nativeRenderer->width + j;
+                const size_t pixelCount = j + chunkWidth < lastColumn ? chunkWidth : lastColumn - j;
+
+                if (NativeRenderer_decayPersistenceSpan(
+                    &nativeRenderer->persistenceBuffer[pxIndex],
+                    &nativeRenderer->currentFrameBuffer[pxIndex],
+                    pixelCount,
+                    persistenceAlphaDecrease
+                )) {
+                    persistenceMask |= (uint64_t) 1 << (j / chunkWidth);
+                }
+            }
+        }
+
+        damage->persistenceRowMasks[i] = persistenceMask;
+    }
+}
+
+static void NativeRenderer_reduceColorDepth(NativeRenderer * nativeRenderer, NativeRendererBand * band)
+{
+    const NativeRendererQuantizer * quantizer = nativeRenderer->quantizer;
+
+    for (size_t i = band->firstRow; i < band->lastRow; i++) {
+        const uint8_t (* rowReducedChannels)[256] = &quantizer->reducedChannels[(i & 3) << 2];
+        uint64_t mask = nativeRenderer->damage->currentRowMasks[i];
+        size_t firstColumn, lastColumn;
+
+        while (NativeRenderer_popDamagedColumns(nativeRenderer, &mask, &firstColumn, &lastColumn)) {
+            for (size_t j = firstColumn; j < lastColumn; j++) {
+                const size_t pxIndex = i * nativeRenderer->width + j;
+                const uint32_t color = nativeRenderer->currentFrameBuffer[pxIndex];
+
+                if ((color & 0xffffff) == 0) {
+                    continue;
+                }
+
+                const uint8_t * reducedChannels = rowReducedChannels[j & 3];
+
+                nativeRenderer->currentFrameBuffer[pxIndex] =
+                    (255 << 24) |
+                    (reducedChannels[(color >> 16) & 0xff] << 16) |
+                    (reducedChannels[(color >> 8) & 0xff] << 8) |
+                    reducedChannels[color & 0xff]
+                ;
+            }
+        }
+    }
+}
+
+// per channel floor((a + b) / 2), the low bits being masked out so that they do not carry into the next channel
+static inline uint32_t NativeRenderer_averageColors(uint32_t a, uint32_t b)
+{
+    return (255u << 24) | (((a & b) + (((a ^ b) & 0xfefefe) >> 1)) & 0xffffff);
+}
+
+/*
+ * Averages the damaged pixels by pairs of columns (low resolution mode 1), or by 2x2 blocks (low resolution mode 2),
+ * so that each pair of columns is encoded as a single double-width cell. The damaged areas are extended to the
+ * blocks they overlap.
+ */
+static void NativeRenderer_reduceResolution(NativeRenderer * nativeRenderer, NativeRendererBand * band, const NativeRendererJob * job)
+{
+    NativeRendererDamage * damage = nativeRenderer->damage;
+    const size_t width = nativeRenderer->width;
+
+    for (size_t i = band->firstRow; i < band->lastRow; i += 2) {
+        uint64_t mask = damage->currentRowMasks[i] | damage->currentRowMasks[i + 1];
+        size_t firstColumn, lastColumn;
+
+        while (NativeRenderer_popDamagedColumns(nativeRenderer, &mask, &firstColumn, &lastColumn)) {
+            // the width is even, see Screen's constructor
+            firstColumn &= ~(size_t) 1;
+            lastColumn = (lastColumn + 1) & ~(size_t) 1;
+
+            const uint64_t blockMask = NativeRenderer_getDamageMask(damage, firstColumn, lastColumn);
+            damage->currentRowMasks[i] |= blockMask;
+            damage->currentRowMasks[i + 1] |= blockMask;
+
+            for (size_t j = firstColumn; j < lastColumn; j += 2) {
+                uint32_t * upperPixels = &nativeRenderer->currentFrameBuffer[i * width + j];
+                uint32_t * lowerPixels = upperPixels + width;
+
+                const uint32_t upperColor = NativeRenderer_averageColors(upperPixels[0], upperPixels[1]);
+                const uint32_t lowerColor = NativeRenderer_averageColors(lowerPixels[0], lowerPixels[1]);
+
+                if (job->lowResolutionMode == 1) {
+                    upperPixels[0] = upperPixels[1] = upperColor;
+                    lowerPixels[0] = lowerPixels[1] = lowerColor;
+                } else {
+                    upperPixels[0] = upperPixels[1] = lowerPixels[0] = lowerPixels[1] =
+                        NativeRenderer_averageColors(upperColor, lowerColor);
+                }
+            }
+        }
+    }
+}
+
+// out of the damaged chunks, both frames hold the clear color
+static inline uint64_t NativeRenderer_getRowPairMask(const NativeRenderer * nativeRenderer, size_t i)
+{
+    const NativeRendererDamage * damage = nativeRenderer->damage;
+
+    if (nativeRenderer->previousFrameBufferInvalidated) {
+        return NativeRenderer_getDamageMask(damage, 0, nativeRenderer->width);
+    }
+
+    return damage->currentRowMasks[i] | damage->currentRowMasks[i + 1]
+        | damage->previousRowMasks[i] | damage->previousRowMasks[i + 1];
+}
+
+// the largest channel difference between two colors
+static inline uint32_t NativeRenderer_getColorDelta(uint32_t a, uint32_t b)
+{
+    uint32_t delta = 0;
+
+    for (int shift = 0; shift < 24; shift += 8) {
+        const int32_t channelDelta = (int32_t) ((a >> shift) & 0xff) - (int32_t) ((b >> shift) & 0xff);
+        const uint32_t absChannelDelta = channelDelta < 0 ? -channelDelta : channelDelta;
+
+        if (absChannelDelta > delta) {
+            delta = absChannelDelta;
+        }
+    }
+
+    return delta;
+}
+
+/*
+ * The largest channel difference between the character at upperPxIndex and the terminal's one,
+ * which is made of columnStep columns of the previous frame.
+ */
+static inline uint32_t NativeRenderer_getCharacterDelta(const NativeRenderer * nativeRenderer, size_t upperPxIndex, size_t columnStep)
+{
+    const size_t lowerPxIndex = upperPxIndex + nativeRenderer->width;
+    const uint32_t upperColor = nativeRenderer->currentFrameBuffer[upperPxIndex];
+    const uint32_t lowerColor = nativeRenderer->currentFrameBuffer[lowerPxIndex];
+
+    uint32_t delta = 0;
+
+    for (size_t k = 0; k < columnStep; k++) {
+        const uint32_t upperDelta = NativeRenderer_getColorDelta(upperColor, nativeRenderer->previousFrameBuffer[upperPxIndex + k]);
+        const uint32_t lowerDelta = NativeRenderer_getColorDelta(lowerColor, nativeRenderer->previousFrameBuffer[lowerPxIndex + k]);
+
+        delta = upperDelta > delta ? upperDelta : delta;
+        delta = lowerDelta > delta ? lowerDelta : delta;
+    }
+
+    return delta;
+}
+
+// copies the pixels of the encoded characters to the previous frame buffer, which mirrors the terminal
+static inline void NativeRenderer_commitCharacters(NativeRenderer * nativeRenderer, size_t upperPxIndex, size_t columnCount)
+{
+    const size_t lowerPxIndex = upperPxIndex + nativeRenderer->width;
+
+    memcpy(nativeRenderer->previousFrameBuffer + upperPxIndex, nativeRenderer->currentFrameBuffer + upperPxIndex, columnCount * sizeof(uint32_t));
+    memcpy(nativeRenderer->previousFrameBuffer + lowerPxIndex, nativeRenderer->currentFrameBuffer + lowerPxIndex, columnCount * sizeof(uint32_t));
+}
+
+/*
+ * Returns the smallest character delta (see NativeRenderer_getCharacterDelta()) of the characters to be encoded first
+ * so as to fit in the band's byte budget, i.e. those which changed the most. Their count is stored in *priorityCount.
+ */
+static uint32_t NativeRenderer_getPriorityDelta(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererBand * band,
+    const NativeRendererJob * job,
+    size_t columnStep,
+    size_t byteBudget,
+    size_t * priorityCount
+) {
+    size_t histogram[256] = {0};
+
+    // the first row pair and column are hidden, see NativeRenderer_runUpdateJob()
+    for (size_t i = band->firstRow > 0 ? band->firstRow : 2; i < band->lastRow; i += 2) {
+        uint64_t mask = NativeRenderer_getRowPairMask(nativeRenderer, i);
+        size_t firstColumn, lastColumn;
+
+        while (NativeRenderer_popDamagedColumns(nativeRenderer, &mask, &firstColumn, &lastColumn)) {
+            if (columnStep == 2) {
+                firstColumn &= ~(size_t) 1;
+                lastColumn = (lastColumn + 1) & ~(size_t) 1;
+            } else if (firstColumn == 0) {
+                firstColumn = 1;
+            }
+
+            for (size_t j = firstColumn; j < lastColumn; j += columnStep) {
+                histogram[NativeRenderer_getCharacterDelta(nativeRenderer, i * nativeRenderer->width + j, columnStep)]++;
+            }
+        }
+    }
+
+    const double characterOutputSize = columnStep * (
+        band->characterOutputSize > 0 ? band->characterOutputSize : NATIVE_RENDERER_DEFAULT_CHARACTER_OUTPUT_SIZE
+    );
+
+    uint32_t priorityDelta = 256;
+    size_t count = 0;
+
+    for (uint32_t delta = 255; delta > (uint32_t) job->changeThreshold; delta--) {
+        if ((count + histogram[delta]) * characterOutputSize > byteBudget) {
+            break;
+        }
+
+        count += histogram[delta];
+        priorityDelta = delta;
+    }
+
+    *priorityCount = count;
+
+    return priorityDelta;
+}
+
+/*
+ * Returns the number of columns by which shifting the row pair i of the previous frame to the left
+ * spares redrawing the most characters, 0 if no shift spares at least NATIVE_RENDERER_MIN_LINE_SHIFT_GAIN of them.
+ * The changed character counts are stored in *changedCount and *shiftedChangedCount.
+ */
+static size_t NativeRenderer_findLineShift(
+    const NativeRenderer * nativeRenderer,
+    size_t i,
+    size_t columnStep,
+    size_t * changedCount,
+    size_t * shiftedChangedCount
+) {
+    const size_t width = nativeRenderer->width;
+    const uint32_t * upperPixels = nativeRenderer->currentFrameBuffer + i * width;
+    const uint32_t * lowerPixels = upperPixels + width;
+    const uint32_t * prevUpperPixels = nativeRenderer->previousFrameBuffer + i * width;
+    const uint32_t * prevLowerPixels = prevUpperPixels + width;
+
+    size_t count = 0;
+    for (size_t j = 0; j < width; j++) {
+        count += (upperPixels[j] != prevUpperPixels[j]) | (lowerPixels[j] != prevLowerPixels[j]);
+    }
+
+    *changedCount = *shiftedChangedCount = count;
+
+    if (count < NATIVE_RENDERER_MIN_LINE_SHIFT_GAIN) {
+        return 0;
+    }
+
+    size_t bestShift = 0;
+    size_t bestCount = count - NATIVE_RENDERER_MIN_LINE_SHIFT_GAIN + 1;
+
+    // in low resolution modes, the pairs of columns must stay aligned
+    for (size_t shift = columnStep; shift <= NATIVE_RENDERER_MAX_LINE_SHIFT && shift < width; shift += columnStep) {
+        // the columns uncovered at the end of the row are always redrawn
+        size_t shiftedCount = shift;
+        for (size_t j = 0; j + shift < width && shiftedCount < bestCount; j++) {
+            shiftedCount += (upperPixels[j] != prevUpperPixels[j + shift]) | (lowerPixels[j] != prevLowerPixels[j + shift]);
+        }
+
+        if (shiftedCount < bestCount) {
+            bestShift = shift;
+            bestCount = shiftedCount;
+        }
+    }
+
+    if (bestShift > 0) {
+        *shiftedChangedCount = bestCount;
+    }
+
+    return bestShift;
+}
+
+/*
+ * Forces the pixels of the row pair i's characters whose text has been removed to be redrawn, and returns their
+ * chunks. *textShown tells whether the line may hold text, in the frame or on the terminal.
+ */
+static uint64_t NativeRenderer_prepareTextLine(NativeRenderer * nativeRenderer, size_t i, int * textShown)
+{
+    NativeRendererText * text = nativeRenderer->text;
+    const size_t line = i / 2;
+    const size_t width = nativeRenderer->width;
+
+    *textShown = text->currentLineFlags[line] || text->previousLineFlags[line];
+    if (! *textShown) {
+        return 0;
+    }
+
+    const uint64_t * cells = text->currentCells + line * width;
+    uint64_t * previousCells = text->previousCells + line * width;
+    uint64_t forcedMask = 0;
+
+    for (size_t j = 1; j < width; j++) {
+        if (previousCells[j] == 0 || cells[j] != 0) {
+            continue;
+        }
+
+        nativeRenderer->previousFrameBuffer[i * width + j] = ~nativeRenderer->currentFrameBuffer[i * width + j];
+        nativeRenderer->previousFrameBuffer[(i + 1) * width + j] = ~nativeRenderer->currentFrameBuffer[(i + 1) * width + j];
+        previousCells[j] = 0;
+        forcedMask |= NativeRenderer_getDamageMask(nativeRenderer->damage, j, j + 1);
+    }
+
+    return forcedMask;
+}
+
+// whether the terminal columns of the character at column j are all covered by text
+static inline int NativeRenderer_isTextCovered(const uint64_t * cells, size_t j, size_t columnStep)
+{
+    for (size_t k = j > 0 ? j : 1; k < j + columnStep; k++) {
+        if (cells[k] == 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Applies the frame effects to the band's rows, then encodes the characters which differ from the previous frame.
+ * Each stage is a separate pass over the band so that it can be timed on its own.
+ */
+static void NativeRenderer_runUpdateJob(NativeRenderer * nativeRenderer, NativeRendererBand * band, const NativeRendererJob * job)
+{
+    const int64_t trueColorModeEnabled = job->trueColorModeEnabled;
+    // in low resolution modes, each pair of columns is encoded as a single double-width cell
+    const size_t columnStep = job->lowResolutionMode > 0 ? 2 : 1;
+
+    band->outputLength = 0;
+    band->outputTruncated = 0;
+    band->updatedCharacterCount = 0;
+    band->deferredCharacterCount = 0;
+    band->savedByteCount = 0;
+    band->firstSgrLength = 0;
+    band->firstSgrAfterBackgroundReset = 0;
+    band->foregroundSgrLength = 0;
+
+    double startTime = NativeRenderer_getTime();
+
+    NativeRenderer_applyPersistence(nativeRenderer, band, job);
+
+    double endTime = NativeRenderer_getTime();
+    band->stageTimes[NATIVE_RENDERER_STAGE_PERSISTENCE] = endTime - startTime;
+    startTime = endTime;
+
+    // the resolution reduction is accounted as a color reduction
+    if (job->lowResolutionMode > 0) {
+        NativeRenderer_reduceResolution(nativeRenderer, band, job);
+    }
+
+    if (job->removedColorDepthBits > 0) {
+        NativeRenderer_reduceColorDepth(nativeRenderer, band);
+    }
+
+    endTime = NativeRenderer_getTime();
+    band->stageTimes[NATIVE_RENDERER_STAGE_COLOR_REDUCTION] = endTime - startTime;
+    startTime = endTime;
+
+    // the graphics output is encoded once the bands are done, see NativeRenderer_update()
+    if (nativeRenderer->graphics) {
+        band->stageTimes[NATIVE_RENDERER_STAGE_ENCODING] = 0;
+
+        return;
+    }
+
+    size_t updatedCharacterCount = 0;
+    size_t deferredCharacterCount = 0;
+    size_t savedByteCount = 0;
+
+    size_t lastPxCol;
+
+    // the terminal's current SGR colors (true colors or color table indexes), -1 when unknown, as the band does not
+    // know the colors left by the previous ones (see NativeRenderer_update())
+    int64_t lastUpperColor = -1, lastLowerColor = -1;
+    int firstSgrEncoded = 0;
+
+    NativeRendererDamage * damage = nativeRenderer->damage;
+    const NativeRendererQuantizer * quantizer = nativeRenderer->quantizer;
+    const uint64_t fullMask = NativeRenderer_getDamageMask(damage, 0, nativeRenderer->width);
+
+    // a redraw of everything can be neither thresholded nor deferred
+    const uint32_t changeThreshold = nativeRenderer->previousFrameBufferInvalidated ? 0 : job->changeThreshold;
+    const size_t byteBudget = nativeRenderer->previousFrameBufferInvalidated || job->outputByteBudget <= 0 ? 0 : (
+        job->outputByteBudget * (band->lastRow - band->firstRow) / nativeRenderer->height
+    );
+
+    // within the byte budget, the characters which changed the most are encoded first, the other ones being encoded
+    // in the row order, from where the previous frame stopped, until the remaining budget is exhausted
+    size_t priorityCount = 0;
+    const uint32_t priorityDelta = byteBudget > 0
+        ? NativeRenderer_getPriorityDelta(nativeRenderer, band, job, columnStep, byteBudget, &priorityCount)
+        : 0;
+
+    const double characterOutputSize = columnStep * (
+        band->characterOutputSize > 0 ? band->characterOutputSize : NATIVE_RENDERER_DEFAULT_CHARACTER_OUTPUT_SIZE
+    );
+
+    const size_t bandHeight = band->lastRow - band->firstRow;
+    const size_t firstRowOffset = byteBudget > 0 && band->roundRobinRow >= band->firstRow && band->roundRobinRow < band->lastRow
+        ? band->roundRobinRow - band->firstRow
+        : 0;
+
+    int deferring = 0;
+
+    for (size_t rowOffset = 0; rowOffset < bandHeight; rowOffset += 2) {
+        const size_t i = band->firstRow + (firstRowOffset + rowOffset) % bandHeight;
+        uint64_t rowPairMask = NativeRenderer_getRowPairMask(nativeRenderer, i);
+
+        // the chunks holding characters which differ from the terminal
+        uint64_t deferredMask = 0;
+
+        uint64_t mask;
+        size_t firstColumn, lastColumn;
+
+        if (i == 0) {
+            // the first row pair shares its terminal line with the second one, which hides it
+            mask = rowPairMask;
+            while (NativeRenderer_popDamagedColumns(nativeRenderer, &mask, &firstColumn, &lastColumn)) {
+                NativeRenderer_commitCharacters(nativeRenderer, i * nativeRenderer->width + firstColumn, lastColumn - firstColumn);
+            }
+
+            damage->previousRowMasks[i] = damage->currentRowMasks[i];
+            damage->previousRowMasks[i + 1] = damage->currentRowMasks[i + 1];
+
+            continue;
+        }
+
+        lastPxCol = nativeRenderer->width;
+
+        int textShown;
+        const uint64_t * textCells = nativeRenderer->text->currentCells + i / 2 * nativeRenderer->width;
+        uint64_t * previousTextCells = nativeRenderer->text->previousCells + i / 2 * nativeRenderer->width;
+        rowPairMask |= NativeRenderer_prepareTextLine(nativeRenderer, i, &textShown);
+
+        // a shift would move the text along
+        if (nativeRenderer->lineShiftsEnabled && ! nativeRenderer->previousFrameBufferInvalidated && rowPairMask && ! textShown) {
+            size_t changedCount, shiftedChangedCount;
+            const size_t shift = NativeRenderer_findLineShift(nativeRenderer, i, columnStep, &changedCount, &shiftedChangedCount);
+
+            char * cursor = shift > 0 ? NativeRenderer_reserveOutput(band, NATIVE_RENDERER_MAX_CELL_OUTPUT_SIZE) : NULL;
+            if (cursor) {
+                // the characters deleted at the beginning of the row are replaced by the following ones,
+                // and the blanks inserted at its end, beyond the screen, take the default background color
+                const char * shiftStart = cursor;
+
+                cursor = NativeRenderer_encodeString(cursor, "\033[49m\033[", 7);
+                cursor = NativeRenderer_encodeDecimal(cursor, i / 2);
+                cursor = NativeRenderer_encodeString(cursor, ";1H\033[", 5);
+                cursor = NativeRenderer_encodeDecimal(cursor, shift);
+                *cursor++ = 'P';
+
+                band->outputLength = cursor - band->outputBuffer;
+                band->firstSgrAfterBackgroundReset |= ! firstSgrEncoded;
+                lastLowerColor = -1;
+
+                savedByteCount += (changedCount - shiftedChangedCount) * (sizeof "▀" - 1) - (cursor - shiftStart);
+
+                // the previous frame is shifted the same way, its uncovered end being forced to differ
+                for (size_t k = i; k < i + 2; k++) {
+                    uint32_t * prevPixels = nativeRenderer->previousFrameBuffer + k * nativeRenderer->width;
+                    const uint32_t * pixels = nativeRenderer->currentFrameBuffer + k * nativeRenderer->width;
+
+                    memmove(prevPixels, prevPixels + shift, (nativeRenderer->width - shift) * sizeof(uint32_t));
+                    for (size_t j = nativeRenderer->width - shift; j < nativeRenderer->width; j++) {
+                        prevPixels[j] = ~pixels[j];
+                    }
+                }
+
+                // the shifted contents may lie anywhere on the row
+                rowPairMask = fullMask;
+            }
+        }
+
+        mask = rowPairMask;
+        while (NativeRenderer_popDamagedColumns(nativeRenderer, &mask, &firstColumn, &lastColumn)) {
+            if (columnStep == 2) {
+                firstColumn &= ~(size_t) 1;
+                lastColumn = (lastColumn + 1) & ~(size_t) 1;
+            }
+
+            for (size_t j = firstColumn; j < lastColumn; j += columnStep) {
+                const size_t upperPxIndex = i * nativeRenderer->width + j;
+                const size_t lowerPxIndex = upperPxIndex + nativeRenderer->width;
+
+                const uint32_t upperColor = nativeRenderer->currentFrameBuffer[upperPxIndex];
+                const uint32_t lowerColor = nativeRenderer->currentFrameBuffer[lowerPxIndex];
+
+                const uint32_t prevUpperColor = nativeRenderer->previousFrameBuffer[upperPxIndex];
+                const uint32_t prevLowerColor = nativeRenderer->previousFrameBuffer[lowerPxIndex];
+
+                if (
+                    ! nativeRenderer->previousFrameBufferInvalidated &&
+                    upperColor == prevUpperColor &&
+                    lowerColor == prevLowerColor && (
+                        // the previous frame may not have been rendered in the same mode
+                        columnStep == 1 || (
+                            upperColor == nativeRenderer->previousFrameBuffer[upperPxIndex + 1] &&
+                            lowerColor == nativeRenderer->previousFrameBuffer[lowerPxIndex + 1]
+                        )
+                    )
+                ) {
+                    continue;
+                }
+
+                // the first two columns share the first terminal column, the second one hiding the first one
+                if (j == 0 && columnStep == 1) {
+                    NativeRenderer_commitCharacters(nativeRenderer, upperPxIndex, 1);
+
+                    continue;
+                }
+
+                // the characters covered by text are drawn by NativeRenderer_outputText()
+                if (textShown && NativeRenderer_isTextCovered(textCells, j, columnStep)) {
+                    NativeRenderer_commitCharacters(nativeRenderer, upperPxIndex, columnStep);
+
+                    continue;
+                }
+
+                if (changeThreshold > 0 || byteBudget > 0) {
+                    const uint32_t delta = NativeRenderer_getCharacterDelta(nativeRenderer, upperPxIndex, columnStep);
+
+                    // the budget left to the other characters is what the remaining priority ones will not need
+                    const int underThreshold = changeThreshold > 0 && delta <= changeThreshold;
+                    const int overBudget = byteBudget > 0 && delta < priorityDelta && (
+                        deferring || band->outputLength + priorityCount * characterOutputSize > byteBudget
+                    );
+
+                    if (underThreshold || overBudget) {
+                        if (overBudget && ! deferring) {
+                            deferring = 1;
+                            band->roundRobinRow = i;
+                        }
+
+                        deferredMask |= NativeRenderer_getDamageMask(damage, j, j + columnStep);
+                        deferredCharacterCount += columnStep;
+
+                        continue;
+                    }
+
+                    if (delta >= priorityDelta && priorityCount > 0) {
+                        priorityCount--;
+                    }
+                }
+
+                char * cursor = NativeRenderer_reserveOutput(band, NATIVE_RENDERER_MAX_CELL_OUTPUT_SIZE);
+                if (! cursor) {
+                    updatedCharacterCount += columnStep;
+                    band->outputTruncated = 1;
+                    lastPxCol = nativeRenderer->width;
+
+                    continue;
+                }
+
+                if (j >= 2 && lastPxCol != nativeRenderer->width && lastPxCol >= 1 && lastPxCol != j - 1) {
+                    // the cursor is on the same row, a relative move is always shorter than an absolute one
+                    const size_t gap = j - lastPxCol - 1;
+
+                    cursor = NativeRenderer_encodeString(cursor, "\033[", 2);
+                    if (gap > 1) {
+                        cursor = NativeRenderer_encodeDecimal(cursor, gap);
+                    }
+
+                    *cursor++ = 'C';
+                } else if (j <= 1 || lastPxCol != j - 1) {
+                    cursor = NativeRenderer_encodeString(cursor, "\033[", 2);
+                    cursor = NativeRenderer_encodeDecimal(cursor, i / 2);
+                    *cursor++ = ';';
+                    cursor = NativeRenderer_encodeDecimal(cursor, j);
+                    *cursor++ = 'H';
+                }
+
+                // the uniform characters are encoded as spaces, only their background color matters, so that their
+                // foreground color is left as is, even unknown, whatever the band count
+                const int spaceEncoded = upperColor == lowerColor;
+
+                const int64_t sgrLowerColor = trueColorModeEnabled
+                    ? (int64_t) lowerColor
+                    : NativeRenderer_getColorTableIndex(quantizer, lowerColor);
+                const int64_t sgrUpperColor = spaceEncoded ? lastUpperColor : (
+                    trueColorModeEnabled ? (int64_t) upperColor : NativeRenderer_getColorTableIndex(quantizer, upperColor)
+                );
+
+                // the SGR sequences encoded against the colors left by the previous bands are recorded, see
+                // NativeRenderer_update(): the first one, then the first one setting the foreground color, if another
+                const int firstSgr = ! firstSgrEncoded;
+                const int foregroundSgr = firstSgrEncoded && lastUpperColor == -1 && sgrUpperColor != -1;
+
+                if (firstSgr) {
+                    band->firstSgrOffset = cursor - band->outputBuffer;
+                    band->firstSgrUpperColor = sgrUpperColor;
+                    band->firstSgrLowerColor = sgrLowerColor;
+                } else if (foregroundSgr) {
+                    band->foregroundSgrOffset = cursor - band->outputBuffer;
+                    band->foregroundSgrUpperColor = sgrUpperColor;
+                    band->foregroundSgrLowerColor = sgrLowerColor;
+                    band->foregroundSgrLastLowerColor = lastLowerColor;
+                }
+
+                cursor = NativeRenderer_encodeSgr(cursor, trueColorModeEnabled, sgrUpperColor, sgrLowerColor, lastUpperColor, lastLowerColor);
+
+                if (firstSgr) {
+                    band->firstSgrLength = cursor - band->outputBuffer - band->firstSgrOffset;
+                    firstSgrEncoded = 1;
+                } else if (foregroundSgr) {
+                    band->foregroundSgrLength = cursor - band->outputBuffer - band->foregroundSgrOffset;
+                }
+
+                lastUpperColor = sgrUpperColor;
+                lastLowerColor = sgrLowerColor;
+
+                // the following characters of the same colors are part of the run, whether they have changed or not,
+                // except from the first column, which shares its terminal column with the second one, and, at full
+                // resolution, up to the text
+                size_t runEnd = j + columnStep;
+                size_t runChangedCount = columnStep;
+                while (
+                    j > 0 &&
+                    runEnd < lastColumn &&
+                    (columnStep == 2 || ! textShown || ! textCells[runEnd]) &&
+                    nativeRenderer->currentFrameBuffer[upperPxIndex + runEnd - j] == upperColor &&
+                    nativeRenderer->currentFrameBuffer[lowerPxIndex + runEnd - j] == lowerColor
+                ) {
+                    runChangedCount += nativeRenderer->previousFrameBufferInvalidated
+                        || nativeRenderer->previousFrameBuffer[upperPxIndex + runEnd - j] != upperColor
+                        || nativeRenderer->previousFrameBuffer[lowerPxIndex + runEnd - j] != lowerColor;
+                    runEnd++;
+                }
+
+                const size_t runLength = runEnd - j;
+                const char * glyph = spaceEncoded ? " " : "▀";
+                const size_t glyphLength = spaceEncoded ? 1 : sizeof "▀" - 1;
+                const char * glyphStart = cursor;
+
+                // the runs are only worth it when they are mostly made of changed characters
+                if (nativeRenderer->repeatSequencesEnabled && (runChangedCount - 1) * glyphLength > NATIVE_RENDERER_MIN_REPEATED_RUN_SIZE) {
+                    cursor = NativeRenderer_encodeString(cursor, glyph, glyphLength);
+                    cursor = NativeRenderer_encodeString(cursor, "\033[", 2);
+                    cursor = NativeRenderer_encodeDecimal(cursor, runLength - 1);
+                    *cursor++ = 'b';
+
+                    lastPxCol = runEnd - 1;
+                } else if (spaceEncoded && runChangedCount >= NATIVE_RENDERER_MIN_ERASED_RUN_LENGTH) {
+                    // the erased characters take the current background color, and the cursor does not move
+                    cursor = NativeRenderer_encodeString(cursor, "\033[", 2);
+                    cursor = NativeRenderer_encodeDecimal(cursor, runLength);
+                    *cursor++ = 'X';
+
+                    // the first columns are always addressed absolutely
+                    lastPxCol = j >= 2 ? j - 1 : nativeRenderer->width;
+                } else {
+                    runEnd = j + columnStep;
+                    runChangedCount = columnStep;
+
+                    // the first pair of columns is a single character, see above
+                    for (size_t k = j == 0 ? 1 : 0; k < columnStep; k++) {
+                        cursor = NativeRenderer_encodeString(cursor, glyph, glyphLength);
+                    }
+
+                    lastPxCol = runEnd - 1;
+                }
+
+                NativeRenderer_commitCharacters(nativeRenderer, upperPxIndex, runEnd - j);
+
+                if (textShown) {
+                    // the overwritten text is drawn again
+                    const size_t firstTextColumn = j > 0 ? j : 1;
+                    memset(previousTextCells + firstTextColumn, 0, (runEnd - firstTextColumn) * sizeof(uint64_t));
+                }
+
+                updatedCharacterCount += runChangedCount;
+                savedByteCount += runChangedCount * (sizeof "▀" - 1) - (cursor - glyphStart);
+
+                // the run's last character is skipped by the loop increment
+                j = runEnd - columnStep;
+
+                band->outputLength = cursor - band->outputBuffer;
+            }
+        }
+
+        damage->previousRowMasks[i] = damage->currentRowMasks[i] | deferredMask;
+        damage->previousRowMasks[i + 1] = damage->currentRowMasks[i + 1] | deferredMask;
+    }
+
+    band->updatedCharacterCount = updatedCharacterCount;
+    band->deferredCharacterCount = deferredCharacterCount;
+    band->savedByteCount = savedByteCount;
+
+    if (updatedCharacterCount > 0) {
+        band->characterOutputSize = (double) band->outputLength / updatedCharacterCount;
+    }
+    band->lastSgrUpperColor = lastUpperColor;
+    band->lastSgrLowerColor = lastLowerColor;
+
+    band->stageTimes[NATIVE_RENDERER_STAGE_ENCODING] = NativeRenderer_getTime() - startTime;
+}
+
+/*
+ * Makes room for size more bytes in the graphics output and returns the write cursor,
+ * or NULL if the output cannot grow.
+ */
+static char * NativeRenderer_reserveGraphicsOutput(NativeRendererGraphics * graphics, size_t size)
+{
+    if (graphics->outputLength + size > graphics->outputSize) {
+        size_t outputSize = 2 * graphics->outputSize;
+        if (outputSize < graphics->outputLength + size) {
+            outputSize = graphics->outputLength + size;
+        }
+
+        char * output = realloc(graphics->output, outputSize);
+        if (! output) {
+            return NULL;
+        }
+
+        graphics->output = output;
+        graphics->outputSize = outputSize;
+    }
+
+    return graphics->output + graphics->outputLength;
+}
+
+static char * NativeRenderer_encodeBase64(char * cursor, const uint8_t * data, size_t size)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    size_t i = 0;
+    for (; i + 3 <= size; i += 3) {
+        const uint32_t bits = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+
+        *cursor++ = alphabet[bits >> 18];
+        *cursor++ = alphabet[(bits >> 12) & 0x3f];
+        *cursor++ = alphabet[(bits >> 6) & 0x3f];
+        *cursor++ = alphabet[bits & 0x3f];
+    }
+
+    if (i < size) {
+        const uint32_t bits = (data[i] << 16) | (i + 1 < size ? data[i + 1] << 8 : 0);
+
+        *cursor++ = alphabet[bits >> 18];
+        *cursor++ = alphabet[(bits >> 12) & 0x3f];
+        *cursor++ = i + 1 < size ? alphabet[(bits >> 6) & 0x3f] : '=';
+        *cursor++ = '=';
+    }
+
+    return cursor;
+}
+
+/*
+ * Transmits the RGB pixels of the given frame buffer area, as the payload of a graphics command starting with the
+ * given keys. Returns 0 if the pixels cannot be transmitted, in which case nothing is added to the output.
+ */
+static int NativeRenderer_uploadGraphicsArea(
+    NativeRenderer * nativeRenderer,
+    const char * keys,
+    size_t keysLength,
+    size_t x,
+    size_t y,
+    size_t areaWidth,
+    size_t areaHeight
+) {
+    NativeRendererGraphics * graphics = nativeRenderer->graphics;
+    const int direct = graphics->medium == NATIVE_RENDERER_GRAPHICS_MEDIUM_DIRECT;
+    const size_t size = 3 * areaWidth * areaHeight;
+
+    char path[NATIVE_RENDERER_GRAPHICS_OBJECT_PATH_SIZE];
+    uint8_t * pixels;
+
+    if (direct) {
+        if (size > graphics->pixelsSize) {
+            uint8_t * newPixels = realloc(graphics->pixels, size);
+            if (! newPixels) {
+                return 0;
+            }
+
+            graphics->pixels = newPixels;
+            graphics->pixelsSize = size;
+        }
+
+        pixels = graphics->pixels;
+    } else if (! (pixels = NativeRenderer_createGraphicsObject(graphics, size, path))) {
+        return 0;
+    }
+
+    uint8_t * pixelCursor = pixels;
+    for (size_t i = y; i < y + areaHeight; i++) {
+        const uint32_t * colors = &nativeRenderer->currentFrameBuffer[i * nativeRenderer->width + x];
+
+        for (size_t j = 0; j < areaWidth; j++) {
+            *pixelCursor++ = colors[j] >> 16;
+            *pixelCursor++ = colors[j] >> 8;
+            *pixelCursor++ = colors[j];
+        }
+    }
+
+    const size_t payloadSize = direct ? size : strlen(path);
+    const size_t chunkCount = (4 * ((payloadSize + 2) / 3) + NATIVE_RENDERER_GRAPHICS_CHUNK_SIZE - 1) / NATIVE_RENDERER_GRAPHICS_CHUNK_SIZE;
+
+    char * cursor = NativeRenderer_reserveGraphicsOutput(
+        graphics,
+        keysLength + 64 + 4 * ((payloadSize + 2) / 3) + 16 * chunkCount
+    );
+
+    if (! direct) {
+        munmap(pixels, size);
+    }
+
+    if (! cursor) {
+        return 0;
+    }
+
+    cursor = NativeRenderer_encodeString(cursor, "\033_G", 3);
+    cursor = NativeRenderer_encodeString(cursor, keys, keysLength);
+    cursor = NativeRenderer_encodeString(cursor, ",f=24,q=2,t=", sizeof ",f=24,q=2,t=" - 1);
+
+    if (! direct) {
+        *cursor++ = graphics->medium == NATIVE_RENDERER_GRAPHICS_MEDIUM_SHARED_MEMORY ? 's' : 't';
+        cursor = NativeRenderer_encodeString(cursor, ",S=", 3);
+        cursor = NativeRenderer_encodeDecimal(cursor, size);
+        *cursor++ = ';';
+
+        // the shared memory objects are named relatively to /dev/shm
+        const size_t nameOffset = graphics->medium == NATIVE_RENDERER_GRAPHICS_MEDIUM_SHARED_MEMORY ? sizeof "/dev/shm/" - 1 : 0;
+        cursor = NativeRenderer_encodeBase64(cursor, (const uint8_t *) path + nameOffset, payloadSize - nameOffset);
+        cursor = NativeRenderer_encodeString(cursor, "\033\\", 2);
+    } else {
+        *cursor++ = 'd';
+
+        // a chunk of CHUNK_SIZE base64 bytes encodes 3/4 as many pixel bytes
+        const size_t chunkPayloadSize = 3 * NATIVE_RENDERER_GRAPHICS_CHUNK_SIZE / 4;
+
+        for (size_t offset = 0; offset < size; offset += chunkPayloadSize) {
+            const size_t chunkSize = size - offset < chunkPayloadSize ? size - offset : chunkPayloadSize;
+
+            if (offset > 0) {
+                cursor = NativeRenderer_encodeString(cursor, "\033_Gq=2", 6);
+            }
+
+            cursor = NativeRenderer_encodeString(cursor, offset + chunkSize < size ? ",m=1;" : ",m=0;", 5);
+            cursor = NativeRenderer_encodeBase64(cursor, pixels + offset, chunkSize);
+            cursor = NativeRenderer_encodeString(cursor, "\033\\", 2);
+        }
+    }
+
+    graphics->outputLength = cursor - graphics->output;
+    graphics->uploadedPixelCount += areaWidth * areaHeight;
+
+    return 1;
+}
+
+/*
+ * Encodes the frame as graphics commands: the whole image when it is not displayed yet, its changed tiles otherwise.
+ * The previous frame buffer then mirrors the image instead of the character cells.
+ * Returns 0 if the frame cannot be transmitted, in which case the image is deleted.
+ */
+static int NativeRenderer_encodeGraphics(NativeRenderer * nativeRenderer)
+{
+    NativeRendererGraphics * graphics = nativeRenderer->graphics;
+    NativeRendererDamage * damage = nativeRenderer->damage;
+    const size_t width = nativeRenderer->width;
+    const size_t height = nativeRenderer->height;
+
+    char keys[256];
+    char * cursor;
+
+    graphics->outputLength = 0;
+    graphics->uploadedPixelCount = 0;
+
+    if (nativeRenderer->previousFrameBufferInvalidated || ! graphics->imageTransmitted) {
+        if (! (cursor = NativeRenderer_reserveGraphicsOutput(graphics, 128))) {
+            goto error;
+        }
+
+        if (graphics->imageTransmitted) {
+            cursor = NativeRenderer_encodeString(
+                cursor,
+                NATIVE_RENDERER_GRAPHICS_DELETION_COMMAND,
+                sizeof NATIVE_RENDERER_GRAPHICS_DELETION_COMMAND - 1
+            );
+
+            graphics->imageTransmitted = 0;
+        }
+
+        // the image is drawn below the glyphs, so that the character cells are erased first
+        cursor = NativeRenderer_encodeString(cursor, "\033[49m\033[2J\033[1;1H", sizeof "\033[49m\033[2J\033[1;1H" - 1);
+        graphics->outputLength = cursor - graphics->output;
+
+        // as with the characters, the first column and the first row pair are hidden, see NativeRenderer_runUpdateJob()
+        cursor = NativeRenderer_encodeString(keys, "a=T,i=" NATIVE_RENDERER_GRAPHICS_IMAGE_ID ",p=1,s=", sizeof "a=T,i=" NATIVE_RENDERER_GRAPHICS_IMAGE_ID ",p=1,s=" - 1);
+        cursor = NativeRenderer_encodeDecimal(cursor, width);
+        cursor = NativeRenderer_encodeString(cursor, ",v=", 3);
+        cursor = NativeRenderer_encodeDecimal(cursor, height);
+        cursor = NativeRenderer_encodeString(cursor, ",x=1,y=2,w=", sizeof ",x=1,y=2,w=" - 1);
+        cursor = NativeRenderer_encodeDecimal(cursor, width - 1);
+        cursor = NativeRenderer_encodeString(cursor, ",h=", 3);
+        cursor = NativeRenderer_encodeDecimal(cursor, height - 2);
+        cursor = NativeRenderer_encodeString(cursor, ",c=", 3);
+        cursor = NativeRenderer_encodeDecimal(cursor, width - 1);
+        cursor = NativeRenderer_encodeString(cursor, ",r=", 3);
+        cursor = NativeRenderer_encodeDecimal(cursor, height / 2 - 1);
+        cursor = NativeRenderer_encodeString(cursor, ",C=1,z=-1", sizeof ",C=1,z=-1" - 1);
+
+        if (! NativeRenderer_uploadGraphicsArea(nativeRenderer, keys, cursor - keys, 0, 0, width, height)) {
+            goto error;
+        }
+
+        graphics->imageTransmitted = 1;
+
+        memcpy(nativeRenderer->previousFrameBuffer, nativeRenderer->currentFrameBuffer, nativeRenderer->pixelCount * sizeof(uint32_t));
+        memcpy(damage->previousRowMasks, damage->currentRowMasks, height * sizeof(uint64_t));
+
+        return 1;
+    }
+
+    for (size_t tileRow = 0; tileRow < height; tileRow += NATIVE_RENDERER_GRAPHICS_TILE_HEIGHT) {
+        const size_t tileHeight = height - tileRow < NATIVE_RENDERER_GRAPHICS_TILE_HEIGHT
+            ? height - tileRow
+            : NATIVE_RENDERER_GRAPHICS_TILE_HEIGHT;
+
+        memset(graphics->changedTiles, 0, graphics->tileColumnCount);
+
+        for (size_t i = tileRow; i < tileRow + tileHeight; i++) {
+            uint64_t mask = damage->currentRowMasks[i] | damage->previousRowMasks[i];
+            size_t firstColumn, lastColumn;
+
+            while (NativeRenderer_popDamagedColumns(nativeRenderer, &mask, &firstColumn, &lastColumn)) {
+                const uint32_t * currentColors = &nativeRenderer->currentFrameBuffer[i * width];
+                uint32_t * previousColors = &nativeRenderer->previousFrameBuffer[i * width];
+
+                for (size_t tile = firstColumn / NATIVE_RENDERER_GRAPHICS_TILE_WIDTH; tile * NATIVE_RENDERER_GRAPHICS_TILE_WIDTH < lastColumn; tile++) {
+                    if (graphics->changedTiles[tile]) {
+                        continue;
+                    }
+
+                    const size_t first = tile * NATIVE_RENDERER_GRAPHICS_TILE_WIDTH > firstColumn ? tile * NATIVE_RENDERER_GRAPHICS_TILE_WIDTH : firstColumn;
+                    const size_t last = (tile + 1) * NATIVE_RENDERER_GRAPHICS_TILE_WIDTH < lastColumn ? (tile + 1) * NATIVE_RENDERER_GRAPHICS_TILE_WIDTH : lastColumn;
+
+                    graphics->changedTiles[tile] = memcmp(currentColors + first, previousColors + first, (last - first) * sizeof(uint32_t)) != 0;
+                }
+
+                memcpy(previousColors + firstColumn, currentColors + firstColumn, (lastColumn - firstColumn) * sizeof(uint32_t));
+            }
+
+            damage->previousRowMasks[i] = damage->currentRowMasks[i];
+        }
+
+        for (size_t tile = 0; tile < graphics->tileColumnCount;) {
+            if (! graphics->changedTiles[tile]) {
+                tile++;
+
+                continue;
+            }
+
+            size_t tileRunEnd = tile + 1;
+            while (tileRunEnd < graphics->tileColumnCount && graphics->changedTiles[tileRunEnd]) {
+                tileRunEnd++;
+            }
+
+            const size_t x = tile * NATIVE_RENDERER_GRAPHICS_TILE_WIDTH;
+            const size_t areaWidth = (tileRunEnd * NATIVE_RENDERER_GRAPHICS_TILE_WIDTH < width ? tileRunEnd * NATIVE_RENDERER_GRAPHICS_TILE_WIDTH : width) - x;
+
+            // edits the image's root frame
+            cursor = NativeRenderer_encodeString(keys, "a=f,r=1,i=" NATIVE_RENDERER_GRAPHICS_IMAGE_ID ",x=", sizeof "a=f,r=1,i=" NATIVE_RENDERER_GRAPHICS_IMAGE_ID ",x=" - 1);
+            cursor = NativeRenderer_encodeDecimal(cursor, x);
+            cursor = NativeRenderer_encodeString(cursor, ",y=", 3);
+            cursor = NativeRenderer_encodeDecimal(cursor, tileRow);
+            cursor = NativeRenderer_encodeString(cursor, ",s=", 3);
+            cursor = NativeRenderer_encodeDecimal(cursor, areaWidth);
+            cursor = NativeRenderer_encodeString(cursor, ",v=", 3);
+            cursor = NativeRenderer_encodeDecimal(cursor, tileHeight);
+
+            if (! NativeRenderer_uploadGraphicsArea(nativeRenderer, keys, cursor - keys, x, tileRow, areaWidth, tileHeight)) {
+                goto error;
+            }
+
+            tile = tileRunEnd;
+        }
+    }
+
+    return 1;
+
+    error:
+        if (graphics->imageTransmitted && (cursor = NativeRenderer_reserveGraphicsOutput(graphics, sizeof NATIVE_RENDERER_GRAPHICS_DELETION_COMMAND))) {
+            cursor = NativeRenderer_encodeString(
+                cursor,
+                NATIVE_RENDERER_GRAPHICS_DELETION_COMMAND,
+                sizeof NATIVE_RENDERER_GRAPHICS_DELETION_COMMAND - 1
+            );
+
+            graphics->outputLength = cursor - graphics->output;
+        }
+
+        graphics->imageTransmitted = 0;
+
+        return 0;
+}
+
+/*
+ * Writes the text cells which differ from the terminal, once the characters below them have been written, line by
+ * line. The cells whose text has been removed are drawn by the bands, except on the status lines and with the
+ * graphics output, where they are erased. Returns the number of written cells.
+ */
+static size_t NativeRenderer_outputText(NativeRenderer * nativeRenderer, int64_t trueColorModeEnabled)
+{
+    NativeRendererText * text = nativeRenderer->text;
+    const NativeRendererQuantizer * quantizer = nativeRenderer->quantizer;
+    const size_t width = nativeRenderer->width;
+
+    size_t writtenCellCount = 0;
+
+    // the terminal's SGR state is unknown once the bands' output has been written
+    int64_t lastColor = -1, lastBackgroundColor = -1;
+
+    for (size_t line = 1; line < text->lineCount; line++) {
+        if (! text->currentLineFlags[line] && ! text->previousLineFlags[line]) {
+            continue;
+        }
+
+        const uint64_t * cells = text->currentCells + line * width;
+        uint64_t * previousCells = text->previousCells + line * width;
+        char * cursor = text->lineOutput;
+        size_t lastColumn = 0;
+
+        for (size_t j = 1; j < width; j++) {
+            const uint64_t cell = cells[j];
+
+            if (cell == 0 ? previousCells[j] == 0 : cell == previousCells[j] && ! nativeRenderer->previousFrameBufferInvalidated) {
+                continue;
+            }
+
+            if (lastColumn != j - 1 || lastColumn == 0) {
+                cursor = NativeRenderer_encodeString(cursor, "\033[", 2);
+                cursor = NativeRenderer_encodeDecimal(cursor, line);
+                *cursor++ = ';';
+                cursor = NativeRenderer_encodeDecimal(cursor, j);
+                *cursor++ = 'H';
+            }
+
+            if (cell == 0) {
+                if (lastBackgroundColor != -1) {
+                    cursor = NativeRenderer_encodeString(cursor, "\033[49m", 5);
+                    lastBackgroundColor = -1;
+                }
+
+                *cursor++ = ' ';
+            } else {
+                const uint32_t color = (cell >> 24) & 0xffffff;
+                const uint32_t backgroundColor = cell & 0xffffff;
+
+                const int64_t sgrColor = trueColorModeEnabled
+                    ? (int64_t) color
+                    : NativeRenderer_getColorTableIndex(quantizer, color);
+                const int64_t sgrBackgroundColor = trueColorModeEnabled
+                    ? (int64_t) backgroundColor
+                    : NativeRenderer_getColorTableIndex(quantizer, backgroundColor);
+
+                cursor = NativeRenderer_encodeSgr(cursor, trueColorModeEnabled, sgrColor, sgrBackgroundColor, lastColor, lastBackgroundColor);
+                lastColor = sgrColor;
+                lastBackgroundColor = sgrBackgroundColor;
+
+                *cursor++ = cell >> 48;
+            }
+
+            previousCells[j] = cell;
+            lastColumn = j;
+            writtenCellCount++;
+        }
+
+        text->previousLineFlags[line] = text->currentLineFlags[line];
+
+        if (cursor != text->lineOutput) {
+            php_output_write(text->lineOutput, cursor - text->lineOutput);
+            nativeRenderer->outputByteCount += cursor - text->lineOutput;
+        }
+    }
+
+    return writtenCellCount;
+}
+
+size_t NativeRenderer_update(
+    NativeRenderer * nativeRenderer,
+    int64_t trueColorModeEnabled,
+    int64_t persistenceEffectsEnabled,
+    int64_t persistenceAlphaDecrease,
+    int64_t removedColorDepthBits,
+    int64_t lowResolutionMode,
+    int64_t orderedDitheringEnabled,
+    int64_t changeThreshold,
+    int64_t outputByteBudget
+) {
+    const NativeRendererJob job = {
+        .run = NativeRenderer_runUpdateJob,
+        .trueColorModeEnabled = trueColorModeEnabled,
+        .persistenceEffectsEnabled = persistenceEffectsEnabled,
+        .persistenceAlphaDecrease = persistenceAlphaDecrease,
+        .removedColorDepthBits = removedColorDepthBits,
+        .lowResolutionMode = lowResolutionMode,
+        .changeThreshold = changeThreshold,
+        .outputByteBudget = outputByteBudget,
+    };
+
+    if (nativeRenderer->capture) {
+        const NativeRendererCapturedUpdate update = {
+            .trueColorModeEnabled = trueColorModeEnabled,
+            .persistenceEffectsEnabled = persistenceEffectsEnabled,
+            .persistenceAlphaDecrease = persistenceAlphaDecrease,
+            .removedColorDepthBits = removedColorDepthBits,
+            .lowResolutionMode = lowResolutionMode,
+            .orderedDitheringEnabled = orderedDitheringEnabled,
+            .changeThreshold = changeThreshold,
+            .outputByteBudget = outputByteBudget,
+        };
+
+        NativeRenderer_writeCaptureRecord(nativeRenderer->capture, NATIVE_RENDERER_CAPTURE_UPDATE, &update, sizeof update);
+    }
+
+    NativeRendererDamage * damage = nativeRenderer->damage;
+
+    NativeRenderer_prepareQuantizer(nativeRenderer->quantizer, removedColorDepthBits, orderedDitheringEnabled);
+
+    // the color reduction alters every pixel which is not black, including the undamaged ones
+    if (removedColorDepthBits > 0 && (damage->clearColor & 0xffffff) != 0) {
+        const uint64_t fullMask = NativeRenderer_getDamageMask(damage, 0, nativeRenderer->width);
+        for (size_t i = 0; i < nativeRenderer->height; i++) {
+            damage->currentRowMasks[i] = fullMask;
+        }
+    }
+
+    NativeRenderer_runJob(nativeRenderer, &job);
+
+    NativeRendererProfiler * profiler = nativeRenderer->profiler;
+
+    // the bands run concurrently, so that the slowest one gives the duration of each stage
+    for (size_t i = 0; i < nativeRenderer->bandCount; i++) {
+        const NativeRendererBand * band = &nativeRenderer->bands[i];
+
+        for (size_t stage = NATIVE_RENDERER_STAGE_PERSISTENCE; stage <= NATIVE_RENDERER_STAGE_ENCODING; stage++) {
+            if (band->stageTimes[stage] > profiler->frameStageTimes[stage]) {
+                profiler->frameStageTimes[stage] = band->stageTimes[stage];
+            }
+        }
+    }
+
+    // the whole frame is needed to find the changed tiles, so that the graphics output is encoded serially
+    int graphicsOutputFailed = 0;
+
+    if (nativeRenderer->graphics) {
+        const double encodingStartTime = NativeRenderer_getTime();
+        graphicsOutputFailed = ! NativeRenderer_encodeGraphics(nativeRenderer);
+        NativeRenderer_addStageTime(nativeRenderer, NATIVE_RENDERER_STAGE_ENCODING, encodingStartTime);
+    }
+
+    const double outputStartTime = NativeRenderer_getTime();
+
+    size_t updatedCharacterCount = 0;
+    size_t deferredCharacterCount = 0;
+    size_t savedByteCount = 0;
+    int outputTruncated = 0;
+
+    nativeRenderer->outputByteCount = 0;
+
+    // the bands' outputs are joined in order, each band's first SGR sequence being re-encoded against
+    // the terminal state left by the previous bands, so that the output does not depend on the band count
+    int64_t lastUpperColor = -1, lastLowerColor = -1;
+
+    for (size_t i = 0; i < nativeRenderer->bandCount; i++) {
+        const NativeRendererBand * band = &nativeRenderer->bands[i];
+
+        updatedCharacterCount += band->updatedCharacterCount;
+        deferredCharacterCount += band->deferredCharacterCount;
+        savedByteCount += band->savedByteCount;
+        outputTruncated |= band->outputTruncated;
+
+        if (band->outputLength == 0) {
+            continue;
+        }
+
+        char sgr[NATIVE_RENDERER_MAX_CELL_OUTPUT_SIZE];
+        size_t offset = 0;
+        nativeRenderer->outputByteCount += band->outputLength;
+
+        if (band->firstSgrLength > 0) {
+            const size_t sgrLength = NativeRenderer_encodeSgr(
+                sgr,
+                trueColorModeEnabled,
+                band->firstSgrUpperColor,
+                band->firstSgrLowerColor,
+                lastUpperColor,
+                band->firstSgrAfterBackgroundReset ? -1 : lastLowerColor
+            ) - sgr;
+
+            php_output_write(band->outputBuffer, band->firstSgrOffset);
+            php_output_write(sgr, sgrLength);
+
+            offset = band->firstSgrOffset + band->firstSgrLength;
+            nativeRenderer->outputByteCount += sgrLength - band->firstSgrLength;
+        }
+
+        // the foreground color is still the one left by the previous bands there
+        if (band->foregroundSgrLength > 0) {
+            const size_t sgrLength = NativeRenderer_encodeSgr(
+                sgr,
+                trueColorModeEnabled,
+                band->foregroundSgrUpperColor,
+                band->foregroundSgrLowerColor,
+                lastUpperColor,
+                band->foregroundSgrLastLowerColor
+            ) - sgr;
+
+            php_output_write(band->outputBuffer + offset, band->foregroundSgrOffset - offset);
+            php_output_write(sgr, sgrLength);
+
+            offset = band->foregroundSgrOffset + band->foregroundSgrLength;
+            nativeRenderer->outputByteCount += sgrLength - band->foregroundSgrLength;
+        }
+
+        php_output_write(band->outputBuffer + offset, band->outputLength - offset);
+
+        // a band which never set a color leaves the previous one
+        if (band->lastSgrUpperColor != -1) {
+            lastUpperColor = band->lastSgrUpperColor;
+        }
+
+        if (band->firstSgrLength > 0 || band->firstSgrAfterBackgroundReset) {
+            lastLowerColor = band->lastSgrLowerColor;
+        }
+    }
+
+    if (nativeRenderer->graphics) {
+        NativeRendererGraphics * graphics = nativeRenderer->graphics;
+
+        php_output_write(graphics->output, graphics->outputLength);
+
+        nativeRenderer->outputByteCount += graphics->outputLength;
+        // each character cell shows 2 pixels
+        updatedCharacterCount += graphics->uploadedPixelCount / 2;
+
+        // back to the text output, from the next frame on
+        if (graphicsOutputFailed) {
+            NativeRenderer_destroyGraphics(nativeRenderer);
+            outputTruncated = 1;
+        }
+    }
+
+    // the text is written last, over the characters or the image
+    updatedCharacterCount += NativeRenderer_outputText(nativeRenderer, trueColorModeEnabled);
+
+    // with an asynchronous presentation, the output is handed over to the presenter once the frame is complete
+    if (! nativeRenderer->presenter) {
+        php_output_flush();
+        profiler->flushCount++;
     }
 
-    nativeRenderer->width = width;
-    nativeRenderer->height = height;
-    nativeRenderer->pixelCount = nativeRenderer->width * nativeRenderer->height;
+    // an incomplete output leaves the terminal out of sync, so that the next update redraws everything
+    nativeRenderer->previousFrameBufferInvalidated = outputTruncated;
 
-    nativeRenderer->currentFrameBuffer = malloc(nativeRenderer->pixelCount * sizeof(int64_t));
-    nativeRenderer->previousFrameBuffer = malloc(nativeRenderer->pixelCount * sizeof(int64_t));
-    nativeRenderer->persistenceBuffer = malloc(nativeRenderer->pixelCount * sizeof(int64_t));
+    NativeRenderer_addStageTime(nativeRenderer, NATIVE_RENDERER_STAGE_OUTPUT, outputStartTime);
 
-    nativeRenderer->drawnBitmapPixelCount = 0;
+    profiler->blendedPixelCount += nativeRenderer->drawnBitmapPixelCount;
+    profiler->changedCharacterCount += updatedCharacterCount;
+    profiler->emittedByteCount += nativeRenderer->outputByteCount;
+    profiler->savedByteCount += savedByteCount;
+    profiler->deferredCharacterCount += deferredCharacterCount;
+
+    NativeRenderer_recordProfiledFrame(nativeRenderer);
+
+    return updatedCharacterCount;
+}
+
+/*
+ * Particles
+ *
+ * Short-lived animated sprites (smoke, stars...) which are simulated and drawn in bulk, without any per-particle
+ * PHP object. The particles are kept in emission order, so that they are drawn in this order.
+ */
+
+#define NATIVE_RENDERER_MAX_PARTICLE_TYPE_COUNT 64
+
+// a particle which has never entered the screen expires after this time (see GameObject::update())
+#define NATIVE_RENDERER_PARTICLE_MAX_OFF_SCREEN_TIME 5
+
+typedef struct NativeRendererParticleTypes {
+    NativeRendererParticleType types[NATIVE_RENDERER_MAX_PARTICLE_TYPE_COUNT];
+    size_t typeCount;
+    // the distortion offsets of the prepared draw commands
+    int64_t * drawArguments;
+    size_t drawArgumentCapacity;
+} NativeRendererParticleTypes;
+
+NativeRendererParticleSystem * NativeRenderer_createParticleSystem(size_t capacity)
+{
+    NativeRendererParticleSystem * particleSystem = calloc(1, sizeof *particleSystem);
+    if (! particleSystem) {
+        goto error;
+    }
+
+    particleSystem->capacity = capacity;
 
     if (
-        ! nativeRenderer->currentFrameBuffer ||
-        ! nativeRenderer->previousFrameBuffer ||
-        ! nativeRenderer->persistenceBuffer
+        ! (particleSystem->types = malloc(capacity * sizeof *particleSystem->types)) ||
+        ! (particleSystem->posX = malloc(capacity * sizeof *particleSystem->posX)) ||
+        ! (particleSystem->posY = malloc(capacity * sizeof *particleSystem->posY)) ||
+        ! (particleSystem->spawnPosX = malloc(capacity * sizeof *particleSystem->spawnPosX)) ||
+        ! (particleSystem->spawnPosY = malloc(capacity * sizeof *particleSystem->spawnPosY)) ||
+        ! (particleSystem->dirX = malloc(capacity * sizeof *particleSystem->dirX)) ||
+        ! (particleSystem->dirY = malloc(capacity * sizeof *particleSystem->dirY)) ||
+        ! (particleSystem->velocities = malloc(capacity * sizeof *particleSystem->velocities)) ||
+        ! (particleSystem->spawnTimes = malloc(capacity * sizeof *particleSystem->spawnTimes)) ||
+        ! (particleSystem->lastStepTimes = malloc(capacity * sizeof *particleSystem->lastStepTimes)) ||
+        ! (particleSystem->durations = malloc(capacity * sizeof *particleSystem->durations)) ||
+        ! (particleSystem->brightnesses = malloc(capacity * sizeof *particleSystem->brightnesses)) ||
+        ! (particleSystem->blendingColors = malloc(capacity * sizeof *particleSystem->blendingColors)) ||
+        ! (particleSystem->randomStates = malloc(capacity * sizeof *particleSystem->randomStates)) ||
+        ! (particleSystem->enteredScreen = malloc(capacity * sizeof *particleSystem->enteredScreen)) ||
+        ! (particleSystem->commands = malloc(capacity * sizeof *particleSystem->commands)) ||
+        ! (particleSystem->commandTypes = malloc(capacity * sizeof *particleSystem->commandTypes)) ||
+        ! (particleSystem->commandFrameIndexes = malloc(capacity * sizeof *particleSystem->commandFrameIndexes)) ||
+        ! (particleSystem->particleTypes = calloc(1, sizeof *particleSystem->particleTypes))
     ) {
         goto error;
     }
 
-    NativeRenderer_reset(nativeRenderer);
-
-    return nativeRenderer;
+    return particleSystem;
 
     error:
-        NativeRenderer_destroy(nativeRenderer);
+        NativeRenderer_destroyParticleSystem(particleSystem);
 
         return NULL;
 }
 
-void NativeRenderer_destroy(NativeRenderer * nativeRenderer)
+void NativeRenderer_destroyParticleSystem(NativeRendererParticleSystem * particleSystem)
 {
-    if (nativeRenderer) {
-        free(nativeRenderer->currentFrameBuffer);
-        free(nativeRenderer->previousFrameBuffer);
-        free(nativeRenderer->persistenceBuffer);
+    if (particleSystem) {
+        free(particleSystem->types);
+        free(particleSystem->posX);
+        free(particleSystem->posY);
+        free(particleSystem->spawnPosX);
+        free(particleSystem->spawnPosY);
+        free(particleSystem->dirX);
+        free(particleSystem->dirY);
+        free(particleSystem->velocities);
+        free(particleSystem->spawnTimes);
+        free(particleSystem->lastStepTimes);
+        free(particleSystem->durations);
+        free(particleSystem->brightnesses);
+        free(particleSystem->blendingColors);
+        free(particleSystem->randomStates);
+        free(particleSystem->enteredScreen);
+        free(particleSystem->commands);
+        free(particleSystem->commandTypes);
+        free(particleSystem->commandFrameIndexes);
+
+        if (particleSystem->particleTypes) {
+            for (size_t i = 0; i < particleSystem->particleTypes->typeCount; i++) {
+                free(particleSystem->particleTypes->types[i].framePixels);
+            }
+
+            free(particleSystem->particleTypes->drawArguments);
+        }
+
+        free(particleSystem->particleTypes);
     }
 
-    free(nativeRenderer);
+    free(particleSystem);
 }
 
-void NativeRenderer_reset(NativeRenderer * nativeRenderer)
+int64_t NativeRenderer_addParticleType(NativeRendererParticleSystem * particleSystem, const NativeRendererParticleType * type)
 {
-    for (size_t i = 0; i < nativeRenderer->pixelCount; i++) {
-        nativeRenderer->currentFrameBuffer[i] = -1;
-        nativeRenderer->previousFrameBuffer[i] = -1;
-        nativeRenderer->persistenceBuffer[i] = 0;
+    NativeRendererParticleTypes * particleTypes = particleSystem->particleTypes;
+
+    if (
+        particleTypes->typeCount == NATIVE_RENDERER_MAX_PARTICLE_TYPE_COUNT ||
+        type->frameCount == 0 ||
+        type->width > NATIVE_RENDERER_KERNEL_MAX_BITMAP_WIDTH ||
+        type->alphaCurvePointCount > sizeof type->alphaCurveRatios / sizeof (double) ||
+        type->distortionCurvePointCount > sizeof type->distortionCurveRatios / sizeof (double)
+    ) {
+        return -1;
+    }
+
+    // the frame list is copied, the frames themselves must outlive the particle system
+    uint32_t ** framePixels = malloc(type->frameCount * sizeof *framePixels);
+    if (! framePixels) {
+        return -1;
+    }
+
+    memcpy(framePixels, type->framePixels, type->frameCount * sizeof *framePixels);
+
+    NativeRendererParticleType * addedType = &particleTypes->types[particleTypes->typeCount];
+    *addedType = *type;
+    addedType->framePixels = framePixels;
+
+    return particleTypes->typeCount++;
+}
+
+int64_t NativeRenderer_emitParticle(
+    NativeRendererParticleSystem * particleSystem,
+    size_t type,
+    double x,
+    double y,
+    double dirX,
+    double dirY,
+    double velocity,
+    double time,
+    double duration,
+    float brightness,
+    int64_t blendingColor,
+    uint64_t seed
+) {
+    if (particleSystem->particleCount == particleSystem->capacity || type >= particleSystem->particleTypes->typeCount) {
+        return 0;
     }
+
+    const size_t i = particleSystem->particleCount++;
+
+    particleSystem->types[i] = type;
+    particleSystem->posX[i] = x;
+    particleSystem->posY[i] = y;
+    particleSystem->spawnPosX[i] = x;
+    particleSystem->spawnPosY[i] = y;
+    particleSystem->dirX[i] = dirX;
+    particleSystem->dirY[i] = dirY;
+    particleSystem->velocities[i] = velocity;
+    particleSystem->spawnTimes[i] = time;
+    particleSystem->lastStepTimes[i] = time;
+    particleSystem->durations[i] = duration;
+    particleSystem->brightnesses[i] = brightness;
+    particleSystem->blendingColors[i] = blendingColor;
+    // xorshift64 does not support a null state
+    particleSystem->randomStates[i] = seed ? seed : 0x9e3779b97f4a7c15;
+    particleSystem->enteredScreen[i] = 0;
+
+    return 1;
 }
 
-void NativeRenderer_clear(NativeRenderer * nativeRenderer, int64_t color)
+// the distance covered after the given time by a particle which reaches its velocity within accelerationTime
+static inline double NativeRenderer_getParticleDistance(double velocity, double accelerationTime, double time)
 {
-    for (size_t i = 0; i < nativeRenderer->pixelCount; i++) {
-        nativeRenderer->currentFrameBuffer[i] = color;
+    if (time <= 0) {
+        return 0;
     }
 
-    nativeRenderer->drawnBitmapPixelCount = 0;
+    if (time < accelerationTime) {
+        return 0.5 * (velocity / accelerationTime) * time * time;
+    }
+
+    return velocity * (time - 0.5 * accelerationTime);
 }
 
-void NativeRenderer_drawBitmap(
-    NativeRenderer * nativeRenderer,
-    int64_t * bitmapPixels,
-    size_t bitmapWidth,
-    size_t bitmapHeight,
-    int64_t x,
-    int64_t y,
-    int64_t globalAlpha,
+static inline uint64_t NativeRenderer_nextParticleRandomState(uint64_t state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    return state;
+}
+
+static inline int NativeRenderer_isParticleOffScreen(
+    const NativeRendererParticleType * type,
+    double x,
+    double y,
+    size_t screenWidth,
+    size_t screenHeight
+) {
+    // same as AABox::intersectWith() with the screen rect
+    return
+        x - type->width / 2.0 > screenWidth ||
+        x + type->width / 2.0 < 0 ||
+        y - type->height / 2.0 > screenHeight ||
+        y + type->height / 2.0 < 0
+    ;
+}
+
+void NativeRenderer_updateParticles(
+    NativeRendererParticleSystem * particleSystem,
+    double time,
+    size_t screenWidth,
+    size_t screenHeight
+) {
+    const NativeRendererParticleType * types = particleSystem->particleTypes->types;
+    size_t particleCount = 0;
+
+    for (size_t i = 0; i < particleSystem->particleCount; i++) {
+        const NativeRendererParticleType * type = &types[particleSystem->types[i]];
+        const double age = time - particleSystem->spawnTimes[i];
+
+        double x = particleSystem->posX[i];
+        double y = particleSystem->posY[i];
+
+        const int offScreen = NativeRenderer_isParticleOffScreen(type, x, y, screenWidth, screenHeight);
+        if (
+            (particleSystem->enteredScreen[i] && ! type->wrapped && offScreen) ||
+            (! particleSystem->enteredScreen[i] && offScreen && age > NATIVE_RENDERER_PARTICLE_MAX_OFF_SCREEN_TIME) ||
+            age >= particleSystem->durations[i]
+        ) {
+            continue;
+        }
+
+        const double distance =
+            NativeRenderer_getParticleDistance(particleSystem->velocities[i], type->accelerationTime, age) -
+            NativeRenderer_getParticleDistance(
+                particleSystem->velocities[i],
+                type->accelerationTime,
+                particleSystem->lastStepTimes[i] - particleSystem->spawnTimes[i]
+            );
+
+        x += particleSystem->dirX[i] * distance;
+        y += particleSystem->dirY[i] * distance;
+
+        if (type->wrapped && x < 0) {
+            uint64_t randomState = NativeRenderer_nextParticleRandomState(particleSystem->randomStates[i]);
+
+            // a random row within [2, screenHeight - 3], as Star::doUpdate() does, the middle one if that range is empty
+            x = screenWidth - 1;
+            y = screenHeight > 4 ? 2 + (int64_t) (randomState % (screenHeight - 4)) : (int64_t) (screenHeight / 2);
+            particleSystem->randomStates[i] = randomState;
+        }
+
+        // the remaining particles are moved towards the beginning of the arrays, in order
+        particleSystem->types[particleCount] = particleSystem->types[i];
+        particleSystem->posX[particleCount] = x;
+        particleSystem->posY[particleCount] = y;
+        particleSystem->spawnPosX[particleCount] = particleSystem->spawnPosX[i];
+        particleSystem->spawnPosY[particleCount] = particleSystem->spawnPosY[i];
+        particleSystem->dirX[particleCount] = particleSystem->dirX[i];
+        particleSystem->dirY[particleCount] = particleSystem->dirY[i];
+        particleSystem->velocities[particleCount] = particleSystem->velocities[i];
+        particleSystem->spawnTimes[particleCount] = particleSystem->spawnTimes[i];
+        particleSystem->lastStepTimes[particleCount] = time;
+        particleSystem->durations[particleCount] = particleSystem->durations[i];
+        particleSystem->brightnesses[particleCount] = particleSystem->brightnesses[i];
+        particleSystem->blendingColors[particleCount] = particleSystem->blendingColors[i];
+        particleSystem->randomStates[particleCount] = particleSystem->randomStates[i];
+        particleSystem->enteredScreen[particleCount] =
+            particleSystem->enteredScreen[i] || ! NativeRenderer_isParticleOffScreen(type, x, y, screenWidth, screenHeight);
+
+        particleCount++;
+    }
+
+    particleSystem->particleCount = particleCount;
+}
+
+void NativeRenderer_clearParticles(NativeRendererParticleSystem * particleSystem)
+{
+    particleSystem->particleCount = 0;
+    particleSystem->commandCount = 0;
+}
+
+size_t NativeRenderer_countParticles(
+    const NativeRendererParticleSystem * particleSystem,
+    int64_t type,
+    int64_t group,
+    double areaX,
+    double areaY,
+    double areaSize
+) {
+    const NativeRendererParticleType * types = particleSystem->particleTypes->types;
+    const int64_t areaColumn = areaSize ? (int64_t) (areaX / areaSize) : 0;
+    const int64_t areaRow = areaSize ? (int64_t) (areaY / areaSize) : 0;
+    size_t count = 0;
+
+    for (size_t i = 0; i < particleSystem->particleCount; i++) {
+        count += (type < 0 || particleSystem->types[i] == type) &&
+            (group < 0 || types[particleSystem->types[i]].group == group) &&
+            (
+                ! areaSize || (
+                    (int64_t) (particleSystem->spawnPosX[i] / areaSize) == areaColumn &&
+                    (int64_t) (particleSystem->spawnPosY[i] / areaSize) == areaRow
+                )
+            )
+        ;
+    }
+
+    return count;
+}
+
+// Math::lerpPath(), a curve without any point being constant
+static double NativeRenderer_evaluateParticleCurve(
+    const double * ratios,
+    const double * values,
+    size_t pointCount,
+    double ratio,
+    double defaultValue
+) {
+    if (pointCount == 0) {
+        return defaultValue;
+    }
+
+    if (ratio <= ratios[0]) {
+        return values[0];
+    }
+
+    for (size_t i = 1; i < pointCount; i++) {
+        if (ratio <= ratios[i]) {
+            const double dist = (ratio - ratios[i - 1]) / (ratios[i] - ratios[i - 1]);
+
+            return values[i - 1] * (1 - dist) + values[i] * dist;
+        }
+    }
+
+    return values[pointCount - 1];
+}
+
+// SpriteEffectHelper::generateHorizontalDistortionOffsets()
+static void NativeRenderer_generateParticleDistortionOffsets(int64_t * offsets, size_t height, double amplitude, double shearFactor)
+{
+    const size_t half = (height + 1) / 2;
+
+    for (size_t i = 0; i < half; i++) {
+        offsets[i] = half > 1
+            ? lround(amplitude * (0.5 + 0.5 * sin(1.5 * M_PI + shearFactor * M_PI * i / (half - 1))))
+            : 0;
+    }
+
+    for (size_t i = half; i < height; i++) {
+        offsets[i] = offsets[half - 1 - (height % 2) - (i - half)];
+    }
+}
+
+int64_t NativeRenderer_prepareParticleDrawCommands(
+    NativeRendererParticleSystem * particleSystem,
+    int64_t layer,
+    double time,
     float brightness,
-    int64_t globalBlendingColor,
-    int64_t * verticalBlendingColors,
-    int64_t persisted,
-    int64_t globalPersistedColor,
-    int64_t * horizontalDistortionOffsets,
-    int64_t * horizontalBackgroundDistortionOffsets,
     float ditheringAlphaRatioThreshold
 ) {
-    if (globalAlpha == 0) {
-        return;
+    NativeRendererParticleTypes * particleTypes = particleSystem->particleTypes;
+
+    particleSystem->commandCount = 0;
+
+    size_t drawArgumentCount = 0;
+    for (size_t i = 0; i < particleSystem->particleCount; i++) {
+        const NativeRendererParticleType * type = &particleTypes->types[particleSystem->types[i]];
+        if (type->layer == layer && type->distortionCurvePointCount > 0) {
+            drawArgumentCount += type->height;
+        }
     }
 
-    const double fullBrightnessReciprocal = 1 / 255.0;
+    if (drawArgumentCount > particleTypes->drawArgumentCapacity) {
+        int64_t * drawArguments = realloc(particleTypes->drawArguments, drawArgumentCount * sizeof *drawArguments);
+        if (! drawArguments) {
+            return 0;
+        }
 
-    for (size_t i = 0; i < bitmapHeight; i++) {
-        const size_t pxPosY = y + i;
+        particleTypes->drawArguments = drawArguments;
+        particleTypes->drawArgumentCapacity = drawArgumentCount;
+    }
 
-        if (
-            pxPosY < 0 || pxPosY >= nativeRenderer->height
-        ) {
+    int64_t * drawArguments = particleTypes->drawArguments;
+
+    for (size_t i = 0; i < particleSystem->particleCount; i++) {
+        const NativeRendererParticleType * type = &particleTypes->types[particleSystem->types[i]];
+        if (type->layer != layer) {
             continue;
         }
 
-        const int64_t horizontalDistortionOffset = horizontalDistortionOffsets[i];
-        const int64_t horizontalBackgroundDistortionOffset = horizontalBackgroundDistortionOffsets[i];
+        const double age = time - particleSystem->spawnTimes[i];
+        const size_t frameIndex = age <= 0 ? 0 : (size_t) (age / type->frameDuration);
+        const size_t boundedFrameIndex = frameIndex < type->frameCount ? frameIndex : type->frameCount - 1;
+        const double completionRatio = type->frameCount > 1 ? boundedFrameIndex / (double) (type->frameCount - 1) : 0;
 
-        for (size_t j = 0; j < bitmapWidth; j++) {
-            const size_t pxPosX = x + j + horizontalDistortionOffset;
+        const int64_t globalAlpha = NativeRenderer_evaluateParticleCurve(
+            type->alphaCurveRatios,
+            type->alphaCurveValues,
+            type->alphaCurvePointCount,
+            completionRatio,
+            255
+        );
 
-            if (
-                pxPosX < 0 || pxPosX >= nativeRenderer->width
-            ) {
-                continue;
-            }
+        if (globalAlpha <= 0) {
+            continue;
+        }
 
-            int64_t color = bitmapPixels[i * bitmapWidth + j];
+        float particleBrightness = particleSystem->brightnesses[i];
+        if (type->twinkling) {
+            // the phase depends on the particle, as Star's brightness depends on its id
+            particleBrightness *= 0.5 + 0.5 * fabs(sin(((particleSystem->randomStates[i] & 0xff) + age) * 2));
+        }
+
+        int64_t * horizontalBackgroundDistortionOffsets = NULL;
+        if (type->distortionCurvePointCount > 0) {
+            const double maxAmplitude = NativeRenderer_evaluateParticleCurve(
+                type->distortionCurveRatios,
+                type->distortionCurveValues,
+                type->distortionCurvePointCount,
+                completionRatio,
+                0
+            );
+
+            horizontalBackgroundDistortionOffsets = drawArguments;
+            drawArguments += type->height;
+
+            NativeRenderer_generateParticleDistortionOffsets(
+                horizontalBackgroundDistortionOffsets,
+                type->height,
+                maxAmplitude * (0.5 + 0.5 * sin(type->distortionTimeFactor * time)),
+                type->distortionShearFactor
+            );
+        }
+
+        const size_t commandIndex = particleSystem->commandCount++;
+
+        // positioned as Sprite::draw() does, by the top left corner of the bounding box
+        particleSystem->commands[commandIndex] = (NativeRendererDrawCommand) {
+            .bitmapPixels = type->framePixels[boundedFrameIndex],
+            .bitmapWidth = type->width,
+            .bitmapHeight = type->height,
+            .x = lround(particleSystem->posX[i] - type->width / 2.0),
+            .y = lround(particleSystem->posY[i] - type->height / 2.0),
+            .globalAlpha = globalAlpha > 255 ? 255 : globalAlpha,
+            .brightness = particleBrightness * brightness,
+            .globalBlendingColor = particleSystem->blendingColors[i],
+            .verticalBlendingColors = NULL,
+            .persisted = 0,
+            .globalPersistedColor = -1,
+            .horizontalDistortionOffsets = NULL,
+            .horizontalBackgroundDistortionOffsets = horizontalBackgroundDistortionOffsets,
+            .ditheringAlphaRatioThreshold = ditheringAlphaRatioThreshold,
+        };
+
+        particleSystem->commandTypes[commandIndex] = particleSystem->types[i];
+        particleSystem->commandFrameIndexes[commandIndex] = boundedFrameIndex;
+    }
+
+    return 1;
+}
+
+/*
+ * Bitmap generators
+ *
+ * They compute exactly what their PHP counterparts used to, so that the floating point operations are performed in the
+ * same order, without contraction nor any other fast-math transformation, and the rounding is delegated to PHP.
+ */
+
+#define NATIVE_RENDERER_EXACT_MATH __attribute__((optimize("no-fast-math", "fp-contract=off")))
 
-            if (color < 0) {
+// Math::lerp()
+NATIVE_RENDERER_EXACT_MATH
+static inline double NativeRenderer_lerp(double a, double b, double dist)
+{
+    return a * (1 - dist) + b * dist;
+}
+
+// Math::roundToInt()
+NATIVE_RENDERER_EXACT_MATH
+static inline int64_t NativeRenderer_roundToInt(double value)
+{
+    return (int64_t) _php_math_round(value, 0, PHP_ROUND_HALF_UP);
+}
+
+typedef struct {
+    double roundedX;
+    double roundedY;
+    int64_t seed;
+    double value;
+    int used;
+} NativeRendererPerlinCacheEntry;
+
+/*
+ * Perlin noise values per coordinates rounded to 2 decimals, as cached by BitmapNoiseGenerator::perlin().
+ * Since a value is shared by all the coordinates which round the same way, it depends on the generation order, so that
+ * the cache lives as long as the process and the noise maps cannot be generated concurrently.
+ */
+static struct {
+    NativeRendererPerlinCacheEntry * entries;
+    size_t capacity;
+    size_t entryCount;
+} NativeRenderer_perlinCache;
+
+static inline uint64_t NativeRenderer_hashPerlinCacheKey(double roundedX, double roundedY, int64_t seed)
+{
+    uint64_t x, y;
+    memcpy(&x, &roundedX, sizeof x);
+    memcpy(&y, &roundedY, sizeof y);
+
+    // splitmix64 finalizer
+    uint64_t hash = x ^ (y * 0x9e3779b97f4a7c15) ^ ((uint64_t) seed * 0xc2b2ae3d27d4eb4f);
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+
+    return hash ^ (hash >> 31);
+}
+
+/*
+ * Returns the entry of the given key, which is not used yet if the key is not cached,
+ * or NULL if the cache cannot grow.
+ */
+static NativeRendererPerlinCacheEntry * NativeRenderer_findPerlinCacheEntry(double roundedX, double roundedY, int64_t seed)
+{
+    if (2 * (NativeRenderer_perlinCache.entryCount + 1) > NativeRenderer_perlinCache.capacity) {
+        const size_t capacity = NativeRenderer_perlinCache.capacity ? 2 * NativeRenderer_perlinCache.capacity : 64 * 1024;
+        NativeRendererPerlinCacheEntry * entries = calloc(capacity, sizeof *entries);
+        if (! entries) {
+            return NULL;
+        }
+
+        for (size_t i = 0; i < NativeRenderer_perlinCache.capacity; i++) {
+            const NativeRendererPerlinCacheEntry * entry = &NativeRenderer_perlinCache.entries[i];
+            if (! entry->used) {
                 continue;
             }
 
-            const int64_t alpha = (color >> 24) & 0xff;
-            if (alpha == 0) {
-                continue;
+            size_t j = NativeRenderer_hashPerlinCacheKey(entry->roundedX, entry->roundedY, entry->seed) & (capacity - 1);
+            while (entries[j].used) {
+                j = (j + 1) & (capacity - 1);
             }
 
-            int64_t blendingColor = globalBlendingColor;
-            const int64_t verticalBlendingColor = verticalBlendingColors[j];
-            if (blendingColor == -1) {
-                blendingColor = verticalBlendingColor;
-            } else if (verticalBlendingColor != -1) {
-                const int64_t verticalBlendingColorA = (verticalBlendingColor >> 24) & 0xff;
-                if (verticalBlendingColorA != 0) {
-                    int64_t blendingColorA = (blendingColor >> 24) & 0xff;
-                    if (blendingColorA == 0) {
-                        blendingColor = verticalBlendingColor;
-                    } else {
-                        const int64_t verticalBlendingColorR = (verticalBlendingColor >> 16) & 0xff;
-                        const int64_t verticalBlendingColorG = (verticalBlendingColor >> 8) & 0xff;
-                        const int64_t verticalBlendingColorB = (verticalBlendingColor >> 0) & 0xff;
-                        int64_t blendingColorR = (blendingColor >> 16) & 0xff;
-                        int64_t blendingColorG = (blendingColor >> 8) & 0xff;
-                        int64_t blendingColorB = (blendingColor >> 0) & 0xff;
+            entries[j] = *entry;
+        }
 
-                        const double blendingColorAlphaRatio = blendingColorA / ((double) blendingColorA + verticalBlendingColorA);
+        free(NativeRenderer_perlinCache.entries);
+        NativeRenderer_perlinCache.entries = entries;
+        NativeRenderer_perlinCache.capacity = capacity;
+    }
 
-                        blendingColorR = (int64_t) (
-                            blendingColorR * blendingColorAlphaRatio
-                                + verticalBlendingColorR * (1 - blendingColorAlphaRatio)
-                        );
+    const size_t mask = NativeRenderer_perlinCache.capacity - 1;
+    size_t i = NativeRenderer_hashPerlinCacheKey(roundedX, roundedY, seed) & mask;
 
-                        blendingColorG = (int64_t) (
-                            blendingColorG * blendingColorAlphaRatio
-                                + verticalBlendingColorG * (1 - blendingColorAlphaRatio)
-                        );
+    for (;;) {
+        NativeRendererPerlinCacheEntry * entry = &NativeRenderer_perlinCache.entries[i];
 
-                        blendingColorB = (int64_t) (
-                            blendingColorB * blendingColorAlphaRatio
-                                + verticalBlendingColorB * (1 - blendingColorAlphaRatio)
-                        );
+        // the keys are compared bitwise, as PHP distinguishes "-0" from "0"
+        if (
+            ! entry->used || (
+                memcmp(&entry->roundedX, &roundedX, sizeof roundedX) == 0 &&
+                memcmp(&entry->roundedY, &roundedY, sizeof roundedY) == 0 &&
+                entry->seed == seed
+            )
+        ) {
+            return entry;
+        }
 
-                        blendingColorA = (int64_t) (
-                            blendingColorA * blendingColorAlphaRatio
-                                + verticalBlendingColorA * (1 - blendingColorAlphaRatio)
-                        );
+        i = (i + 1) & mask;
+    }
+}
 
-                        blendingColor =
-                            blendingColorA << 24
-                            | blendingColorR << 16
-                            | blendingColorG << 8
-                            | blendingColorB
-                        ;
-                    }
-                }
-            }
+typedef struct {
+    const double * gradients;
+    int64_t firstX;
+    int64_t firstY;
+    int64_t width;
+} NativeRendererGradientGrid;
 
-            int64_t persistedColor = globalPersistedColor >= 0 ? globalPersistedColor : color;
+NATIVE_RENDERER_EXACT_MATH
+static inline double NativeRenderer_dotGridGradient(const NativeRendererGradientGrid * grid, int64_t ix, int64_t iy, double x, double y)
+{
+    const double * gradient = grid->gradients + 2 * ((iy - grid->firstY) * grid->width + (ix - grid->firstX));
 
-            const size_t pxIndex = pxPosY * nativeRenderer->width + pxPosX;
+    const double dx = x - ix;
+    const double dy = y - iy;
 
-            if (
-                alpha < 255
-                || globalAlpha < 255
-                || brightness != 1
-                || blendingColor >= 0
-            ) {
-                int64_t colorR = (color >> 16) & 0xff;
-                int64_t colorG = (color >> 8) & 0xff;
-                int64_t colorB = color & 0xff;
+    return dx * gradient[0] + dy * gradient[1];
+}
 
-                const int64_t blendingColorA = blendingColor >= 0 ? (blendingColor >> 24) & 0xff : 0;
+NATIVE_RENDERER_EXACT_MATH
+static inline double NativeRenderer_perlin(const NativeRendererGradientGrid * grid, double x, double y)
+{
+    const int64_t x0 = (int64_t) floor(x);
+    const int64_t x1 = x0 + 1;
+    const int64_t y0 = (int64_t) floor(y);
+    const int64_t y1 = y0 + 1;
 
-                if (blendingColorA > 0) {
-                    const int64_t blendingColorR = (blendingColor >> 16) & 0xff;
-                    const int64_t blendingColorG = (blendingColor >> 8) & 0xff;
-                    const int64_t blendingColorB = blendingColor & 0xff;
+    const double sx = x - x0;
+    const double sy = y - y0;
 
-                    const double blendingColorAlphaRatio = blendingColorA * fullBrightnessReciprocal;
+    double n0 = NativeRenderer_dotGridGradient(grid, x0, y0, x, y);
+    double n1 = NativeRenderer_dotGridGradient(grid, x1, y0, x, y);
+    const double ix0 = NativeRenderer_lerp(n0, n1, sx);
 
-                    colorR = (int64_t) (
-                        blendingColorR * blendingColorAlphaRatio
-                        + colorR * (1 - blendingColorAlphaRatio)
-                    );
+    n0 = NativeRenderer_dotGridGradient(grid, x0, y1, x, y);
+    n1 = NativeRenderer_dotGridGradient(grid, x1, y1, x, y);
+    const double ix1 = NativeRenderer_lerp(n0, n1, sx);
 
-                    colorG = (int64_t) (
-                        blendingColorG * blendingColorAlphaRatio
-                        + colorG * (1 - blendingColorAlphaRatio)
-                    );
+    return NativeRenderer_lerp(ix0, ix1, sy);
+}
 
-                    colorB = (int64_t) (
-                        blendingColorB * blendingColorAlphaRatio
-                        + colorB * (1 - blendingColorAlphaRatio)
-                    );
-                }
+NATIVE_RENDERER_EXACT_MATH
+int64_t NativeRenderer_generateNoiseMap(
+    double * noiseMap,
+    size_t width,
+    size_t height,
+    double shift,
+    double radius,
+    const double * scales,
+    const int64_t * scaleSeeds,
+    size_t scaleCount,
+    const double * gradients,
+    const int64_t * gradientGridBounds
+) {
+    // without any scale, the map is not modulated by noise, as in the former PHP implementation
+    NativeRendererGradientGrid grids[scaleCount > 0 ? scaleCount : 1];
 
-                colorR = (int64_t) (colorR * brightness);
-                colorG = (int64_t) (colorG * brightness);
-                colorB = (int64_t) (colorB * brightness);
+    const double * scaleGradients = gradients;
+    for (size_t k = 0; k < scaleCount; k++) {
+        const int64_t * bounds = gradientGridBounds + 4 * k;
 
-                int64_t combinedAlpha = 255;
-                if (globalAlpha < 255 || alpha < 255) {
-                    combinedAlpha = (int64_t) (255 * (globalAlpha * fullBrightnessReciprocal) * (alpha * fullBrightnessReciprocal));
-                }
+        grids[k].gradients = scaleGradients;
+        grids[k].firstX = bounds[0];
+        grids[k].firstY = bounds[1];
+        grids[k].width = bounds[2] - bounds[0] + 1;
 
-                if (persisted) {
-                    if (globalPersistedColor < 0) {
-                        persistedColor =
-                            (combinedAlpha << 24) |
-                            ((colorR & 0xff) << 16) |
-                            ((colorG & 0xff) << 8) |
-                            (colorB & 0xff)
-                        ;
-                    }
+        scaleGradients += 2 * grids[k].width * (bounds[3] - bounds[1] + 1);
+    }
 
-                    if (brightness != 1) {
-                        persistedColor =
-                            (((persistedColor >> 24) & 0xff) << 24) |
-                            ((((int) (((persistedColor >> 16) & 0xff) * brightness) & 0xff)) << 16) |
-                            ((((int) (((persistedColor >> 8) & 0xff) * brightness) & 0xff)) << 8) |
-                            ((((int) (((persistedColor >> 0) & 0xff) * brightness) & 0xff)) << 0)
-                        ;
-                    }
-                }
+    const double maxScale = scaleCount > 0 ? scales[scaleCount - 1] : 1;
+    const double halfWidth = width / 2.0;
+    const double halfHeight = height / 2.0;
 
-                if (combinedAlpha < 255) {
-                    double combinedAlphaRatio = combinedAlpha * fullBrightnessReciprocal;
+    // as PHP's ** operator, pow() is called with a runtime exponent
+    volatile double squareExponent = 2;
 
-                    if (ditheringAlphaRatioThreshold > 0 && combinedAlphaRatio <= ditheringAlphaRatioThreshold) {
-                        const uint64_t rn = (214013 * pxIndex + 2531011) & 0xffff;
-                        combinedAlphaRatio = (combinedAlphaRatio * 0xffff) < rn ? 0.0 : 1.0;
+    for (size_t y = 0; y < height; y++) {
+        const double distY = (y < halfHeight ? halfHeight - y : y - halfHeight) / halfHeight;
 
-                        if (combinedAlphaRatio == 0.0 && horizontalBackgroundDistortionOffset == 0) {
-                            continue;
-                        }
-                    }
+        for (size_t x = 0; x < width; x++) {
+            const double distX = (x < halfWidth ? halfWidth - x : x - halfWidth) / halfWidth;
 
-                    if (combinedAlphaRatio < 1) {
-                        const int64_t backgroundColor = pxIndex + horizontalBackgroundDistortionOffset < nativeRenderer->pixelCount
-                            ? nativeRenderer->currentFrameBuffer[pxIndex + horizontalBackgroundDistortionOffset] : 0;
+            double z;
 
-                        const int64_t backgroundColorR = (backgroundColor >> 16) & 0xff;
-                        const int64_t backgroundColorG = (backgroundColor >> 8) & 0xff;
-                        const int64_t backgroundColorB = backgroundColor & 0xff;
+            if (sqrt(pow(distX, squareExponent) + pow(distY, squareExponent)) > radius) {
+                z = 0;
+            } else {
+                z = 1;
+                for (size_t k = 0; k < scaleCount; k++) {
+                    const double r = scales[k];
+                    const double pX = x / r + shift;
+                    const double pY = y / r + shift;
 
-                        if (combinedAlphaRatio == 0.0) {
-                            colorR = backgroundColorR;
-                            colorG = backgroundColorG;
-                            colorB = backgroundColorB;
-                        } else {
-                            colorR = (int64_t) (
-                                colorR * combinedAlphaRatio
-                                + backgroundColorR * (1 - combinedAlphaRatio)
-                            );
+                    const double roundedX = _php_math_round(pX, 2, PHP_ROUND_HALF_UP);
+                    const double roundedY = _php_math_round(pY, 2, PHP_ROUND_HALF_UP);
 
-                            colorG = (int64_t) (
-                                colorG * combinedAlphaRatio
-                                + backgroundColorG * (1 - combinedAlphaRatio)
-                            );
+                    NativeRendererPerlinCacheEntry * entry = NativeRenderer_findPerlinCacheEntry(roundedX, roundedY, scaleSeeds[k]);
+                    if (! entry) {
+                        return 0;
+                    }
 
-                            colorB = (int64_t) (
-                                colorB * combinedAlphaRatio
-                                + backgroundColorB * (1 - combinedAlphaRatio)
-                            );
-                        }
+                    if (! entry->used) {
+                        entry->roundedX = roundedX;
+                        entry->roundedY = roundedY;
+                        entry->seed = scaleSeeds[k];
+                        entry->value = NativeRenderer_perlin(&grids[k], pX, pY);
+                        entry->used = 1;
+                        NativeRenderer_perlinCache.entryCount++;
                     }
-                }
 
-                color =
-                    (255 << 24) |
-                    ((colorR & 0xff) << 16) |
-                    ((colorG & 0xff) << 8) |
-                    (colorB & 0xff)
-                ;
+                    z *= NativeRenderer_lerp(
+                        NativeRenderer_lerp(0.8, 0, r / maxScale),
+                        1,
+                        entry->value * 0.5 + 0.5
+                    );
+                }
             }
 
-            nativeRenderer->currentFrameBuffer[pxIndex] = color;
-            nativeRenderer->drawnBitmapPixelCount++;
-            if (persisted && alpha > 1) {
-                const int64_t currentPersistedColor = nativeRenderer->persistenceBuffer[pxIndex];
-                const int64_t currentPersistedColorA = (currentPersistedColor >> 24) & 0xff;
-                if (currentPersistedColorA <= 2) {
-                    nativeRenderer->persistenceBuffer[pxIndex] = persistedColor;
-                } else {
-                    int64_t persistedColorA = (persistedColor >> 24) & 0xff;
-                    double blendingRatio = persistedColorA / (double) (persistedColorA + currentPersistedColorA);
+            if (z > 0) {
+                z *= cos((1.1 / radius) * M_PI_2 * distY);
+                z *= cos((1.1 / radius) * M_PI_2 * distX);
+            }
 
-                    if (ditheringAlphaRatioThreshold > 0 && blendingRatio <= ditheringAlphaRatioThreshold) {
-                        const uint64_t rn = (214013 * pxIndex + 2531011) & 0xffff;
-                        blendingRatio = (blendingRatio * 0xffff) < rn ? 0.0 : 1.0;
-                    }
+            noiseMap[y * width + x] = z;
+        }
+    }
 
-                    if (blendingRatio == 1.0) {
-                        nativeRenderer->persistenceBuffer[pxIndex] = persistedColor;
-                    } else if (blendingRatio > 0) {
-                        const int64_t currentPersistedColorR = (currentPersistedColor >> 16) & 0xff;
-                        const int64_t currentPersistedColorG = (currentPersistedColor >> 8) & 0xff;
-                        const int64_t currentPersistedColorB = currentPersistedColor & 0xff;
+    return 1;
+}
 
-                        int64_t persistedColorR = (persistedColor >> 16) & 0xff;
-                        int64_t persistedColorG = (persistedColor >> 8) & 0xff;
-                        int64_t persistedColorB = persistedColor & 0xff;
+typedef struct {
+    const int64_t * pixels;
+    size_t width;
+    size_t height;
+    const double * matrices;
+    int64_t * rotatedPixels;
+    size_t firstFrame;
+    size_t lastFrame;
+} NativeRendererRotationJob;
 
-                        persistedColorA = persistedColorA > currentPersistedColorA ? persistedColorA : currentPersistedColorA;
+NATIVE_RENDERER_EXACT_MATH
+static void * NativeRenderer_runRotationJob(void * arg)
+{
+    const NativeRendererRotationJob * job = arg;
+    const size_t pixelCount = job->width * job->height;
 
-                        persistedColorR = (int64_t) (
-                            persistedColorR * blendingRatio
-                                + currentPersistedColorR * (1 - blendingRatio)
-                        );
+    for (size_t i = job->firstFrame; i < job->lastFrame; i++) {
+        const double * matrix = job->matrices + 6 * i;
+        int64_t * rotatedPixels = job->rotatedPixels + i * pixelCount;
 
-                        persistedColorG = (int64_t) (
-                            persistedColorG * blendingRatio
-                            + currentPersistedColorG * (1 - blendingRatio)
-                        );
+        for (size_t y = 0; y < job->height; y++) {
+            for (size_t x = 0; x < job->width; x++) {
+                // Mat3::transform()
+                const double projectedX = matrix[0] * x + matrix[1] * y + matrix[2];
+                const double projectedY = matrix[3] * x + matrix[4] * y + matrix[5];
 
-                        persistedColorB = (int64_t) (
-                            persistedColorB * blendingRatio
-                            + currentPersistedColorB * (1 - blendingRatio)
-                        );
+                const int64_t pX = NativeRenderer_roundToInt(projectedX);
+                const int64_t pY = pX < 0 || (int64_t) job->width <= pX ? -1 : NativeRenderer_roundToInt(projectedY);
 
-                        nativeRenderer->persistenceBuffer[pxIndex] =
-                            ((persistedColorA & 0xff) << 24) |
-                            ((persistedColorR & 0xff) << 16) |
-                            ((persistedColorG & 0xff) << 8) |
-                            (persistedColorB & 0xff)
-                        ;
-                    }
-                }
+                rotatedPixels[y * job->width + x] = pY < 0 || (int64_t) job->height <= pY
+                    ? 0
+                    : job->pixels[pY * job->width + pX];
             }
         }
     }
+
+    return NULL;
 }
 
-void NativeRenderer_drawRect(
-    NativeRenderer * nativeRenderer,
-    size_t rectWidth,
-    size_t rectHeight,
-    int64_t x,
-    int64_t y,
-    int64_t color
+#define NATIVE_RENDERER_MAX_ROTATION_THREAD_COUNT 16
+
+void NativeRenderer_rotateBitmap(
+    const int64_t * pixels,
+    size_t width,
+    size_t height,
+    const double * matrices,
+    size_t frameCount,
+    int64_t * rotatedPixels
 ) {
-    for (size_t i = 0; i < rectHeight; i++) {
-        const int64_t pxPosY = y + i;
+    long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threadCount = cpuCount < 1 ? 1 : cpuCount;
+    threadCount = threadCount > NATIVE_RENDERER_MAX_ROTATION_THREAD_COUNT ? NATIVE_RENDERER_MAX_ROTATION_THREAD_COUNT : threadCount;
+    threadCount = threadCount > frameCount ? frameCount : threadCount;
 
-        if (
-            pxPosY < 0 || pxPosY >= nativeRenderer->height
-        ) {
-            continue;
+    NativeRendererRotationJob jobs[NATIVE_RENDERER_MAX_ROTATION_THREAD_COUNT];
+    pthread_t threads[NATIVE_RENDERER_MAX_ROTATION_THREAD_COUNT];
+    int threadStarted[NATIVE_RENDERER_MAX_ROTATION_THREAD_COUNT];
+
+    // the frames are independent, they are split between threads, the first job being run by the calling one
+    for (size_t i = 0; i < threadCount; i++) {
+        jobs[i] = (NativeRendererRotationJob) {
+            .pixels = pixels,
+            .width = width,
+            .height = height,
+            .matrices = matrices,
+            .rotatedPixels = rotatedPixels,
+            .firstFrame = frameCount * i / threadCount,
+            .lastFrame = frameCount * (i + 1) / threadCount,
+        };
+
+        threadStarted[i] = i > 0 && pthread_create(&threads[i], NULL, NativeRenderer_runRotationJob, &jobs[i]) == 0;
+    }
+
+    for (size_t i = 0; i < threadCount; i++) {
+        if (threadStarted[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            NativeRenderer_runRotationJob(&jobs[i]);
         }
+    }
+}
 
-        for (size_t j = 0; j < rectWidth; j++) {
-            const int64_t pxPosX = x + j;
+/*
+ * Input
+ *
+ * The terminal input is read into a buffer, out of which the key events are decoded once their escape sequences are
+ * complete. Waiting for a frame deadline also reads the input which arrives meanwhile, so that the wait does not need
+ * to be split into short sleeps to keep the terminal responsive.
+ */
 
-            if (
-                pxPosX < 0 || pxPosX >= nativeRenderer->width
-            ) {
-                continue;
-            }
+#define NATIVE_RENDERER_INPUT_BUFFER_SIZE 4096
 
-            if (
-                i > 0 && i < rectHeight - 1 &&
-                j > 0 && j < rectWidth - 1
-            ) {
-                continue;
-            }
+// a CSI sequence longer than this is dropped
+#define NATIVE_RENDERER_MAX_CSI_SEQUENCE_LENGTH 32
 
-            const size_t pxIndex = pxPosY * nativeRenderer->width + pxPosX;
-            nativeRenderer->currentFrameBuffer[pxIndex] = color;
-            nativeRenderer->drawnBitmapPixelCount++;
-        }
+// the kitty keyboard protocol's keypad keys (see Input), from KP_0 (57399) to KP_SEPARATOR (57416)
+#define NATIVE_RENDERER_FIRST_KEYPAD_KEY_CODE 57399
+static const char NativeRenderer_keypadKeys[] = "0123456789./*-+\0=,";
+
+typedef struct NativeRendererInput {
+    int fd;
+    int timerFd;
+    // the fd is not polled anymore once it has been closed
+    int closed;
+    char buffer[NATIVE_RENDERER_INPUT_BUFFER_SIZE];
+    size_t bufferLength;
+} NativeRendererInput;
+
+NativeRendererInput * NativeRenderer_createInput(int64_t fd)
+{
+    NativeRendererInput * input = calloc(1, sizeof (NativeRendererInput));
+    if (! input) {
+        goto error;
+    }
+
+    input->fd = fd;
+    input->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (input->timerFd < 0) {
+        goto error;
     }
+
+    return input;
+
+error:
+    free(input);
+
+    return NULL;
 }
 
-size_t NativeRenderer_getDrawnBitmapPixelCount(
-    NativeRenderer * nativeRenderer
-) {
-    return nativeRenderer->drawnBitmapPixelCount;
+void NativeRenderer_destroyInput(NativeRendererInput * input)
+{
+    close(input->timerFd);
+    free(input);
 }
 
-size_t NativeRenderer_update(
-    NativeRenderer * nativeRenderer,
-    int64_t trueColorModeEnabled,
-    int64_t persistenceEffectsEnabled,
-    int64_t persistenceAlphaDecrease,
-    int64_t removedColorDepthBits
-) {
-    static char buffer[4 * 1024];
+/*
+ * Reads what the fd has to offer without blocking, until the buffer is full.
+ */
+static void NativeRenderer_readInput(NativeRendererInput * input)
+{
+    struct pollfd pollFd = { .fd = input->fd, .events = POLLIN };
 
-    buffer[0] = 0;
-    char * bufferCursor = buffer;
-    size_t remainingBufferSize = sizeof buffer;
+    while (
+        ! input->closed &&
+            input->bufferLength < NATIVE_RENDERER_INPUT_BUFFER_SIZE &&
+            poll(&pollFd, 1, 0) > 0
+    ) {
+        ssize_t length = read(
+            input->fd,
+            input->buffer + input->bufferLength,
+            NATIVE_RENDERER_INPUT_BUFFER_SIZE - input->bufferLength
+        );
 
-    size_t updatedCharacterCount = 0;
-    const double fullBrightnessReciprocal = 1 / 255.0;
-    const uint64_t colorReductionCorrectionMask = removedColorDepthBits != 0 ? 1 << (removedColorDepthBits - 1) : 0;
+        if (length > 0) {
+            input->bufferLength += length;
+        } else if (length == 0 || errno != EINTR) {
+            input->closed = 1;
+        }
+    }
+}
 
-    int lastPxCol;
-    int lastUpperColor = 0, lastLowerColor = 0;
+int64_t NativeRenderer_waitForInput(NativeRendererInput * input, double duration)
+{
+    if (duration <= 0) {
+        NativeRenderer_readInput(input);
 
-    for (size_t i = 0; i < nativeRenderer->height; i += 2) {
-        lastPxCol = nativeRenderer->width;
-        for (size_t j = 0; j < nativeRenderer->width; j++) {
-            size_t upperPxIndex = 0;
-            size_t lowerPxIndex = 0;
+        return 1;
+    }
 
-            int64_t upperColor = 0;
-            int64_t lowerColor = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-            for (size_t k = 0; k < 2; k++) {
-                const size_t pxIndex = (i + k) * nativeRenderer->width + j;
+    // the deadline is absolute so that the interrupted and the woken up waits do not drift
+    int64_t deadlineNs = now.tv_sec * 1000000000LL + now.tv_nsec + (int64_t) (duration * 1e9);
+    struct itimerspec timerSpec = {
+        .it_value = { .tv_sec = deadlineNs / 1000000000LL, .tv_nsec = deadlineNs % 1000000000LL },
+    };
 
-                int64_t color = nativeRenderer->currentFrameBuffer[pxIndex];
-                int64_t persistedColor = nativeRenderer->persistenceBuffer[pxIndex];
+    if (timerfd_settime(input->timerFd, TFD_TIMER_ABSTIME, &timerSpec, NULL) != 0) {
+        return 0;
+    }
 
-                int64_t persistedColorA = (persistedColor >> 24) & 0xff;
+    for (;;) {
+        const int inputPolled = ! input->closed && input->bufferLength < NATIVE_RENDERER_INPUT_BUFFER_SIZE;
 
-                if (!persistenceEffectsEnabled && persistedColorA > 0) {
-                    nativeRenderer->persistenceBuffer[pxIndex] = 0;
-                }
+        // a negative fd is ignored by poll(), unlike a closed one without events, which keeps reporting POLLHUP
+        struct pollfd pollFds[2] = {
+            { .fd = input->timerFd, .events = POLLIN },
+            { .fd = inputPolled ? input->fd : -1, .events = POLLIN },
+        };
 
-                if (persistenceEffectsEnabled && persistedColorA > 0) {
-                    const int64_t persistedColorR = (persistedColor >> 16) & 0xff;
-                    const int64_t persistedColorG = (persistedColor >> 8) & 0xff;
-                    const int64_t persistedColorB = persistedColor & 0xff;
+        if (poll(pollFds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
 
-                    int64_t colorR = (color >> 16) & 0xff;
-                    int64_t colorG = (color >> 8) & 0xff;
-                    int64_t colorB = color & 0xff;
+            return 0;
+        }
 
-                    const double persistedColorAlphaRatio = persistedColorA * fullBrightnessReciprocal;
+        if (pollFds[1].revents) {
+            NativeRenderer_readInput(input);
+        }
 
-                    colorR = (int64_t) (
-                        colorR * (1 - persistedColorAlphaRatio)
-                        + persistedColorR * persistedColorAlphaRatio
-                    );
+        if (pollFds[0].revents & POLLIN) {
+            uint64_t expirationCount;
+            if (read(input->timerFd, &expirationCount, sizeof expirationCount) < 0 && errno != EAGAIN) {
+                return 0;
+            }
 
-                    colorG = (int64_t) (
-                        colorG * (1 - persistedColorAlphaRatio)
-                        + persistedColorG * persistedColorAlphaRatio
-                    );
+            return 1;
+        }
+    }
+}
 
-                    colorB = (int64_t) (
-                        colorB * (1 - persistedColorAlphaRatio)
-                        + persistedColorB * persistedColorAlphaRatio
-                    );
+static void NativeRenderer_setInputEventKey(NativeRendererInputEvent * event, const char * key, size_t length)
+{
+    length = length < sizeof event->key - 1 ? length : sizeof event->key - 1;
+    memcpy(event->key, key, length);
+    event->key[length] = '\0';
+}
 
-                    color =
-                        (255 << 24) |
-                        ((colorR & 0xff) << 16) |
-                        ((colorG & 0xff) << 8) |
-                        (colorB & 0xff)
-                    ;
+static size_t NativeRenderer_encodeUtf8(uint32_t codepoint, char * output)
+{
+    if (codepoint < 0x80) {
+        output[0] = codepoint;
 
-                    persistedColorA -= persistenceAlphaDecrease;
-                    if (persistedColorA < 0) {
-                        persistedColorA = 0;
-                    }
+        return 1;
+    }
 
-                    nativeRenderer->persistenceBuffer[pxIndex] =
-                        ((persistedColorA & 0xff) << 24) |
-                        ((persistedColorR & 0xff) << 16) |
-                        ((persistedColorG & 0xff) << 8) |
-                        (persistedColorB & 0xff)
-                    ;
+    if (codepoint < 0x800) {
+        output[0] = 0xc0 | (codepoint >> 6);
+        output[1] = 0x80 | (codepoint & 0x3f);
 
-                    nativeRenderer->currentFrameBuffer[pxIndex] = color;
-                }
+        return 2;
+    }
 
-                if (removedColorDepthBits > 0 && (color & 0xffffff) != 0) {
-                    int64_t colorR = (color >> 16) & 0xff;
-                    int64_t colorG = (color >> 8) & 0xff;
-                    int64_t colorB = color & 0xff;
+    if (codepoint < 0x10000) {
+        output[0] = 0xe0 | (codepoint >> 12);
+        output[1] = 0x80 | ((codepoint >> 6) & 0x3f);
+        output[2] = 0x80 | (codepoint & 0x3f);
 
-                    color =
-                        (255 << 24) |
-                        ((((colorR >> removedColorDepthBits) << removedColorDepthBits) | colorReductionCorrectionMask)<< 16) |
-                        ((((colorG >> removedColorDepthBits) << removedColorDepthBits) | colorReductionCorrectionMask) << 8) |
-                        (((colorB >> removedColorDepthBits) << removedColorDepthBits) | colorReductionCorrectionMask)
-                    ;
+        return 3;
+    }
 
-                    nativeRenderer->currentFrameBuffer[pxIndex] = color;
-                }
+    output[0] = 0xf0 | ((codepoint >> 18) & 0x07);
+    output[1] = 0x80 | ((codepoint >> 12) & 0x3f);
+    output[2] = 0x80 | ((codepoint >> 6) & 0x3f);
+    output[3] = 0x80 | (codepoint & 0x3f);
 
-                if (k == 0) {
-                    upperPxIndex = pxIndex;
-                    upperColor = color;
-                } else {
-                    lowerPxIndex = pxIndex;
-                    lowerColor = color;
-                }
-            }
+    return 4;
+}
 
-            const int64_t prevUpperColor = nativeRenderer->previousFrameBuffer[upperPxIndex];
-            const int64_t prevLowerColor = nativeRenderer->previousFrameBuffer[lowerPxIndex];
+/*
+ * Decodes the CSI sequence of the given length, its parameters being "code;modifiers:eventType" as with the kitty
+ * keyboard protocol. The modifiers are ignored: the arrow keys are reported as "\e[A" and so on, the keys reported as
+ * codepoints as the characters they produce.
+ */
+static void NativeRenderer_decodeCsiSequence(const char * sequence, size_t length, NativeRendererInputEvent * event)
+{
+    int64_t parameters[2] = { 1, 1 };
+    int64_t eventType = 1;
+    size_t parameterIndex = 0;
+    size_t subParameterIndex = 0;
+    int parameterStarted = 0;
 
-            if (
-                upperColor == prevUpperColor &&
-                lowerColor == prevLowerColor
-            ) {
-                continue;
+    for (size_t i = 2; i < length - 1; i++) {
+        char c = sequence[i];
+
+        if (c >= '0' && c <= '9') {
+            // only the event type is kept out of the sub-parameters, it follows the modifiers
+            int64_t * value = NULL;
+            if (subParameterIndex == 0 && parameterIndex < 2) {
+                value = &parameters[parameterIndex];
+            } else if (subParameterIndex == 1 && parameterIndex == 1) {
+                value = &eventType;
             }
 
-            updatedCharacterCount++;
+            if (value) {
+                *value = (parameterStarted ? *value * 10 : 0) + (c - '0');
+                *value = *value > 0x10ffff ? 0x10ffff : *value;
+            }
 
-            int writtenCharCount;
+            parameterStarted = 1;
+        } else if (c == ';' || c == ':') {
+            parameterIndex += c == ';';
+            subParameterIndex = c == ';' ? 0 : subParameterIndex + 1;
+            parameterStarted = 0;
+        }
+    }
 
-            if (j <= 1 || lastPxCol != j - 1) {
-                writtenCharCount = snprintf(
-                    bufferCursor,
-                    remainingBufferSize,
-                    "\033[%zu;%zuH",
-                    i / 2, j
-                );
+    char finalByte = sequence[length - 1];
+    event->release = eventType == 3;
 
-                remainingBufferSize -= writtenCharCount;
-                bufferCursor += writtenCharCount;
-            }
+    if (finalByte == 'u') {
+        int64_t code = parameters[0];
+        char key[4];
 
-            if (lastUpperColor != upperColor || lastLowerColor != lowerColor) {
-                if (trueColorModeEnabled) {
-                    writtenCharCount = snprintf(
-                        bufferCursor,
-                        remainingBufferSize,
-                        "\033[38;2;%lu;%lu;%lu;48;2;%lu;%lu;%lum",
-                        (upperColor >> 16) & 0xff, (upperColor >> 8) & 0xff, upperColor & 0xff,
-                        (lowerColor >> 16) & 0xff, (lowerColor >> 8) & 0xff, lowerColor & 0xff
-                    );
+        if (
+            code >= NATIVE_RENDERER_FIRST_KEYPAD_KEY_CODE &&
+                code < NATIVE_RENDERER_FIRST_KEYPAD_KEY_CODE + (int64_t) sizeof NativeRenderer_keypadKeys - 1 &&
+                NativeRenderer_keypadKeys[code - NATIVE_RENDERER_FIRST_KEYPAD_KEY_CODE] != '\0'
+        ) {
+            NativeRenderer_setInputEventKey(event, &NativeRenderer_keypadKeys[code - NATIVE_RENDERER_FIRST_KEYPAD_KEY_CODE], 1);
+        } else if (code == '\r') {
+            NativeRenderer_setInputEventKey(event, "\n", 1);
+        } else {
+            NativeRenderer_setInputEventKey(event, key, NativeRenderer_encodeUtf8(code, key));
+        }
+    } else if (finalByte == '~') {
+        char key[16];
+        NativeRenderer_setInputEventKey(event, key, snprintf(key, sizeof key, "\033[%d~", (int) parameters[0]));
+    } else if (finalByte >= 'A' && finalByte <= 'Z') {
+        char key[3] = { '\033', '[', finalByte };
+        NativeRenderer_setInputEventKey(event, key, 3);
+    } else {
+        NativeRenderer_setInputEventKey(event, sequence, length);
+    }
+}
 
-                    lastUpperColor = upperColor;
-                    lastLowerColor = lowerColor;
-                } else {
-                    double brightnessBoost = 0.3;
+/*
+ * Decodes the key event at the start of the given bytes and returns the number of consumed bytes,
+ * or 0 if the event is incomplete.
+ */
+static size_t NativeRenderer_decodeInputEvent(const char * input, size_t length, NativeRendererInputEvent * event)
+{
+    event->release = 0;
 
-                    const int upperColorTableIdx = 16 + fmin(215,
-                        + 36 * (int) round(brightnessBoost + 5 * ((upperColor >> 16) & 0xff) * fullBrightnessReciprocal)
-                        + 6 * (int) round(brightnessBoost + 5 * ((upperColor >> 8) & 0xff) * fullBrightnessReciprocal)
-                        + (int) round(brightnessBoost + 5 * ((upperColor >> 0) & 0xff) * fullBrightnessReciprocal)
-                    );
+    if (input[0] != '\033') {
+        uint8_t leadByte = input[0];
+        size_t size = leadByte >= 0xf0 ? 4 : (leadByte >= 0xe0 ? 3 : (leadByte >= 0xc0 ? 2 : 1));
+        if (size > length) {
+            return 0;
+        }
 
-                    const int lowerColorTableIdx = 16 + fmin(215,
-                        + 36 * (int) round(brightnessBoost + 5 * ((lowerColor >> 16) & 0xff) * fullBrightnessReciprocal)
-                        + 6 * (int) round(brightnessBoost + 5 * ((lowerColor >> 8) & 0xff) * fullBrightnessReciprocal)
-                        + (int) round(brightnessBoost + 5 * ((lowerColor >> 0) & 0xff) * fullBrightnessReciprocal)
-                    );
+        NativeRenderer_setInputEventKey(event, input, size);
 
-                    writtenCharCount = snprintf(
-                        bufferCursor,
-                        remainingBufferSize,
-                        "\033[38;5;%d;48;5;%dm",
-                        upperColorTableIdx,
-                        lowerColorTableIdx
-                    );
+        return size;
+    }
 
-                    lastUpperColor = upperColorTableIdx;
-                    lastLowerColor = lowerColorTableIdx;
-                }
+    // a lone escape is the escape key, as the terminals write each sequence at once
+    if (length == 1 || input[1] != '[') {
+        NativeRenderer_setInputEventKey(event, input, 1);
 
-                remainingBufferSize -= writtenCharCount;
-                bufferCursor += writtenCharCount;
-            }
+        return 1;
+    }
 
-            writtenCharCount = snprintf(
-                bufferCursor,
-                remainingBufferSize,
-                "▀"
-            );
+    for (size_t i = 2; i < length; i++) {
+        uint8_t c = input[i];
 
-            lastPxCol = j;
+        if (c >= 0x40 && c <= 0x7e) {
+            NativeRenderer_decodeCsiSequence(input, i + 1, event);
 
-            remainingBufferSize -= writtenCharCount;
-            bufferCursor += writtenCharCount;
+            return i + 1;
+        }
 
-            if (remainingBufferSize < 512) {
-                php_output_write(buffer, strlen(buffer));
-                php_output_flush();
+        if (c < 0x20 || c > 0x3f || i + 1 >= NATIVE_RENDERER_MAX_CSI_SEQUENCE_LENGTH) {
+            // not a CSI sequence, the escape key followed by other keys
+            NativeRenderer_setInputEventKey(event, input, 1);
 
-                buffer[0] = 0;
-                bufferCursor = buffer;
-                remainingBufferSize = sizeof buffer;
-            }
+            return 1;
         }
     }
 
-    php_output_write(buffer, strlen(buffer));
-    php_output_flush();
+    return 0;
+}
+
+size_t NativeRenderer_readInputEvents(NativeRendererInput * input, NativeRendererInputEvent * events, size_t capacity)
+{
+    NativeRenderer_readInput(input);
 
-    memcpy(
-        nativeRenderer->previousFrameBuffer,
-        nativeRenderer->currentFrameBuffer,
-        nativeRenderer->pixelCount * sizeof(int64_t)
-    );
+    size_t eventCount = 0;
+    size_t offset = 0;
 
-    return updatedCharacterCount;
+    while (eventCount < capacity && offset < input->bufferLength) {
+        size_t size = NativeRenderer_decodeInputEvent(
+            input->buffer + offset,
+            input->bufferLength - offset,
+            &events[eventCount]
+        );
+
+        if (size == 0) {
+            // the rest of the sequence has not been read yet, unless the buffer is full of it
+            if (offset > 0 || input->bufferLength < NATIVE_RENDERER_INPUT_BUFFER_SIZE) {
+                break;
+            }
+
+            size = input->bufferLength;
+        } else {
+            eventCount++;
+        }
+
+        offset += size;
+    }
+
+    memmove(input->buffer, input->buffer + offset, input->bufferLength - offset);
+    input->bufferLength -= offset;
+
+    return eventCount;
 }
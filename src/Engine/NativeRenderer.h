@@ -3,23 +3,151 @@ typedef struct {
     size_t width;
     size_t height;
     size_t pixelCount;
-    int64_t * currentFrameBuffer;
-    int64_t * previousFrameBuffer;
-    int64_t * persistenceBuffer;
+    uint32_t * currentFrameBuffer;
+    uint32_t * previousFrameBuffer;
+    uint32_t * persistenceBuffer;
+    int64_t previousFrameBufferInvalidated;
     size_t drawnBitmapPixelCount;
+    size_t outputByteCount;
+    struct NativeRendererBand * bands;
+    size_t bandCount;
+    struct NativeRendererThreadPool * threadPool;
+    struct NativeRendererPresenter * presenter;
+    struct NativeRendererProfiler * profiler;
+    struct NativeRendererDamage * damage;
+    struct NativeRendererQuantizer * quantizer;
+    // see NativeRenderer_setOutputCompression()
+    int64_t repeatSequencesEnabled;
+    int64_t lineShiftsEnabled;
+    // see NativeRenderer_setGraphicsOutput(), NULL with the text output
+    struct NativeRendererGraphics * graphics;
+    // see NativeRenderer_drawText()
+    struct NativeRendererText * text;
+    // see NativeRenderer_startCapture(), NULL when no capture is running
+    struct NativeRendererCapture * capture;
 } NativeRenderer;
 
+typedef struct {
+    uint32_t * bitmapPixels;
+    size_t bitmapWidth;
+    size_t bitmapHeight;
+    int64_t x;
+    int64_t y;
+    int64_t globalAlpha;
+    float brightness;
+    int64_t globalBlendingColor;
+    int64_t * verticalBlendingColors;
+    int64_t persisted;
+    int64_t globalPersistedColor;
+    int64_t * horizontalDistortionOffsets;
+    int64_t * horizontalBackgroundDistortionOffsets;
+    float ditheringAlphaRatioThreshold;
+    // in radians, around the bitmap center, the bitmap being sampled within its own area
+    double rotationAngle;
+    int64_t bilinearFilteringEnabled;
+} NativeRendererDrawCommand;
+
+/*
+ * Per-stage frame times (in seconds) and cumulated counters since the last profile reset.
+ * The stages are, in this order: clear, draw, persistence, color reduction, encoding, output.
+ */
+typedef struct {
+    uint64_t frameCount;
+    double lastStageTimes[6];
+    double p50StageTimes[6];
+    double p95StageTimes[6];
+    double p99StageTimes[6];
+    double maxStageTimes[6];
+    uint64_t blendedPixelCount;
+    uint64_t ditheredAwayPixelCount;
+    uint64_t changedCharacterCount;
+    uint64_t emittedByteCount;
+    // estimated bytes avoided by the output compression, the uncompressed output size being their sum
+    uint64_t savedByteCount;
+    // characters left out of date since they changed less than the change threshold or exceeded the byte budget
+    uint64_t deferredCharacterCount;
+    uint64_t flushCount;
+} NativeRendererProfile;
+
 NativeRenderer * NativeRenderer_create(size_t width, size_t height);
 
 void NativeRenderer_destroy(NativeRenderer * nativeRenderer);
 
+int64_t NativeRenderer_setThreadCount(NativeRenderer * nativeRenderer, size_t threadCount);
+
+int64_t NativeRenderer_setPresentationBufferCount(NativeRenderer * nativeRenderer, size_t bufferCount);
+
+void NativeRenderer_setOutputCompression(
+    NativeRenderer * nativeRenderer,
+    // REP sequences (repeat the previous character), which some terminals do not support
+    int64_t repeatSequencesEnabled,
+    // DCH sequences (delete characters) reusing the row contents shifted left by a few columns
+    int64_t lineShiftsEnabled
+);
+
+/*
+ * Switches to the kitty graphics protocol output, the frames being sent as an image through the given medium
+ * (1: shared memory, 2: temporary file, 3: direct), or back to the text output (0).
+ * Returns 0 if the medium is unavailable, in which case the text output is used.
+ */
+int64_t NativeRenderer_setGraphicsOutput(NativeRenderer * nativeRenderer, int64_t medium);
+
+/*
+ * Deletes the displayed image, if any, e.g. before another renderer takes over the screen.
+ */
+void NativeRenderer_hideGraphics(NativeRenderer * nativeRenderer);
+
+void NativeRenderer_present(NativeRenderer * nativeRenderer, const char * output, size_t outputLength);
+
+void NativeRenderer_waitForPresentation(NativeRenderer * nativeRenderer);
+
+size_t NativeRenderer_getPresentationQueueDepth(NativeRenderer * nativeRenderer);
+
+double NativeRenderer_getPresentationWriteLatency(NativeRenderer * nativeRenderer);
+
+/*
+ * Records the draw stream (the reset, clear, draw, text and update calls) into the given file, until
+ * NativeRenderer_stopCapture() is called or the renderer is destroyed. Returns 0 if the file cannot be created.
+ */
+int64_t NativeRenderer_startCapture(NativeRenderer * nativeRenderer, const char * fileName);
+
+/*
+ * Returns 0 if the capture could not be completely written.
+ */
+int64_t NativeRenderer_stopCapture(NativeRenderer * nativeRenderer);
+
+/*
+ * Maps a bitmap atlas file (see BitmapAtlas) read-only, until the process exits.
+ * Returns its pixels, or NULL if the file cannot be mapped or is not an atlas of the given version.
+ * The generation identifies the build of the atlas, so that the serialized bitmaps can be matched with it.
+ */
+uint32_t * NativeRenderer_mapBitmapAtlas(const char * fileName, uint32_t version, size_t * pixelCount, uint64_t * generation);
+
 void NativeRenderer_reset(NativeRenderer * nativeRenderer);
 
-void NativeRenderer_clear(NativeRenderer * nativeRenderer, int64_t color);
+void NativeRenderer_clear(NativeRenderer * nativeRenderer, uint32_t color);
 
 void NativeRenderer_drawBitmap(
     NativeRenderer * nativeRenderer,
-    int64_t * bitmapPixels,
+    uint32_t * bitmapPixels,
+    size_t bitmapWidth,
+    size_t bitmapHeight,
+    int64_t x,
+    int64_t y,
+    int64_t globalAlpha,
+    float brightness,
+    int64_t globalBlendingColor,
+    int64_t * verticalBlendingColors,
+    int64_t persisted,
+    int64_t globalPersistedColor,
+    int64_t * horizontalDistortionOffsets,
+    int64_t * horizontalBackgroundDistortionOffsets,
+    float ditheringAlphaRatioThreshold
+);
+
+void NativeRenderer_drawBitmapReference(
+    NativeRenderer * nativeRenderer,
+    uint32_t * bitmapPixels,
     size_t bitmapWidth,
     size_t bitmapHeight,
     int64_t x,
@@ -35,23 +163,250 @@ void NativeRenderer_drawBitmap(
     float ditheringAlphaRatioThreshold
 );
 
+void NativeRenderer_drawCommand(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command
+);
+
+void NativeRenderer_drawBatch(
+    NativeRenderer * nativeRenderer,
+    NativeRendererDrawCommand * commands,
+    size_t commandCount
+);
+
 void NativeRenderer_drawRect(
     NativeRenderer * nativeRenderer,
     size_t rectWidth,
     size_t rectHeight,
     int64_t x,
     int64_t y,
-    int64_t color
+    uint32_t color
+);
+
+void NativeRenderer_clearText(NativeRenderer * nativeRenderer);
+
+/*
+ * Draws ASCII text on the text layer, whose cells are drawn over the frame's characters and diffed the same way.
+ * The lines and the columns are the terminal ones (from 1, the first line past the frame being height / 2), the text
+ * being clipped to the layer, which extends past the frame by a few lines.
+ */
+void NativeRenderer_drawText(
+    NativeRenderer * nativeRenderer,
+    size_t line,
+    size_t column,
+    const char * string,
+    size_t length,
+    uint32_t color,
+    uint32_t backgroundColor
 );
 
 size_t NativeRenderer_getDrawnBitmapPixelCount(
     NativeRenderer * nativeRenderer
 );
 
+size_t NativeRenderer_getOutputByteCount(
+    NativeRenderer * nativeRenderer
+);
+
+void NativeRenderer_getProfile(NativeRenderer * nativeRenderer, NativeRendererProfile * profile);
+
+void NativeRenderer_resetProfile(NativeRenderer * nativeRenderer);
+
 size_t NativeRenderer_update(
     NativeRenderer * nativeRenderer,
     int64_t trueColorModeEnabled,
     int64_t persistenceEffectsEnabled,
     int64_t persistenceAlphaDecrease,
-    int64_t removedColorDepthBits
+    int64_t removedColorDepthBits,
+    // 0: full resolution, 1: pairs of columns are averaged, 2: 2x2 blocks are averaged
+    int64_t lowResolutionMode,
+    int64_t orderedDitheringEnabled,
+    // the characters whose channels all changed by at most this are not redrawn, 0 to redraw any change
+    int64_t changeThreshold,
+    // soft limit of the bytes per frame, the characters which changed the least being deferred, 0 for no limit
+    int64_t outputByteBudget
+);
+
+/*
+ * A particle type: an animation whose frames are bitmaps of the same size, played once over the particle lifetime,
+ * and the effects applied to it, which are functions of the particle age.
+ * The curves are piecewise linear over the animation completion ratio, their points being sorted by ratio.
+ */
+typedef struct {
+    uint32_t ** framePixels;
+    size_t frameCount;
+    size_t width;
+    size_t height;
+    double frameDuration;
+    // the particles reach their velocity within this time, as with Accelerator
+    double accelerationTime;
+    // the particles of a layer are drawn together (see NativeRenderer_prepareParticleDrawCommands())
+    int64_t layer;
+    // the particles of a group are counted together (see NativeRenderer_countParticles())
+    int64_t group;
+    // a wrapped particle which leaves the screen by the left side enters it again by the right side, at a random row
+    int64_t wrapped;
+    // the brightness of a twinkling particle oscillates between half and full brightness
+    int64_t twinkling;
+    double alphaCurveRatios[4];
+    double alphaCurveValues[4];
+    size_t alphaCurvePointCount;
+    // horizontal background distortion (see SpriteEffectHelper::generateHorizontalDistortionOffsets())
+    double distortionCurveRatios[4];
+    double distortionCurveValues[4];
+    size_t distortionCurvePointCount;
+    double distortionTimeFactor;
+    double distortionShearFactor;
+} NativeRendererParticleType;
+
+/*
+ * Particles, stored as one array per attribute, in emission order.
+ */
+typedef struct {
+    size_t capacity;
+    size_t particleCount;
+    uint32_t * types;
+    double * posX;
+    double * posY;
+    double * spawnPosX;
+    double * spawnPosY;
+    double * dirX;
+    double * dirY;
+    double * velocities;
+    double * spawnTimes;
+    double * lastStepTimes;
+    double * durations;
+    float * brightnesses;
+    int64_t * blendingColors;
+    uint64_t * randomStates;
+    uint8_t * enteredScreen;
+    // the draw commands of the last prepared layer, with the type and the frame index of each one
+    NativeRendererDrawCommand * commands;
+    uint32_t * commandTypes;
+    uint32_t * commandFrameIndexes;
+    size_t commandCount;
+    struct NativeRendererParticleTypes * particleTypes;
+} NativeRendererParticleSystem;
+
+NativeRendererParticleSystem * NativeRenderer_createParticleSystem(size_t capacity);
+
+void NativeRenderer_destroyParticleSystem(NativeRendererParticleSystem * particleSystem);
+
+/*
+ * Returns the index of the added type, or -1 if it cannot be added.
+ */
+int64_t NativeRenderer_addParticleType(NativeRendererParticleSystem * particleSystem, const NativeRendererParticleType * type);
+
+/*
+ * Returns 0 if the particle system is full.
+ */
+int64_t NativeRenderer_emitParticle(
+    NativeRendererParticleSystem * particleSystem,
+    size_t type,
+    double x,
+    double y,
+    double dirX,
+    double dirY,
+    double velocity,
+    double time,
+    double duration,
+    float brightness,
+    int64_t blendingColor,
+    uint64_t seed
+);
+
+/*
+ * Moves and ages the particles, and removes the ones which have expired or left the screen.
+ */
+void NativeRenderer_updateParticles(
+    NativeRendererParticleSystem * particleSystem,
+    double time,
+    size_t screenWidth,
+    size_t screenHeight
+);
+
+void NativeRenderer_clearParticles(NativeRendererParticleSystem * particleSystem);
+
+/*
+ * Counts the particles of the given type and group (-1 for any), and, if areaSize is not 0, which have been emitted
+ * within the same areaSize x areaSize area as (areaX, areaY), as ScreenAreaStats does.
+ */
+size_t NativeRenderer_countParticles(
+    const NativeRendererParticleSystem * particleSystem,
+    int64_t type,
+    int64_t group,
+    double areaX,
+    double areaY,
+    double areaSize
+);
+
+/*
+ * Builds the draw commands of the given layer's particles (see NativeRendererParticleSystem::commands).
+ * Returns 0 if the distortion offsets cannot be allocated.
+ */
+int64_t NativeRenderer_prepareParticleDrawCommands(
+    NativeRendererParticleSystem * particleSystem,
+    int64_t layer,
+    double time,
+    float brightness,
+    float ditheringAlphaRatioThreshold
 );
+
+/*
+ * Computes BitmapNoiseGenerator's noise map, the gradient grid of each scale being given by its bounds (first x, first
+ * y, last x, last y) and its (x, y) gradients, row by row. scaleCount may be 0 (e.g. for a 1 pixel wide bitmap), in
+ * which case the arrays are not read. Returns 0 if the noise cache cannot grow.
+ */
+int64_t NativeRenderer_generateNoiseMap(
+    double * noiseMap,
+    size_t width,
+    size_t height,
+    double shift,
+    double radius,
+    const double * scales,
+    const int64_t * scaleSeeds,
+    size_t scaleCount,
+    const double * gradients,
+    const int64_t * gradientGridBounds
+);
+
+/*
+ * Computes Bitmap::withCenteredRotation() for each of the given matrices (the first 2 rows of each), in parallel.
+ */
+void NativeRenderer_rotateBitmap(
+    const int64_t * pixels,
+    size_t width,
+    size_t height,
+    const double * matrices,
+    size_t frameCount,
+    int64_t * rotatedPixels
+);
+
+/*
+ * A key event decoded out of the terminal input.
+ */
+typedef struct {
+    // the key as named by InputEvent: the character it produces, or its escape sequence for the arrow keys and so on
+    char key[16];
+    // 1 for a release, which only the kitty keyboard protocol reports
+    int64_t release;
+} NativeRendererInputEvent;
+
+/*
+ * Reads the terminal input from the given fd, which is expected to be in non-canonical mode.
+ */
+struct NativeRendererInput * NativeRenderer_createInput(int64_t fd);
+
+void NativeRenderer_destroyInput(struct NativeRendererInput * input);
+
+/*
+ * Sleeps for the given duration (in seconds) while reading the input which arrives meanwhile.
+ * Returns 0 if the wait failed, in which case it may have returned early.
+ */
+int64_t NativeRenderer_waitForInput(struct NativeRendererInput * input, double duration);
+
+/*
+ * Decodes up to capacity key events out of the input read so far, an incomplete escape sequence being kept for the
+ * next call. Returns the number of decoded events.
+ */
+size_t NativeRenderer_readInputEvents(struct NativeRendererInput * input, NativeRendererInputEvent * events, size_t capacity);
@@ -6,43 +6,55 @@ class NativeRenderer implements RendererInterface
 {
     const BITMAP_DIMENSION_MAX_SIZE = 256;
 
+    const DRAW_COMMAND_BUFFER_SIZE = 2048;
+
+    const DRAW_ARGUMENT_BUFFER_SIZE = 64 * 1024;
+
+    /**
+     * In the order of NativeRendererProfile's per-stage arrays
+     */
+    const PROFILE_STAGES = ['clear', 'draw', 'persistence', 'colorReduction', 'encoding', 'output'];
+
+    /**
+     * The transmission mediums of the kitty graphics protocol output, in the order of the native side's ones
+     */
+    const GRAPHICS_OUTPUT_MEDIUMS = ['shm', 'file', 'direct'];
+
     private object $nativeRendererFfi;
 
-    private object $verticalBlendingColorsFfiBuffer;
+    /**
+     * Draw commands are queued here and submitted to the native side all at once (see flushDrawCommands()).
+     */
+    private object $drawCommandsFfiBuffer;
+
+    private int $drawCommandCount = 0;
+
+    /**
+     * Per-column / per-row arrays of the queued draw commands (blending colors, distortion offsets).
+     */
+    private object $drawArgumentsFfiBuffer;
+
+    private object $drawArgumentsFfiPointer;
+
+    private int $drawArgumentCount = 0;
+
+    /**
+     * @var array<Bitmap> keeps the queued bitmaps (and thus their native pixels) alive until the next flush
+     */
+    private array $drawCommandBitmaps = [];
 
-    private object $horizontalDistortionOffsetsFfiBuffer;
+    private object $profileFfi;
 
-    private object $horizontalBackgroundDistortionOffsetsFfiBuffer;
+    private ?string $graphicsOutputMedium = null;
 
     private static ?\FFI $ffi = null;
 
     public static function getFfi(): \FFI
     {
         if (self::$ffi === null) {
-            $sharedObjectDirName = realpath(__DIR__ . '/../../.tmp');
-            assert($sharedObjectDirName !== false);
-
-            $includePathFlags = [
-                '-I/usr/local/include/php',
-                '-I/usr/local/include/php/main',
-                '-I/usr/local/include/php/TSRM',
-                '-I/usr/local/include/php/Zend',
-                '-I/usr/local/include/php/ext',
-                '-I/usr/local/include/php/ext/date/lib',
-            ];
-
-            $sharedObjectFileName = $sharedObjectDirName . '/NativeRenderer.so';
-            shell_exec('rm -rf ' . $sharedObjectFileName);
-            shell_exec(sprintf(
-                'gcc -O3 -march=native -ffast-math -Werror -Wall %s -shared -fPIC -o %s %s',
-                implode(' ', $includePathFlags),
-                $sharedObjectFileName,
-                __DIR__ . '/NativeRenderer.c',
-            ));
-
             self::$ffi = \FFI::cdef(
                 file_get_contents(__DIR__ . '/NativeRenderer.h'),
-                $sharedObjectFileName
+                NativeRendererLibrary::getFileName()
             );
         }
 
@@ -53,20 +65,19 @@ class NativeRenderer implements RendererInterface
     {
         $this->nativeRendererFfi = self::getFfi()->NativeRenderer_create($width, $height);
 
-        $this->verticalBlendingColorsFfiBuffer = self::getFfi()->new(sprintf(
-            'int64_t[%d]',
-            self::BITMAP_DIMENSION_MAX_SIZE
+        $this->drawCommandsFfiBuffer = self::getFfi()->new(sprintf(
+            'NativeRendererDrawCommand[%d]',
+            self::DRAW_COMMAND_BUFFER_SIZE
         ));
 
-        $this->horizontalDistortionOffsetsFfiBuffer = self::getFfi()->new(sprintf(
+        $this->drawArgumentsFfiBuffer = self::getFfi()->new(sprintf(
             'int64_t[%d]',
-            self::BITMAP_DIMENSION_MAX_SIZE
+            self::DRAW_ARGUMENT_BUFFER_SIZE
         ));
 
-        $this->horizontalBackgroundDistortionOffsetsFfiBuffer = self::getFfi()->new(sprintf(
-            'int64_t[%d]',
-            self::BITMAP_DIMENSION_MAX_SIZE
-        ));
+        $this->drawArgumentsFfiPointer = self::getFfi()->cast('int64_t *', $this->drawArgumentsFfiBuffer);
+
+        $this->profileFfi = self::getFfi()->new('NativeRendererProfile');
     }
 
     public function __destruct()
@@ -74,13 +85,179 @@ class NativeRenderer implements RendererInterface
         self::getFfi()->NativeRenderer_destroy($this->nativeRendererFfi);
     }
 
+    /**
+     * With more than one thread, the screen is split into horizontal bands which are drawn and updated in parallel.
+     */
+    public function setThreadCount(int $threadCount): void
+    {
+        if ($threadCount < 1) {
+            throw new \RuntimeException('The thread count must be at least 1');
+        }
+
+        $this->flushDrawCommands();
+
+        if (! self::getFfi()->NativeRenderer_setThreadCount($this->nativeRendererFfi, $threadCount)) {
+            throw new \RuntimeException(sprintf('Cannot start %d rendering threads', $threadCount));
+        }
+    }
+
+    /**
+     * With at least one buffer, present() hands the frames over to a dedicated writer thread instead of writing them
+     * synchronously. Up to $bufferCount frames can be queued before present() blocks.
+     */
+    public function setPresentationBufferCount(int $bufferCount): void
+    {
+        if (! self::getFfi()->NativeRenderer_setPresentationBufferCount($this->nativeRendererFfi, $bufferCount)) {
+            throw new \RuntimeException(sprintf('Cannot set up %d presentation buffers', $bufferCount));
+        }
+    }
+
+    /**
+     * Runs of identical characters are always erased (ECH) when made of spaces. The REP sequences (repeat the
+     * previous character) and the line shifts (DCH, delete characters) are optional since some terminals lack them.
+     */
+    public function setOutputCompression(bool $repeatSequencesEnabled, bool $lineShiftsEnabled): void
+    {
+        self::getFfi()->NativeRenderer_setOutputCompression(
+            $this->nativeRendererFfi,
+            (int) $repeatSequencesEnabled,
+            (int) $lineShiftsEnabled
+        );
+    }
+
+    /**
+     * With a medium, the frames are sent as an image through the kitty graphics protocol instead of being encoded as
+     * characters: 'shm' (shared memory) and 'file' (temporary file) only transmit the name of an object holding the
+     * pixels, which requires the terminal to share the memory / file system, while 'direct' transmits them in base64.
+     *
+     * @return bool false if the medium is unavailable, in which case the frames are still encoded as characters
+     */
+    public function setGraphicsOutput(?string $medium): bool
+    {
+        $mediumIndex = $medium !== null ? array_search($medium, self::GRAPHICS_OUTPUT_MEDIUMS, true) : -1;
+
+        if ($mediumIndex === false) {
+            throw new \RuntimeException(sprintf('Unknown graphics output medium: %s', $medium));
+        }
+
+        $this->graphicsOutputMedium = $medium;
+
+        return (bool) self::getFfi()->NativeRenderer_setGraphicsOutput($this->nativeRendererFfi, $mediumIndex + 1);
+    }
+
+    /**
+     * @return string|null null with the text output, which is also fallen back to when a frame cannot be transmitted
+     */
+    public function getGraphicsOutput(): ?string
+    {
+        return \FFI::isNull($this->nativeRendererFfi->graphics) ? null : $this->graphicsOutputMedium;
+    }
+
+    /**
+     * Deletes the image displayed by the graphics output, if any, so that another renderer can take over the screen.
+     */
+    public function hideGraphics(): void
+    {
+        self::getFfi()->NativeRenderer_hideGraphics($this->nativeRendererFfi);
+    }
+
+    /**
+     * Records all the subsequent draw calls and frame updates into $fileName, until stopCapture() is called or the
+     * renderer is destroyed, so that they can be replayed by NativeRendererReplay or replayDrawStream.php.
+     */
+    public function startCapture(string $fileName): void
+    {
+        $this->flushDrawCommands();
+
+        if (! self::getFfi()->NativeRenderer_startCapture($this->nativeRendererFfi, $fileName)) {
+            throw new \RuntimeException(sprintf('Cannot create the draw stream capture file: %s', $fileName));
+        }
+    }
+
+    public function stopCapture(): void
+    {
+        $this->flushDrawCommands();
+
+        if (! self::getFfi()->NativeRenderer_stopCapture($this->nativeRendererFfi)) {
+            throw new \RuntimeException('Cannot write the draw stream capture file');
+        }
+    }
+
+    public function present(string $output): void
+    {
+        self::getFfi()->NativeRenderer_present($this->nativeRendererFfi, $output, strlen($output));
+    }
+
+    public function waitForPresentation(): void
+    {
+        self::getFfi()->NativeRenderer_waitForPresentation($this->nativeRendererFfi);
+    }
+
+    /**
+     * @return int the number of frames which were waiting to be written when the last frame was presented
+     */
+    public function getPresentationQueueDepth(): int
+    {
+        return self::getFfi()->NativeRenderer_getPresentationQueueDepth($this->nativeRendererFfi);
+    }
+
+    /**
+     * @return float the time between the presentation of the last written frame and the end of its writing, in seconds
+     */
+    public function getPresentationWriteLatency(): float
+    {
+        return self::getFfi()->NativeRenderer_getPresentationWriteLatency($this->nativeRendererFfi);
+    }
+
+    /**
+     * @return array the per-stage frame times (in ms) and the counters cumulated since the last profile reset
+     */
+    public function getProfile(): array
+    {
+        self::getFfi()->NativeRenderer_getProfile($this->nativeRendererFfi, \FFI::addr($this->profileFfi));
+
+        $profile = $this->profileFfi;
+
+        $stages = [];
+        foreach (self::PROFILE_STAGES as $i => $stage) {
+            $stages[$stage] = [
+                'lastMs' => 1000 * $profile->lastStageTimes[$i],
+                'p50Ms' => 1000 * $profile->p50StageTimes[$i],
+                'p95Ms' => 1000 * $profile->p95StageTimes[$i],
+                'p99Ms' => 1000 * $profile->p99StageTimes[$i],
+                'maxMs' => 1000 * $profile->maxStageTimes[$i],
+            ];
+        }
+
+        return [
+            'frameCount' => $profile->frameCount,
+            'stages' => $stages,
+            'blendedPixelCount' => $profile->blendedPixelCount,
+            'ditheredAwayPixelCount' => $profile->ditheredAwayPixelCount,
+            'changedCharacterCount' => $profile->changedCharacterCount,
+            'emittedByteCount' => $profile->emittedByteCount,
+            'savedByteCount' => $profile->savedByteCount,
+            'deferredCharacterCount' => $profile->deferredCharacterCount,
+            'flushCount' => $profile->flushCount,
+        ];
+    }
+
+    public function resetProfile(): void
+    {
+        self::getFfi()->NativeRenderer_resetProfile($this->nativeRendererFfi);
+    }
+
     public function reset(): void
     {
+        $this->flushDrawCommands();
+
         self::getFfi()->NativeRenderer_reset($this->nativeRendererFfi);
     }
 
     public function clear(int $color): void
     {
+        $this->flushDrawCommands();
+
         self::getFfi()->NativeRenderer_clear($this->nativeRendererFfi, $color);
     }
 
@@ -97,10 +274,15 @@ class NativeRenderer implements RendererInterface
         array  $horizontalDistortionOffsets = [],
         array  $horizontalBackgroundDistortionOffsets = [],
         float  $ditheringAlphaRatioThreshold = 0,
+        float  $rotationAngle = 0,
+        bool   $bilinearFilteringEnabled = false,
     ): void {
+        if ($globalAlpha === 0) {
+            return;
+        }
+
         $bitmapWidth = $bitmap->getWidth();
         $bitmapHeight = $bitmap->getHeight();
-        $bitmapNativePixels = $bitmap->getNativePixels();
 
         if (
             $bitmapWidth > self::BITMAP_DIMENSION_MAX_SIZE ||
@@ -113,36 +295,57 @@ class NativeRenderer implements RendererInterface
             ));
         }
 
-        for ($i = 0; $i < $bitmapWidth; $i++) {
-            $this->verticalBlendingColorsFfiBuffer[$i] = $verticalBlendingColors[$i] ?? -1;
+        if (
+            $this->drawCommandCount === self::DRAW_COMMAND_BUFFER_SIZE ||
+            $this->drawArgumentCount + $bitmapWidth + 2 * $bitmapHeight > self::DRAW_ARGUMENT_BUFFER_SIZE
+        ) {
+            $this->flushDrawCommands();
         }
 
-        for ($i = 0; $i < $bitmapHeight; $i++) {
-            $this->horizontalDistortionOffsetsFfiBuffer[$i] = $horizontalDistortionOffsets[$i] ?? 0;
-            $this->horizontalBackgroundDistortionOffsetsFfiBuffer[$i] = $horizontalBackgroundDistortionOffsets[$i] ?? 0;
+        $command = $this->drawCommandsFfiBuffer[$this->drawCommandCount++];
+        $this->drawCommandBitmaps[] = $bitmap;
+
+        $command->bitmapPixels = $bitmap->getNativePixelsPointer();
+        $command->bitmapWidth = $bitmapWidth;
+        $command->bitmapHeight = $bitmapHeight;
+        $command->x = $x;
+        $command->y = $y;
+        $command->globalAlpha = $globalAlpha;
+        $command->brightness = $brightness;
+        $command->globalBlendingColor = $globalBlendingColor ?? -1;
+        $command->verticalBlendingColors = $this->pushDrawArguments($verticalBlendingColors, $bitmapWidth, -1);
+        $command->persisted = $persisted ? 1 : 0;
+        $command->globalPersistedColor = $globalPersistedColor ?? -1;
+        $command->horizontalDistortionOffsets = $this->pushDrawArguments($horizontalDistortionOffsets, $bitmapHeight, 0);
+        $command->horizontalBackgroundDistortionOffsets = $this->pushDrawArguments($horizontalBackgroundDistortionOffsets, $bitmapHeight, 0);
+        $command->ditheringAlphaRatioThreshold = $ditheringAlphaRatioThreshold;
+        $command->rotationAngle = $rotationAngle;
+        $command->bilinearFilteringEnabled = $bilinearFilteringEnabled ? 1 : 0;
+    }
+
+    /**
+     * Draws draw commands which have been built on the native side (e.g. see ParticleSystem::prepareDrawCommands()).
+     */
+    public function drawCommands(\FFI\CData $commands, int $commandCount): void
+    {
+        // the queued commands must be drawn first
+        $this->flushDrawCommands();
+
+        if ($commandCount === 0) {
+            return;
         }
 
-        self::getFfi()->NativeRenderer_drawBitmap(
+        self::getFfi()->NativeRenderer_drawBatch(
             $this->nativeRendererFfi,
-            $bitmapNativePixels,
-            $bitmapWidth,
-            $bitmapHeight,
-            $x,
-            $y,
-            $globalAlpha,
-            $brightness,
-            $globalBlendingColor !== null ? $globalBlendingColor : -1,
-            $this->verticalBlendingColorsFfiBuffer,
-            $persisted ? 1 : 0,
-            $globalPersistedColor !== null ? $globalPersistedColor : -1,
-            $this->horizontalDistortionOffsetsFfiBuffer,
-            $this->horizontalBackgroundDistortionOffsetsFfiBuffer,
-            $ditheringAlphaRatioThreshold
+            $commands,
+            $commandCount,
         );
     }
 
     public function drawRect(AABox $rect, int $color): void
     {
+        $this->flushDrawCommands();
+
         self::getFfi()->NativeRenderer_drawRect(
             $this->nativeRendererFfi,
             (int) $rect->getSize()->getWidth(),
@@ -153,21 +356,69 @@ class NativeRenderer implements RendererInterface
         );
     }
 
+    public function clearText(): void
+    {
+        self::getFfi()->NativeRenderer_clearText($this->nativeRendererFfi);
+    }
+
+    /**
+     * Draws ASCII text over the frame, in terminal coordinates (from 1), the lines past the frame (from height / 2)
+     * being status lines. Only the cells which differ from the terminal are written by update().
+     */
+    public function drawText(int $line, int $column, string $text, int $color, int $backgroundColor): void
+    {
+        if ($line < 1 || $column < 1) {
+            throw new \RuntimeException(sprintf('Invalid text position: %d;%d', $line, $column));
+        }
+
+        self::getFfi()->NativeRenderer_drawText(
+            $this->nativeRendererFfi,
+            $line,
+            $column,
+            $text,
+            strlen($text),
+            $color,
+            $backgroundColor,
+        );
+    }
+
     public function getDrawnBitmapPixelCount(): int
     {
+        $this->flushDrawCommands();
+
         return self::getFfi()->NativeRenderer_getDrawnBitmapPixelCount(
             $this->nativeRendererFfi,
         );
     }
 
+    public function getOutputByteCount(): int
+    {
+        return self::getFfi()->NativeRenderer_getOutputByteCount(
+            $this->nativeRendererFfi,
+        );
+    }
+
+    public function getPresentedPixels(): array
+    {
+        $this->flushDrawCommands();
+
+        return array_values(unpack(
+            'V*',
+            \FFI::string($this->nativeRendererFfi->previousFrameBuffer, 4 * $this->nativeRendererFfi->pixelCount)
+        ));
+    }
+
     function update(
         bool $trueColorModeEnabled,
         bool $persistenceEffectsEnabled,
         int $persistenceAlphaDecrease,
         int $removedColorDepthBits,
         int $lowResolutionMode,
+        bool $orderedDitheringEnabled = false,
+        int $changeThreshold = 0,
+        int $outputByteBudget = 0,
     ): int {
-        // $lowResolutionMode is not implemented yet
+        $this->flushDrawCommands();
 
         return self::getFfi()->NativeRenderer_update(
             $this->nativeRendererFfi,
@@ -175,6 +426,61 @@ class NativeRenderer implements RendererInterface
             $persistenceEffectsEnabled ? 1 : 0,
             $persistenceAlphaDecrease,
             $removedColorDepthBits,
+            $lowResolutionMode,
+            $orderedDitheringEnabled ? 1 : 0,
+            $changeThreshold,
+            $outputByteBudget,
         );
     }
+
+    private function flushDrawCommands(): void
+    {
+        if ($this->drawCommandCount === 0) {
+            return;
+        }
+
+        self::getFfi()->NativeRenderer_drawBatch(
+            $this->nativeRendererFfi,
+            $this->drawCommandsFfiBuffer,
+            $this->drawCommandCount,
+        );
+
+        $this->drawCommandCount = 0;
+        $this->drawArgumentCount = 0;
+        $this->drawCommandBitmaps = [];
+    }
+
+    /**
+     * Copies a per-row / per-column argument array into the shared argument buffer.
+     *
+     * @param array<int> $values
+     * @return \FFI\CData|null null (i.e. NULL on the native side) when there is nothing to copy
+     */
+    private function pushDrawArguments(array $values, int $count, int $defaultValue): ?\FFI\CData
+    {
+        if (count($values) === 0) {
+            return null;
+        }
+
+        $pointer = $this->drawArgumentsFfiPointer + $this->drawArgumentCount;
+        $this->drawArgumentCount += $count;
+
+        // only a list can be copied as is, an array filtered with array_filter() (e.g.) keeps its keys, which may be
+        // sparse (array_is_list() is not available before PHP 8.1, the bounds are checked instead of every key)
+        if (
+            count($values) === $count &&
+            array_key_first($values) === 0 &&
+            array_key_last($values) === $count - 1
+        ) {
+            \FFI::memcpy($pointer, pack('q*', ...$values), $count * 8);
+
+            return $pointer;
+        }
+
+        for ($i = 0; $i < $count; $i++) {
+            $pointer[$i] = $values[$i] ?? $defaultValue;
+        }
+
+        return $pointer;
+    }
 }
@@ -0,0 +1,217 @@
+/*
+ * Measures the sprite fill rate (drawn pixels per second, as reported by the "Sprite fill rate" figure of the debug
+ * line) of every drawing kernel of the native renderer, and of NativeRenderer_drawBitmapReference() for comparison.
+ *
+ * The sprites are drawn at random positions on a 300x144 screen, half of their pixels being translucent or
+ * transparent, as the game sprites are.
+ *
+ * It is built without PHP, as NativeRendererReplay.c is:
+ *     gcc -O3 -march=native -ffast-math -Wall -pthread -Isrc/Engine/NativeRendererReplay \
+ *         -o NativeRendererBenchmark src/Engine/NativeRendererBenchmark.c -lm
+ *
+ * Usage: NativeRendererBenchmark [--duration=<seconds per kernel>] [--sprite-size=<width>x<height>]
+ */
+#include "NativeRenderer.c"
+
+#define NATIVE_RENDERER_BENCHMARK_WIDTH 300
+#define NATIVE_RENDERER_BENCHMARK_HEIGHT 144
+#define NATIVE_RENDERER_BENCHMARK_POSITION_COUNT 1024
+
+size_t php_output_write(const char * str, size_t len)
+{
+    (void) str;
+
+    return len;
+}
+
+void php_output_flush(void)
+{
+}
+
+double _php_math_round(double value, int places, int mode)
+{
+    (void) places;
+    (void) mode;
+
+    return round(value);
+}
+
+typedef size_t (*NativeRendererBenchmarkKernel)(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command,
+    size_t firstRow,
+    size_t lastRow,
+    size_t * ditheredAwayPixelCount
+);
+
+// same signature as the kernels, so that the reference is measured the same way
+static size_t NativeRendererBenchmark_drawReferenceBitmap(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command,
+    size_t firstRow,
+    size_t lastRow,
+    size_t * ditheredAwayPixelCount
+) {
+    // the reference draws every row and does not count the pixels it dithers away
+    (void) firstRow;
+    (void) lastRow;
+    (void) ditheredAwayPixelCount;
+
+    const size_t drawnBitmapPixelCount = nativeRenderer->drawnBitmapPixelCount;
+
+    NativeRenderer_drawBitmapReference(
+        nativeRenderer,
+        command->bitmapPixels,
+        command->bitmapWidth,
+        command->bitmapHeight,
+        command->x,
+        command->y,
+        command->globalAlpha,
+        command->brightness,
+        command->globalBlendingColor,
+        command->verticalBlendingColors,
+        command->persisted,
+        command->globalPersistedColor,
+        command->horizontalDistortionOffsets,
+        command->horizontalBackgroundDistortionOffsets,
+        command->ditheringAlphaRatioThreshold
+    );
+
+    return nativeRenderer->drawnBitmapPixelCount - drawnBitmapPixelCount;
+}
+
+typedef struct {
+    const char * name;
+    NativeRendererBenchmarkKernel kernel;
+    int64_t globalAlpha;
+    float brightness;
+    int64_t globalBlendingColor;
+    int64_t persisted;
+} NativeRendererBenchmarkCase;
+
+static const NativeRendererBenchmarkCase NativeRendererBenchmark_cases[] = {
+    {"opaque", NativeRenderer_drawOpaqueBitmap, 255, 1, -1, 0},
+    {"translucent", NativeRenderer_drawTranslucentBitmap, 192, 1, -1, 0},
+    {"shaded", NativeRenderer_drawShadedBitmap, 192, 0.6f, -1, 0},
+    {"blended", NativeRenderer_drawBlendedBitmap, 192, 0.6f, 0x80ff4000, 0},
+    {"persisted", NativeRenderer_drawPersistedBitmap, 192, 0.6f, 0x80ff4000, 1},
+    {"reference (blended)", NativeRendererBenchmark_drawReferenceBitmap, 192, 0.6f, 0x80ff4000, 0},
+    {"reference (persisted)", NativeRendererBenchmark_drawReferenceBitmap, 192, 0.6f, 0x80ff4000, 1},
+};
+
+int main(int argc, char ** argv)
+{
+    double duration = 1;
+    size_t spriteWidth = 32;
+    size_t spriteHeight = 32;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--duration=", 11) == 0) {
+            duration = strtod(argv[i] + 11, NULL);
+        } else if (
+            strncmp(argv[i], "--sprite-size=", 14) != 0
+            || sscanf(argv[i] + 14, "%zux%zu", &spriteWidth, &spriteHeight) != 2
+        ) {
+            fprintf(
+                stderr,
+                "Usage: %s [--duration=<seconds per kernel>] [--sprite-size=<width>x<height>]\n",
+                argv[0]
+            );
+
+            return 1;
+        }
+    }
+
+    if (spriteWidth < 1 || spriteWidth > NATIVE_RENDERER_KERNEL_MAX_BITMAP_WIDTH || spriteHeight < 1) {
+        fprintf(stderr, "The sprite width must be within [1, %d]\n", NATIVE_RENDERER_KERNEL_MAX_BITMAP_WIDTH);
+
+        return 1;
+    }
+
+    NativeRenderer * nativeRenderer = NativeRenderer_create(
+        NATIVE_RENDERER_BENCHMARK_WIDTH,
+        NATIVE_RENDERER_BENCHMARK_HEIGHT
+    );
+    uint32_t * spritePixels = malloc(spriteWidth * spriteHeight * sizeof(uint32_t));
+    if (! nativeRenderer || ! spritePixels) {
+        fprintf(stderr, "Cannot create the renderer\n");
+
+        return 1;
+    }
+
+    uint32_t randomState = 1;
+    for (size_t i = 0; i < spriteWidth * spriteHeight; i++) {
+        randomState = 214013 * randomState + 2531011;
+        const uint32_t alpha = (randomState >> 16) % 4 == 0 ? 0 : ((randomState >> 16) % 4 == 1 ? 128 : 255);
+        spritePixels[i] = alpha << 24 | (randomState & 0xffffff);
+    }
+
+    int64_t positions[NATIVE_RENDERER_BENCHMARK_POSITION_COUNT][2];
+    for (size_t i = 0; i < NATIVE_RENDERER_BENCHMARK_POSITION_COUNT; i++) {
+        randomState = 214013 * randomState + 2531011;
+        positions[i][0] = (int64_t) ((randomState >> 8) % (NATIVE_RENDERER_BENCHMARK_WIDTH + spriteWidth)) - spriteWidth;
+        randomState = 214013 * randomState + 2531011;
+        positions[i][1] = (int64_t) ((randomState >> 8) % (NATIVE_RENDERER_BENCHMARK_HEIGHT + spriteHeight)) - spriteHeight;
+    }
+
+    printf(
+        "Sprite fill rate (%zux%zu sprites on a %dx%d screen):\n",
+        spriteWidth,
+        spriteHeight,
+        NATIVE_RENDERER_BENCHMARK_WIDTH,
+        NATIVE_RENDERER_BENCHMARK_HEIGHT
+    );
+
+    for (size_t i = 0; i < sizeof NativeRendererBenchmark_cases / sizeof NativeRendererBenchmark_cases[0]; i++) {
+        const NativeRendererBenchmarkCase * benchmarkCase = &NativeRendererBenchmark_cases[i];
+
+        NativeRendererDrawCommand command = {
+            .bitmapPixels = spritePixels,
+            .bitmapWidth = spriteWidth,
+            .bitmapHeight = spriteHeight,
+            .globalAlpha = benchmarkCase->globalAlpha,
+            .brightness = benchmarkCase->brightness,
+            .globalBlendingColor = benchmarkCase->globalBlendingColor,
+            .persisted = benchmarkCase->persisted,
+            .globalPersistedColor = -1,
+        };
+
+        NativeRenderer_reset(nativeRenderer);
+
+        size_t drawnPixelCount = 0;
+        size_t ditheredAwayPixelCount = 0;
+        size_t drawCount = 0;
+        double elapsedTime = 0;
+        const double startTime = NativeRenderer_getTime();
+
+        // the clock is only read every batch of draws, so that its cost is negligible
+        while (elapsedTime < duration) {
+            for (size_t j = 0; j < NATIVE_RENDERER_BENCHMARK_POSITION_COUNT; j++) {
+                command.x = positions[j][0];
+                command.y = positions[j][1];
+                drawnPixelCount += benchmarkCase->kernel(
+                    nativeRenderer,
+                    &command,
+                    0,
+                    NATIVE_RENDERER_BENCHMARK_HEIGHT,
+                    &ditheredAwayPixelCount
+                );
+            }
+
+            drawCount += NATIVE_RENDERER_BENCHMARK_POSITION_COUNT;
+            elapsedTime = NativeRenderer_getTime() - startTime;
+        }
+
+        printf(
+            "    %-24s %8.1fM pixel/s (%6.0fK sprite/s)\n",
+            benchmarkCase->name,
+            drawnPixelCount / elapsedTime / (1000 * 1000),
+            drawCount / elapsedTime / 1000
+        );
+    }
+
+    free(spritePixels);
+    NativeRenderer_destroy(nativeRenderer);
+
+    return 0;
+}
@@ -0,0 +1,264 @@
+<?php
+
+namespace NoiseByNorthwest\TermAsteroids\Engine;
+
+/**
+ * Builds and locates the shared library of the native renderer (NativeRenderer.c).
+ *
+ * The libraries are cached in .tmp under a key derived from their sources, all of their compiler and linker flags and
+ * the PHP version, so that the compiler only runs when one of them changed. The prebuilt ISA variants (see
+ * buildIsaVariants()) are picked first, according to the CPU features, then the host-specific build (-march=native) is
+ * compiled on demand.
+ */
+class NativeRendererLibrary
+{
+    /**
+     * The prebuilt variants, from the most to the least specialized, with the CPU flags (as listed by /proc/cpuinfo)
+     * they require. They are GCC's x86-64 micro-architecture levels: AVX-512, AVX2 and the baseline.
+     */
+    const ISA_VARIANTS = [
+        'x86-64-v4' => [
+            'avx', 'avx2', 'bmi1', 'bmi2', 'f16c', 'fma', 'abm', 'movbe', 'xsave',
+            'avx512f', 'avx512bw', 'avx512cd', 'avx512dq', 'avx512vl',
+        ],
+        'x86-64-v3' => ['avx', 'avx2', 'bmi1', 'bmi2', 'f16c', 'fma', 'abm', 'movbe', 'xsave'],
+        'x86-64' => [],
+    ];
+
+    private const HOST_VARIANT = 'native';
+
+    private const COMPILER_FLAGS = '-O3 -ffast-math -Werror -Wall -pthread -fPIC';
+
+    private const LINKER_FLAGS = '-lm';
+
+    private const INCLUDE_PATH_FLAGS = [
+        '-I/usr/local/include/php',
+        '-I/usr/local/include/php/main',
+        '-I/usr/local/include/php/TSRM',
+        '-I/usr/local/include/php/Zend',
+        '-I/usr/local/include/php/ext',
+        '-I/usr/local/include/php/ext/date/lib',
+    ];
+
+    // the value profiling counters are thread-local in libgcov, which breaks the loading of the instrumented library
+    private const PROFILE_GENERATION_FLAGS = '-fno-profile-values -fprofile-update=atomic';
+
+    private const PROFILE_USE_FLAGS = '-flto=auto';
+
+    private static ?string $fileName = null;
+
+    private static ?string $sourceHash = null;
+
+    /**
+     * Makes getFileName() return $fileName instead of a cached library (e.g. to train an instrumented one).
+     */
+    public static function setFileName(?string $fileName): void
+    {
+        self::$fileName = $fileName;
+    }
+
+    public static function getFileName(): string
+    {
+        if (self::$fileName !== null) {
+            return self::$fileName;
+        }
+
+        foreach (self::getSupportedIsaVariants() as $variant) {
+            foreach ([true, false] as $profileGuided) {
+                $fileName = self::getVariantFileName($variant, $profileGuided);
+
+                if (file_exists($fileName)) {
+                    return $fileName;
+                }
+            }
+        }
+
+        $fileName = self::getVariantFileName(self::HOST_VARIANT, false);
+
+        if (! file_exists($fileName)) {
+            self::build(self::HOST_VARIANT, $fileName);
+        }
+
+        return $fileName;
+    }
+
+    /**
+     * With $train, each variant is compiled with profile-guided and link-time optimizations, the profile being
+     * collected by calling $train with the file name of an instrumented library, which it must load in other
+     * processes and exercise until they exit.
+     *
+     * @param callable(string): void|null $train
+     * @return array<string> the built library file name per variant
+     */
+    public static function buildIsaVariants(?callable $train = null): array
+    {
+        $profileDirName = self::getDirName() . '/NativeRendererProfile';
+        $objectFileName = $profileDirName . '/NativeRenderer.o';
+
+        if ($train !== null) {
+            shell_exec('rm -rf ' . escapeshellarg($profileDirName));
+            mkdir($profileDirName);
+
+            // the least specialized variant is profiled, its control flow being the same as the others' one
+            $instrumentedFileName = $profileDirName . '/NativeRenderer.so';
+            self::build(
+                array_key_last(self::ISA_VARIANTS),
+                $instrumentedFileName,
+                sprintf('-fprofile-generate=%s %s', $profileDirName, self::PROFILE_GENERATION_FLAGS),
+                $objectFileName
+            );
+
+            $train($instrumentedFileName);
+        }
+
+        $fileNames = [];
+        foreach (array_keys(self::ISA_VARIANTS) as $variant) {
+            $fileName = self::getVariantFileName($variant, $train !== null);
+
+            self::build(
+                $variant,
+                $fileName,
+                $train !== null ? sprintf('-fprofile-use=%s %s', $profileDirName, self::PROFILE_USE_FLAGS) : '',
+                // the profile is looked up by the object file name
+                $train !== null ? $objectFileName : null
+            );
+
+            $fileNames[$variant] = $fileName;
+        }
+
+        return $fileNames;
+    }
+
+    /**
+     * @return array<string> the prebuildable variants supported by the CPU, from the most to the least specialized
+     */
+    private static function getSupportedIsaVariants(): array
+    {
+        if (php_uname('m') !== 'x86_64') {
+            return [];
+        }
+
+        $cpuFlags = self::getCpuFlags();
+
+        return array_keys(array_filter(
+            self::ISA_VARIANTS,
+            fn (array $requiredCpuFlags) => count(array_diff($requiredCpuFlags, $cpuFlags)) === 0
+        ));
+    }
+
+    /**
+     * @return array<string>
+     */
+    private static function getCpuFlags(): array
+    {
+        $cpuInfo = @file_get_contents('/proc/cpuinfo');
+
+        if ($cpuInfo === false || ! preg_match('/^flags\s*:(.*)$/m', $cpuInfo, $matches)) {
+            return [];
+        }
+
+        return preg_split('/\s+/', trim($matches[1]));
+    }
+
+    private static function getDirName(): string
+    {
+        $dirName = realpath(__DIR__ . '/../../.tmp');
+        assert($dirName !== false);
+
+        return $dirName;
+    }
+
+    private static function getVariantFileName(string $variant, bool $profileGuided): string
+    {
+        self::$sourceHash ??= sha1(implode("\0", [
+            file_get_contents(__DIR__ . '/NativeRenderer.c'),
+            file_get_contents(__DIR__ . '/NativeRenderer.h'),
+            self::COMPILER_FLAGS,
+            implode(' ', self::INCLUDE_PATH_FLAGS),
+            self::PROFILE_GENERATION_FLAGS,
+            self::PROFILE_USE_FLAGS,
+            self::LINKER_FLAGS,
+            PHP_VERSION,
+        ]));
+
+        $key = self::$sourceHash;
+        if ($variant === self::HOST_VARIANT) {
+            // a host-specific build must not be picked by another CPU sharing the cache
+            $key = sha1($key . implode(' ', self::getCpuFlags()));
+        }
+
+        return sprintf(
+            '%s/NativeRenderer.%s%s.%s.so',
+            self::getDirName(),
+            $variant,
+            $profileGuided ? '.pgo' : '',
+            substr($key, 0, 16)
+        );
+    }
+
+    /**
+     * The other libraries of the same variant are removed once $fileName is built, as they are either outdated or
+     * superseded.
+     *
+     * @param string|null $objectFileName if set, the source is compiled then linked in two steps through this object
+     */
+    private static function build(
+        string $variant,
+        string $fileName,
+        string $additionalFlags = '',
+        ?string $objectFileName = null
+    ): void {
+        // the library is built aside then moved, so that a concurrent process never loads it half written
+        $temporaryFileName = sprintf('%s.%d.tmp', $fileName, getmypid());
+        $flags = sprintf(
+            '%s -march=%s %s %s',
+            self::COMPILER_FLAGS,
+            $variant,
+            implode(' ', self::INCLUDE_PATH_FLAGS),
+            $additionalFlags
+        );
+
+        $commands = $objectFileName !== null
+            ? [
+                sprintf('gcc %s -c -o %s %s', $flags, $objectFileName, __DIR__ . '/NativeRenderer.c'),
+                sprintf(
+                    'gcc %s -shared -o %s %s %s',
+                    $flags,
+                    $temporaryFileName,
+                    $objectFileName,
+                    self::LINKER_FLAGS
+                ),
+            ]
+            : [
+                sprintf(
+                    'gcc %s -shared -o %s %s %s',
+                    $flags,
+                    $temporaryFileName,
+                    __DIR__ . '/NativeRenderer.c',
+                    self::LINKER_FLAGS
+                ),
+            ];
+
+        foreach ($commands as $command) {
+            exec($command . ' 2>&1', $output, $resultCode);
+
+            if ($resultCode !== 0) {
+                @unlink($temporaryFileName);
+
+                throw new \RuntimeException(sprintf(
+                    "Cannot build the native renderer library:\n%s\n%s",
+                    $command,
+                    implode("\n", $output)
+                ));
+            }
+        }
+
+        rename($temporaryFileName, $fileName);
+
+        foreach (glob(sprintf('%s/NativeRenderer.%s.*so', dirname($fileName), $variant)) as $otherFileName) {
+            if ($otherFileName !== $fileName) {
+                @unlink($otherFileName);
+            }
+        }
+    }
+}
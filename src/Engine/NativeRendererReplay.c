@@ -0,0 +1,359 @@
+/*
+ * Replays a draw stream captured by NativeRenderer_startCapture() through the native renderer, as fast as possible,
+ * and reports the frame times and the output sizes, so that renderer changes can be compared on the same frames,
+ * without the gameplay, PHP nor the terminal.
+ *
+ * It is built without PHP (see the headers of the NativeRendererReplay directory), the few PHP functions used by the
+ * renderer being provided here:
+ *     gcc -O3 -march=native -ffast-math -Wall -pthread -Isrc/Engine/NativeRendererReplay \
+ *         -o NativeRendererReplay src/Engine/NativeRendererReplay.c -lm
+ *
+ * Usage: NativeRendererReplay <capture file> [--threads=<count>] [--iterations=<count>] [--output=<file>] [--frames]
+ *     --output: writes the terminal output of the first iteration, so that the outputs of two builds can be diffed
+ *               (with the same thread count, each rendering band being encoded on its own)
+ *     --frames: prints the time and the output size of every frame of the first iteration
+ */
+#include "NativeRenderer.c"
+
+static FILE * NativeRendererReplay_outputFile = NULL;
+
+size_t php_output_write(const char * str, size_t len)
+{
+    if (NativeRendererReplay_outputFile) {
+        fwrite(str, 1, len, NativeRendererReplay_outputFile);
+    }
+
+    return len;
+}
+
+void php_output_flush(void)
+{
+}
+
+// only used by the bitmap generators, which are not replayed
+double _php_math_round(double value, int places, int mode)
+{
+    (void) places;
+    (void) mode;
+
+    return round(value);
+}
+
+static int NativeRendererReplay_compareDoubles(const void * a, const void * b)
+{
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void NativeRendererReplay_fail(const char * message, const char * argument)
+{
+    fprintf(stderr, message, argument);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char ** argv)
+{
+    const char * fileName = NULL;
+    const char * outputFileName = NULL;
+    size_t threadCount = 1;
+    size_t iterationCount = 1;
+    int framesPrinted = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threadCount = strtoul(argv[i] + 10, NULL, 10);
+        } else if (strncmp(argv[i], "--iterations=", 13) == 0) {
+            iterationCount = strtoul(argv[i] + 13, NULL, 10);
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            outputFileName = argv[i] + 9;
+        } else if (strcmp(argv[i], "--frames") == 0) {
+            framesPrinted = 1;
+        } else if (argv[i][0] != '-' && ! fileName) {
+            fileName = argv[i];
+        } else {
+            NativeRendererReplay_fail("Unknown argument: %s", argv[i]);
+        }
+    }
+
+    if (! fileName || threadCount < 1 || iterationCount < 1) {
+        NativeRendererReplay_fail(
+            "Usage: %s <capture file> [--threads=<count>] [--iterations=<count>] [--output=<file>] [--frames]",
+            argv[0]
+        );
+    }
+
+    const int fd = open(fileName, O_RDONLY);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) != 0) {
+        NativeRendererReplay_fail("Cannot open %s", fileName);
+    }
+
+    const size_t fileSize = fileStat.st_size;
+    const char * data = fileSize > 0 ? mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    const NativeRendererCaptureHeader * header = (const NativeRendererCaptureHeader *) data;
+    if (
+        data == MAP_FAILED ||
+            fileSize < sizeof *header ||
+            memcmp(header->magic, NATIVE_RENDERER_CAPTURE_MAGIC, sizeof header->magic) != 0 ||
+            header->version != NATIVE_RENDERER_CAPTURE_VERSION
+    ) {
+        NativeRendererReplay_fail("%s is not a draw stream capture of the current version", fileName);
+    }
+
+    // first pass: the bitmaps are indexed, and the records checked, so that the replay itself only draws
+    const uint32_t ** bitmapPixels = NULL;
+    const NativeRendererCapturedBitmap ** bitmaps = NULL;
+    size_t bitmapCount = 0;
+    size_t frameCount = 0;
+    size_t maxBatchSize = 1;
+    size_t batchSize = 0;
+
+    for (size_t offset = sizeof *header; offset < fileSize;) {
+        const NativeRendererCaptureRecord * record = (const NativeRendererCaptureRecord *) (data + offset);
+        if (fileSize - offset < sizeof *record || fileSize - offset - sizeof *record < record->size) {
+            NativeRendererReplay_fail("%s is truncated", fileName);
+        }
+
+        const char * payload = data + offset + sizeof *record;
+        offset += sizeof *record + record->size;
+
+        if (record->type == NATIVE_RENDERER_CAPTURE_BITMAP) {
+            const NativeRendererCapturedBitmap * bitmap = (const NativeRendererCapturedBitmap *) payload;
+            if (bitmap->index != bitmapCount) {
+                NativeRendererReplay_fail("%s has out of order bitmaps", fileName);
+            }
+
+            if (bitmap->width > NATIVE_RENDERER_KERNEL_MAX_BITMAP_WIDTH) {
+                NativeRendererReplay_fail("%s has a bitmap too wide to be drawn", fileName);
+            }
+
+            bitmapPixels = realloc(bitmapPixels, (bitmapCount + 1) * sizeof *bitmapPixels);
+            bitmaps = realloc(bitmaps, (bitmapCount + 1) * sizeof *bitmaps);
+            if (! bitmapPixels || ! bitmaps) {
+                NativeRendererReplay_fail("Cannot index the bitmaps of %s", fileName);
+            }
+
+            bitmaps[bitmapCount] = bitmap;
+            bitmapPixels[bitmapCount] = (const uint32_t *) (bitmap + 1);
+            bitmapCount++;
+        } else if (record->type == NATIVE_RENDERER_CAPTURE_DRAW) {
+            if (((const NativeRendererCapturedDraw *) payload)->bitmapIndex >= bitmapCount) {
+                NativeRendererReplay_fail("%s draws an unknown bitmap", fileName);
+            }
+
+            batchSize++;
+            maxBatchSize = batchSize > maxBatchSize ? batchSize : maxBatchSize;
+        } else {
+            batchSize = 0;
+            frameCount += record->type == NATIVE_RENDERER_CAPTURE_UPDATE;
+        }
+    }
+
+    NativeRenderer * nativeRenderer = NativeRenderer_create(header->width, header->height);
+    NativeRendererDrawCommand * commands = malloc(maxBatchSize * sizeof *commands);
+    double * frameTimes = malloc((frameCount + 1) * sizeof *frameTimes);
+    double * sortedFrameTimes = malloc((frameCount + 1) * iterationCount * sizeof *sortedFrameTimes);
+    size_t * frameOutputSizes = malloc((frameCount + 1) * sizeof *frameOutputSizes);
+    if (! nativeRenderer || ! commands || ! frameTimes || ! sortedFrameTimes || ! frameOutputSizes) {
+        NativeRendererReplay_fail("Cannot allocate the renderer for %s", fileName);
+    }
+
+    if (! NativeRenderer_setThreadCount(nativeRenderer, threadCount)) {
+        NativeRendererReplay_fail("Cannot start the rendering threads of %s", fileName);
+    }
+
+    if (outputFileName && ! (NativeRendererReplay_outputFile = fopen(outputFileName, "wb"))) {
+        NativeRendererReplay_fail("Cannot create %s", outputFileName);
+    }
+
+    size_t totalOutputSize = 0;
+    double totalTime = 0;
+
+    for (size_t iteration = 0; iteration < iterationCount; iteration++) {
+        size_t frameIndex = 0;
+        size_t commandCount = 0;
+        double frameStartTime = NativeRenderer_getTime();
+
+        NativeRenderer_reset(nativeRenderer);
+
+        for (size_t offset = sizeof *header; offset < fileSize;) {
+            const NativeRendererCaptureRecord * record = (const NativeRendererCaptureRecord *) (data + offset);
+            const char * payload = data + offset + sizeof *record;
+            offset += sizeof *record + record->size;
+
+            if (record->type == NATIVE_RENDERER_CAPTURE_DRAW) {
+                // the consecutive draws are batched, as NativeRenderer::flushDrawCommands() does
+                const NativeRendererCapturedDraw * draw = (const NativeRendererCapturedDraw *) payload;
+                const NativeRendererCapturedBitmap * bitmap = bitmaps[draw->bitmapIndex];
+                int64_t * arrays = (int64_t *) (draw + 1);
+
+                NativeRendererDrawCommand * command = &commands[commandCount++];
+                *command = (NativeRendererDrawCommand) {
+                    .bitmapPixels = (uint32_t *) bitmapPixels[draw->bitmapIndex],
+                    .bitmapWidth = bitmap->width,
+                    .bitmapHeight = bitmap->height,
+                    .x = draw->x,
+                    .y = draw->y,
+                    .globalAlpha = draw->globalAlpha,
+                    .brightness = draw->brightness,
+                    .globalBlendingColor = draw->globalBlendingColor,
+                    .persisted = draw->persisted,
+                    .globalPersistedColor = draw->globalPersistedColor,
+                    .ditheringAlphaRatioThreshold = draw->ditheringAlphaRatioThreshold,
+                    .rotationAngle = draw->rotationAngle,
+                    .bilinearFilteringEnabled = draw->bilinearFilteringEnabled,
+                };
+
+                if (draw->arrayFlags & NATIVE_RENDERER_CAPTURED_VERTICAL_BLENDING_COLORS) {
+                    command->verticalBlendingColors = arrays;
+                    arrays += bitmap->width;
+                }
+
+                if (draw->arrayFlags & NATIVE_RENDERER_CAPTURED_HORIZONTAL_DISTORTION_OFFSETS) {
+                    command->horizontalDistortionOffsets = arrays;
+                    arrays += bitmap->height;
+                }
+
+                if (draw->arrayFlags & NATIVE_RENDERER_CAPTURED_HORIZONTAL_BACKGROUND_DISTORTION_OFFSETS) {
+                    command->horizontalBackgroundDistortionOffsets = arrays;
+                }
+
+                continue;
+            }
+
+            if (commandCount > 0) {
+                NativeRenderer_drawBatch(nativeRenderer, commands, commandCount);
+                commandCount = 0;
+            }
+
+            switch (record->type) {
+                case NATIVE_RENDERER_CAPTURE_RESET:
+                    NativeRenderer_reset(nativeRenderer);
+                    break;
+
+                case NATIVE_RENDERER_CAPTURE_CLEAR:
+                    NativeRenderer_clear(nativeRenderer, ((const NativeRendererCapturedClear *) payload)->color);
+                    break;
+
+                case NATIVE_RENDERER_CAPTURE_RECT: {
+                    const NativeRendererCapturedRect * rect = (const NativeRendererCapturedRect *) payload;
+                    NativeRenderer_drawRect(nativeRenderer, rect->width, rect->height, rect->x, rect->y, rect->color);
+                    break;
+                }
+
+                case NATIVE_RENDERER_CAPTURE_CLEAR_TEXT:
+                    NativeRenderer_clearText(nativeRenderer);
+                    break;
+
+                case NATIVE_RENDERER_CAPTURE_TEXT: {
+                    const NativeRendererCapturedText * text = (const NativeRendererCapturedText *) payload;
+                    NativeRenderer_drawText(
+                        nativeRenderer,
+                        text->line,
+                        text->column,
+                        (const char *) (text + 1),
+                        text->length,
+                        text->color,
+                        text->backgroundColor
+                    );
+                    break;
+                }
+
+                case NATIVE_RENDERER_CAPTURE_UPDATE: {
+                    const NativeRendererCapturedUpdate * update = (const NativeRendererCapturedUpdate *) payload;
+                    NativeRenderer_update(
+                        nativeRenderer,
+                        update->trueColorModeEnabled,
+                        update->persistenceEffectsEnabled,
+                        update->persistenceAlphaDecrease,
+                        update->removedColorDepthBits,
+                        update->lowResolutionMode,
+                        update->orderedDitheringEnabled,
+                        update->changeThreshold,
+                        update->outputByteBudget
+                    );
+
+                    const double frameEndTime = NativeRenderer_getTime();
+                    frameTimes[frameIndex] = frameEndTime - frameStartTime;
+                    frameOutputSizes[frameIndex] = NativeRenderer_getOutputByteCount(nativeRenderer);
+                    sortedFrameTimes[iteration * frameCount + frameIndex] = frameTimes[frameIndex];
+                    totalOutputSize += frameOutputSizes[frameIndex];
+                    totalTime += frameTimes[frameIndex];
+                    frameIndex++;
+                    frameStartTime = frameEndTime;
+                    break;
+                }
+            }
+        }
+
+        if (iteration == 0) {
+            if (NativeRendererReplay_outputFile) {
+                fclose(NativeRendererReplay_outputFile);
+                NativeRendererReplay_outputFile = NULL;
+            }
+
+            for (size_t i = 0; framesPrinted && i < frameCount; i++) {
+                printf("Frame %6zu: %8.3f ms - %8zu bytes\n", i, 1000 * frameTimes[i], frameOutputSizes[i]);
+            }
+        }
+    }
+
+    const size_t replayedFrameCount = frameCount * iterationCount;
+    if (replayedFrameCount == 0) {
+        NativeRendererReplay_fail("%s has no frame", fileName);
+    }
+
+    qsort(sortedFrameTimes, replayedFrameCount, sizeof *sortedFrameTimes, NativeRendererReplay_compareDoubles);
+
+    printf(
+        "Frames: %zu x %zu - Bitmaps: %zu - Threads: %zu\n",
+        frameCount,
+        iterationCount,
+        bitmapCount,
+        threadCount
+    );
+    printf(
+        "Frame time (ms): mean: %.3f - p50: %.3f - p95: %.3f - p99: %.3f - max: %.3f - FPS: %.1f\n",
+        1000 * totalTime / replayedFrameCount,
+        1000 * sortedFrameTimes[replayedFrameCount / 2],
+        1000 * sortedFrameTimes[replayedFrameCount * 95 / 100],
+        1000 * sortedFrameTimes[replayedFrameCount * 99 / 100],
+        1000 * sortedFrameTimes[replayedFrameCount - 1],
+        replayedFrameCount / totalTime
+    );
+    printf(
+        "Output (bytes): mean: %.0f per frame - total: %zu\n",
+        (double) totalOutputSize / replayedFrameCount,
+        totalOutputSize
+    );
+
+    NativeRendererProfile profile;
+    NativeRenderer_getProfile(nativeRenderer, &profile);
+
+    static const char * stageNames[NATIVE_RENDERER_STAGE_COUNT] = {
+        "clear", "draw", "persistence", "colorReduction", "encoding", "output",
+    };
+
+    printf("Stages (p50 / p95 / p99 ms):");
+    for (size_t i = 0; i < NATIVE_RENDERER_STAGE_COUNT; i++) {
+        printf(
+            "%s %s: %.3f / %.3f / %.3f",
+            i > 0 ? " -" : "",
+            stageNames[i],
+            1000 * profile.p50StageTimes[i],
+            1000 * profile.p95StageTimes[i],
+            1000 * profile.p99StageTimes[i]
+        );
+    }
+
+    printf("\n");
+
+    NativeRenderer_destroy(nativeRenderer);
+
+    return 0;
+}
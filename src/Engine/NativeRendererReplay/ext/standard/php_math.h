@@ -0,0 +1,6 @@
+/*
+ * Provided by NativeRendererReplay.c
+ */
+#define PHP_ROUND_HALF_UP 1
+
+double _php_math_round(double value, int places, int mode);
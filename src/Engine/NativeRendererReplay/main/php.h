@@ -0,0 +1,7 @@
+/*
+ * Stands in for PHP's header when NativeRenderer.c is built into NativeRendererReplay, without PHP.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
@@ -0,0 +1,6 @@
+/*
+ * Provided by NativeRendererReplay.c
+ */
+size_t php_output_write(const char * str, size_t len);
+
+void php_output_flush(void);
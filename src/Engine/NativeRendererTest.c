@@ -0,0 +1,1029 @@
+/*
+ * Checks the specialized drawing kernels of the native renderer against NativeRenderer_drawBitmapReference(), over
+ * randomized bitmaps, backgrounds and draw parameters, for every kernel with and without distortion and dithering.
+ * Then checks that the banded (multithreaded) rendering outputs the same bytes as the single-threaded one, and the
+ * kitty graphics output of a few known frames, for every transmission medium, by decoding the emitted graphics
+ * commands and the shared memory objects / temporary files they refer to into a mirror of the image.
+ *
+ * The kernels use exact integer arithmetic where the reference truncates double products, so their channels may
+ * differ by 1, but the drawn pixels, the dithering decisions and the alpha channels must be the same.
+ * Rotation is not covered by the reference (see replayDrawStream.php for a comparison with the PHP renderer, which
+ * supports it), but the bilinear sampling of rotated bitmaps is checked against a scalar bilinear sampler.
+ *
+ * It is built without PHP, as NativeRendererReplay.c is:
+ *     gcc -O3 -march=native -ffast-math -Wall -pthread -Isrc/Engine/NativeRendererReplay \
+ *         -o NativeRendererTest src/Engine/NativeRendererTest.c -lm
+ *
+ * Usage: NativeRendererTest [--iterations=<count per case>] [--seed=<seed>]
+ */
+#include "NativeRenderer.c"
+
+#define NATIVE_RENDERER_TEST_WIDTH 97
+#define NATIVE_RENDERER_TEST_HEIGHT 61
+#define NATIVE_RENDERER_TEST_MAX_BITMAP_WIDTH 80
+#define NATIVE_RENDERER_TEST_MAX_BITMAP_HEIGHT 40
+#define NATIVE_RENDERER_TEST_CHANNEL_TOLERANCE 1
+#define NATIVE_RENDERER_TEST_SAMPLE_TOLERANCE 3
+
+// the output of the renderer, see NativeRendererTest_runGraphicsCase()
+static char * NativeRendererTest_output = NULL;
+static size_t NativeRendererTest_outputLength = 0;
+static size_t NativeRendererTest_outputSize = 0;
+
+size_t php_output_write(const char * str, size_t len)
+{
+    if (NativeRendererTest_outputLength + len > NativeRendererTest_outputSize) {
+        NativeRendererTest_outputSize = 2 * (NativeRendererTest_outputLength + len);
+        NativeRendererTest_output = realloc(NativeRendererTest_output, NativeRendererTest_outputSize);
+        if (! NativeRendererTest_output) {
+            fprintf(stderr, "Cannot buffer the output\n");
+            exit(1);
+        }
+    }
+
+    memcpy(NativeRendererTest_output + NativeRendererTest_outputLength, str, len);
+    NativeRendererTest_outputLength += len;
+
+    return len;
+}
+
+void php_output_flush(void)
+{
+}
+
+double _php_math_round(double value, int places, int mode)
+{
+    (void) places;
+    (void) mode;
+
+    return round(value);
+}
+
+typedef size_t (*NativeRendererTestKernel)(
+    NativeRenderer * nativeRenderer,
+    const NativeRendererDrawCommand * command,
+    size_t firstRow,
+    size_t lastRow,
+    size_t * ditheredAwayPixelCount
+);
+
+typedef struct {
+    const char * name;
+    NativeRendererTestKernel kernel;
+    int alphaEnabled;
+    int brightnessEnabled;
+    int blendingEnabled;
+    int persistenceEnabled;
+} NativeRendererTestKernelCase;
+
+static const NativeRendererTestKernelCase NativeRendererTest_kernelCases[] = {
+    {"opaque", NativeRenderer_drawOpaqueBitmap, 0, 0, 0, 0},
+    {"translucent", NativeRenderer_drawTranslucentBitmap, 1, 0, 0, 0},
+    {"shaded", NativeRenderer_drawShadedBitmap, 1, 1, 0, 0},
+    {"blended", NativeRenderer_drawBlendedBitmap, 1, 1, 1, 0},
+    {"persisted", NativeRenderer_drawPersistedBitmap, 1, 1, 1, 1},
+};
+
+static uint64_t NativeRendererTest_randomState = 1;
+
+static uint32_t NativeRendererTest_random(void)
+{
+    // xorshift64*
+    NativeRendererTest_randomState ^= NativeRendererTest_randomState >> 12;
+    NativeRendererTest_randomState ^= NativeRendererTest_randomState << 25;
+    NativeRendererTest_randomState ^= NativeRendererTest_randomState >> 27;
+
+    return (NativeRendererTest_randomState * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+static int64_t NativeRendererTest_randomRange(int64_t min, int64_t max)
+{
+    return min + (int64_t) (NativeRendererTest_random() % (uint64_t) (max - min + 1));
+}
+
+// fully transparent and fully opaque alphas are over-represented, as the kernels special-case them
+static uint32_t NativeRendererTest_randomAlpha(void)
+{
+    switch (NativeRendererTest_random() % 4) {
+        case 0:
+            return 0;
+        case 1:
+            return 255;
+        default:
+            return NativeRendererTest_random() & 0xff;
+    }
+}
+
+static uint32_t NativeRendererTest_randomColor(uint32_t alpha)
+{
+    return alpha << 24 | (NativeRendererTest_random() & 0xffffff);
+}
+
+static int NativeRendererTest_comparePixels(uint32_t pixel, uint32_t referencePixel)
+{
+    if ((pixel >> 24) != (referencePixel >> 24)) {
+        return 0;
+    }
+
+    for (int shift = 0; shift < 24; shift += 8) {
+        const int difference = (int) ((pixel >> shift) & 0xff) - (int) ((referencePixel >> shift) & 0xff);
+        if (abs(difference) > NATIVE_RENDERER_TEST_CHANNEL_TOLERANCE) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static size_t NativeRendererTest_compareBuffers(
+    const char * name,
+    const char * caseName,
+    size_t iteration,
+    const uint32_t * buffer,
+    const uint32_t * referenceBuffer,
+    size_t pixelCount
+) {
+    for (size_t i = 0; i < pixelCount; i++) {
+        if (! NativeRendererTest_comparePixels(buffer[i], referenceBuffer[i])) {
+            fprintf(
+                stderr,
+                "%s, iteration %zu: %s pixel %zu is %08x instead of %08x\n",
+                caseName,
+                iteration,
+                name,
+                i,
+                buffer[i],
+                referenceBuffer[i]
+            );
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static size_t NativeRendererTest_runKernelCase(
+    NativeRenderer * nativeRenderer,
+    NativeRenderer * referenceRenderer,
+    const NativeRendererTestKernelCase * kernelCase,
+    int distorted,
+    int dithered,
+    size_t iterationCount
+) {
+    char caseName[64];
+    snprintf(
+        caseName,
+        sizeof caseName,
+        "%s%s%s",
+        kernelCase->name,
+        distorted ? ", distorted" : "",
+        dithered ? ", dithered" : ""
+    );
+
+    uint32_t bitmapPixels[NATIVE_RENDERER_TEST_MAX_BITMAP_WIDTH * NATIVE_RENDERER_TEST_MAX_BITMAP_HEIGHT];
+    int64_t verticalBlendingColors[NATIVE_RENDERER_TEST_MAX_BITMAP_WIDTH];
+    int64_t horizontalDistortionOffsets[NATIVE_RENDERER_TEST_MAX_BITMAP_HEIGHT];
+    int64_t horizontalBackgroundDistortionOffsets[NATIVE_RENDERER_TEST_MAX_BITMAP_HEIGHT];
+    const size_t pixelCount = nativeRenderer->pixelCount;
+    size_t failureCount = 0;
+
+    for (size_t iteration = 0; iteration < iterationCount; iteration++) {
+        for (size_t i = 0; i < pixelCount; i++) {
+            nativeRenderer->currentFrameBuffer[i] = NativeRendererTest_randomColor(255);
+            nativeRenderer->persistenceBuffer[i] = NativeRendererTest_randomColor(NativeRendererTest_randomAlpha());
+        }
+
+        memcpy(referenceRenderer->currentFrameBuffer, nativeRenderer->currentFrameBuffer, pixelCount * sizeof(uint32_t));
+        memcpy(referenceRenderer->persistenceBuffer, nativeRenderer->persistenceBuffer, pixelCount * sizeof(uint32_t));
+
+        const size_t bitmapWidth = NativeRendererTest_randomRange(1, NATIVE_RENDERER_TEST_MAX_BITMAP_WIDTH);
+        const size_t bitmapHeight = NativeRendererTest_randomRange(1, NATIVE_RENDERER_TEST_MAX_BITMAP_HEIGHT);
+
+        for (size_t i = 0; i < bitmapWidth * bitmapHeight; i++) {
+            bitmapPixels[i] = NativeRendererTest_randomColor(NativeRendererTest_randomAlpha());
+        }
+
+        NativeRendererDrawCommand command = {
+            .bitmapPixels = bitmapPixels,
+            .bitmapWidth = bitmapWidth,
+            .bitmapHeight = bitmapHeight,
+            // partially out of the screen on any side
+            .x = NativeRendererTest_randomRange(-(int64_t) bitmapWidth, NATIVE_RENDERER_TEST_WIDTH),
+            .y = NativeRendererTest_randomRange(-(int64_t) bitmapHeight, NATIVE_RENDERER_TEST_HEIGHT),
+            .globalAlpha = kernelCase->alphaEnabled ? NativeRendererTest_randomRange(1, 255) : 255,
+            .brightness = kernelCase->brightnessEnabled ? NativeRendererTest_randomRange(0, 1000) / 1000.0f : 1,
+            .globalBlendingColor = -1,
+            .persisted = kernelCase->persistenceEnabled,
+            .globalPersistedColor = -1,
+            .ditheringAlphaRatioThreshold = dithered ? NativeRendererTest_randomRange(1, 1000) / 1000.0f : 0,
+        };
+
+        if (kernelCase->blendingEnabled) {
+            if (NativeRendererTest_random() % 2) {
+                command.globalBlendingColor = NativeRendererTest_randomColor(NativeRendererTest_randomAlpha());
+            }
+
+            if (NativeRendererTest_random() % 2) {
+                for (size_t j = 0; j < bitmapWidth; j++) {
+                    verticalBlendingColors[j] = NativeRendererTest_random() % 4 == 0
+                        ? -1
+                        : (int64_t) NativeRendererTest_randomColor(NativeRendererTest_randomAlpha());
+                }
+
+                command.verticalBlendingColors = verticalBlendingColors;
+            }
+        }
+
+        if (kernelCase->persistenceEnabled && NativeRendererTest_random() % 2) {
+            command.globalPersistedColor = NativeRendererTest_randomColor(NativeRendererTest_randomAlpha());
+        }
+
+        if (distorted) {
+            for (size_t i = 0; i < bitmapHeight; i++) {
+                horizontalDistortionOffsets[i] = NativeRendererTest_randomRange(-8, 8);
+                // may wrap around the screen edges, or read out of the frame buffer
+                horizontalBackgroundDistortionOffsets[i] = NativeRendererTest_random() % 3 == 0
+                    ? 0
+                    : NativeRendererTest_randomRange(-2 * NATIVE_RENDERER_TEST_WIDTH, 2 * NATIVE_RENDERER_TEST_WIDTH);
+            }
+
+            command.horizontalDistortionOffsets = horizontalDistortionOffsets;
+            command.horizontalBackgroundDistortionOffsets = horizontalBackgroundDistortionOffsets;
+        }
+
+        size_t ditheredAwayPixelCount = 0;
+        const size_t drawnPixelCount = kernelCase->kernel(
+            nativeRenderer,
+            &command,
+            0,
+            nativeRenderer->height,
+            &ditheredAwayPixelCount
+        );
+
+        referenceRenderer->drawnBitmapPixelCount = 0;
+        NativeRenderer_drawBitmapReference(
+            referenceRenderer,
+            command.bitmapPixels,
+            command.bitmapWidth,
+            command.bitmapHeight,
+            command.x,
+            command.y,
+            command.globalAlpha,
+            command.brightness,
+            command.globalBlendingColor,
+            command.verticalBlendingColors,
+            command.persisted,
+            command.globalPersistedColor,
+            command.horizontalDistortionOffsets,
+            command.horizontalBackgroundDistortionOffsets,
+            command.ditheringAlphaRatioThreshold
+        );
+
+        if (drawnPixelCount != referenceRenderer->drawnBitmapPixelCount) {
+            fprintf(
+                stderr,
+                "%s, iteration %zu: %zu drawn pixels instead of %zu\n",
+                caseName,
+                iteration,
+                drawnPixelCount,
+                referenceRenderer->drawnBitmapPixelCount
+            );
+            failureCount++;
+            continue;
+        }
+
+        failureCount += NativeRendererTest_compareBuffers(
+            "frame buffer",
+            caseName,
+            iteration,
+            nativeRenderer->currentFrameBuffer,
+            referenceRenderer->currentFrameBuffer,
+            pixelCount
+        ) || NativeRendererTest_compareBuffers(
+            "persistence buffer",
+            caseName,
+            iteration,
+            nativeRenderer->persistenceBuffer,
+            referenceRenderer->persistenceBuffer,
+            pixelCount
+        );
+    }
+
+    printf("%-32s %s\n", caseName, failureCount == 0 ? "ok" : "FAILED");
+
+    return failureCount;
+}
+
+/*
+ * Straightforward bilinear sampling of the bitmap at (x, y), in doubles and with the premultiplied alpha of the
+ * sampler, the pixels out of the bitmap being transparent.
+ */
+static uint32_t NativeRendererTest_sampleBilinearReference(
+    const uint32_t * pixels,
+    size_t width,
+    size_t height,
+    double x,
+    double y
+) {
+    const double floorX = floor(x);
+    const double floorY = floor(y);
+    double alpha = 0, r = 0, g = 0, b = 0;
+
+    for (int k = 0; k < 4; k++) {
+        const int64_t sampleX = (int64_t) floorX + (k & 1);
+        const int64_t sampleY = (int64_t) floorY + (k >> 1);
+
+        if (sampleX < 0 || sampleX >= (int64_t) width || sampleY < 0 || sampleY >= (int64_t) height) {
+            continue;
+        }
+
+        const double weight = ((k & 1) ? x - floorX : 1 - (x - floorX)) * ((k >> 1) ? y - floorY : 1 - (y - floorY));
+        const uint32_t color = pixels[sampleY * width + sampleX];
+        const double weightedAlpha = weight * (color >> 24);
+
+        alpha += weightedAlpha;
+        r += weightedAlpha * ((color >> 16) & 0xff);
+        g += weightedAlpha * ((color >> 8) & 0xff);
+        b += weightedAlpha * (color & 0xff);
+    }
+
+    if (alpha < 1) {
+        return 0;
+    }
+
+    return (uint32_t) alpha << 24 | (uint32_t) lround(r / alpha) << 16 | (uint32_t) lround(g / alpha) << 8
+        | (uint32_t) lround(b / alpha);
+}
+
+/*
+ * The sampler quantizes its weights to 1/256, so the samples are compared premultiplied by their alpha (a nearly
+ * transparent sample may have any color), with NATIVE_RENDERER_TEST_SAMPLE_TOLERANCE.
+ */
+static int NativeRendererTest_compareSamples(uint32_t sample, uint32_t referenceSample)
+{
+    const int alpha = sample >> 24;
+    const int referenceAlpha = referenceSample >> 24;
+
+    if (abs(alpha - referenceAlpha) > NATIVE_RENDERER_TEST_SAMPLE_TOLERANCE) {
+        return 0;
+    }
+
+    for (int shift = 0; shift < 24; shift += 8) {
+        const int difference = (alpha * (int) ((sample >> shift) & 0xff)
+            - referenceAlpha * (int) ((referenceSample >> shift) & 0xff)) / 255;
+        if (abs(difference) > NATIVE_RENDERER_TEST_SAMPLE_TOLERANCE) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Checks the bilinear sampling of rotated bitmaps (see NativeRenderer_sampleTransformedBitmapRow()) against
+ * NativeRendererTest_sampleBilinearReference(), the source coordinates of each pixel being computed from scratch as
+ * PhpRenderer::rotatePixels() does, over random bitmaps, angles and row parts.
+ */
+static size_t NativeRendererTest_runBilinearSamplingCase(size_t iterationCount)
+{
+    const char * caseName = "rotated, bilinear";
+
+    uint32_t bitmapPixels[NATIVE_RENDERER_TEST_MAX_BITMAP_WIDTH * NATIVE_RENDERER_TEST_MAX_BITMAP_HEIGHT];
+    uint32_t sampledRowPixels[NATIVE_RENDERER_TEST_MAX_BITMAP_WIDTH];
+    size_t failureCount = 0;
+
+    for (size_t iteration = 0; iteration < iterationCount; iteration++) {
+        const size_t bitmapWidth = NativeRendererTest_randomRange(1, NATIVE_RENDERER_TEST_MAX_BITMAP_WIDTH);
+        const size_t bitmapHeight = NativeRendererTest_randomRange(1, NATIVE_RENDERER_TEST_MAX_BITMAP_HEIGHT);
+
+        for (size_t i = 0; i < bitmapWidth * bitmapHeight; i++) {
+            bitmapPixels[i] = NativeRendererTest_randomColor(NativeRendererTest_randomAlpha());
+        }
+
+        const NativeRendererDrawCommand command = {
+            .bitmapPixels = bitmapPixels,
+            .bitmapWidth = bitmapWidth,
+            .bitmapHeight = bitmapHeight,
+            .rotationAngle = NativeRendererTest_randomRange(-6283, 6283) / 1000.0,
+            .bilinearFilteringEnabled = 1,
+        };
+
+        const NativeRendererTransform transform = NativeRenderer_createRotationTransform(&command);
+        const double cosAngle = cos(command.rotationAngle);
+        const double sinAngle = sin(command.rotationAngle);
+        const double centerX = bitmapWidth / 2.0;
+        const double centerY = bitmapHeight / 2.0;
+
+        for (size_t i = 0; i < bitmapHeight && failureCount == 0; i++) {
+            // the rows are clipped by the screen edges
+            const size_t firstColumn = NativeRendererTest_randomRange(0, bitmapWidth - 1);
+            const size_t lastColumn = NativeRendererTest_randomRange(firstColumn + 1, bitmapWidth);
+
+            NativeRenderer_sampleTransformedBitmapRow(&command, &transform, i, firstColumn, lastColumn, sampledRowPixels);
+
+            for (size_t j = firstColumn; j < lastColumn; j++) {
+                const uint32_t referenceSample = NativeRendererTest_sampleBilinearReference(
+                    bitmapPixels,
+                    bitmapWidth,
+                    bitmapHeight,
+                    cosAngle * (j - centerX) - sinAngle * (i - centerY) + centerX,
+                    sinAngle * (j - centerX) + cosAngle * (i - centerY) + centerY
+                );
+
+                if (! NativeRendererTest_compareSamples(sampledRowPixels[j], referenceSample)) {
+                    fprintf(
+                        stderr,
+                        "%s, iteration %zu: pixel (%zu, %zu) is %08x instead of %08x\n",
+                        caseName,
+                        iteration,
+                        j,
+                        i,
+                        sampledRowPixels[j],
+                        referenceSample
+                    );
+                    failureCount++;
+                    break;
+                }
+            }
+        }
+    }
+
+    printf("%-32s %s\n", caseName, failureCount == 0 ? "ok" : "FAILED");
+
+    return failureCount;
+}
+
+#define NATIVE_RENDERER_TEST_BANDED_WIDTH 300
+#define NATIVE_RENDERER_TEST_BANDED_HEIGHT 144
+#define NATIVE_RENDERER_TEST_BANDED_THREAD_COUNT 4
+#define NATIVE_RENDERER_TEST_BANDED_FRAME_COUNT 30
+
+// draws the same random frame with both renderers, a few flat colors so that some characters are uniform
+static void NativeRendererTest_drawBandedFrame(NativeRenderer * nativeRenderers[2], uint32_t * bitmapPixels)
+{
+    static const uint32_t colors[] = {0xff000000, 0xff102030, 0xffffffff, 0xff808080, 0xffff4000};
+    const size_t colorCount = sizeof colors / sizeof colors[0];
+
+    const uint32_t clearColor = colors[NativeRendererTest_random() % colorCount];
+    const size_t rectCount = NativeRendererTest_randomRange(0, 40);
+    const size_t bitmapCount = NativeRendererTest_randomRange(0, 20);
+
+    for (size_t k = 0; k < 2; k++) {
+        NativeRenderer_clear(nativeRenderers[k], clearColor);
+    }
+
+    for (size_t i = 0; i < rectCount; i++) {
+        const size_t rectWidth = NativeRendererTest_randomRange(1, NATIVE_RENDERER_TEST_BANDED_WIDTH);
+        const size_t rectHeight = NativeRendererTest_randomRange(1, NATIVE_RENDERER_TEST_BANDED_HEIGHT);
+        const int64_t x = NativeRendererTest_randomRange(-(int64_t) rectWidth, NATIVE_RENDERER_TEST_BANDED_WIDTH);
+        const int64_t y = NativeRendererTest_randomRange(-(int64_t) rectHeight, NATIVE_RENDERER_TEST_BANDED_HEIGHT);
+        const uint32_t color = colors[NativeRendererTest_random() % colorCount];
+
+        for (size_t k = 0; k < 2; k++) {
+            NativeRenderer_drawRect(nativeRenderers[k], rectWidth, rectHeight, x, y, color);
+        }
+    }
+
+    for (size_t i = 0; i < bitmapCount; i++) {
+        const size_t bitmapWidth = NativeRendererTest_randomRange(1, NATIVE_RENDERER_TEST_MAX_BITMAP_WIDTH);
+        const size_t bitmapHeight = NativeRendererTest_randomRange(1, NATIVE_RENDERER_TEST_MAX_BITMAP_HEIGHT);
+        const int flat = NativeRendererTest_random() % 2;
+
+        for (size_t j = 0; j < bitmapWidth * bitmapHeight; j++) {
+            bitmapPixels[j] = flat
+                ? colors[(j / bitmapWidth / 4) % colorCount]
+                : NativeRendererTest_randomColor(NativeRendererTest_randomAlpha());
+        }
+
+        const int64_t x = NativeRendererTest_randomRange(-(int64_t) bitmapWidth, NATIVE_RENDERER_TEST_BANDED_WIDTH);
+        const int64_t y = NativeRendererTest_randomRange(-(int64_t) bitmapHeight, NATIVE_RENDERER_TEST_BANDED_HEIGHT);
+        const int64_t globalAlpha = NativeRendererTest_randomRange(1, 255);
+
+        for (size_t k = 0; k < 2; k++) {
+            NativeRenderer_drawBitmap(
+                nativeRenderers[k], bitmapPixels, bitmapWidth, bitmapHeight, x, y, globalAlpha, 1, -1, NULL, 0, -1,
+                NULL, NULL, 0
+            );
+        }
+    }
+}
+
+/*
+ * Checks that the banded (multithreaded) rendering outputs the same bytes as the single-threaded one, over random
+ * frames and output settings.
+ */
+static size_t NativeRendererTest_runBandedCase(void)
+{
+    const char * caseName = "banded output";
+
+    NativeRenderer * nativeRenderers[2] = {
+        NativeRenderer_create(NATIVE_RENDERER_TEST_BANDED_WIDTH, NATIVE_RENDERER_TEST_BANDED_HEIGHT),
+        NativeRenderer_create(NATIVE_RENDERER_TEST_BANDED_WIDTH, NATIVE_RENDERER_TEST_BANDED_HEIGHT),
+    };
+    uint32_t * bitmapPixels = malloc(
+        NATIVE_RENDERER_TEST_MAX_BITMAP_WIDTH * NATIVE_RENDERER_TEST_MAX_BITMAP_HEIGHT * sizeof(uint32_t)
+    );
+    if (
+        ! nativeRenderers[0] ||
+        ! nativeRenderers[1] ||
+        ! bitmapPixels ||
+        ! NativeRenderer_setThreadCount(nativeRenderers[1], NATIVE_RENDERER_TEST_BANDED_THREAD_COUNT)
+    ) {
+        fprintf(stderr, "Cannot create the renderers\n");
+        exit(1);
+    }
+
+    char * singleThreadedOutput = NULL;
+    size_t failureCount = 0;
+
+    for (size_t frameIndex = 0; frameIndex < NATIVE_RENDERER_TEST_BANDED_FRAME_COUNT && failureCount == 0; frameIndex++) {
+        const int64_t repeatSequencesEnabled = NativeRendererTest_random() % 2;
+        const int64_t lineShiftsEnabled = NativeRendererTest_random() % 2;
+        const int64_t trueColorModeEnabled = NativeRendererTest_random() % 2;
+        const int64_t removedColorDepthBits = NativeRendererTest_random() % 3 == 0 ? NativeRendererTest_randomRange(1, 4) : 0;
+        const int64_t lowResolutionMode = NativeRendererTest_randomRange(0, 2);
+        const int64_t orderedDitheringEnabled = NativeRendererTest_random() % 2;
+        const int64_t changeThreshold = NativeRendererTest_random() % 3 == 0 ? NativeRendererTest_randomRange(1, 16) : 0;
+
+        NativeRendererTest_drawBandedFrame(nativeRenderers, bitmapPixels);
+
+        size_t singleThreadedOutputLength = 0;
+
+        for (size_t k = 0; k < 2; k++) {
+            NativeRenderer_setOutputCompression(nativeRenderers[k], repeatSequencesEnabled, lineShiftsEnabled);
+
+            NativeRendererTest_outputLength = 0;
+            NativeRenderer_update(
+                nativeRenderers[k],
+                trueColorModeEnabled,
+                1,
+                32,
+                removedColorDepthBits,
+                lowResolutionMode,
+                orderedDitheringEnabled,
+                changeThreshold,
+                0
+            );
+
+            if (k == 0) {
+                singleThreadedOutput = realloc(singleThreadedOutput, NativeRendererTest_outputLength + 1);
+                memcpy(singleThreadedOutput, NativeRendererTest_output, NativeRendererTest_outputLength);
+                singleThreadedOutputLength = NativeRendererTest_outputLength;
+
+                continue;
+            }
+
+            if (
+                NativeRendererTest_outputLength != singleThreadedOutputLength ||
+                memcmp(NativeRendererTest_output, singleThreadedOutput, singleThreadedOutputLength) != 0
+            ) {
+                size_t offset = 0;
+                while (
+                    offset < singleThreadedOutputLength &&
+                    offset < NativeRendererTest_outputLength &&
+                    NativeRendererTest_output[offset] == singleThreadedOutput[offset]
+                ) {
+                    offset++;
+                }
+
+                fprintf(
+                    stderr,
+                    "%s, frame %zu: %zu bytes instead of %zu, differing from byte %zu\n",
+                    caseName,
+                    frameIndex,
+                    NativeRendererTest_outputLength,
+                    singleThreadedOutputLength,
+                    offset
+                );
+                failureCount++;
+            }
+        }
+    }
+
+    printf("%-32s %s\n", caseName, failureCount == 0 ? "ok" : "FAILED");
+
+    NativeRenderer_destroy(nativeRenderers[0]);
+    NativeRenderer_destroy(nativeRenderers[1]);
+    free(bitmapPixels);
+    free(singleThreadedOutput);
+
+    return failureCount;
+}
+
+typedef struct {
+    size_t x;
+    size_t y;
+    size_t width;
+    size_t height;
+    uint32_t color;
+} NativeRendererTestRect;
+
+typedef struct {
+    uint32_t clearColor;
+    NativeRendererTestRect rects[2];
+    size_t rectCount;
+    // 'T': the whole image is transmitted, 'f': only changed areas are, 0: nothing is
+    char expectedAction;
+} NativeRendererTestFrame;
+
+#define NATIVE_RENDERER_TEST_GRAPHICS_WIDTH 100
+#define NATIVE_RENDERER_TEST_GRAPHICS_HEIGHT 50
+
+static const NativeRendererTestFrame NativeRendererTest_graphicsFrames[] = {
+    {0xff203040, {{5, 7, 20, 9, 0xffc08010}}, 1, 'T'},
+    // the rectangle moves, the tiles it leaves and enters are uploaded
+    {0xff203040, {{60, 30, 12, 6, 0xff10a0f0}}, 1, 'f'},
+    {0xff203040, {{60, 30, 12, 6, 0xff10a0f0}}, 1, 0},
+    {0xff203040, {{60, 30, 12, 6, 0xff10a0f0}, {90, 0, 30, 3, 0xffffffff}}, 2, 'f'},
+};
+
+static const struct {
+    const char * name;
+    int64_t medium;
+    // the expected value of the transmission medium key (t)
+    char transmission;
+} NativeRendererTest_graphicsCases[] = {
+    {"graphics, shared memory", NATIVE_RENDERER_GRAPHICS_MEDIUM_SHARED_MEMORY, 's'},
+    {"graphics, temporary file", NATIVE_RENDERER_GRAPHICS_MEDIUM_TEMPORARY_FILE, 't'},
+    {"graphics, direct", NATIVE_RENDERER_GRAPHICS_MEDIUM_DIRECT, 'd'},
+};
+
+/*
+ * Returns the value of the given key of a graphics command's control data, or NULL if the key is absent.
+ */
+static const char * NativeRendererTest_getGraphicsKey(const char * keys, char key)
+{
+    for (const char * cursor = keys; *cursor; cursor++) {
+        if ((cursor == keys || cursor[-1] == ',') && cursor[0] == key && cursor[1] == '=') {
+            return cursor + 2;
+        }
+    }
+
+    return NULL;
+}
+
+static long long NativeRendererTest_getGraphicsNumericKey(const char * keys, char key)
+{
+    const char * value = NativeRendererTest_getGraphicsKey(keys, key);
+
+    return value ? strtoll(value, NULL, 10) : -1;
+}
+
+static size_t NativeRendererTest_decodeBase64(uint8_t * data, const char * encoded, size_t encodedLength)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    size_t size = 0;
+    uint32_t bits = 0;
+    size_t bitCount = 0;
+
+    for (size_t i = 0; i < encodedLength && encoded[i] != '='; i++) {
+        const char * digit = strchr(alphabet, encoded[i]);
+        if (! digit || ! *digit) {
+            return 0;
+        }
+
+        bits = bits << 6 | (uint32_t) (digit - alphabet);
+        bitCount += 6;
+
+        if (bitCount >= 8) {
+            bitCount -= 8;
+            data[size++] = bits >> bitCount;
+        }
+    }
+
+    return size;
+}
+
+static size_t NativeRendererTest_failGraphics(const char * caseName, size_t frameIndex, const char * message)
+{
+    fprintf(stderr, "%s, frame %zu: %s\n", caseName, frameIndex, message);
+
+    return 1;
+}
+
+/*
+ * Decodes the graphics commands of a frame's output into the image mirror, and counts the transmissions per action.
+ */
+static size_t NativeRendererTest_decodeGraphicsOutput(
+    const char * caseName,
+    size_t frameIndex,
+    char transmission,
+    uint8_t * image,
+    size_t * fullTransmissionCount,
+    size_t * areaTransmissionCount
+) {
+    const size_t imageSize = 3 * NATIVE_RENDERER_TEST_GRAPHICS_WIDTH * NATIVE_RENDERER_TEST_GRAPHICS_HEIGHT;
+    const char * output = NativeRendererTest_output;
+    const char * outputEnd = output + NativeRendererTest_outputLength;
+
+    // the area being transmitted, which spans several commands with the direct medium
+    uint8_t * pixels = malloc(imageSize);
+    size_t pixelsSize = 0;
+    long long x = 0, y = 0, areaWidth = 0, areaHeight = 0;
+    int transmitting = 0;
+    size_t failureCount = 0;
+
+    while ((output = memmem(output, outputEnd - output, "\033_G", 3)) && failureCount == 0) {
+        output += 3;
+
+        const char * payload = memchr(output, ';', outputEnd - output);
+        const char * commandEnd = memmem(output, outputEnd - output, "\033\\", 2);
+        if (! payload || ! commandEnd || payload > commandEnd || payload - output >= 256) {
+            failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, "malformed graphics command");
+            break;
+        }
+
+        char keys[256];
+        memcpy(keys, output, payload - output);
+        keys[payload - output] = '\0';
+        payload++;
+        output = commandEnd + 2;
+
+        const char * action = NativeRendererTest_getGraphicsKey(keys, 'a');
+        const long long more = NativeRendererTest_getGraphicsNumericKey(keys, 'm');
+
+        if (action) {
+            if (transmitting) {
+                failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, "unterminated chunked transmission");
+                break;
+            }
+
+            const char * format = NativeRendererTest_getGraphicsKey(keys, 'f');
+            const char * medium = NativeRendererTest_getGraphicsKey(keys, 't');
+            const char * imageId = NativeRendererTest_getGraphicsKey(keys, 'i');
+
+            if (
+                ! format || strncmp(format, "24,", 3) != 0 ||
+                ! medium || *medium != transmission ||
+                ! imageId || strncmp(imageId, NATIVE_RENDERER_GRAPHICS_IMAGE_ID ",", sizeof NATIVE_RENDERER_GRAPHICS_IMAGE_ID) != 0 ||
+                NativeRendererTest_getGraphicsNumericKey(keys, 'q') != 2
+            ) {
+                failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, keys);
+                break;
+            }
+
+            areaWidth = NativeRendererTest_getGraphicsNumericKey(keys, 's');
+            areaHeight = NativeRendererTest_getGraphicsNumericKey(keys, 'v');
+
+            if (*action == 'T') {
+                // x and y select the displayed part of the image here
+                x = 0;
+                y = 0;
+                (*fullTransmissionCount)++;
+
+                if (areaWidth != NATIVE_RENDERER_TEST_GRAPHICS_WIDTH || areaHeight != NATIVE_RENDERER_TEST_GRAPHICS_HEIGHT) {
+                    failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, "the image size is not the screen one");
+                    break;
+                }
+            } else if (*action == 'f') {
+                x = NativeRendererTest_getGraphicsNumericKey(keys, 'x');
+                y = NativeRendererTest_getGraphicsNumericKey(keys, 'y');
+                (*areaTransmissionCount)++;
+
+                if (
+                    x < 0 || y < 0 || areaWidth <= 0 || areaHeight <= 0 ||
+                    x + areaWidth > NATIVE_RENDERER_TEST_GRAPHICS_WIDTH ||
+                    y + areaHeight > NATIVE_RENDERER_TEST_GRAPHICS_HEIGHT
+                ) {
+                    failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, "the area is out of the image");
+                    break;
+                }
+            } else {
+                failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, keys);
+                break;
+            }
+
+            pixelsSize = 0;
+            transmitting = 1;
+        } else if (! transmitting || transmission != 'd') {
+            failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, "unexpected continuation command");
+            break;
+        }
+
+        const size_t areaSize = 3 * areaWidth * areaHeight;
+
+        if (transmission == 'd') {
+            // chunked: m=1 on every chunk but the last one, which has m=0
+            if (more != 0 && more != 1) {
+                failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, "missing chunking key");
+                break;
+            }
+
+            if (commandEnd - payload > NATIVE_RENDERER_GRAPHICS_CHUNK_SIZE || (more == 1 && (commandEnd - payload) % 4 != 0)) {
+                failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, "invalid chunk size");
+                break;
+            }
+
+            pixelsSize += NativeRendererTest_decodeBase64(pixels + pixelsSize, payload, commandEnd - payload);
+            if (pixelsSize > areaSize || (more == 1) != (pixelsSize < areaSize)) {
+                failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, "the chunks do not match the area size");
+                break;
+            }
+
+            if (more == 1) {
+                continue;
+            }
+        } else {
+            // the payload is the name of the object holding the pixels
+            char name[NATIVE_RENDERER_GRAPHICS_OBJECT_PATH_SIZE];
+            char path[NATIVE_RENDERER_GRAPHICS_OBJECT_PATH_SIZE + 16];
+            const size_t nameLength = NativeRendererTest_decodeBase64((uint8_t *) name, payload, commandEnd - payload);
+            name[nameLength] = '\0';
+            snprintf(path, sizeof path, "%s%s", transmission == 's' ? "/dev/shm/" : "", name);
+
+            if (more != -1 || NativeRendererTest_getGraphicsNumericKey(keys, 'S') != (long long) areaSize) {
+                failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, keys);
+                break;
+            }
+
+            // the object is read then unlinked, as the terminal does
+            FILE * file = fopen(path, "rb");
+            pixelsSize = file ? fread(pixels, 1, imageSize, file) : 0;
+            if (file) {
+                fclose(file);
+            }
+
+            unlink(path);
+
+            if (! strstr(name, "tty-graphics-protocol") || pixelsSize != areaSize) {
+                failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, "the object does not hold the area");
+                break;
+            }
+        }
+
+        for (long long i = 0; i < areaHeight; i++) {
+            memcpy(
+                image + 3 * ((y + i) * NATIVE_RENDERER_TEST_GRAPHICS_WIDTH + x),
+                pixels + 3 * i * areaWidth,
+                3 * areaWidth
+            );
+        }
+
+        transmitting = 0;
+    }
+
+    if (transmitting && failureCount == 0) {
+        failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, "unterminated transmission");
+    }
+
+    free(pixels);
+
+    return failureCount;
+}
+
+static size_t NativeRendererTest_runGraphicsCase(const char * caseName, int64_t medium, char transmission)
+{
+    const size_t width = NATIVE_RENDERER_TEST_GRAPHICS_WIDTH;
+    const size_t height = NATIVE_RENDERER_TEST_GRAPHICS_HEIGHT;
+
+    NativeRenderer * nativeRenderer = NativeRenderer_create(width, height);
+    uint8_t * image = calloc(3, width * height);
+    uint8_t * expectedImage = malloc(3 * width * height);
+    if (! nativeRenderer || ! image || ! expectedImage) {
+        fprintf(stderr, "Cannot create the renderer\n");
+        exit(1);
+    }
+
+    size_t failureCount = 0;
+
+    if (! NativeRenderer_setGraphicsOutput(nativeRenderer, medium)) {
+        failureCount += NativeRendererTest_failGraphics(caseName, 0, "the medium is not available");
+    }
+
+    const size_t frameCount = sizeof NativeRendererTest_graphicsFrames / sizeof NativeRendererTest_graphicsFrames[0];
+
+    for (size_t frameIndex = 0; frameIndex < frameCount && failureCount == 0; frameIndex++) {
+        const NativeRendererTestFrame * frame = &NativeRendererTest_graphicsFrames[frameIndex];
+
+        NativeRenderer_clear(nativeRenderer, frame->clearColor);
+        for (size_t i = 0; i < frame->rectCount; i++) {
+            const NativeRendererTestRect * rect = &frame->rects[i];
+            NativeRenderer_drawRect(nativeRenderer, rect->width, rect->height, rect->x, rect->y, rect->color);
+        }
+
+        NativeRendererTest_outputLength = 0;
+        NativeRenderer_update(nativeRenderer, 1, 0, 0, 0, 0, 0, 0, 0);
+
+        size_t fullTransmissionCount = 0;
+        size_t areaTransmissionCount = 0;
+        failureCount += NativeRendererTest_decodeGraphicsOutput(
+            caseName,
+            frameIndex,
+            transmission,
+            image,
+            &fullTransmissionCount,
+            &areaTransmissionCount
+        );
+
+        if (failureCount > 0) {
+            break;
+        }
+
+        if (
+            fullTransmissionCount != (frame->expectedAction == 'T') ||
+            (areaTransmissionCount > 0) != (frame->expectedAction == 'f')
+        ) {
+            failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, "unexpected transmissions");
+            break;
+        }
+
+        for (size_t i = 0; i < height; i++) {
+            for (size_t j = 0; j < width; j++) {
+                uint32_t color = frame->clearColor;
+                for (size_t k = 0; k < frame->rectCount; k++) {
+                    const NativeRendererTestRect * rect = &frame->rects[k];
+                    const int inside = j >= rect->x && j < rect->x + rect->width && i >= rect->y && i < rect->y + rect->height;
+                    const int outlined = j == rect->x || j == rect->x + rect->width - 1 || i == rect->y || i == rect->y + rect->height - 1;
+
+                    // NativeRenderer_drawRect() only draws the outline
+                    if (inside && outlined) {
+                        color = rect->color;
+                    }
+                }
+
+                uint8_t * pixel = expectedImage + 3 * (i * width + j);
+                pixel[0] = color >> 16;
+                pixel[1] = color >> 8;
+                pixel[2] = color;
+            }
+        }
+
+        if (memcmp(image, expectedImage, 3 * width * height) != 0) {
+            failureCount += NativeRendererTest_failGraphics(caseName, frameIndex, "the image differs from the frame");
+        }
+    }
+
+    printf("%-32s %s\n", caseName, failureCount == 0 ? "ok" : "FAILED");
+
+    NativeRenderer_destroy(nativeRenderer);
+    free(image);
+    free(expectedImage);
+
+    return failureCount;
+}
+
+int main(int argc, char ** argv)
+{
+    size_t iterationCount = 2000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--iterations=", 13) == 0) {
+            iterationCount = strtoul(argv[i] + 13, NULL, 10);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            NativeRendererTest_randomState = strtoull(argv[i] + 7, NULL, 10) | 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--iterations=<count per case>] [--seed=<seed>]\n", argv[0]);
+
+            return 1;
+        }
+    }
+
+    NativeRenderer * nativeRenderer = NativeRenderer_create(NATIVE_RENDERER_TEST_WIDTH, NATIVE_RENDERER_TEST_HEIGHT);
+    NativeRenderer * referenceRenderer = NativeRenderer_create(NATIVE_RENDERER_TEST_WIDTH, NATIVE_RENDERER_TEST_HEIGHT);
+    if (! nativeRenderer || ! referenceRenderer) {
+        fprintf(stderr, "Cannot create the renderers\n");
+
+        return 1;
+    }
+
+    size_t failureCount = 0;
+
+    for (size_t i = 0; i < sizeof NativeRendererTest_kernelCases / sizeof NativeRendererTest_kernelCases[0]; i++) {
+        for (int distorted = 0; distorted <= 1; distorted++) {
+            for (int dithered = 0; dithered <= 1; dithered++) {
+                failureCount += NativeRendererTest_runKernelCase(
+                    nativeRenderer,
+                    referenceRenderer,
+                    &NativeRendererTest_kernelCases[i],
+                    distorted,
+                    dithered,
+                    iterationCount
+                );
+            }
+        }
+    }
+
+    failureCount += NativeRendererTest_runBilinearSamplingCase(iterationCount);
+    failureCount += NativeRendererTest_runBandedCase();
+
+    NativeRenderer_destroy(nativeRenderer);
+    NativeRenderer_destroy(referenceRenderer);
+
+    for (size_t i = 0; i < sizeof NativeRendererTest_graphicsCases / sizeof NativeRendererTest_graphicsCases[0]; i++) {
+        failureCount += NativeRendererTest_runGraphicsCase(
+            NativeRendererTest_graphicsCases[i].name,
+            NativeRendererTest_graphicsCases[i].medium,
+            NativeRendererTest_graphicsCases[i].transmission
+        );
+    }
+
+    if (failureCount > 0) {
+        printf("%zu failures\n", failureCount);
+
+        return 1;
+    }
+
+    return 0;
+}
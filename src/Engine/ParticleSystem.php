@@ -0,0 +1,276 @@
+<?php
+
+namespace NoiseByNorthwest\TermAsteroids\Engine;
+
+/**
+ * Short-lived animated sprites (smoke, stars...) which are moved, aged, culled and drawn natively, in bulk.
+ *
+ * Unlike game objects, particles have no PHP counterpart: they are emitted with their initial state, then their
+ * animation, their fading and their distortion only depend on their type and their age.
+ */
+class ParticleSystem
+{
+    const MAX_CURVE_POINT_COUNT = 4;
+
+    private \FFI\CData $particleSystemFfi;
+
+    /**
+     * @var array<string, int> type indexes per type name
+     */
+    private array $typeIndexes = [];
+
+    /**
+     * @var array<int, array<Bitmap>> frames per type index, which are referenced by the native side
+     */
+    private array $typeFrames = [];
+
+    /**
+     * @var array<string, int>
+     */
+    private array $groupIndexes = [];
+
+    /**
+     * @var array<int> in ascending order
+     */
+    private array $layers = [];
+
+    public function __construct(int $capacity = 16 * 1024)
+    {
+        $particleSystemFfi = NativeRenderer::getFfi()->NativeRenderer_createParticleSystem($capacity);
+        if ($particleSystemFfi === null) {
+            throw new \RuntimeException(sprintf('Cannot allocate %d particles', $capacity));
+        }
+
+        $this->particleSystemFfi = $particleSystemFfi;
+    }
+
+    public function __destruct()
+    {
+        NativeRenderer::getFfi()->NativeRenderer_destroyParticleSystem($this->particleSystemFfi);
+    }
+
+    public function hasType(string $typeName): bool
+    {
+        return isset($this->typeIndexes[$typeName]);
+    }
+
+    /**
+     * @param array<Bitmap> $frames played once over the particle lifetime, they must all have the same size
+     * @param int $layer see Game::run(), the particles of a layer are drawn after the game objects of the same z index
+     * @param array<float> $alphaCurve global alpha per completion ratio, as given to Math::lerpPath()
+     * @param array<float> $distortionCurve max horizontal background distortion amplitude per completion ratio
+     */
+    public function addType(
+        string $typeName,
+        array $frames,
+        float $frameDuration,
+        int $layer = 0,
+        ?string $group = null,
+        float $accelerationTime = 0.1,
+        array $alphaCurve = [],
+        array $distortionCurve = [],
+        float $distortionTimeFactor = 1,
+        float $distortionShearFactor = 1,
+        bool $wrapped = false,
+        bool $twinkling = false,
+    ): void {
+        assert(! $this->hasType($typeName));
+        assert(count($frames) > 0);
+
+        $ffi = NativeRenderer::getFfi();
+
+        $framePixels = $ffi->new(sprintf('uint32_t *[%d]', count($frames)));
+        foreach (array_values($frames) as $i => $frame) {
+            assert($frame->getWidth() === $frames[0]->getWidth() && $frame->getHeight() === $frames[0]->getHeight());
+
+            $framePixels[$i] = $frame->getNativePixelsPointer();
+        }
+
+        if ($group !== null && ! isset($this->groupIndexes[$group])) {
+            $this->groupIndexes[$group] = count($this->groupIndexes);
+        }
+
+        $type = $ffi->new('NativeRendererParticleType');
+        $type->framePixels = \FFI::addr($framePixels[0]);
+        $type->frameCount = count($frames);
+        $type->width = $frames[0]->getWidth();
+        $type->height = $frames[0]->getHeight();
+        $type->frameDuration = $frameDuration;
+        $type->accelerationTime = $accelerationTime;
+        $type->layer = $layer;
+        $type->group = $group === null ? -1 : $this->groupIndexes[$group];
+        $type->wrapped = $wrapped ? 1 : 0;
+        $type->twinkling = $twinkling ? 1 : 0;
+        $type->alphaCurvePointCount = self::setCurve($type->alphaCurveRatios, $type->alphaCurveValues, $alphaCurve);
+        $type->distortionCurvePointCount = self::setCurve($type->distortionCurveRatios, $type->distortionCurveValues, $distortionCurve);
+        $type->distortionTimeFactor = $distortionTimeFactor;
+        $type->distortionShearFactor = $distortionShearFactor;
+
+        $typeIndex = $ffi->NativeRenderer_addParticleType($this->particleSystemFfi, \FFI::addr($type));
+        if ($typeIndex < 0) {
+            throw new \RuntimeException('Cannot add the particle type ' . $typeName);
+        }
+
+        $this->typeIndexes[$typeName] = $typeIndex;
+        $this->typeFrames[$typeIndex] = array_values($frames);
+
+        if (! in_array($layer, $this->layers, true)) {
+            $this->layers[] = $layer;
+            sort($this->layers);
+        }
+    }
+
+    /**
+     * @return bool false if the particle system is full
+     */
+    public function emit(
+        string $typeName,
+        Vec2 $pos,
+        Vec2 $dir,
+        float $velocity,
+        float $duration = INF,
+        float $brightness = 1,
+        ?int $blendingColor = null,
+    ): bool {
+        assert($this->hasType($typeName));
+
+        $dir = $dir->copy()->normalize();
+
+        return (bool) NativeRenderer::getFfi()->NativeRenderer_emitParticle(
+            $this->particleSystemFfi,
+            $this->typeIndexes[$typeName],
+            $pos->getX(),
+            $pos->getY(),
+            $dir->getX(),
+            $dir->getY(),
+            $velocity,
+            Timer::getCurrentGameTime(),
+            $duration,
+            $brightness,
+            $blendingColor ?? -1,
+            // the seed of the particle's random numbers
+            RandomUtils::getRandomInt(1, PHP_INT_MAX),
+        );
+    }
+
+    /**
+     * @param Vec2|null $areaPos when given, only the particles emitted in the same area (see ScreenAreaStats) are counted
+     */
+    public function count(?string $typeName = null, ?string $group = null, ?Vec2 $areaPos = null, float $areaSize = 10): int
+    {
+        if ($typeName !== null && ! $this->hasType($typeName)) {
+            return 0;
+        }
+
+        if ($group !== null && ! isset($this->groupIndexes[$group])) {
+            return 0;
+        }
+
+        return NativeRenderer::getFfi()->NativeRenderer_countParticles(
+            $this->particleSystemFfi,
+            $typeName === null ? -1 : $this->typeIndexes[$typeName],
+            $group === null ? -1 : $this->groupIndexes[$group],
+            $areaPos?->getX() ?? 0,
+            $areaPos?->getY() ?? 0,
+            $areaPos === null ? 0 : $areaSize,
+        );
+    }
+
+    public function getParticleCount(): int
+    {
+        return $this->particleSystemFfi->particleCount;
+    }
+
+    /**
+     * @return array<string, int> particle count per type name
+     */
+    public function getStats(): array
+    {
+        $stats = [];
+        foreach (array_keys($this->typeIndexes) as $typeName) {
+            $stats[$typeName] = $this->count($typeName);
+        }
+
+        asort($stats);
+
+        return $stats;
+    }
+
+    public function update(Screen $screen): void
+    {
+        NativeRenderer::getFfi()->NativeRenderer_updateParticles(
+            $this->particleSystemFfi,
+            Timer::getCurrentGameTime(),
+            $screen->getWidth(),
+            $screen->getHeight(),
+        );
+    }
+
+    public function clear(): void
+    {
+        NativeRenderer::getFfi()->NativeRenderer_clearParticles($this->particleSystemFfi);
+    }
+
+    /**
+     * @return array<int>
+     */
+    public function getLayers(): array
+    {
+        return $this->layers;
+    }
+
+    /**
+     * Builds the draw commands of the given layer's particles, see getDrawCommands().
+     *
+     * @return int the number of draw commands
+     */
+    public function prepareDrawCommands(int $layer, float $brightness, float $ditheringAlphaRatioThreshold): int
+    {
+        if (! NativeRenderer::getFfi()->NativeRenderer_prepareParticleDrawCommands(
+            $this->particleSystemFfi,
+            $layer,
+            Timer::getCurrentGameTime(),
+            $brightness,
+            $ditheringAlphaRatioThreshold,
+        )) {
+            throw new \RuntimeException('Cannot allocate the particle draw commands');
+        }
+
+        return $this->particleSystemFfi->commandCount;
+    }
+
+    /**
+     * @return \FFI\CData a NativeRendererDrawCommand pointer to the prepared draw commands
+     */
+    public function getDrawCommands(): \FFI\CData
+    {
+        return $this->particleSystemFfi->commands;
+    }
+
+    public function getDrawCommandBitmap(int $commandIndex): Bitmap
+    {
+        return $this->typeFrames[$this->particleSystemFfi->commandTypes[$commandIndex]][
+            $this->particleSystemFfi->commandFrameIndexes[$commandIndex]
+        ];
+    }
+
+    /**
+     * @param array<float> $curve
+     * @return int the number of points
+     */
+    private static function setCurve(\FFI\CData $ratios, \FFI\CData $values, array $curve): int
+    {
+        if (count($curve) > self::MAX_CURVE_POINT_COUNT) {
+            throw new \RuntimeException(sprintf('A particle curve cannot exceed %d points', self::MAX_CURVE_POINT_COUNT));
+        }
+
+        $i = 0;
+        foreach ($curve as $ratio => $value) {
+            $ratios[$i] = (float) $ratio;
+            $values[$i] = $value;
+            $i++;
+        }
+
+        return $i;
+    }
+}
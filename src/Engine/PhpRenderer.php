@@ -4,6 +4,14 @@ namespace NoiseByNorthwest\TermAsteroids\Engine;
 
 class PhpRenderer implements RendererInterface
 {
+    // must match NATIVE_RENDERER_ORDERED_DITHERING_MATRIX
+    private const ORDERED_DITHERING_MATRIX = [
+        0, 8, 2, 10,
+        12, 4, 14, 6,
+        3, 11, 1, 9,
+        15, 7, 13, 5,
+    ];
+
     private int $width;
 
     private int $height;
@@ -27,12 +35,49 @@ class PhpRenderer implements RendererInterface
 
     private int $drawnBitmapPixelCount = 0;
 
+    private int $outputByteCount = 0;
+
+    /**
+     * @var array<int> the color cube level (0 to 5) of each channel value
+     */
+    private array $cubeLevels = [];
+
+    /**
+     * @var array<int> the palette index of each gray, out of the color cube's grays and the gray ramp's ones
+     */
+    private array $grayColorTableIndexes = [];
+
     public function __construct(int $width, int $height)
     {
         $this->width = $width;
         $this->height = $height;
         $this->pixelCount = $this->width * $this->height;
 
+        // same tables as the native renderer's quantizer
+        $fullBrightnessReciprocal = 1 / 255.0;
+        $brightnessBoost = 0.3;
+        for ($i = 0; $i < 256; $i++) {
+            $this->cubeLevels[$i] = (int) round($brightnessBoost + 5 * $i * $fullBrightnessReciprocal);
+        }
+
+        // the brightness boost of the cube levels, in channel values (a level spanning 255 / 5 of them), so that the
+        // ramp's grays are as bright as the cube's ones
+        $grayBrightnessBoost = (int) round($brightnessBoost * 255 / 5);
+
+        for ($i = 0; $i < 256; $i++) {
+            // the gray ramp goes from 8 to 238 by steps of 10, the cube's grays are 0 then 95 to 255 by steps of 40
+            $target = min($i + $grayBrightnessBoost, 255);
+            $level = $this->cubeLevels[$i];
+            $cubeGray = $level ? 55 + 40 * $level : 0;
+            $rampStep = min(intdiv($target - 3, 10), 23);
+            $rampGray = 8 + 10 * $rampStep;
+
+            // black stays black
+            $this->grayColorTableIndexes[$i] = $i > 0 && abs($rampGray - $target) < abs($cubeGray - $target)
+                ? 232 + $rampStep
+                : 16 + 43 * $level;
+        }
+
         $this->reset();
     }
 
@@ -66,6 +111,8 @@ class PhpRenderer implements RendererInterface
         array  $horizontalDistortionOffsets = [],
         array  $horizontalBackgroundDistortionOffsets = [],
         float  $ditheringAlphaRatioThreshold = 0,
+        float  $rotationAngle = 0,
+        bool   $bilinearFilteringEnabled = false,
     ): void {
         if ($globalAlpha === 0) {
             return;
@@ -77,6 +124,11 @@ class PhpRenderer implements RendererInterface
         $bitmapHeight = $bitmap->getHeight();
         $bitmapPixels = $bitmap->getPixels();
 
+        // bilinear filtering is only supported by the native renderer
+        if ($rotationAngle != 0) {
+            $bitmapPixels = self::rotatePixels($bitmapPixels, $bitmapWidth, $bitmapHeight, $rotationAngle);
+        }
+
         $fullBrightnessReciprocal = 1 / 255.0;
 
         for ($i = 0; $i < $bitmapHeight; $i++) {
@@ -209,7 +261,8 @@ class PhpRenderer implements RendererInterface
 
                     $combinedAlpha = 255;
                     if ($globalAlpha < 255 || $alpha < 255) {
-                        $combinedAlpha = (int) (255 * ($globalAlpha * $fullBrightnessReciprocal) * ($alpha * $fullBrightnessReciprocal));
+                        // exact floor, as the dithering decision depends on it
+                        $combinedAlpha = intdiv($globalAlpha * $alpha, 255);
                     }
 
                     if ($persisted) {
@@ -237,7 +290,8 @@ class PhpRenderer implements RendererInterface
 
                         if ($ditheringAlphaRatioThreshold !== 0.0 && $combinedAlphaRatio <= $ditheringAlphaRatioThreshold) {
                             $rn = (214013 * $pxIndex + 2531011) & 0xffff;
-                            $combinedAlphaRatio = ($combinedAlphaRatio * 0xffff) < $rn ? 0.0 : 1.0;
+                            // exact form of $combinedAlphaRatio * 0xffff < $rn
+                            $combinedAlphaRatio = $combinedAlpha * 257 < $rn ? 0.0 : 1.0;
 
                             if ($combinedAlphaRatio === 0.0 && $horizontalBackgroundDistortionOffset === 0) {
                                 continue;
@@ -297,7 +351,9 @@ class PhpRenderer implements RendererInterface
 
                         if ($ditheringAlphaRatioThreshold !== 0.0 && $blendingRatio <= $ditheringAlphaRatioThreshold) {
                             $rn = (214013 * $pxIndex + 2531011) & 0xffff;
-                            $blendingRatio = ($blendingRatio * 0xffff) < $rn ? 0.0 : 1.0;
+                            // exact form of $blendingRatio * 0xffff < $rn
+                            $blendingRatio = $persistedColorA * 0xffff < $rn * ($persistedColorA + $currentPersistedColorA)
+                                ? 0.0 : 1.0;
                         }
 
                         if ($blendingRatio === 1.0) {
@@ -385,19 +441,41 @@ class PhpRenderer implements RendererInterface
         return $this->drawnBitmapPixelCount;
     }
 
+    public function getOutputByteCount(): int
+    {
+        return $this->outputByteCount;
+    }
+
+    public function getPresentedPixels(): array
+    {
+        return $this->previousFrameBuffer;
+    }
+
     function update(
         bool $trueColorModeEnabled,
         bool $persistenceEffectsEnabled,
         int $persistenceAlphaDecrease,
         int $removedColorDepthBits,
         int $lowResolutionMode,
+        bool $orderedDitheringEnabled = false,
+        int $changeThreshold = 0,
+        int $outputByteBudget = 0,
     ): int {
         $updatedCharacterCount = 0;
+        $this->outputByteCount = 0;
 
         $fullBrightnessReciprocal = 1 / 255.0;
 
         $colorReductionCorrectionMask = $removedColorDepthBits !== 0 ? 1 << ($removedColorDepthBits - 1) : 0;
 
+        $ditheringOffsets = array_map(
+            fn (int $e) => $orderedDitheringEnabled ? ($e << $removedColorDepthBits) >> 4 : 0,
+            self::ORDERED_DITHERING_MATRIX
+        );
+
+        $cubeLevels = $this->cubeLevels;
+        $grayColorTableIndexes = $this->grayColorTableIndexes;
+
         $width = $this->width;
         $height = $this->height;
 
@@ -476,9 +554,11 @@ class PhpRenderer implements RendererInterface
                     }
 
                     if ($removedColorDepthBits !== 0 && ($color & 0xffffff) !== 0) {
-                        $colorR = ($color >> 16) & 0xff;
-                        $colorG = ($color >> 8) & 0xff;
-                        $colorB = $color & 0xff;
+                        $ditheringOffset = $ditheringOffsets[((($i + $k) & 3) << 2) | ($j & 3)];
+
+                        $colorR = min((($color >> 16) & 0xff) + $ditheringOffset, 255);
+                        $colorG = min((($color >> 8) & 0xff) + $ditheringOffset, 255);
+                        $colorB = min(($color & 0xff) + $ditheringOffset, 255);
 
                         $color =
                             (255 << 24) |
@@ -553,27 +633,21 @@ class PhpRenderer implements RendererInterface
                         $lastUpperColor = $upperColor;
                         $lastLowerColor = $lowerColor;
                     } else {
-                        $brightnessBoost = 0.3;
+                        $upperColorR = ($upperColor >> 16) & 0xff;
+                        $upperColorG = ($upperColor >> 8) & 0xff;
+                        $upperColorB = $upperColor & 0xff;
 
-                        $upperColorTableIdx = 16 +
-                            + 36 * (int) round($brightnessBoost + 5 * (($upperColor >> 16) & 0xff) * $fullBrightnessReciprocal)
-                            + 6 * (int) round($brightnessBoost + 5 * (($upperColor >> 8) & 0xff) * $fullBrightnessReciprocal)
-                            + (int) round($brightnessBoost + 5 * (($upperColor >> 0) & 0xff) * $fullBrightnessReciprocal)
-                        ;
-
-                        if ($upperColorTableIdx > 231) {
-                            $upperColorTableIdx = 231;
-                        }
+                        $upperColorTableIdx = $upperColorR === $upperColorG && $upperColorG === $upperColorB
+                            ? $grayColorTableIndexes[$upperColorR]
+                            : 16 + 36 * $cubeLevels[$upperColorR] + 6 * $cubeLevels[$upperColorG] + $cubeLevels[$upperColorB];
 
-                        $lowerColorTableIdx = 16
-                            + 36 * (int) round($brightnessBoost + 5 * (($lowerColor >> 16) & 0xff) * $fullBrightnessReciprocal)
-                            + 6 * (int) round($brightnessBoost + 5 * (($lowerColor >> 8) & 0xff) * $fullBrightnessReciprocal)
-                            + (int) round($brightnessBoost + 5 * (($lowerColor >> 0) & 0xff) * $fullBrightnessReciprocal)
-                        ;
+                        $lowerColorR = ($lowerColor >> 16) & 0xff;
+                        $lowerColorG = ($lowerColor >> 8) & 0xff;
+                        $lowerColorB = $lowerColor & 0xff;
 
-                        if ($lowerColorTableIdx > 231) {
-                            $lowerColorTableIdx = 231;
-                        }
+                        $lowerColorTableIdx = $lowerColorR === $lowerColorG && $lowerColorG === $lowerColorB
+                            ? $grayColorTableIndexes[$lowerColorR]
+                            : 16 + 36 * $cubeLevels[$lowerColorR] + 6 * $cubeLevels[$lowerColorG] + $cubeLevels[$lowerColorB];
 
                         echo "\033", '[38;5;', $upperColorTableIdx, ';48;5;', $lowerColorTableIdx, 'm';
 
@@ -594,15 +668,45 @@ class PhpRenderer implements RendererInterface
                 }
 
                 if ($updatedCharacterCount % 300 === 0) {
+                    $this->outputByteCount += (int) ob_get_length();
                     ob_flush();
                 }
             }
         }
 
+        $this->outputByteCount += (int) ob_get_length();
         ob_flush();
 
         $this->previousFrameBuffer = $this->currentFrameBuffer;
 
         return $updatedCharacterCount;
     }
+
+    /**
+     * Nearest neighbour counterpart of Bitmap::withCenteredRotation()
+     *
+     * @param array<int> $pixels
+     * @return array<int>
+     */
+    private static function rotatePixels(array $pixels, int $width, int $height, float $angle): array
+    {
+        $cos = cos($angle);
+        $sin = sin($angle);
+        $centerX = $width / 2;
+        $centerY = $height / 2;
+
+        $rotatedPixels = [];
+        for ($y = 0; $y < $height; $y++) {
+            for ($x = 0; $x < $width; $x++) {
+                $pX = Math::roundToInt($cos * ($x - $centerX) - $sin * ($y - $centerY) + $centerX);
+                $pY = Math::roundToInt($sin * ($x - $centerX) + $cos * ($y - $centerY) + $centerY);
+
+                $rotatedPixels[] = $pX < 0 || $width <= $pX || $pY < 0 || $height <= $pY
+                    ? 0
+                    : $pixels[$pX + $pY * $width];
+            }
+        }
+
+        return $rotatedPixels;
+    }
 }
@@ -8,6 +8,9 @@ interface RendererInterface
 
     public function clear(int $color): void;
 
+    /**
+     * The bitmap can be rotated around its center (by $rotationAngle radians), it is then drawn within its own area.
+     */
     public function drawBitmap(
         Bitmap $bitmap,
         int    $x,
@@ -21,17 +24,39 @@ interface RendererInterface
         array  $horizontalDistortionOffsets = [],
         array  $horizontalBackgroundDistortionOffsets = [],
         float  $ditheringAlphaRatioThreshold = 0,
+        float  $rotationAngle = 0,
+        bool   $bilinearFilteringEnabled = false,
     ): void;
 
     public function drawRect(AABox $rect, int $color): void;
 
     public function getDrawnBitmapPixelCount(): int;
 
+    /**
+     * @return int the number of bytes written to the terminal by the last update() call
+     */
+    public function getOutputByteCount(): int;
+
+    /**
+     * @return array<int> the pixels of the last frame written to the terminal, as updated by update()
+     */
+    public function getPresentedPixels(): array;
+
+    /**
+     * $changeThreshold (the characters whose channels all changed by at most this are not redrawn) and
+     * $outputByteBudget (soft limit of the bytes per frame, the characters which changed the least being deferred to
+     * the next frames) are only supported by the native renderer, 0 disabling them.
+     *
+     * @return int the number of updated characters
+     */
     function update(
         bool $trueColorModeEnabled,
         bool $persistenceEffectsEnabled,
         int $persistenceAlphaDecrease,
         int $removedColorDepthBits,
         int $lowResolutionMode,
+        bool $orderedDitheringEnabled = false,
+        int $changeThreshold = 0,
+        int $outputByteBudget = 0,
     ): int;
 }
@@ -4,6 +4,13 @@ namespace NoiseByNorthwest\TermAsteroids\Engine;
 
 class Screen
 {
+    /**
+     * The colors of the centered text and of the status lines, as SGR 37;40 (white on black) renders them by default
+     */
+    private const TEXT_COLOR = 0xe5e5e5;
+
+    private const TEXT_BACKGROUND_COLOR = 0x000000;
+
     private AABox $rect;
 
     private PhpRenderer $phpRenderer;
@@ -16,12 +23,19 @@ class Screen
 
     private bool $trueColorModeAvailable;
 
+    /**
+     * In headless mode, no terminal is required and the output is discarded
+     */
+    private bool $headless;
+
     private int $maxFrameRate = 80;
 
     private bool $debugInfoDisplayEnabled = false;
 
     private bool $debugRectDisplayEnabled = false;
 
+    private bool $nativeRendererProfileDisplayEnabled = false;
+
     private float $renderingStartTime;
 
     private float $previousRenderingEndTime;
@@ -32,6 +46,13 @@ class Screen
 
     private ?string $centeredText = null;
 
+    /**
+     * The status lines of the last frame, which the native renderer draws over the next one
+     *
+     * @var array<string>
+     */
+    private array $statusLines = [];
+
     private float $brightness = 1;
 
     private float $lastPersistenceAlphaDecreaseGameTime = 0;
@@ -40,12 +61,42 @@ class Screen
 
     private int $removedColorDepthBits = 0;
 
+    private bool $orderedDitheringEnabled = false;
+
     private float $ditheringAlphaRatioThreshold = 0;
 
+    /**
+     * The characters whose channels all changed by at most this are not redrawn (native renderer only)
+     */
+    private int $changeThreshold = 0;
+
+    /**
+     * Soft limit of the bytes written per frame, 0 for no limit (native renderer only)
+     */
+    private int $outputByteBudget = 0;
+
     private bool $persistenceEffectsEnabled = true;
 
+    /**
+     * 0: full resolution, 1: pairs of columns are averaged, 2: 2x2 blocks are averaged (native renderer only)
+     */
     private int $lowResolutionMode = 0;
 
+    /**
+     * Consecutive frames which call for a lower (when positive) or a higher (when negative) resolution
+     */
+    private int $lowResolutionModePressure = 0;
+
+    /**
+     * 0 means that the frames are written synchronously
+     */
+    private int $presentationBufferCount = 0;
+
+    /**
+     * @var array<float>|null
+     */
+    private ?array $recordedFrameTimes = null;
+
     private array $stats = [
         'renderedFrameCount' => 0,
         'totalTime' => 0,
@@ -54,13 +105,15 @@ class Screen
         'drawingTime' => 0,
         'updateTime' => 0,
         'updatedPixelCount' => 0,
+        'outputByteCount' => 0,
         'drawnBitmapPixelCount' => 0,
     ];
 
     public function __construct(
         int $width,
         int $height,
-        AdaptivePerformanceManager $adaptivePerformanceManager
+        AdaptivePerformanceManager $adaptivePerformanceManager,
+        bool $headless = false
     ) {
         if ($width % 4 !== 0) {
             throw new \RuntimeException('Screen width must be a multiple of 4');
@@ -75,7 +128,8 @@ class Screen
         $this->nativeRenderer = new NativeRenderer($width, $height);
         $this->renderer = $this->phpRenderer;
         $this->adaptivePerformanceManager = $adaptivePerformanceManager;
-        $this->trueColorModeAvailable = ((int) shell_exec('tput colors')) !== 256;
+        $this->headless = $headless;
+        $this->trueColorModeAvailable = $headless || ((int) shell_exec('tput colors')) !== 256;
         $this->renderingStartTime = microtime(true);
         $this->previousRenderingEndTime = microtime(true);
         $this->cumulatedExtraFrameLatency = 0;
@@ -112,16 +166,66 @@ class Screen
 
     public function toggleRenderer(): void
     {
+        $this->nativeRenderer->waitForPresentation();
+        $this->nativeRenderer->hideGraphics();
         $this->renderer = $this->renderer === $this->nativeRenderer ? $this->phpRenderer : $this->nativeRenderer;
         $this->renderer->reset();
     }
 
     public function useNativeRenderer(): void
     {
+        $this->nativeRenderer->waitForPresentation();
         $this->renderer = $this->nativeRenderer;
         $this->renderer->reset();
     }
 
+    public function setNativeRendererThreadCount(int $threadCount): void
+    {
+        $this->nativeRenderer->setThreadCount($threadCount);
+    }
+
+    /**
+     * Only applies to the native renderer, the frames rendered by the PHP renderer are always written synchronously.
+     */
+    public function setPresentationBufferCount(int $presentationBufferCount): void
+    {
+        if ($this->headless && $presentationBufferCount > 0) {
+            // the presentation thread writes straight to the standard output
+            throw new \RuntimeException('Asynchronous presentation is not supported in headless mode');
+        }
+
+        $this->nativeRenderer->setPresentationBufferCount($presentationBufferCount);
+        $this->presentationBufferCount = $presentationBufferCount;
+    }
+
+    /**
+     * Only applies to the native renderer.
+     */
+    public function setOutputCompression(bool $repeatSequencesEnabled, bool $lineShiftsEnabled): void
+    {
+        $this->nativeRenderer->setOutputCompression($repeatSequencesEnabled, $lineShiftsEnabled);
+    }
+
+    /**
+     * Only applies to the native renderer, see NativeRenderer::setGraphicsOutput().
+     *
+     * @return bool false if the medium is unavailable, in which case the text output is kept
+     */
+    public function setGraphicsOutput(?string $medium): bool
+    {
+        $this->nativeRenderer->waitForPresentation();
+
+        return $this->nativeRenderer->setGraphicsOutput($medium);
+    }
+
+    /**
+     * Only applies to the native renderer, see NativeRenderer::startCapture().
+     */
+    public function startDrawStreamCapture(string $fileName): void
+    {
+        $this->nativeRenderer->startCapture($fileName);
+    }
+
     public function setMaxFrameRate(int $maxFrameRate): void
     {
         $this->maxFrameRate = $maxFrameRate;
@@ -153,6 +257,30 @@ class Screen
         $this->debugRectDisplayEnabled = ! $this->debugRectDisplayEnabled;
     }
 
+    /**
+     * Ordered dithering smooths the gradients of the reduced color depth modes (see $removedColorDepthBits)
+     */
+    public function toggleOrderedDitheringEnabled(): void
+    {
+        $this->orderedDitheringEnabled = ! $this->orderedDitheringEnabled;
+    }
+
+    /**
+     * Only applies to the native renderer, the profile is displayed below the debug info
+     */
+    public function toggleNativeRendererProfileDisplayEnabled(): void
+    {
+        $this->nativeRendererProfileDisplayEnabled = ! $this->nativeRendererProfileDisplayEnabled;
+    }
+
+    /**
+     * @return array|null null when the native renderer is not in use
+     */
+    public function getNativeRendererProfile(): ?array
+    {
+        return $this->renderer === $this->nativeRenderer ? $this->nativeRenderer->getProfile() : null;
+    }
+
     /**
      * @return array
      */
@@ -161,8 +289,29 @@ class Screen
         return $this->stats;
     }
 
+    public function setFrameTimeRecordingEnabled(bool $frameTimeRecordingEnabled): void
+    {
+        $this->recordedFrameTimes = $frameTimeRecordingEnabled ? [] : null;
+    }
+
+    /**
+     * @return array<float>
+     */
+    public function getRecordedFrameTimes(): array
+    {
+        return $this->recordedFrameTimes ?? [];
+    }
+
     public function init(): void
     {
+        if ($this->headless) {
+            assert(ob_get_level() === 0);
+            // null sink, the frames are still fully encoded but nothing reaches the standard output
+            ob_start(fn (string $buffer): string => '');
+
+            return;
+        }
+
         $this->checkTermSize();
 
         system('tput clear');
@@ -177,8 +326,10 @@ class Screen
     public function reset(): void
     {
         $this->centeredText = null;
+        $this->nativeRenderer->waitForPresentation();
         $this->phpRenderer->reset();
         $this->nativeRenderer->reset();
+        $this->nativeRenderer->resetProfile();
     }
 
     public function clear(int|Vec3 $color): void
@@ -193,7 +344,8 @@ class Screen
      */
     public function setCenteredText(?string $centeredText): void
     {
-        if (strlen($this->centeredText ?? '') > strlen($centeredText ?? '')) {
+        // the native renderer diffs the text as the rest of the frame
+        if ($this->renderer !== $this->nativeRenderer && strlen($this->centeredText ?? '') > strlen($centeredText ?? '')) {
             $this->renderer->reset();
         }
 
@@ -220,6 +372,8 @@ class Screen
      * @param int|null $globalPersistedColor
      * @param array $horizontalDistortionOffsets
      * @param array $horizontalBackgroundDistortionOffsets
+     * @param float $rotationAngle
+     * @param bool $bilinearFilteringEnabled
      * @return void
      */
     public function drawBitmap(
@@ -234,6 +388,8 @@ class Screen
         ?int   $globalPersistedColor = null,
         array  $horizontalDistortionOffsets = [],
         array  $horizontalBackgroundDistortionOffsets = [],
+        float  $rotationAngle = 0,
+        bool   $bilinearFilteringEnabled = false,
     ): void {
         if ($globalAlpha === 0) {
             return;
@@ -251,10 +407,46 @@ class Screen
             $globalPersistedColor,
             $horizontalDistortionOffsets,
             $horizontalBackgroundDistortionOffsets,
-            $this->ditheringAlphaRatioThreshold
+            $this->ditheringAlphaRatioThreshold,
+            $rotationAngle,
+            $bilinearFilteringEnabled,
         );
     }
 
+    public function drawParticles(ParticleSystem $particleSystem, int $layer): void
+    {
+        $commandCount = $particleSystem->prepareDrawCommands($layer, $this->brightness, $this->ditheringAlphaRatioThreshold);
+        $commands = $particleSystem->getDrawCommands();
+
+        if ($this->renderer === $this->nativeRenderer) {
+            $this->nativeRenderer->drawCommands($commands, $commandCount);
+
+            return;
+        }
+
+        for ($i = 0; $i < $commandCount; $i++) {
+            $command = $commands[$i];
+
+            $horizontalBackgroundDistortionOffsets = [];
+            if ($command->horizontalBackgroundDistortionOffsets !== null) {
+                for ($j = 0; $j < $command->bitmapHeight; $j++) {
+                    $horizontalBackgroundDistortionOffsets[] = $command->horizontalBackgroundDistortionOffsets[$j];
+                }
+            }
+
+            $this->renderer->drawBitmap(
+                $particleSystem->getDrawCommandBitmap($i),
+                $command->x,
+                $command->y,
+                $command->globalAlpha,
+                $command->brightness,
+                $command->globalBlendingColor === -1 ? null : $command->globalBlendingColor,
+                horizontalBackgroundDistortionOffsets: $horizontalBackgroundDistortionOffsets,
+                ditheringAlphaRatioThreshold: $command->ditheringAlphaRatioThreshold,
+            );
+        }
+    }
+
     public function drawDebugRect(AABox $rect, int $color): void
     {
         if (! $this->debugRectDisplayEnabled) {
@@ -291,54 +483,70 @@ class Screen
 
         $removedColorDepthBits = $this->removedColorDepthBits;
         $lowResolutionMode = $this->lowResolutionMode;
+        $asyncPresentation = $this->presentationBufferCount > 0 && $this->renderer === $this->nativeRenderer;
+
+        if ($this->renderer === $this->nativeRenderer) {
+            $this->drawNativeText();
+        }
 
         $updatedCharacterCount = $this->renderer->update(
             $this->trueColorModeAvailable,
             $this->persistenceEffectsEnabled,
             $persistenceAlphaDecrease,
             removedColorDepthBits: $removedColorDepthBits,
-            lowResolutionMode: $lowResolutionMode
+            lowResolutionMode: $lowResolutionMode,
+            orderedDitheringEnabled: $this->orderedDitheringEnabled,
+            changeThreshold: $this->changeThreshold,
+            outputByteBudget: $this->outputByteBudget,
         );
 
         $drawnBitmapPixelCount = $this->renderer->getDrawnBitmapPixelCount();
+        $outputByteCount = $this->renderer->getOutputByteCount();
 
         if ($this->centeredText) {
-            echo "\033", '[',
-            Math::roundToInt($this->getHeight() * 0.22), ';',
-            max(0, Math::roundToInt($this->getWidth() * 0.5 - strlen($this->centeredText) * 0.5)), 'H';
+            if ($this->renderer !== $this->nativeRenderer) {
+                echo "\033", '[',
+                $this->getCenteredTextLine(), ';',
+                $this->getCenteredTextColumn(), 'H';
 
-            echo "\033", '[', 37, ';', 40, 'm';
-            echo $this->centeredText;
+                echo "\033", '[', 37, ';', 40, 'm';
+                echo $this->centeredText;
 
-            ob_flush();
+                if (! $asyncPresentation) {
+                    ob_flush();
+                }
+            }
 
             if (trim($this->centeredText) === '') {
                 $this->centeredText = null;
             } else {
-                // to be cleared for the next frame
-                // FIXME centeredText should be handled by renderer's update()
+                // to be cleared for the next frame (the spaces are not drawn by the native renderer, whose text
+                // layer is redrawn from scratch)
                 $this->centeredText = str_pad('', strlen($this->centeredText), ' ');
             }
         }
 
+        if ($asyncPresentation) {
+            // the frame is handed over to the native renderer's presentation thread, which writes it while the next
+            //  one is computed
+            $this->presentOutput();
+        }
+
         $updateEndTime = microtime(true);
 
         $renderingEndTime = $updateEndTime;
         $frameTime = $renderingEndTime - $this->previousRenderingEndTime;
 
-        $minFrameTime = 1.0 / $this->maxFrameRate;
+        $minFrameTime = $this->headless ? 0 : 1.0 / $this->maxFrameRate;
         if ($frameTime > $minFrameTime) {
             $this->cumulatedExtraFrameLatency += $frameTime - $minFrameTime;
         } else {
             $requiredSleepTime = $minFrameTime - $frameTime - $this->cumulatedExtraFrameLatency;
             $this->cumulatedExtraFrameLatency = 0;
             if ($requiredSleepTime > 0) {
-                do {
-                    // Sleeping in one call could make the terminal rendering laggy (without increasing the measured
-                    //  frame time).
-                    usleep(70);
-                    $renderingEndTime = microtime(true);
-                } while ($renderingEndTime - $updateEndTime < $requiredSleepTime);
+                // the input is read while sleeping, up to an absolute deadline, instead of polling it in a loop
+                Input::wait($requiredSleepTime);
+                $renderingEndTime = microtime(true);
 
                 $frameTime = $renderingEndTime - $this->previousRenderingEndTime;
             } else {
@@ -360,17 +568,20 @@ class Screen
         $this->stats['drawingTime'] += $drawingTime;
         $this->stats['updateTime'] += $updateTime;
         $this->stats['updatedPixelCount'] += $updatedCharacterCount * 2;
+        $this->stats['outputByteCount'] += $outputByteCount;
         $this->stats['drawnBitmapPixelCount'] += $drawnBitmapPixelCount;
 
-        echo "\033", '[', $this->getHeight() / 2, ';', 0, 'H';
-        echo "\033", '[', 37, ';', 40, 'm';
-        echo str_pad(
+        if ($this->recordedFrameTimes !== null) {
+            $this->recordedFrameTimes[] = $frameTime;
+        }
+
+        $statusLines = [
             sprintf(
                 'Time: %s%s',
                 date('i:s', (int)Timer::getCurrentGameTime()),
                 $this->debugInfoDisplayEnabled ?
                     sprintf(
-                        ' - Speed: %6.2fx - FPS: %6.1f - Min (-5s): %6.1f - Frame time: %3dms - Max (-5s): %4dms - Gameplay+physic: %3dms - Rendering time: %3dms (Drawing: %3dms / Update: %3dms / Sleep: %3dms) - Sprite fill rate: %4.1fM pixel/s - Change rate: %3.1fM char/s / %3.1fM pixel/s',
+                        ' - Speed: %6.2fx - FPS: %6.1f - Min (-5s): %6.1f - Frame time: %3dms - Max (-5s): %4dms - Gameplay+physic: %3dms - Rendering time: %3dms (Drawing: %3dms / Update: %3dms / Sleep: %3dms) - Sprite fill rate: %4.1fM pixel/s - Change rate: %3.1fM char/s / %3.1fM pixel/s / %5.1fMB/s',
                         Timer::getGameTimeSpeedFactor(),
                         1 / $frameTime,
                         1 / $this->maxFrameTime,
@@ -384,41 +595,67 @@ class Screen
                         $drawnBitmapPixelCount / $drawingTime / (1000 * 1000),
                         $updatedCharacterCount / $updateTime / (1000 * 1000),
                         $updatedCharacterCount * 2 / $updateTime / (1000 * 1000),
+                        $outputByteCount / $updateTime / (1000 * 1000),
                     )
                     : ''
             ),
-            $this->getWidth() - 1,
-            ' '
-        ), "\n";
+        ];
 
         if ($this->debugInfoDisplayEnabled) {
             $gcStatus = gc_status();
-            echo str_pad(
-                sprintf(
-                    'PHP: %s - Renderer: %-6s - JIT: %-3s - Memory (allocated / used): %5.1fMB / %5.1fMB - GC runs: %5d - GC roots: %3dK - Adapt perf: %-3s - ARCR: %4.2f - CD: %1db - DART: %4.2f - PE: %-3s',
-                    PHP_VERSION,
-                    $this->renderer === $this->nativeRenderer ? 'Native' : 'PHP',
-                    opcache_get_status()['jit']['on'] ? 'On' : 'Off',
-                    memory_get_usage(true) / (1024 * 1024),
-                    memory_get_usage() / (1024 * 1024),
-                    $gcStatus['runs'],
-                    (int)($gcStatus['roots'] / 1000),
-                    $this->adaptivePerformanceManager->isEnabled() ? 'On' : 'Off',
-                    $this->adaptivePerformanceManager->getAllowedResourceConsumptionRatio(),
-                    8 - $this->removedColorDepthBits,
-                    $this->ditheringAlphaRatioThreshold,
-                    $this->persistenceEffectsEnabled ? 'On' : 'Off',
-                ),
-                $this->getWidth() - 1,
-                ' '
-            ), "\n";
+            $statusLines[] = sprintf(
+                'PHP: %s - Renderer: %-6s - JIT: %-3s - Memory (allocated / used): %5.1fMB / %5.1fMB - GC runs: %5d - GC roots: %3dK - Adapt perf: %-3s - ARCR: %4.2f - CD: %1db - OD: %-3s - LR: %1d - DART: %4.2f - CT: %2d - OBB: %3dK - GO: %-6s - PE: %-3s - PQ: %1d/%1d - PWL: %3dms',
+                PHP_VERSION,
+                $this->renderer === $this->nativeRenderer ? 'Native' : 'PHP',
+                opcache_get_status()['jit']['on'] ? 'On' : 'Off',
+                memory_get_usage(true) / (1024 * 1024),
+                memory_get_usage() / (1024 * 1024),
+                $gcStatus['runs'],
+                (int)($gcStatus['roots'] / 1000),
+                $this->adaptivePerformanceManager->isEnabled() ? 'On' : 'Off',
+                $this->adaptivePerformanceManager->getAllowedResourceConsumptionRatio(),
+                8 - $this->removedColorDepthBits,
+                $this->orderedDitheringEnabled ? 'On' : 'Off',
+                $this->lowResolutionMode,
+                $this->ditheringAlphaRatioThreshold,
+                $this->changeThreshold,
+                intdiv($this->outputByteBudget, 1024),
+                $this->nativeRenderer->getGraphicsOutput() ?? 'Off',
+                $this->persistenceEffectsEnabled ? 'On' : 'Off',
+                $this->nativeRenderer->getPresentationQueueDepth(),
+                $this->presentationBufferCount,
+                (int)round(1000 * $this->nativeRenderer->getPresentationWriteLatency()),
+            );
 
             if ($debugLine !== null) {
-                echo str_pad(
-                    $debugLine,
-                    $this->getWidth() - 1,
-                    ' '
-                ), "\n";
+                $statusLines[] = $debugLine;
+            }
+
+            if ($this->nativeRendererProfileDisplayEnabled && $this->renderer === $this->nativeRenderer) {
+                $stageTimes = [];
+                foreach ($this->nativeRenderer->getProfile()['stages'] as $stage => $times) {
+                    $stageTimes[] = sprintf(
+                        '%s: %5.2f / %5.2f / %5.2f',
+                        $stage,
+                        $times['p50Ms'],
+                        $times['p95Ms'],
+                        $times['p99Ms'],
+                    );
+                }
+
+                $statusLines[] = 'Native stages (p50 / p95 / p99 ms): ' . implode(' - ', $stageTimes);
+            }
+        }
+
+        if ($this->renderer === $this->nativeRenderer) {
+            // drawn over the next frame, see drawNativeText()
+            $this->statusLines = $statusLines;
+        } else {
+            echo "\033", '[', $this->getHeight() / 2, ';', 0, 'H';
+            echo "\033", '[', 37, ';', 40, 'm';
+
+            foreach ($statusLines as $statusLine) {
+                echo str_pad($statusLine, $this->getWidth() - 1, ' '), "\n";
             }
         }
 
@@ -426,7 +663,10 @@ class Screen
             $this->removedColorDepthBits = 0;
             $this->persistenceEffectsEnabled = true;
             $this->ditheringAlphaRatioThreshold = 0;
+            $this->changeThreshold = 0;
+            $this->outputByteBudget = 0;
             $this->lowResolutionMode = 0;
+            $this->lowResolutionModePressure = 0;
         } else {
             $acceptableRenderingTimeLimit = 0.018;
             $renderingTimeVsAcceptableLimitRatio = $renderingTime / $acceptableRenderingTimeLimit;
@@ -459,16 +699,124 @@ class Screen
                 '1' => 0
             ], $this->graphicQuality);
 
-            $this->persistenceEffectsEnabled = $this->graphicQuality > 0.7;
+            if ($this->renderer === $this->nativeRenderer) {
+                $this->changeThreshold = Math::roundToInt(Math::lerpPath([
+                    '0' => 12,
+                    '0.5' => 4,
+                    '1' => 0,
+                ], $this->graphicQuality));
+
+                // at low quality, the terminal is assumed to be the bottleneck, so that the frames are capped in size
+                $this->outputByteBudget = $this->graphicQuality >= 0.5 ? 0 : Math::roundToInt(Math::lerpPath([
+                    '0' => 128 * 1024,
+                    '0.5' => 512 * 1024,
+                ], $this->graphicQuality));
+            } else {
+                $this->changeThreshold = 0;
+                $this->outputByteBudget = 0;
+            }
+
+            // the native renderer only visits the live trails, so that they are kept until the quality gets really low
+            $this->persistenceEffectsEnabled = $this->graphicQuality > ($this->renderer === $this->nativeRenderer ? 0.2 : 0.7);
 
-            // disabled for now (too extreme / uncomfortable)
-            $this->lowResolutionMode = 0;
+            $this->updateLowResolutionMode($renderingTimeVsAcceptableLimitRatio);
+        }
+
+        if ($asyncPresentation) {
+            $this->presentOutput();
+        } else {
+            ob_flush();
         }
 
-        ob_flush();
         $this->previousRenderingEndTime = $renderingEndTime;
     }
 
+    /**
+     * The low resolution modes are the last resort of the graphic quality controller: the resolution is lowered when
+     * the frames stay too slow at the lowest graphic quality, and raised back when they stay fast enough at the highest
+     * one. Both conditions must hold for a while, and they are far apart, so that the mode does not flicker.
+     */
+    private function updateLowResolutionMode(float $renderingTimeVsAcceptableLimitRatio): void
+    {
+        if ($this->renderer !== $this->nativeRenderer) {
+            // the PHP renderer drops columns instead of averaging them
+            $this->lowResolutionMode = 0;
+            $this->lowResolutionModePressure = 0;
+
+            return;
+        }
+
+        if ($this->graphicQuality <= 0 && $renderingTimeVsAcceptableLimitRatio > 1) {
+            $this->lowResolutionModePressure = max($this->lowResolutionModePressure, 0) + 1;
+        } elseif ($this->graphicQuality >= 1 && $renderingTimeVsAcceptableLimitRatio < 0.6) {
+            $this->lowResolutionModePressure = min($this->lowResolutionModePressure, 0) - 1;
+        } else {
+            $this->lowResolutionModePressure = 0;
+        }
+
+        if ($this->lowResolutionModePressure >= 30 && $this->lowResolutionMode < 2) {
+            $this->lowResolutionMode++;
+            $this->lowResolutionModePressure = 0;
+        }
+
+        if ($this->lowResolutionModePressure <= -90 && $this->lowResolutionMode > 0) {
+            $this->lowResolutionMode--;
+            $this->lowResolutionModePressure = 0;
+        }
+    }
+
+    /**
+     * The native renderer composites its text layer in the same diff pass as the pixels, so the text is only
+     * written when it changes. The status lines are built after the update, hence they lag one frame behind.
+     */
+    private function drawNativeText(): void
+    {
+        $this->nativeRenderer->clearText();
+
+        if ($this->centeredText !== null && trim($this->centeredText) !== '') {
+            $this->nativeRenderer->drawText(
+                $this->getCenteredTextLine(),
+                max(1, $this->getCenteredTextColumn()),
+                $this->centeredText,
+                self::TEXT_COLOR,
+                self::TEXT_BACKGROUND_COLOR,
+            );
+        }
+
+        foreach ($this->statusLines as $i => $statusLine) {
+            $this->nativeRenderer->drawText(
+                intdiv($this->getHeight(), 2) + $i,
+                1,
+                $statusLine,
+                self::TEXT_COLOR,
+                self::TEXT_BACKGROUND_COLOR,
+            );
+        }
+    }
+
+    private function getCenteredTextLine(): int
+    {
+        return Math::roundToInt($this->getHeight() * 0.22);
+    }
+
+    /**
+     * @return int the CUP column parameter (0 and 1 both address the first column)
+     */
+    private function getCenteredTextColumn(): int
+    {
+        return max(0, Math::roundToInt($this->getWidth() * 0.5 - strlen($this->centeredText) * 0.5));
+    }
+
+    private function presentOutput(): void
+    {
+        $output = ob_get_contents();
+        ob_clean();
+
+        if ($output !== '') {
+            $this->nativeRenderer->present($output);
+        }
+    }
+
     private function checkTermSize(): void
     {
         $width = $this->rect->getSize()->getWidth();
@@ -0,0 +1,145 @@
+<?php
+
+namespace NoiseByNorthwest\TermAsteroids\Engine;
+
+/**
+ * Uniform grid broadphase for collision queries.
+ *
+ * Each indexed game object is registered in every cell overlapped by its bounding box, and is only moved to other
+ * cells when its bounding box crosses a cell border.
+ */
+class SpatialHash
+{
+    // cell keys are computed as row * stride + column, which is unique as long as |column| < stride / 2
+    private const CELL_KEY_ROW_STRIDE = 1 << 20;
+
+    private int $cellSize;
+
+    /**
+     * @var array<int, array<int, GameObject>> game objects by id, per cell key
+     */
+    private array $cells = [];
+
+    /**
+     * @var array<int, array<int>> cell range (first column, first row, last column, last row) per game object id
+     */
+    private array $cellRanges = [];
+
+    public function __construct(int $cellSize = 16)
+    {
+        assert($cellSize > 0);
+
+        $this->cellSize = $cellSize;
+    }
+
+    public function clear(): void
+    {
+        $this->cells = [];
+        $this->cellRanges = [];
+    }
+
+    public function getIndexedGameObjectCount(): int
+    {
+        return count($this->cellRanges);
+    }
+
+    /**
+     * Inserts the game object or moves it according to its current bounding box.
+     */
+    public function update(GameObject $gameObject): void
+    {
+        $id = $gameObject->getId();
+        $cellRange = $this->resolveCellRange($gameObject->getBoundingBox());
+        $currentCellRange = $this->cellRanges[$id] ?? null;
+
+        if ($cellRange === $currentCellRange) {
+            return;
+        }
+
+        if ($currentCellRange !== null) {
+            $this->removeFromCells($id, $currentCellRange);
+        }
+
+        [$firstColumn, $firstRow, $lastColumn, $lastRow] = $cellRange;
+        for ($row = $firstRow; $row <= $lastRow; $row++) {
+            for ($column = $firstColumn; $column <= $lastColumn; $column++) {
+                $this->cells[$row * self::CELL_KEY_ROW_STRIDE + $column][$id] = $gameObject;
+            }
+        }
+
+        $this->cellRanges[$id] = $cellRange;
+    }
+
+    public function remove(GameObject $gameObject): void
+    {
+        $id = $gameObject->getId();
+
+        if (! isset($this->cellRanges[$id])) {
+            return;
+        }
+
+        $this->removeFromCells($id, $this->cellRanges[$id]);
+        unset($this->cellRanges[$id]);
+    }
+
+    /**
+     * @template T of GameObject
+     * @param AABox $box
+     * @param class-string<T>|null $className
+     * @return array<int, T> the indexed game objects which may intersect the box, by id and in ascending id order
+     */
+    public function query(AABox $box, ?string $className = null): array
+    {
+        [$firstColumn, $firstRow, $lastColumn, $lastRow] = $this->resolveCellRange($box);
+
+        $gameObjects = [];
+        for ($row = $firstRow; $row <= $lastRow; $row++) {
+            for ($column = $firstColumn; $column <= $lastColumn; $column++) {
+                foreach ($this->cells[$row * self::CELL_KEY_ROW_STRIDE + $column] ?? [] as $id => $gameObject) {
+                    if ($className !== null && ! $gameObject instanceof $className) {
+                        continue;
+                    }
+
+                    $gameObjects[$id] = $gameObject;
+                }
+            }
+        }
+
+        // same order as Game::getGameObjects(), so that the collision resolution order does not change
+        ksort($gameObjects);
+
+        return $gameObjects;
+    }
+
+    /**
+     * @return array<int>
+     */
+    private function resolveCellRange(AABox $box): array
+    {
+        return [
+            (int) floor($box->getLeft() / $this->cellSize),
+            (int) floor($box->getTop() / $this->cellSize),
+            (int) floor($box->getRight() / $this->cellSize),
+            (int) floor($box->getBottom() / $this->cellSize),
+        ];
+    }
+
+    /**
+     * @param int $id
+     * @param array<int> $cellRange
+     */
+    private function removeFromCells(int $id, array $cellRange): void
+    {
+        [$firstColumn, $firstRow, $lastColumn, $lastRow] = $cellRange;
+        for ($row = $firstRow; $row <= $lastRow; $row++) {
+            for ($column = $firstColumn; $column <= $lastColumn; $column++) {
+                $cellKey = $row * self::CELL_KEY_ROW_STRIDE + $column;
+
+                unset($this->cells[$cellKey][$id]);
+                if (count($this->cells[$cellKey]) === 0) {
+                    unset($this->cells[$cellKey]);
+                }
+            }
+        }
+    }
+}
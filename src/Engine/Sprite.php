@@ -192,6 +192,8 @@ class Sprite
             $this->getRenderingParameters()->getPersistedColor(),
             $this->getRenderingParameters()->getHorizontalDistortionOffsets(),
             $this->getRenderingParameters()->getHorizontalBackgroundDistortionOffsets(),
+            $this->getRenderingParameters()->getRotationAngle(),
+            $this->getRenderingParameters()->isBilinearFilteringEnabled(),
         );
 
         if ($screen->isDebugRectDisplayEnabled()) {
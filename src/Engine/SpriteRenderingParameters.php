@@ -20,6 +20,10 @@ class SpriteRenderingParameters
 
     private array $horizontalBackgroundDistortionOffsets = [];
 
+    private float $rotationAngle = 0;
+
+    private bool $bilinearFilteringEnabled = false;
+
     public function reset(): void
     {
         $this->globalAlpha = 255;
@@ -30,6 +34,8 @@ class SpriteRenderingParameters
         $this->persistedColor = null;
         $this->horizontalDistortionOffsets = [];
         $this->horizontalBackgroundDistortionOffsets = [];
+        $this->rotationAngle = 0;
+        $this->bilinearFilteringEnabled = false;
     }
 
     /**
@@ -145,4 +151,27 @@ class SpriteRenderingParameters
     {
         $this->horizontalBackgroundDistortionOffsets = $horizontalBackgroundDistortionOffsets;
     }
+
+    /**
+     * @return float the rotation of the drawn bitmap around its center, in radians
+     */
+    public function getRotationAngle(): float
+    {
+        return $this->rotationAngle;
+    }
+
+    public function setRotationAngle(float $rotationAngle): void
+    {
+        $this->rotationAngle = $rotationAngle;
+    }
+
+    public function isBilinearFilteringEnabled(): bool
+    {
+        return $this->bilinearFilteringEnabled;
+    }
+
+    public function setBilinearFilteringEnabled(bool $bilinearFilteringEnabled): void
+    {
+        $this->bilinearFilteringEnabled = $bilinearFilteringEnabled;
+    }
 }
\ No newline at end of file
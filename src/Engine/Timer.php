@@ -18,6 +18,11 @@ class Timer
 
     private static float $currentFrameStartGameTime = 0;
 
+    /**
+     * When set, each frame lasts exactly this duration instead of the measured one, so that the game plays the same
+     *  way whatever the speed of the machine (it is not cleared by reset())
+     */
+    private static ?float $fixedTimeStep = null;
 
     public static function getAbsoluteCurrentTime(): float
     {
@@ -49,6 +54,18 @@ class Timer
         return self::$gameTimeSpeedFactor;
     }
 
+    public static function setFixedTimeStep(?float $fixedTimeStep): void
+    {
+        assert($fixedTimeStep === null || $fixedTimeStep > 0);
+
+        self::$fixedTimeStep = $fixedTimeStep;
+    }
+
+    public static function getFixedTimeStep(): ?float
+    {
+        return self::$fixedTimeStep;
+    }
+
     public static function reset(): void
     {
         $absoluteCurrentTime = self::getAbsoluteCurrentTime();
@@ -65,7 +82,9 @@ class Timer
     public static function startFrame(): void
     {
         self::$previousFrameStartTime = self::$currentFrameStartTime;
-        self::$currentFrameStartTime = self::getAbsoluteCurrentTime();
+        self::$currentFrameStartTime = self::$fixedTimeStep === null ?
+            self::getAbsoluteCurrentTime()
+            : self::$previousFrameStartTime + self::$fixedTimeStep;
 
         self::$currentGameTime +=
             (self::$gameTimeFrozen ? 0 : 1)
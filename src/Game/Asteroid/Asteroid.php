@@ -3,9 +3,7 @@
 namespace NoiseByNorthwest\TermAsteroids\Game\Asteroid;
 
 use NoiseByNorthwest\TermAsteroids\Engine\Accelerator;
-use NoiseByNorthwest\TermAsteroids\Engine\Bitmap;
 use NoiseByNorthwest\TermAsteroids\Engine\BitmapNoiseGenerator;
-use NoiseByNorthwest\TermAsteroids\Engine\CacheUtils;
 use NoiseByNorthwest\TermAsteroids\Engine\ClassUtils;
 use NoiseByNorthwest\TermAsteroids\Engine\ColorUtils;
 use NoiseByNorthwest\TermAsteroids\Engine\Math;
@@ -24,6 +22,8 @@ abstract class Asteroid extends DamageableGameObject
 {
     private ?int $initiatorId = null;
 
+    private float $initialRotationAngle = 0;
+
     abstract public static function getSize(): int;
 
     abstract public static function getMaxVariantCount(): int;
@@ -38,6 +38,14 @@ abstract class Asteroid extends DamageableGameObject
         return (int) ceil((static::getSize() * 0.4) ** 3);
     }
 
+    /**
+     * @return float the duration of a full turn, in seconds
+     */
+    public static function getRotationPeriod(): float
+    {
+        return Math::bound(Math::roundToInt((static::getSize() ** 2) * 0.12), 1, INF) * 0.05;
+    }
+
     public static function warmCaches(): void
     {
         foreach (ClassUtils::getLocalChildClassNames(self::class) as $childClassName) {
@@ -58,16 +66,13 @@ abstract class Asteroid extends DamageableGameObject
             new Sprite(
                 $size,
                 $size,
-                CacheUtils::memoize([static::class, __METHOD__, $seed], fn () => [
+                [
                     [
                         'name' => 'default',
-                        'frames' => array_map(
-                            fn (Bitmap $e) => [
-                                'duration' => 0.05,
-                                'bitmap' => $e,
-                            ],
-                            Bitmap::generateCenteredRotationAnimation(
-                                BitmapNoiseGenerator::generate(
+                        'frames' => [
+                            [
+                                // the rotation is applied when drawn
+                                'bitmap' => BitmapNoiseGenerator::generate(
                                     $size,
                                     $size,
                                     [
@@ -80,14 +85,18 @@ abstract class Asteroid extends DamageableGameObject
                                     seed: [static::class, $seed],
                                     radius: 1.2,
                                 ),
-                                Math::bound(Math::roundToInt(($size ** 2) * 0.12), 1, INF)
-                            ),
-                        )
+                            ],
+                        ],
                     ]
-                ]),
+                ],
                 [
                     new SpriteEffect(
                         function (SpriteRenderingParameters $renderingParameters) use($color, $size) {
+                            $renderingParameters->setRotationAngle(
+                                $this->initialRotationAngle
+                                    + 2 * M_PI * (Timer::getCurrentGameTime() - $this->getCreationTime()) / static::getRotationPeriod()
+                            );
+
                             if ($this->isGoingToLeftScreenSide()) {
                                 $renderingParameters->setBrightness(
                                     Math::lerpPath([
@@ -143,7 +152,7 @@ abstract class Asteroid extends DamageableGameObject
             ),
         ]);
 
-        $this->getSprite()->getCurrentAnimation()->selectRandomFrame();
+        $this->initialRotationAngle = RandomUtils::getRandomFloat(0, 2 * M_PI);
 
         $this->damageableObjectInit();
     }
@@ -86,15 +86,8 @@ class BlueLaser extends GameObject
 
     protected function doUpdate(): void
     {
-        foreach ($this->getGame()->getGameObjects() as $otherGameObject) {
-            if ($this === $otherGameObject) {
-                continue;
-            }
-
-            if (! $otherGameObject instanceof DamageableGameObject) {
-                continue;
-            }
-
+        $candidates = $this->getGame()->getSpatialHash()->query($this->getBoundingBox(), DamageableGameObject::class);
+        foreach ($candidates as $otherGameObject) {
             if ($otherGameObject->getId() === $this->initiatorId) {
                 continue;
             }
@@ -116,17 +116,7 @@ class Bonus extends GameObject
 
     protected function doUpdate(): void
     {
-        foreach ($this->getGame()->getGameObjects() as $otherGameObject) {
-            if ($this === $otherGameObject) {
-                continue;
-            }
-
-            if (! $otherGameObject instanceof Spaceship) {
-                continue;
-            }
-
-            $spaceship = $otherGameObject;
-
+        foreach ($this->getGame()->getSpatialHash()->query($this->getBoundingBox(), Spaceship::class) as $spaceship) {
             if (! $spaceship->collidesWith($this)) {
                 continue;
             }
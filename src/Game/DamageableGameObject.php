@@ -120,6 +120,11 @@ abstract class DamageableGameObject extends GameObject
         $this->setInitialized();
     }
 
+    public function isCollidable(): bool
+    {
+        return true;
+    }
+
     protected function doUpdate(): void
     {
         if (
@@ -132,16 +137,14 @@ abstract class DamageableGameObject extends GameObject
             return;
         }
 
-        foreach ($this->getGame()->getGameObjects() as $otherGameObject) {
+        $candidates = $this->getGame()->getSpatialHash()->query($this->getBoundingBox(), DamageableGameObject::class);
+        foreach ($candidates as $otherGameObject) {
             if ($this === $otherGameObject) {
                 continue;
             }
 
-            if (
-                ! $otherGameObject instanceof DamageableGameObject
-                // in order to not process twice this pair
-                || $this->getId() < $otherGameObject->getId()
-            ) {
+            // in order to not process twice this pair
+            if ($this->getId() < $otherGameObject->getId()) {
                 continue;
             }
 
@@ -13,7 +13,6 @@ use NoiseByNorthwest\TermAsteroids\Engine\SpriteEffectHelper;
 use NoiseByNorthwest\TermAsteroids\Engine\SpriteRenderingParameters;
 use NoiseByNorthwest\TermAsteroids\Engine\Timer;
 use NoiseByNorthwest\TermAsteroids\Engine\Vec2;
-use NoiseByNorthwest\TermAsteroids\Game\Smoke\Smoke;
 use NoiseByNorthwest\TermAsteroids\Game\Smoke\VerySmallSmoke;
 
 class EnergyBeamSection extends GameObject
@@ -162,15 +161,8 @@ class EnergyBeamSection extends GameObject
             return;
         }
 
-        foreach ($this->getGame()->getGameObjects() as $otherGameObject) {
-            if ($this === $otherGameObject) {
-                continue;
-            }
-
-            if (!$otherGameObject instanceof DamageableGameObject) {
-                continue;
-            }
-
+        $candidates = $this->getGame()->getSpatialHash()->query($this->getBoundingBox(), DamageableGameObject::class);
+        foreach ($candidates as $otherGameObject) {
             if ($otherGameObject->getId() === $this->initiatorId) {
                 continue;
             }
@@ -180,22 +172,16 @@ class EnergyBeamSection extends GameObject
             }
 
             if (RandomUtils::getRandomBool(0.35)) {
-                $smoke = $this->getPool()->acquire(
-                    VerySmallSmoke::class,
-                    pos: new Vec2(
+                VerySmallSmoke::emit(
+                    $this->getGame(),
+                    new Vec2(
                         $this->getBoundingBox()->getRight(),
                         $this->getPos()->getY(),
                     ),
-                    initializer: fn (Smoke $e) => $e->init(
-                        blendingColor: ColorUtils::createColor(self::$hitColorComponents, alpha: 92),
-                        baseVelocity: 0
-                    ),
+                    blendingColor: ColorUtils::createColor(self::$hitColorComponents, alpha: 92),
+                    baseVelocity: 0,
                     withLimit: true
                 );
-
-                if ($smoke) {
-                    $this->getGame()->addGameObject($smoke);
-                }
             }
 
             $otherGameObject->hit(Math::roundToInt(1 * Spaceship::getMainWeaponPowerIndex() * $this->level));
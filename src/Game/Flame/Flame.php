@@ -202,18 +202,14 @@ abstract class Flame extends GameObject
             $currentTime - $this->getCreationTime() > $this->smokeEmissionDelay
                 && $currentTime - $this->lastSmokeEmissionTime > $this->smokeEmissionPeriod
         ) {
-            $smoke = $this->getPool()->acquire(
-                static::getSmokeClassName(),
-                pos: $this->getPos(),
-                initializer: fn (Smoke $e) => $e->init(
-                    $this->blendingColor
-                ),
+            $smokeEmitted = static::getSmokeClassName()::emit(
+                $this->getGame(),
+                $this->getPos(),
+                $this->blendingColor,
                 withLimit: true
             );
 
-            if ($smoke) {
-                $this->getGame()->addGameObject($smoke);
-
+            if ($smokeEmitted) {
                 $this->lastSmokeEmissionTime = $currentTime;
             }
         }
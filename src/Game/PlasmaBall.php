@@ -142,15 +142,8 @@ class PlasmaBall extends GameObject
             return;
         }
 
-        foreach ($this->getGame()->getGameObjects() as $otherGameObject) {
-            if ($this === $otherGameObject) {
-                continue;
-            }
-
-            if (!$otherGameObject instanceof DamageableGameObject) {
-                continue;
-            }
-
+        $candidates = $this->getGame()->getSpatialHash()->query($this->getBoundingBox(), DamageableGameObject::class);
+        foreach ($candidates as $otherGameObject) {
             if ($otherGameObject->getId() === $this->initiatorId) {
                 continue;
             }
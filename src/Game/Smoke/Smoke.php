@@ -2,39 +2,26 @@
 
 namespace NoiseByNorthwest\TermAsteroids\Game\Smoke;
 
-use NoiseByNorthwest\TermAsteroids\Engine\Accelerator;
 use NoiseByNorthwest\TermAsteroids\Engine\Bitmap;
 use NoiseByNorthwest\TermAsteroids\Engine\BitmapNoiseGenerator;
 use NoiseByNorthwest\TermAsteroids\Engine\ClassUtils;
 use NoiseByNorthwest\TermAsteroids\Engine\ColorUtils;
-use NoiseByNorthwest\TermAsteroids\Engine\GameObject;
+use NoiseByNorthwest\TermAsteroids\Engine\Game;
 use NoiseByNorthwest\TermAsteroids\Engine\Math;
-use NoiseByNorthwest\TermAsteroids\Engine\Mover;
 use NoiseByNorthwest\TermAsteroids\Engine\RandomUtils;
-use NoiseByNorthwest\TermAsteroids\Engine\ScreenAreaStats;
-use NoiseByNorthwest\TermAsteroids\Engine\Sprite;
-use NoiseByNorthwest\TermAsteroids\Engine\SpriteEffect;
-use NoiseByNorthwest\TermAsteroids\Engine\SpriteEffectHelper;
-use NoiseByNorthwest\TermAsteroids\Engine\SpriteRenderingParameters;
-use NoiseByNorthwest\TermAsteroids\Engine\Timer;
 use NoiseByNorthwest\TermAsteroids\Engine\Vec2;
 
-abstract class Smoke extends GameObject
+/**
+ * Smoke puffs are particles (see ParticleSystem), the classes of this namespace only describe and emit them.
+ */
+abstract class Smoke
 {
-    private Vec2 $originalPos;
-
     private const FRAME_DURATION = 0.03;
 
-    private ?int $blendingColor;
-
-    private float $duration;
+    // drawn after the flames
+    private const PARTICLE_LAYER = 1;
 
-    private float $baseVelocity;
-
-    public static function shouldBeExcluded(Vec2 $pos, float $allowedResourceConsumptionRatio): bool
-    {
-        return ScreenAreaStats::get('smoke', $pos) > 2 + 14 * $allowedResourceConsumptionRatio;
-    }
+    private const PARTICLE_GROUP = 'smoke';
 
     abstract public static function getSize(): int;
 
@@ -43,6 +30,11 @@ abstract class Smoke extends GameObject
         return 1.6;
     }
 
+    public static function getMaxAcquiredCount(): ?int
+    {
+        return null;
+    }
+
     public static function getMaxVariantCount(): int
     {
         return 1;
@@ -52,132 +44,123 @@ abstract class Smoke extends GameObject
     {
         foreach (ClassUtils::getLocalChildClassNames(self::class) as $childClassName) {
             for ($i = 0; $i < $childClassName::getMaxVariantCount(); $i++) {
-                new $childClassName($i);
+                $childClassName::getFrames($i);
             }
         }
     }
 
-    public function __construct(?int $seed = null)
+    /**
+     * @return array<Bitmap>
+     */
+    public static function getFrames(int $variant = 0): array
     {
-        $seed = $seed ?? RandomUtils::getRandomInt(0, self::getMaxVariantCount() - 1);
         $size = static::getSize();
+        $count = self::getFrameCount();
 
         $color = ColorUtils::createColor([128, 128, 128]);
 
-        parent::__construct(
-            new Sprite(
+        return array_map(
+            fn (int $e) => BitmapNoiseGenerator::generate(
                 $size,
                 $size,
                 [
-                    [
-                        'name' => 'default',
-                        'repeat' => false,
-                        'frames' => array_map(
-                            fn (Bitmap $e) => [
-                                'duration' => self::FRAME_DURATION,
-                                'bitmap' => $e,
-                            ],
-                            [
-                                ...(fn ($count) => array_map(
-                                    fn (int $e) => BitmapNoiseGenerator::generate(
-                                        $size,
-                                        $size,
-                                        [
-                                            '0' => [0, 0, 0, 0],
-                                            '0.25' => [0, 0, 0, 0],
-                                            '0.26' => ColorUtils::applyEffects($color, globalAlpha: 2, brightness: 0.1),
-                                            '0.24' => ColorUtils::applyEffects($color, globalAlpha: 8, brightness: 0.15),
-                                            '0.3' => ColorUtils::applyEffects($color, globalAlpha: 96, brightness: 0.3),
-                                            '0.7' => ColorUtils::applyEffects($color, globalAlpha: 128, brightness: 0.6),
-                                            '1' => ColorUtils::applyEffects($color, globalAlpha: 140, brightness: 0.8)
-                                        ],
-                                        seed: [static::class, $seed],
-                                        shift: $e * Math::lerp(0.08, 0.015, $size / HugeSmoke::getSize()),
-                                        radius: Math::lerpPath([
-                                            '0.0' => 0.2,
-                                            '0.5' => 1.2,
-                                            '1.0' => 1.2,
-                                        ], $e / ($count - 1)),
-                                        zFactor: Math::lerpPath([
-                                            '0.0' => 1,
-                                            '0.5' => 1,
-                                            '1.0' => 0.1,
-                                        ], $e / ($count - 1)),
-                                        maxScaleCount: 4,
-                                    ),
-                                    array_keys(array_fill(0, $count, null))
-                                ))(
-                                    Math::roundToInt(Math::lerp(40, 60, $size / HugeSmoke::getSize()))
-                                ),
-                            ],
-                        )
-                    ]
-                ],
-                [
-                    new SpriteEffect(
-                        function (SpriteRenderingParameters $renderingParameters) {
-                            $renderingParameters->setGlobalBlendingColor($this->blendingColor);
-
-                            $completionRatio = $this->getSprite()->getCurrentAnimation()->getCompletionRatio();
-
-                            $renderingParameters->setGlobalAlpha((int) Math::lerpPath([
-                                '0.0' => 220,
-                                '0.6' => 220,
-                                '1.0' => 0,
-                            ], $completionRatio));
-
-                            $height = $this->getSprite()->getHeight();
-                            $horizontalBackgroundDistortionOffsets = SpriteEffectHelper::generateHorizontalDistortionOffsets(
-                                height: $height,
-                                maxAmplitude: Math::lerpPath([
-                                    '0.0' => 0,
-                                    '5.0' => 22,
-                                    '1.0' => 0,
-                                ],$completionRatio),
-                                timeFactor: 5,
-                                shearFactor: 15 * ($height / HugeSmoke::getSize())
-                            );
-
-                            $renderingParameters->setHorizontalBackgroundDistortionOffsets($horizontalBackgroundDistortionOffsets);
-                        },
-                    )
+                    '0' => [0, 0, 0, 0],
+                    '0.25' => [0, 0, 0, 0],
+                    '0.26' => ColorUtils::applyEffects($color, globalAlpha: 2, brightness: 0.1),
+                    '0.24' => ColorUtils::applyEffects($color, globalAlpha: 8, brightness: 0.15),
+                    '0.3' => ColorUtils::applyEffects($color, globalAlpha: 96, brightness: 0.3),
+                    '0.7' => ColorUtils::applyEffects($color, globalAlpha: 128, brightness: 0.6),
+                    '1' => ColorUtils::applyEffects($color, globalAlpha: 140, brightness: 0.8)
                 ],
+                seed: [static::class, $variant],
+                shift: $e * Math::lerp(0.08, 0.015, $size / HugeSmoke::getSize()),
+                radius: Math::lerpPath([
+                    '0.0' => 0.2,
+                    '0.5' => 1.2,
+                    '1.0' => 1.2,
+                ], $e / ($count - 1)),
+                zFactor: Math::lerpPath([
+                    '0.0' => 1,
+                    '0.5' => 1,
+                    '1.0' => 0.1,
+                ], $e / ($count - 1)),
+                maxScaleCount: 4,
             ),
-            zIndex: 1
+            array_keys(array_fill(0, $count, null))
         );
     }
 
-    public function init(
+    /**
+     * @return bool false if the smoke has not been emitted because of the limits (see $withLimit) or because the
+     *              particle system is full
+     */
+    public static function emit(
+        Game $game,
+        Vec2 $pos,
         ?int $blendingColor = null,
         ?float $duration = null,
         float $baseVelocity = 1,
-    ): void {
-        $this->originalPos = $this->getPos()->copy();
-        ScreenAreaStats::inc('smoke', $this->originalPos);
-
-        $this->blendingColor = $blendingColor;
-        $this->duration = $duration ?? count($this->getSprite()->getCurrentAnimation()->getFrames()) * self::FRAME_DURATION;
-        $this->baseVelocity = $baseVelocity;
-
-        $this->setMovers([
-            new Mover(
-                new Vec2(1, -0.3),
-                new Accelerator(
-                    $this->baseVelocity * RandomUtils::getRandomInt(10, 30),
-                    0.1,
-                    0,
-                )
-            ),
-        ]);
+        bool $withLimit = false,
+    ): bool {
+        $particleSystem = $game->getParticleSystem();
+
+        if (! $particleSystem->hasType(static::class)) {
+            self::addParticleType($game);
+        }
 
-        $this->setInitialized();
+        if ($withLimit) {
+            $allowedResourceConsumptionRatio = $game->getAdaptivePerformanceManager()->getAllowedResourceConsumptionRatio();
+
+            if (
+                (
+                    static::getMaxAcquiredCount() !== null &&
+                    $particleSystem->count(static::class) >= Math::roundToInt(
+                        static::getMaxAcquiredCount() * $allowedResourceConsumptionRatio
+                    )
+                ) ||
+                    $particleSystem->count(group: self::PARTICLE_GROUP, areaPos: $pos) > 2 + 14 * $allowedResourceConsumptionRatio
+            ) {
+                return false;
+            }
+        }
+
+        return $particleSystem->emit(
+            static::class,
+            $pos,
+            new Vec2(1, -0.3),
+            $baseVelocity * RandomUtils::getRandomInt(10, 30),
+            $duration ?? self::getFrameCount() * self::FRAME_DURATION,
+            blendingColor: $blendingColor,
+        );
     }
 
-    protected function doUpdate(): void
+    private static function getFrameCount(): int
     {
-        if (Timer::getCurrentGameTime() - $this->getCreationTime() >= $this->duration) {
-            $this->setTerminated();
-            ScreenAreaStats::dec('smoke', $this->originalPos);
-        }
+        return Math::roundToInt(Math::lerp(40, 60, static::getSize() / HugeSmoke::getSize()));
+    }
+
+    private static function addParticleType(Game $game): void
+    {
+        $size = static::getSize();
+
+        $game->getParticleSystem()->addType(
+            static::class,
+            static::getFrames(),
+            self::FRAME_DURATION,
+            layer: self::PARTICLE_LAYER,
+            group: self::PARTICLE_GROUP,
+            accelerationTime: 0.1,
+            alphaCurve: [
+                '0.0' => 220,
+                '0.6' => 220,
+                '1.0' => 0,
+            ],
+            distortionCurve: [
+                '0.0' => 0,
+                '1.0' => 4.4,
+            ],
+            distortionTimeFactor: 5,
+            distortionShearFactor: 15 * ($size / HugeSmoke::getSize()),
+        );
     }
 }
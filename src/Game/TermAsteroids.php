@@ -14,18 +14,67 @@ use NoiseByNorthwest\TermAsteroids\Game\Asteroid\Asteroid;
 use NoiseByNorthwest\TermAsteroids\Game\Asteroid\HugeAsteroid;
 use NoiseByNorthwest\TermAsteroids\Game\Asteroid\LargeAsteroid;
 use NoiseByNorthwest\TermAsteroids\Game\Asteroid\MediumAsteroid;
+use NoiseByNorthwest\TermAsteroids\Game\Asteroid\MicroAsteroid;
 use NoiseByNorthwest\TermAsteroids\Game\Asteroid\SmallAsteroid;
 use NoiseByNorthwest\TermAsteroids\Game\Flame\Flame;
+use NoiseByNorthwest\TermAsteroids\Game\Flame\LargeFlame;
+use NoiseByNorthwest\TermAsteroids\Game\Flame\MediumFlame;
+use NoiseByNorthwest\TermAsteroids\Game\Flame\SmallFlame;
+use NoiseByNorthwest\TermAsteroids\Game\Smoke\MediumSmoke;
+use NoiseByNorthwest\TermAsteroids\Game\Smoke\SmallSmoke;
 use NoiseByNorthwest\TermAsteroids\Game\Smoke\Smoke;
+use NoiseByNorthwest\TermAsteroids\Game\Smoke\VerySmallSmoke;
 
 class TermAsteroids extends Game
 {
+    public const BENCHMARK_SCENARIO_DEFAULT = 'default';
+
+    // hundreds of small asteroids crossing each other, in order to stress the collision broadphase
+    public const BENCHMARK_SCENARIO_ASTEROID_SWARM = 'asteroid-swarm';
+
+    // flames & smokes continuously spawned all over the screen
+    public const BENCHMARK_SCENARIO_PARTICLE_STORM = 'particle-storm';
+
+    // fast moving persisted objects (the spaceship with all its weapons and asteroids), leaving trails everywhere
+    public const BENCHMARK_SCENARIO_PERSISTENCE = 'persistence';
+
+    public const BENCHMARK_SCENARIOS = [
+        self::BENCHMARK_SCENARIO_DEFAULT,
+        self::BENCHMARK_SCENARIO_ASTEROID_SWARM,
+        self::BENCHMARK_SCENARIO_PARTICLE_STORM,
+        self::BENCHMARK_SCENARIO_PERSISTENCE,
+    ];
+
+    private const BENCHMARK_DURATION = 20;
+
+    private const BENCHMARK_RANDOM_SEED = 42;
+
+    private const HEADLESS_BENCHMARK_TIME_STEP = 1 / 60;
+
     private bool $devMode;
 
     private bool $benchmarkMode;
 
+    private string $benchmarkScenario;
+
+    private bool $headless;
+
+    private int $benchmarkFrameCount;
+
     private bool $useNativeRenderer;
 
+    private int $nativeRendererThreadCount;
+
+    private int $presentationBufferCount;
+
+    private bool $repeatSequencesEnabled;
+
+    private bool $lineShiftsEnabled;
+
+    private ?string $graphicsOutput;
+
+    private ?string $drawStreamCaptureFileName;
+
     private Spaceship $spaceship;
 
     private bool $spawnAsteroids = true;
@@ -36,21 +85,60 @@ class TermAsteroids extends Game
 
     private float $lastBonusCreationTime = 0;
 
+    private float $lastBenchmarkSpawnTime = 0;
+
+    private ?int $benchmarkSpaceshipThruster = null;
+
     public function __construct(
         bool $devMode,
         bool $benchmarkMode,
         bool $useNativeRenderer,
-        bool $kittyKeyboardProtocolSupported
+        bool $kittyKeyboardProtocolSupported,
+        int $nativeRendererThreadCount = 1,
+        int $presentationBufferCount = 0,
+        bool $repeatSequencesEnabled = false,
+        bool $lineShiftsEnabled = false,
+        ?string $graphicsOutput = null,
+        ?string $drawStreamCaptureFileName = null,
+        string $benchmarkScenario = self::BENCHMARK_SCENARIO_DEFAULT,
+        bool $headless = false,
+        ?int $benchmarkFrameCount = null
     ) {
-        parent::__construct(kittyKeyboardProtocolSupported: $kittyKeyboardProtocolSupported);
+        parent::__construct(kittyKeyboardProtocolSupported: $kittyKeyboardProtocolSupported, headless: $headless);
 
         if ($devMode && $benchmarkMode) {
             throw new \RuntimeException('Dev mode & benchmark modes cannot be selected at the same time');
         }
 
+        if ($headless && ! $benchmarkMode) {
+            throw new \RuntimeException('Headless mode is only available in benchmark mode');
+        }
+
+        if (! in_array($benchmarkScenario, self::BENCHMARK_SCENARIOS, true)) {
+            throw new \RuntimeException(sprintf('Unsupported benchmark scenario: %s', $benchmarkScenario));
+        }
+
+        if ($benchmarkFrameCount !== null && ! $headless) {
+            throw new \RuntimeException('A benchmark frame count can only be set in headless mode');
+        }
+
+        if ($benchmarkFrameCount !== null && $benchmarkFrameCount <= 0) {
+            throw new \RuntimeException(sprintf('Invalid benchmark frame count: %d', $benchmarkFrameCount));
+        }
+
         $this->devMode = $devMode;
         $this->benchmarkMode = $benchmarkMode;
+        $this->benchmarkScenario = $benchmarkScenario;
+        $this->headless = $headless;
+        $this->benchmarkFrameCount = $benchmarkFrameCount
+            ?? Math::roundToInt(self::BENCHMARK_DURATION / self::HEADLESS_BENCHMARK_TIME_STEP);
         $this->useNativeRenderer = $useNativeRenderer;
+        $this->nativeRendererThreadCount = $nativeRendererThreadCount;
+        $this->presentationBufferCount = $presentationBufferCount;
+        $this->repeatSequencesEnabled = $repeatSequencesEnabled;
+        $this->lineShiftsEnabled = $lineShiftsEnabled;
+        $this->graphicsOutput = $graphicsOutput;
+        $this->drawStreamCaptureFileName = $drawStreamCaptureFileName;
     }
 
     protected function onInit(): void
@@ -63,8 +151,9 @@ class TermAsteroids extends Game
         }
 
         $cacheFileName = $cacheDir . '/init.dat';
+        $bitmapAtlasFileName = $cacheDir . '/bitmaps.dat';
         if (file_exists($cacheFileName)) {
-            if (!CacheUtils::loadFromFile($cacheFileName)) {
+            if (!CacheUtils::loadFromFile($cacheFileName, $bitmapAtlasFileName)) {
                 unlink($cacheFileName);
             }
         }
@@ -94,13 +183,29 @@ class TermAsteroids extends Game
         );
 
         if (! file_exists($cacheFileName)) {
-            CacheUtils::saveToFile($cacheFileName);
+            CacheUtils::saveToFile($cacheFileName, $bitmapAtlasFileName);
+        }
+
+        $this->getScreen()->setNativeRendererThreadCount($this->nativeRendererThreadCount);
+        $this->getScreen()->setPresentationBufferCount($this->presentationBufferCount);
+        $this->getScreen()->setOutputCompression($this->repeatSequencesEnabled, $this->lineShiftsEnabled);
+
+        if ($this->graphicsOutput !== null && ! $this->getScreen()->setGraphicsOutput($this->graphicsOutput)) {
+            echo sprintf("Graphics output medium unavailable (%s), falling back to the text output\n", $this->graphicsOutput);
         }
 
         if ($this->useNativeRenderer) {
             $this->getScreen()->useNativeRenderer();
         }
 
+        if ($this->drawStreamCaptureFileName !== null) {
+            if (! $this->useNativeRenderer) {
+                throw new \RuntimeException('The draw stream can only be captured with the native renderer');
+            }
+
+            $this->getScreen()->startDrawStreamCapture($this->drawStreamCaptureFileName);
+        }
+
         if ($this->devMode || $this->benchmarkMode) {
             $this->getScreen()->setMaxFrameRate(10000);
             $this->getScreen()->setDebugInfoDisplayEnabled(true);
@@ -109,19 +214,24 @@ class TermAsteroids extends Game
 
         if ($this->benchmarkMode) {
             $this->getAdaptivePerformanceManager()->setEnabled(false);
+            $this->getScreen()->setFrameTimeRecordingEnabled(true);
+        }
+
+        if ($this->headless) {
+            // the game time no longer depends on how fast the frames are computed, so that each run plays exactly
+            //  the same frames
+            Timer::setFixedTimeStep(self::HEADLESS_BENCHMARK_TIME_STEP);
         }
     }
 
     protected function onReset(): void
     {
-        foreach (range(0, 100) as $_) {
-            $star = $this->getGameObjectPool()->acquire(
-                Star::class,
-                new Vec2(0, 0),
-                initializer: fn (Star $e) => $e->init(),
-            );
+        if ($this->benchmarkMode) {
+            mt_srand(self::BENCHMARK_RANDOM_SEED);
+        }
 
-            $this->addGameObject($star);
+        foreach (range(0, 100) as $_) {
+            Star::emit($this);
         }
 
         $this->spaceship = $this->getGameObjectPool()->acquire(
@@ -134,6 +244,8 @@ class TermAsteroids extends Game
 
         $this->lastAsteroidCreationTime = 0;
         $this->lastBonusCreationTime = 0;
+        $this->lastBenchmarkSpawnTime = 0;
+        $this->benchmarkSpaceshipThruster = null;
 
         $this->getScreen()->setBrightness(0);
     }
@@ -213,6 +325,16 @@ class TermAsteroids extends Game
 
                             break;
 
+                        case 'n':
+                            $this->getScreen()->toggleNativeRendererProfileDisplayEnabled();
+
+                            break;
+
+                        case 'h':
+                            $this->getScreen()->toggleOrderedDitheringEnabled();
+
+                            break;
+
                         case 'm':
                             $this->toggleProfiling();
 
@@ -422,44 +544,102 @@ class TermAsteroids extends Game
 
     private function handleBenchmarkGameplay(): void
     {
-        $currentTime = Timer::getCurrentGameTime();
-        if ($currentTime > 20) {
+        if (
+            $this->headless ?
+                $this->getScreen()->getStats()['renderedFrameCount'] >= $this->benchmarkFrameCount
+                : Timer::getCurrentGameTime() > self::BENCHMARK_DURATION
+        ) {
             $this->setFinished(true);
+            $this->saveBenchmarkResults();
+        }
 
-            $stats = $this->getScreen()->getStats();
-
-            $stats['avgDrawingTimeMs'] = Math::roundToInt(1000 * $stats['drawingTime'] / $stats['renderedFrameCount']);
-            $stats['avgUpdateTimeMs'] = Math::roundToInt(1000 * $stats['updateTime'] / $stats['renderedFrameCount']);
-            $stats['avgFrameTimeMs'] = Math::roundToInt(1000 * $stats['totalTime'] / $stats['renderedFrameCount']);
-
-            $jitEnabled = opcache_get_status()['jit']['on'];
-            $resultFileName = sprintf(
-                '%s/../../.tmp/benchmark-%s:%s:%s-jit:%s.%05d.json',
-                __DIR__,
-                date('Ymd_His'),
-                PHP_VERSION,
-                $this->useNativeRenderer ? '1' : '0',
-                $jitEnabled ? '1' : '0',
-                $stats['renderedFrameCount']
-            );
+        match ($this->benchmarkScenario) {
+            self::BENCHMARK_SCENARIO_DEFAULT => $this->handleDefaultBenchmarkGameplay(),
+            self::BENCHMARK_SCENARIO_ASTEROID_SWARM => $this->handleAsteroidSwarmBenchmarkGameplay(),
+            self::BENCHMARK_SCENARIO_PARTICLE_STORM => $this->handleParticleStormBenchmarkGameplay(),
+            self::BENCHMARK_SCENARIO_PERSISTENCE => $this->handlePersistenceBenchmarkGameplay(),
+        };
+    }
 
-            file_put_contents(
-                $resultFileName,
-                json_encode(
-                    [
-                        'phpVersion' => PHP_VERSION,
-                        'cpu' => trim(shell_exec(
-                            "cat /proc/cpuinfo | grep -Po 'model name\s+: \K.+' | head -1"
-                        )),
-                        'nativeRenderer' => $this->useNativeRenderer,
-                        'jit' => $jitEnabled,
-                        'stats' => $stats,
-                        'gameObjectPoolStats' => $this->getGameObjectPool()->getStats(),
-                    ],
-                    JSON_PRETTY_PRINT
-                )
-            );
+    private function saveBenchmarkResults(): void
+    {
+        $stats = $this->getScreen()->getStats();
+
+        $stats['avgDrawingTimeMs'] = Math::roundToInt(1000 * $stats['drawingTime'] / $stats['renderedFrameCount']);
+        $stats['avgUpdateTimeMs'] = Math::roundToInt(1000 * $stats['updateTime'] / $stats['renderedFrameCount']);
+        $stats['avgFrameTimeMs'] = Math::roundToInt(1000 * $stats['totalTime'] / $stats['renderedFrameCount']);
+        $stats['avgGameplayTimeMs'] = Math::roundToInt(1000 * $stats['nonRenderingTime'] / $stats['renderedFrameCount']);
+
+        $frameTimes = $this->getScreen()->getRecordedFrameTimes();
+        foreach ([50, 90, 99] as $percentile) {
+            $stats[sprintf('p%dFrameTimeMs', $percentile)] = round(1000 * Math::percentile($frameTimes, $percentile), 2);
+        }
+
+        $stats['maxFrameTimeMs'] = round(1000 * max($frameTimes), 2);
+
+        $jitEnabled = opcache_get_status()['jit']['on'];
+        $nativeRendererProfile = $this->getScreen()->getNativeRendererProfile();
+        $resultFileName = sprintf(
+            '%s/../../.tmp/%s-%s:%s:%s-jit:%s.%05d.json',
+            __DIR__,
+            $this->resolveBenchmarkResultFilePrefix(),
+            date('Ymd_His'),
+            PHP_VERSION,
+            $this->useNativeRenderer ? '1' : '0',
+            $jitEnabled ? '1' : '0',
+            $stats['renderedFrameCount']
+        );
+
+        file_put_contents(
+            $resultFileName,
+            json_encode(
+                [
+                    'scenario' => $this->benchmarkScenario,
+                    'headless' => $this->headless,
+                    'timeStep' => Timer::getFixedTimeStep(),
+                    'randomSeed' => self::BENCHMARK_RANDOM_SEED,
+                    'phpVersion' => PHP_VERSION,
+                    'cpu' => trim(shell_exec(
+                        "cat /proc/cpuinfo | grep -Po 'model name\s+: \K.+' | head -1"
+                    )),
+                    'nativeRenderer' => $this->useNativeRenderer,
+                    'jit' => $jitEnabled,
+                    'stats' => $stats,
+                    'gameObjectPoolStats' => $this->getGameObjectPool()->getStats(),
+                    'particleSystemStats' => $this->getParticleSystem()->getStats(),
+                ] + ($nativeRendererProfile !== null ? ['nativeRendererProfile' => $nativeRendererProfile] : []),
+                JSON_PRETTY_PRINT
+            )
+        );
+
+        if ($this->headless) {
+            // the standard output is discarded
+            fwrite(STDERR, sprintf("Benchmark results written to %s\n", realpath($resultFileName)));
         }
+    }
+
+    /**
+     * The default (terminal) benchmark keeps the historical prefix, which is the one read by default by
+     *  generateBenchmarkReport.php
+     */
+    private function resolveBenchmarkResultFilePrefix(): string
+    {
+        $prefix = 'benchmark';
+
+        if ($this->benchmarkScenario !== self::BENCHMARK_SCENARIO_DEFAULT) {
+            $prefix .= '_' . str_replace('-', '_', $this->benchmarkScenario);
+        }
+
+        if ($this->headless) {
+            $prefix .= '_headless';
+        }
+
+        return $prefix;
+    }
+
+    private function handleDefaultBenchmarkGameplay(): void
+    {
+        $currentTime = Timer::getCurrentGameTime();
 
         $createAsteroidColumn = function (float $x) {
             $y = LargeAsteroid::getSize() / 2;
@@ -503,4 +683,136 @@ class TermAsteroids extends Game
             $this->lastAsteroidCreationTime = $currentTime;
         }
     }
+
+    private function handleAsteroidSwarmBenchmarkGameplay(): void
+    {
+        $createAsteroidColumn = function (float $x) {
+            $y = SmallAsteroid::getSize() / 2;
+            while ($y < $this->getScreen()->getHeight()) {
+                $asteroidClassName = RandomUtils::getRandomBool() ? SmallAsteroid::class : MicroAsteroid::class;
+
+                $asteroid = $this->getGameObjectPool()->acquire(
+                    $asteroidClassName,
+                    pos: new Vec2(
+                        $x + SmallAsteroid::getSize(),
+                        $y
+                    ),
+                    initializer: fn (Asteroid $e) => $e->init(
+                        RandomUtils::getRandomFloat(40, 120),
+                        dir: (new Vec2(-1, RandomUtils::getRandomFloat(-0.5, 0.5)))->normalize()
+                    ),
+                    withLimit: false
+                );
+
+                $this->addGameObject($asteroid);
+
+                $y += SmallAsteroid::getSize();
+            }
+        };
+
+        if ($this->getScreen()->getStats()['renderedFrameCount'] === 0) {
+            $x = $this->getScreen()->getWidth() * 0.3;
+            while ($x < $this->getScreen()->getWidth()) {
+                $createAsteroidColumn($x);
+                $x += SmallAsteroid::getSize();
+            }
+        }
+
+        if (
+            Timer::getCurrentGameTime() - $this->lastAsteroidCreationTime > 0.2
+        ) {
+            $createAsteroidColumn($this->getScreen()->getWidth());
+
+            $this->lastAsteroidCreationTime = Timer::getCurrentGameTime();
+        }
+    }
+
+    private function handleParticleStormBenchmarkGameplay(): void
+    {
+        $currentTime = Timer::getCurrentGameTime();
+        if ($currentTime - $this->lastBenchmarkSpawnTime < 0.05) {
+            return;
+        }
+
+        $randomPos = fn () => new Vec2(
+            RandomUtils::getRandomInt(0, $this->getScreen()->getWidth()),
+            RandomUtils::getRandomInt(0, $this->getScreen()->getHeight())
+        );
+
+        foreach (range(1, 3) as $_) {
+            $flameClassName = match (RandomUtils::getRandomInt(0, 2)) {
+                0 => SmallFlame::class,
+                1 => MediumFlame::class,
+                2 => LargeFlame::class,
+            };
+
+            $flame = $this->getGameObjectPool()->acquire(
+                $flameClassName,
+                pos: $randomPos(),
+                initializer: fn (Flame $e) => $e->init(),
+                withLimit: false
+            );
+
+            $this->addGameObject($flame);
+        }
+
+        foreach (range(1, 6) as $_) {
+            $smokeClassName = match (RandomUtils::getRandomInt(0, 2)) {
+                0 => VerySmallSmoke::class,
+                1 => SmallSmoke::class,
+                2 => MediumSmoke::class,
+            };
+
+            $smokeClassName::emit($this, $randomPos(), baseVelocity: RandomUtils::getRandomFloat(0.5, 3));
+        }
+
+        $this->lastBenchmarkSpawnTime = $currentTime;
+    }
+
+    private function handlePersistenceBenchmarkGameplay(): void
+    {
+        $currentTime = Timer::getCurrentGameTime();
+
+        if ($this->getScreen()->getStats()['renderedFrameCount'] === 0) {
+            $this->spaceship->improveWeaponLevels(
+                blueLaser: 100,
+                plasmaBall: 100,
+                energyBeam: 100,
+            );
+        }
+
+        // the spaceship sweeps the whole screen height
+        $thruster = ((int) ($currentTime / 1.5)) % 2 === 0 ? Spaceship::THRUSTER_UP : Spaceship::THRUSTER_DOWN;
+        if ($thruster !== $this->benchmarkSpaceshipThruster) {
+            if ($this->benchmarkSpaceshipThruster !== null) {
+                $this->spaceship->stopThruster($this->benchmarkSpaceshipThruster);
+            }
+
+            $this->spaceship->startThruster($thruster);
+            $this->benchmarkSpaceshipThruster = $thruster;
+        }
+
+        if ($currentTime - $this->lastBenchmarkSpawnTime < 0.3) {
+            return;
+        }
+
+        foreach ([-1, 1] as $verticalDir) {
+            $asteroid = $this->getGameObjectPool()->acquire(
+                MediumAsteroid::class,
+                pos: new Vec2(
+                    $this->getScreen()->getWidth() + MediumAsteroid::getSize(),
+                    $verticalDir < 0 ? $this->getScreen()->getHeight() : 0
+                ),
+                initializer: fn (Asteroid $e) => $e->init(
+                    RandomUtils::getRandomFloat(100, 200),
+                    dir: (new Vec2(-1, $verticalDir * RandomUtils::getRandomFloat(0.2, 0.6)))->normalize()
+                ),
+                withLimit: false
+            );
+
+            $this->addGameObject($asteroid);
+        }
+
+        $this->lastBenchmarkSpawnTime = $currentTime;
+    }
 }